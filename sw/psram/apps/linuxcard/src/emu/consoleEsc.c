@@ -0,0 +1,58 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include "consoleEsc.h"
+
+
+#define CONSOLE_ESCAPE_CHAR		0x1d	//^]
+
+
+static struct ConsoleEscKey {
+	uint8_t ch;
+	ConsoleEscHandlerF handler;
+} mEscKeys[CONSOLE_ESC_MAX_KEYS];
+
+static uint8_t mNumEscKeys;
+static bool mConsoleEscaped;
+
+
+bool consoleEscRegister(uint8_t ch, ConsoleEscHandlerF handler)
+{
+	if (mNumEscKeys == CONSOLE_ESC_MAX_KEYS)
+		return false;
+	
+	mEscKeys[mNumEscKeys].ch = ch;
+	mEscKeys[mNumEscKeys].handler = handler;
+	mNumEscKeys++;
+	
+	return true;
+}
+
+bool consoleEscRx(uint8_t ch)
+{
+	uint_fast8_t i;
+	
+	if (mConsoleEscaped) {
+		
+		mConsoleEscaped = false;
+		for (i = 0; i < mNumEscKeys; i++) {
+			
+			if (mEscKeys[i].ch == ch) {
+				
+				mEscKeys[i].handler(ch);
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	if (ch == CONSOLE_ESCAPE_CHAR) {
+		
+		mConsoleEscaped = true;
+		return false;
+	}
+	
+	return true;
+}
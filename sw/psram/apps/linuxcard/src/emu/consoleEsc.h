@@ -0,0 +1,26 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _CONSOLE_ESC_H_
+#define _CONSOLE_ESC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//console escape: ^] followed by a key someone registered runs that key's handler and neither char reaches the guest.
+//^] followed by anything else sends that on. handlers run wherever consoleEscRx() is called from, maybe an irq
+
+#define CONSOLE_ESC_MAX_KEYS		4
+
+typedef void (*ConsoleEscHandlerF)(uint8_t ch);
+
+bool consoleEscRegister(uint8_t ch, ConsoleEscHandlerF handler);	//false if full
+
+//returns true if the char should be delivered as usual
+bool consoleEscRx(uint8_t ch);
+
+
+#endif
@@ -0,0 +1,36 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _CORE1_H_
+#define _CORE1_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//core1 does the work that would otherwise stall the emulated cpu on core0: USB, the vsync irq, slow devices. the
+//cores pass each other calls to make through two single-producer single-consumer rings in SRAM, so neither ever
+//waits on a lock. core0 queues work with core1Call(), core1 sends results back with core1Reply(), and those are
+//run on core0 from core1Poll() (called by cpuExtService(), which core1 asks for), where it is safe to touch the
+//emulated devices. either core may queue from irq handlers too, each only ever queues into its own ring
+
+#ifndef CORE1_RING_SZ
+	#define CORE1_RING_SZ			32		//calls each way, a power of 2
+#endif
+#define CORE1_MAX_PERIODIC			4
+
+typedef void (*Core1F)(void *userData, uint32_t param);
+
+void core1Init(void);											//core0, launches core1
+
+bool core1Call(Core1F f, void *userData, uint32_t param);		//core0: have core1 run f. false if the ring is full
+bool core1Reply(Core1F f, void *userData, uint32_t param);		//core1: have core0 run f. false if the ring is full
+void core1Poll(void);											//core0: run what core1 replied with
+
+//core1: also run f every periodMs when there is nothing else to do (for pollers like tuh_task)
+bool core1AddPeriodic(Core1F f, void *userData, uint32_t periodMs);
+
+
+#endif
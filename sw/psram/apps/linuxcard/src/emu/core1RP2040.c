@@ -0,0 +1,162 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#include "hardware/irq.h"
+#include "pico/time.h"
+#include "core1.h"
+#include "cpu.h"
+
+
+struct Core1Msg {
+	Core1F f;
+	void *userData;
+	uint32_t param;
+};
+
+struct Core1Ring {
+	volatile uint32_t wr;		//only the producing core writes this
+	volatile uint32_t rd;		//only the consuming core writes this
+	struct Core1Msg msgs[CORE1_RING_SZ];
+};
+
+struct Core1Periodic {
+	Core1F f;
+	void *userData;
+	uint32_t periodUs;
+	uint64_t due;
+};
+
+static struct Core1Ring mCalls, mReplies;
+static struct Core1Periodic mPeriodic[CORE1_MAX_PERIODIC];		//core1's alone
+static uint_fast8_t mNumPeriodic;
+
+
+//irqs are off so that the core's own irq handlers may queue too
+static bool core1PrvPut(struct Core1Ring *ring, Core1F f, void *userData, uint32_t param)
+{
+	uint32_t irqState = save_and_disable_interrupts(), wr = ring->wr;
+	bool ret = false;
+	
+	if (wr - ring->rd != CORE1_RING_SZ) {
+		
+		ring->msgs[wr % CORE1_RING_SZ] = (struct Core1Msg){.f = f, .userData = userData, .param = param, };
+		__dmb();		//the message is all there before the other core can see it
+		ring->wr = wr + 1;
+		ret = true;
+	}
+	restore_interrupts(irqState);
+	
+	return ret;
+}
+
+//consumers never call this from irq handlers
+static bool core1PrvGet(struct Core1Ring *ring, struct Core1Msg *msg)
+{
+	uint32_t rd = ring->rd;
+	
+	if (rd == ring->wr)
+		return false;
+	
+	__dmb();
+	*msg = ring->msgs[rd % CORE1_RING_SZ];
+	__dmb();		//done with the slot before the producer may reuse it
+	ring->rd = rd + 1;
+	
+	return true;
+}
+
+//core0's SIO irq: core1 has replies for it
+static void core1PrvDoorbell(void)
+{
+	multicore_fifo_drain();
+	multicore_fifo_clear_irq();
+	cpuRequestService();
+}
+
+static void core1PrvMain(void)
+{
+	struct Core1Msg msg;
+	uint64_t now, next;
+	uint_fast8_t i;
+	
+	while (1) {
+		
+		while (core1PrvGet(&mCalls, &msg))
+			msg.f(msg.userData, msg.param);
+		
+		now = time_us_64();
+		next = UINT64_MAX;
+		for (i = 0; i < mNumPeriodic; i++) {
+			
+			if (now >= mPeriodic[i].due) {
+				
+				mPeriodic[i].f(mPeriodic[i].userData, 0);
+				mPeriodic[i].due = now + mPeriodic[i].periodUs;
+			}
+			if (mPeriodic[i].due < next)
+				next = mPeriodic[i].due;
+		}
+		
+		//core1Call() sends an event, which is latched, so none can be missed between the check and the wait
+		if (mCalls.rd != mCalls.wr)
+			continue;
+		if (next == UINT64_MAX)
+			__wfe();
+		else
+			best_effort_wfe_or_timeout(from_us_since_boot(next));
+	}
+}
+
+void core1Init(void)
+{
+	multicore_reset_core1();
+	multicore_fifo_drain();
+	multicore_launch_core1(core1PrvMain);
+	
+	//the launch handshake is done with the fifo. from here on only core1 writes it, to ring the doorbell
+	multicore_fifo_drain();
+	multicore_fifo_clear_irq();
+	irq_set_exclusive_handler(SIO_IRQ_PROC0, core1PrvDoorbell);
+	irq_set_enabled(SIO_IRQ_PROC0, true);
+}
+
+bool core1Call(Core1F f, void *userData, uint32_t param)
+{
+	if (!core1PrvPut(&mCalls, f, userData, param))
+		return false;
+	
+	__sev();
+	return true;
+}
+
+bool core1Reply(Core1F f, void *userData, uint32_t param)
+{
+	if (!core1PrvPut(&mReplies, f, userData, param))
+		return false;
+	
+	if (multicore_fifo_wready())		//else the doorbell is still ringing from before
+		multicore_fifo_push_blocking(0);
+	
+	return true;
+}
+
+void core1Poll(void)
+{
+	struct Core1Msg msg;
+	
+	while (core1PrvGet(&mReplies, &msg))
+		msg.f(msg.userData, msg.param);
+}
+
+bool core1AddPeriodic(Core1F f, void *userData, uint32_t periodMs)
+{
+	if (mNumPeriodic == CORE1_MAX_PERIODIC)
+		return false;
+	
+	mPeriodic[mNumPeriodic++] = (struct Core1Periodic){.f = f, .userData = userData, .periodUs = periodMs * 1000, .due = time_us_64(), };
+	return true;
+}
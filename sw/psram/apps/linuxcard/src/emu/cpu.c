@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "printf.h"
+#include "perf.h"
 #include "fpu.h"
 
 #define HYPERCALL			0x4f646776
@@ -23,11 +24,19 @@
 //#define SUPPORT_EXTEND_OPS		//set to enable SEH/SEB, even though lacking in R4000
 //#define SUPPORT_BYTESWAP		//set to enable WSBH, even though lacking in R4000
 #define SUPPORT_LL_SC
+#define DECODED_CACHE			//set to keep instrs pre-decoded by physical page, run via computed goto (gcc only)
+#define TLB_REFILL_ACCEL		//set to do user TLB refills natively when the guest's handler is the standard one
 
 
 #include "cpu.h"
 #include "mem.h"
 #include "decBus.h"
+#include "cpuJit.h"
+#include "cpuIdle.h"
+
+#if defined(CPU_JIT) && !defined(DECODED_CACHE)
+	#error "translations are entered from the threaded cpuRun"
+#endif
 
 #define NUM_TLB_ENTRIES			64
 #define NUM_WIRED_TLB_ENTRIES	8
@@ -96,6 +105,7 @@ static struct {
 #define TLB_ENTRYHI_VA_MASK		0xfffff000
 #define TLB_ENTRYHI_ASID_MASK	0x00000fc0
 #define TLB_ENTRYHI_ASID_SHIFT	6
+#define TLB_PAGE_SZ				(1 + (uint32_t)~TLB_ENTRYHI_VA_MASK)
 
 #define TLB_ENTRYLO_PA_MASK		0xfffff000
 #define TLB_ENTRYLO_N			0x00000800
@@ -157,17 +167,6 @@ static struct {
 #define CP0_STATUS_IM_MASK		0x0000ff00
 #define CP0_STATUS_IM_BITLEN	8
 #define CP0_STATUS_IM_SHIFT		8
-#ifdef R4000
-	#define CP0_STATUS_UM		0x00000020	//set for user mode
-	#define CP0_STATUS_ERL		0x00000004
-	#define CP0_STATUS_EXL		0x00000002
-#else
-	#define CP0_STATUS_KUO		0x00000020
-	#define CP0_STATUS_IEO		0x00000010
-	#define CP0_STATUS_KUP		0x00000008
-	#define CP0_STATUS_IEP		0x00000004
-	#define CP0_STATUS_KUC		0x00000002	//set when in userspace
-#endif
 #define CP0_STATUS_IE_SHIFT		0
 #define CP0_STATUS_IE			(1 << CP0_STATUS_IE_SHIFT)
 
@@ -307,8 +306,19 @@ static struct {
 */
 
 
+#define ICACHE_ASID_ANY			0xff
+
 static void cpuPrvIcacheFlushEntire(void);
-static void cpuPrvIcacheFlushPage(uint32_t va);
+static void cpuPrvIcacheFlushPage(uint32_t va, uint_fast8_t asid);
+static bool cpuPrvMemAccess(uint32_t pa, uint_fast8_t sz, bool write, void *buf, bool allocate);
+
+#ifdef CPU_JIT
+	static uint32_t mJitExceptions;		//so a step can tell an exception apart from landing on the vector by itself
+#endif
+
+#ifdef PERF_COUNTERS
+	static struct CpuPerfCounters mPerfCounters;
+#endif
 
 
 
@@ -392,10 +402,14 @@ static void cpuPrvTakeException(uint_fast8_t excCode)
 #endif
 	
 	cpu.cause = (cpu.cause &~ CP0_CAUSE_EXC_COD_MASK) | ((((uint32_t)excCode) << CP0_CAUSE_EXC_COD_SHIFT) & CP0_CAUSE_EXC_COD_MASK);
+	perfInc(mPerfCounters.exceptions[excCode % 32]);
 	
 	cpu.inDelaySlot = false;
 	cpu.pc = vector;
 	cpu.npc = vector + 4;
+#ifdef CPU_JIT
+	mJitExceptions++;
+#endif
 }
 
 
@@ -426,6 +440,7 @@ static inline void cpuPrvTakeTlbRefillExc(uint32_t va, bool wasWrite)
 		cause |= CP0_EXC_COD_KU;
 	
 //	err_str(" EXC: Refill @0x%08x\r\n", va);
+	perfInc(mPerfCounters.tlbRefills);
 	cpuPrvSetBadVA(va);
 	cpuPrvSetEntryHiVa(va);
 	cpuPrvTakeException(cause);
@@ -644,30 +659,19 @@ static int_fast8_t cpuPrvTlbHashSearch(uint32_t pageVa)
 	return -1;
 }
 
-static void cpuPrvMaybeAsidChanded(uint32_t prevVal)
-{
-	(void)prevVal;
-	if ((prevVal ^ cpu.entryHi) & TLB_ENTRYHI_ASID_MASK) {
-		
-		//changed
-		cpuPrvIcacheFlushEntire();
-	}
-}
-
 static void cpuPrvTlbr(void)
 {
 	uint_fast8_t index = ((cpu.index >> 8) & 0x3f) % NUM_TLB_ENTRIES;
-	uint32_t prevVal = cpu.entryHi;
 	
+	//icache lines are ASID-tagged, so an ASID change here needs no flushing
 	cpu.entryHi = cpu.tlb[index].va | (((uint32_t)cpu.tlb[index].asid) << TLB_ENTRYHI_ASID_SHIFT);
 	cpu.entryLo = cpu.tlb[index].pa | (((uint32_t)cpu.tlb[index].flagsAsByte) << TLB_ENTRYLO_FLAGS_SHIFT);
-	
-	cpuPrvMaybeAsidChanded(prevVal);
 }
 
 static void cpuPrvTlbWrite(uint_fast8_t index)
 {
-//	cpuPrvIcacheFlushPage(cpu.tlb[index].va);
+	//lines fetched through the mapping we are replacing are the only ones that may go stale
+	cpuPrvIcacheFlushPage(cpu.tlb[index].va, cpu.tlb[index].g ? ICACHE_ASID_ANY : cpu.tlb[index].asid);
 		
 	cpuPrvTlbHashRemove(index);
 	
@@ -677,10 +681,6 @@ static void cpuPrvTlbWrite(uint_fast8_t index)
 	cpu.tlb[index].flagsAsByte = (cpu.entryLo & TLB_ENTRYLO_FLAGS_MASK) >> TLB_ENTRYLO_FLAGS_SHIFT;
 	
 	cpuPrvTlbHashAdd(index);
-	
-	cpuPrvIcacheFlushEntire();
-	//XXX: flush old & new page should work, but does not. i am too lazy to track it down
-	//cpuPrvIcacheFlushPage(cpu.tlb[index].va);
 }
 
 static void cpuPrvTlbwi(void)
@@ -729,6 +729,110 @@ static bool cpuPrvIsInKernelMode(void)
 #endif
 }
 
+#if defined(TLB_REFILL_ACCEL) && !defined(R4000)
+
+	//the UTLB miss handler from the R3000 books, which ultrix installs at 0x80000000 as is. when the guest's handler
+	//is exactly this, we can do what it would do without taking the exception and running nine instructions of it
+	static const uint32_t mStdRefillHandler[] = {
+		0x401a2000,		//mfc0	k0, C0_CONTEXT
+		0x401b7000,		//mfc0	k1, C0_EPC
+		0x8f5a0000,		//lw	k0, 0(k0)
+		0x00000000,		//nop
+		0x409a1000,		//mtc0	k0, C0_ENTRYLO
+		0x00000000,		//nop
+		0x42000006,		//tlbwr
+		0x03600008,		//jr	k1
+		0x42000010,		//rfe
+	};
+	
+	//checked on first use, and again after the guest writes instructions (isolated cache stores), as it must after
+	//installing a handler. a handler written without that is stale in a real icache too, so we need not notice it
+	static enum {
+		RefillHandlerUnknown = 0,
+		RefillHandlerStandard,
+		RefillHandlerOther,
+	} mRefillHandler;
+	
+	static bool cpuPrvRefillHandlerIsStandard(void)
+	{
+		uint_fast8_t i;
+		uint32_t instr;
+		
+		if (mRefillHandler == RefillHandlerUnknown) {
+			
+			mRefillHandler = RefillHandlerStandard;
+			for (i = 0; i < sizeof(mStdRefillHandler) / sizeof(*mStdRefillHandler); i++) {
+				
+				if (!cpuPrvMemAccess(EXC_OFST_KU_TLB_REFILL + i * sizeof(uint32_t), sizeof(uint32_t), false, &instr, false) || instr != mStdRefillHandler[i]) {
+					
+					mRefillHandler = RefillHandlerOther;
+					break;
+				}
+			}
+		}
+		
+		return mRefillHandler == RefillHandlerStandard;
+	}
+	
+	//leaves things exactly as the standard handler would have, then the access is retried. false if the guest's own
+	//handler needs to run: the PTE is not valid (it will take an invalid exception next), or is itself not mapped
+	static bool cpuPrvTlbRefillAccel(uint32_t va, bool wasWrite)
+	{
+		uint32_t pteVa, ptePa, pte;
+		int_fast8_t idx;
+		
+		if (va >= 0x80000000 || (cpu.status & CP0_STATUS_BEV) || !cpuPrvRefillHandlerIsStandard())
+			return false;
+		
+		//the handler runs in kernel mode, so the page table may be anywhere but it may not miss
+		pteVa = (cpu.context & CP0_CTX_PTEBASE_MASK) | (((va >> 12) << CP0_CTX_BADVPN2_SHIFT) & CP0_CTX_BADVPN2_MASK);
+		if ((pteVa >> 30) == 2)
+			ptePa = pteVa &~ 0xe0000000;
+		else {
+			
+			idx = cpuPrvTlbHashSearch(pteVa & TLB_ENTRYHI_VA_MASK);
+			if (idx < 0 || !cpu.tlb[idx].v)
+				return false;
+			ptePa = cpu.tlb[idx].pa | (pteVa &~ TLB_ENTRYHI_VA_MASK);
+		}
+		
+		if (!cpuPrvMemAccess(ptePa, sizeof(uint32_t), false, &pte, true) || !(pte & TLB_ENTRYLO_V))
+			return false;
+		
+		//the exception
+		cpuPrvSetBadVA(va);
+		cpuPrvSetEntryHiVa(va);
+		if (cpu.inDelaySlot) {
+			
+			cpu.epc = cpu.pc - 4;
+			cpu.cause |= CP0_CAUSE_BD;
+		}
+		else {
+			
+			cpu.epc = cpu.pc;
+			cpu.cause &=~ CP0_CAUSE_BD;
+		}
+		cpu.cause = (cpu.cause &~ CP0_CAUSE_EXC_COD_MASK) | ((((uint32_t)(wasWrite ? CP0_EXC_COD_TLBS : CP0_EXC_COD_TLBL)) << CP0_CAUSE_EXC_COD_SHIFT) & CP0_CAUSE_EXC_COD_MASK);
+		
+		//the handler
+		cpu.regs[MIPS_REG_K0] = pte;
+		cpu.regs[MIPS_REG_K1] = cpu.epc;
+		cpu.entryLo = pte;
+		cpuPrvTlbwr();
+		perfInc(mPerfCounters.tlbRefills);
+		
+		//the exception's push of the KU/IE stack and the rfe's pop leave only the old pair changed
+		cpu.status =
+			(cpu.status &~ (CP0_STATUS_KUO | CP0_STATUS_IEO)) |
+			((cpu.status & (CP0_STATUS_KUP | CP0_STATUS_IEP)) << 2);
+		cpu.llbit = 0;
+		
+		//returning to epc would redo the branch (if any) that led here, and it would go the same way again
+		return true;
+	}
+
+#endif
+
 static bool cpuPrvMemTranslate(uint32_t *paP, uint32_t va, bool write)
 {
 	int_fast8_t idx;
@@ -784,6 +888,10 @@ static bool cpuPrvMemTranslate(uint32_t *paP, uint32_t va, bool write)
 	
 	//we need to consult the TLB
 	idx = cpuPrvTlbHashSearch(va & TLB_ENTRYHI_VA_MASK);
+#if defined(TLB_REFILL_ACCEL) && !defined(R4000)
+	if (idx < 0 && cpuPrvTlbRefillAccel(va, write))
+		idx = cpuPrvTlbHashSearch(va & TLB_ENTRYHI_VA_MASK);
+#endif
 	if (idx < 0) {
 		cpuPrvTakeTlbRefillExc(va, write);
 	//	fprintf(stderr, "refill exc 0x%08x\n", va);
@@ -805,40 +913,319 @@ static bool cpuPrvMemTranslate(uint32_t *paP, uint32_t va, bool write)
 	return false;
 }
 
+#ifdef DCACHE_NUM_SETS_ORDER
+
+	//model of the write-back data cache embedded builds keep in front of PSRAM (dcache.c), same geometry
+	//knobs, so hit rates and coherence can be checked here. it covers [0 .. ramAmount) only
+
+	#ifndef DCACHE_NUM_WAYS_ORDER
+		#define DCACHE_NUM_WAYS_ORDER	1
+	#endif
+	
+	#ifndef DCACHE_LINE_SZ_ORDER
+		#define DCACHE_LINE_SZ_ORDER	5
+	#endif
+	
+	#define DCACHE_NUM_SETS			(1 << DCACHE_NUM_SETS_ORDER)
+	#define DCACHE_NUM_WAYS			(1 << DCACHE_NUM_WAYS_ORDER)
+	#define DCACHE_LINE_SZ			(1 << DCACHE_LINE_SZ_ORDER)
+	
+	#define DCACHE_FLAG_VALID		0x01
+	#define DCACHE_FLAG_DIRTY		0x02
+	
+	struct DcacheLine {
+		uint32_t addr;	//line address with DCACHE_FLAG_* in low bits, 0 is invalid
+		uint8_t data[DCACHE_LINE_SZ];
+	};
+	
+	static struct {
+		struct DcacheLine lines[DCACHE_NUM_SETS][DCACHE_NUM_WAYS];
+		uint8_t mru[DCACHE_NUM_SETS];
+		uint32_t ramAmount;
+		uint64_t hits, misses, writebacks;
+	} mDcache;
+	
+	static void cpuPrvDcacheFlushEntire(void)	//write back and drop all lines
+	{
+		uint_fast16_t set, way;
+		
+		for (set = 0; set < DCACHE_NUM_SETS; set++) {
+			for (way = 0; way < DCACHE_NUM_WAYS; way++) {
+				
+				struct DcacheLine *line = &mDcache.lines[set][way];
+				
+				if ((line->addr & DCACHE_FLAG_DIRTY) && !memAccess(line->addr &~ (DCACHE_LINE_SZ - 1), DCACHE_LINE_SZ, true, line->data))
+					fprintf(stderr, "DCACHE writeback failed for pa 0x%08x\n", line->addr &~ (DCACHE_LINE_SZ - 1));
+				line->addr = 0;
+			}
+		}
+	}
+	
+	static void cpuPrvDcacheReport(void)
+	{
+		fprintf(stderr, "DCACHE: %llu hits, %llu misses, %llu writebacks\n",
+			(unsigned long long)mDcache.hits, (unsigned long long)mDcache.misses, (unsigned long long)mDcache.writebacks);
+	}
+	
+	static bool cpuPrvDcacheAccess(uint32_t pa, uint_fast8_t sz, bool write, void *buf, bool allocate)
+	{
+		uint32_t lineAddr = pa &~ (DCACHE_LINE_SZ - 1);
+		uint_fast16_t set, way, ofst = pa % DCACHE_LINE_SZ;
+		struct DcacheLine *line;
+		
+		//line crossers are only ever external/bulk. keep them simple
+		if (ofst + sz > DCACHE_LINE_SZ) {
+			
+			uint_fast8_t now = DCACHE_LINE_SZ - ofst;
+			
+			return cpuPrvDcacheAccess(pa, now, write, buf, allocate) &&
+				cpuPrvDcacheAccess(pa + now, sz - now, write, (uint8_t*)buf + now, allocate);
+		}
+		
+		set = (pa / DCACHE_LINE_SZ) % DCACHE_NUM_SETS;
+		line = mDcache.lines[set];
+		
+		for (way = 0; way < DCACHE_NUM_WAYS; way++, line++) {
+			
+			if ((line->addr &~ DCACHE_FLAG_DIRTY) == (lineAddr | DCACHE_FLAG_VALID)) {
+				
+				if (allocate)
+					mDcache.hits++;
+				goto found;
+			}
+		}
+		
+		if (!allocate)
+			return memAccess(pa, sz, write, buf);
+		
+		mDcache.misses++;
+		way = (mDcache.mru[set] + 1) % DCACHE_NUM_WAYS;
+		line = &mDcache.lines[set][way];
+		
+		if (line->addr & DCACHE_FLAG_DIRTY) {
+			
+			if (!memAccess(line->addr &~ (DCACHE_LINE_SZ - 1), DCACHE_LINE_SZ, true, line->data))
+				return false;
+			mDcache.writebacks++;
+		}
+		line->addr = 0;
+		
+		if (!memAccess(lineAddr, DCACHE_LINE_SZ, false, line->data))
+			return false;
+		
+		line->addr = lineAddr | DCACHE_FLAG_VALID;
+	
+	found:
+		mDcache.mru[set] = way;
+		
+		if (write) {
+			memcpy(line->data + ofst, buf, sz);
+			line->addr |= DCACHE_FLAG_DIRTY;
+		}
+		else
+			memcpy(buf, line->data + ofst, sz);
+		
+		return true;
+	}
+
+#endif
+
+static bool cpuPrvMemAccess(uint32_t pa, uint_fast8_t sz, bool write, void *buf, bool allocate)
+{
+#ifdef DCACHE_NUM_SETS_ORDER
+	if (pa < mDcache.ramAmount)
+		return cpuPrvDcacheAccess(pa, sz, write, buf, allocate);
+#else
+	(void)allocate;
+#endif
+	return memAccess(pa, sz, write, buf);
+}
+
 #define ICACHE_LINE_SZ	32	//in bytes
 #define ICACHE_NUM_SETS	32
 #define ICACHE_NUM_WAYS	2
 
+#define ISC_CACHE_SZ	65536	//what isolated loads make the guest think both caches are (a DECstation 3100's)
+
+
+
+#ifdef DECODED_CACHE
+
+	#define DECODED_NUM_PAGES	64
+	
+	//the common instrs, with everything cpuRun needs already pulled out of them. the rest are DecOpGeneric
+	//and go through the big switch
+	enum DecOp {
+		DecOpUndecoded = 0,
+		DecOpGeneric,
+		DecOpNop,
+		DecOpSll,
+		DecOpSrl,
+		DecOpSra,
+		DecOpSllv,
+		DecOpSrlv,
+		DecOpSrav,
+		DecOpJr,
+		DecOpJalr,
+		DecOpMfhi,
+		DecOpMthi,
+		DecOpMflo,
+		DecOpMtlo,
+		DecOpMult,
+		DecOpMultu,
+		DecOpDiv,
+		DecOpDivu,
+		DecOpAddu,
+		DecOpSubu,
+		DecOpAnd,
+		DecOpOr,
+		DecOpXor,
+		DecOpNor,
+		DecOpSlt,
+		DecOpSltu,
+		DecOpBltz,
+		DecOpBgez,
+		DecOpJ,
+		DecOpJal,
+		DecOpBeq,
+		DecOpBne,
+		DecOpBlez,
+		DecOpBgtz,
+		DecOpAddiu,
+		DecOpSlti,
+		DecOpSltiu,
+		DecOpAndi,
+		DecOpOri,
+		DecOpXori,
+		DecOpLui,
+		DecOpLb,
+		DecOpLh,
+		DecOpLw,
+		DecOpLbu,
+		DecOpLhu,
+		DecOpSb,
+		DecOpSh,
+		DecOpSw,
+		
+		DecOpNum,
+	};
+	
+	struct DecodedInstr {
+		uint32_t instr;			//what this was decoded from
+		uint8_t op;				//enum DecOp
+		uint8_t rs, rt, rd;		//rd is the destination whatever the format, never 0 (such instrs become nops)
+		uint32_t imm;			//extended as the op needs. shift amount for immediate shifts, branch offsets pre-shifted
+	};
+	
+	//keyed by PA, so they outlive icache lines and survive remaps. a slot is only used if its instr matches what the
+	//icache just fetched from there, so these need no invalidating of their own: they are exactly as stale as the icache
+	static struct DecodedPage {
+		uint32_t pageNo;
+		struct DecodedInstr instrs[TLB_PAGE_SZ / sizeof(uint32_t)];
+	} mDecodedPages[DECODED_NUM_PAGES];
 
+#endif
 
+//lines are tagged by VA and the ASID they were fetched under, so ASID changes need no flush, and a TLB
+//write only needs to drop the lines that came via the entry being replaced. kseg0/kseg1 are unmapped and
+//the same in every address space, they get ICACHE_ASID_ANY
 struct IcacheLine {
 	uint32_t addr;	//kept as LSRed by ICACHE_LINE_SIZE, so 0xfffffffe is a valid "empty "sentinel
+	uint8_t asid;
 	uint8_t icache[ICACHE_LINE_SZ];
+	uint32_t pa;
 } mIcache[ICACHE_NUM_SETS][ICACHE_NUM_WAYS];
 
+static struct CpuIcacheStats mIcacheStats;
+
+//valid lines by the isolated store index that would drop them, so that stores that drop nothing (most of any flush
+//loop) need no search
+static uint8_t mIcacheIscIdxLines[ISC_CACHE_SZ / ICACHE_LINE_SZ];
+
 
 static void __attribute__((used)) cpuPrvIcacheFlushEntire(void)
 {
 	memset(mIcache, 0xff, sizeof(mIcache));
+	memset(mIcacheIscIdxLines, 0, sizeof(mIcacheIscIdxLines));
+	mIcacheStats.fullFlushes++;
+#ifdef CPU_JIT
+	cpuJitFlushAll();
+#endif
 }
 
-static void __attribute__((used)) cpuPrvIcacheFlushPage(uint32_t va)
+static void cpuPrvIcacheLineDrop(struct IcacheLine *line)
 {
-	struct IcacheLine *line;
+	if (line->addr != 0xffffffff)
+		mIcacheIscIdxLines[(line->pa % ISC_CACHE_SZ) / ICACHE_LINE_SZ]--;
+	line->addr = 0xffffffff;
+}
+
+static void __attribute__((used)) cpuPrvIcacheFlushPage(uint32_t va, uint_fast8_t asid)	//asid may be ICACHE_ASID_ANY
+{
+	struct IcacheLine *line = mIcache[0];
 	uint_fast16_t i;
+	
+	//a page's lines land in every set
+	for (i = 0; i < ICACHE_NUM_SETS * ICACHE_NUM_WAYS; i++, line++) {
 		
-	line = mIcache[(va / ICACHE_LINE_SZ) % ICACHE_NUM_SETS];
+		if (line->addr / (TLB_PAGE_SZ / ICACHE_LINE_SZ) != va / TLB_PAGE_SZ)
+			continue;
+		if (asid != ICACHE_ASID_ANY && line->asid != ICACHE_ASID_ANY && line->asid != asid)
+			continue;
+		cpuPrvIcacheLineDrop(line);
+	}
+	mIcacheStats.pageFlushes++;
+#ifdef CPU_JIT
+	cpuJitFlushPage(va, asid);
+#endif
+}
+
+//an isolated store with the caches swapped lands in the icache and drops the line it hits. the real icache is
+//indexed by PA, and the guest sized it by what isolated loads told it, so every line whose PA is the same modulo
+//that size goes. lines are bigger than the guest's, so this may drop a few more instrs than asked, never fewer
+static void cpuPrvIcacheIscWrite(uint32_t pa)
+{
+	struct IcacheLine *line = mIcache[0];
+	uint_fast16_t i, idx = (pa % ISC_CACHE_SZ) / ICACHE_LINE_SZ;
 	
-	for (i = 0; i < ICACHE_NUM_WAYS; i++, line++) {
+#ifdef CPU_JIT
+	//translations outlive the lines they came from, so they cannot go by this. this is free if there are none
+	cpuJitFlushAll();
+#endif
+	if (!mIcacheIscIdxLines[idx])
+		return;
+	
+	for (i = 0; i < ICACHE_NUM_SETS * ICACHE_NUM_WAYS; i++, line++) {
 		
-		if (line->addr == va / ICACHE_LINE_SZ)
-			line->addr = 0xffffffff;
+		if (line->addr != 0xffffffff && (line->pa % ISC_CACHE_SZ) / ICACHE_LINE_SZ == idx)
+			cpuPrvIcacheLineDrop(line);
 	}
+	mIcacheStats.iscLineDrops++;
 }
 
-static bool __attribute__((used)) cpuPrvInstrFetchCached(uint32_t *instrP)	//if false, do nothing, all has been handled
+static uint_fast8_t cpuPrvIcacheAsidFor(uint32_t va)
+{
+	return ((va >> 30) == 2) ? ICACHE_ASID_ANY : (cpu.entryHi & TLB_ENTRYHI_ASID_MASK) >> TLB_ENTRYHI_ASID_SHIFT;
+}
+
+void cpuGetIcacheStats(struct CpuIcacheStats *statsP)
+{
+	*statsP = mIcacheStats;
+}
+
+void cpuGetPerfCounters(struct CpuPerfCounters *ctrsP)
+{
+#ifdef PERF_COUNTERS
+	*ctrsP = mPerfCounters;
+#else
+	memset(ctrsP, 0, sizeof(*ctrsP));
+#endif
+}
+
+static struct IcacheLine* cpuPrvIcacheLineFetch(void)	//the line holding the instr at pc. if NULL, do nothing, all has been handled
 {
 	uint32_t va = cpu.pc, pa;
+	uint_fast8_t asid = cpuPrvIcacheAsidFor(va);
 	struct IcacheLine *line;
 	uint_fast16_t i, set;
 	static unsigned rng = 1;
@@ -855,13 +1242,15 @@ static bool __attribute__((used)) cpuPrvInstrFetchCached(uint32_t *instrP)	//if
 	
 	for (i = 0; i < ICACHE_NUM_WAYS; i++, line++) {
 		
-		if (line->addr == va / ICACHE_LINE_SZ) {
+		if (line->addr == va / ICACHE_LINE_SZ && line->asid == asid) {
 
+			perfInc(mPerfCounters.icHits);
 			goto hit;
 		}
 	}
 	
 	//miss
+	mIcacheStats.misses++;
 	line = mIcache[set];
 	
 	rng *= 214013;
@@ -869,19 +1258,33 @@ static bool __attribute__((used)) cpuPrvInstrFetchCached(uint32_t *instrP)	//if
 	line += rng % ICACHE_NUM_WAYS;
 		
 	if (!cpuPrvMemTranslate(&pa, va, false))
-		return false;
+		return NULL;
 	
 	pa /= ICACHE_LINE_SZ;
 	pa *= ICACHE_LINE_SZ;
 	
-	if (!memAccess(pa, ICACHE_LINE_SZ, false, line->icache)) {
+	cpuPrvIcacheLineDrop(line);
+	if (!cpuPrvMemAccess(pa, ICACHE_LINE_SZ, false, line->icache, false)) {
 		cpuPrvTakeBusError(pa, true);
-		return false;
+		return NULL;
 	}
 	line->addr = va / ICACHE_LINE_SZ;
+	line->asid = asid;
+	line->pa = pa;
+	mIcacheIscIdxLines[(pa % ISC_CACHE_SZ) / ICACHE_LINE_SZ]++;
 	
 hit:
-	*instrP = *(uint32_t*)(&line->icache[(va % ICACHE_LINE_SZ)]);	//god, i hope gcc optimizes this wel...
+	return line;
+}
+
+static bool __attribute__((used)) cpuPrvInstrFetchCached(uint32_t *instrP)	//if false, do nothing, all has been handled
+{
+	struct IcacheLine *line = cpuPrvIcacheLineFetch();
+	
+	if (!line)
+		return false;
+	
+	*instrP = *(uint32_t*)(&line->icache[(cpu.pc % ICACHE_LINE_SZ)]);	//god, i hope gcc optimizes this wel...
 	return true;
 }
 
@@ -892,7 +1295,7 @@ static bool __attribute__((used)) cpuPrvInstrFetch(uint32_t *instrP)	//if false,
 	if (!cpuPrvMemTranslate(&pa, va, false))
 		return false;
 	
-	if (!memAccess(pa, 4, false, instrP)) {
+	if (!cpuPrvMemAccess(pa, 4, false, instrP, false)) {
 		
 		cpuPrvTakeBusError(pa, true);
 		return false;
@@ -917,8 +1320,11 @@ static bool cpuPrvDataAccess(void* buf, uint32_t va, uint_fast8_t sz, bool write
 
 	if (cpu.status & CP0_STATUS_ISC) {
 		
-		//XXX: this makes cache sizing algos work...badly
-		static uint32_t lastWrite;
+		//isolated loads see what isolated word stores left, in a cache of ISC_CACHE_SZ. that way the guest's sizing
+		//code gets that size, and its flush loops then cover every index we drop lines by. one array does for both
+		//caches, they are sized one at a time
+		static uint32_t iscData[ISC_CACHE_SZ / sizeof(uint32_t)];
+		uint32_t *iscWord = &iscData[(pa % ISC_CACHE_SZ) / sizeof(uint32_t)];
 		
 		//weird mode. see r3000 doc for this, this might need adjustment for R4000
 		#ifdef R4000
@@ -928,37 +1334,49 @@ static bool cpuPrvDataAccess(void* buf, uint32_t va, uint_fast8_t sz, bool write
 		if (write) {
 			
 			if (sz == 4)
-				lastWrite = *(uint32_t*)buf;
-			cpuPrvIcacheFlushEntire();
+				*iscWord = *(uint32_t*)buf;
+			mIcacheStats.iscWrites++;
+			
+			//without swapped caches this lands in the dcache, which has nothing of ours to drop
+			if (cpu.status & CP0_STATUS_SWC)
+				cpuPrvIcacheIscWrite(pa);
+		#if defined(TLB_REFILL_ACCEL) && !defined(R4000)
+			mRefillHandler = RefillHandlerUnknown;
+		#endif
 		}
 		else {
 			switch (sz) {
 				case 1:
-					*(uint8_t*)buf = lastWrite;
+					*(uint8_t*)buf = *iscWord;
 					break;
 				case 2:
-					*(uint16_t*)buf = lastWrite;
+					*(uint16_t*)buf = *iscWord;
 					break;
 				case 4:
-					*(uint32_t*)buf = lastWrite;
+					*(uint32_t*)buf = *iscWord;
 					break;
 				case 8:
-					*(uint64_t*)buf = lastWrite;
+					*(uint64_t*)buf = *iscWord;
 					break;
 			}
 		}
 		return true;
 	}
 
-	if (memAccess(pa, sz, write, buf))
+	if (cpuPrvMemAccess(pa, sz, write, buf, true)) {
+	#ifdef CPU_JIT
+		if (write)
+			cpuJitNoteWrite(pa);
+	#endif
 		return true;
+	}
 	
 	cpuPrvTakeBusError(pa, false);
 
 	return false;
 }
 
-bool cpuMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, enum CpuMemAccessType type)
+static bool cpuPrvMemTranslateExternal(uint32_t *paP, uint32_t va, bool write, enum CpuMemAccessType type)	//no exceptions, no side effects
 {
 	uint_fast8_t i, curAsid;
 	uint32_t pageVa, pa;
@@ -1023,7 +1441,15 @@ bool cpuMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, e
 	return false;
 	
 resolved:
-	return memAccess(pa, sz, write, buf);
+	*paP = pa;
+	return true;
+}
+
+bool cpuMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, enum CpuMemAccessType type)
+{
+	uint32_t pa;
+	
+	return cpuPrvMemTranslateExternal(&pa, va, write, type) && cpuPrvMemAccess(pa, sz, write, buf, false);
 }
 
 
@@ -1064,6 +1490,124 @@ static void cpuPrvBranchTo(uint32_t to)
 	}
 #endif
 
+#ifdef DECODED_CACHE
+
+	static struct DecodedInstr* cpuPrvDecodedSlot(uint32_t pa)
+	{
+		struct DecodedPage *page = &mDecodedPages[(pa / TLB_PAGE_SZ) % DECODED_NUM_PAGES];
+		
+		//a fresh page is all DecOpUndecoded. zero is a valid pageNo for that reason
+		if (page->pageNo != pa / TLB_PAGE_SZ) {
+			
+			page->pageNo = pa / TLB_PAGE_SZ;
+			memset(page->instrs, 0, sizeof(page->instrs));
+		}
+		
+		return &page->instrs[(pa % TLB_PAGE_SZ) / sizeof(uint32_t)];
+	}
+
+	static void cpuPrvDecode(struct DecodedInstr *d, uint32_t instr)
+	{
+		static const uint8_t special[64] = {
+			[0] = DecOpSll,		[2] = DecOpSrl,		[3] = DecOpSra,		[4] = DecOpSllv,
+			[6] = DecOpSrlv,	[7] = DecOpSrav,	[8] = DecOpJr,		[9] = DecOpJalr,
+			[16] = DecOpMfhi,	[17] = DecOpMthi,	[18] = DecOpMflo,	[19] = DecOpMtlo,
+			[24] = DecOpMult,	[25] = DecOpMultu,	[26] = DecOpDiv,	[27] = DecOpDivu,
+			[33] = DecOpAddu,	[35] = DecOpSubu,	[36] = DecOpAnd,	[37] = DecOpOr,
+			[38] = DecOpXor,	[39] = DecOpNor,	[42] = DecOpSlt,	[43] = DecOpSltu,
+		};
+		static const uint8_t primary[64] = {
+			[2] = DecOpJ,		[3] = DecOpJal,		[4] = DecOpBeq,		[5] = DecOpBne,
+			[6] = DecOpBlez,	[7] = DecOpBgtz,	[9] = DecOpAddiu,	[10] = DecOpSlti,
+			[11] = DecOpSltiu,	[12] = DecOpAndi,	[13] = DecOpOri,	[14] = DecOpXori,
+			[15] = DecOpLui,	[32] = DecOpLb,		[33] = DecOpLh,		[35] = DecOpLw,
+			[36] = DecOpLbu,	[37] = DecOpLhu,	[40] = DecOpSb,		[41] = DecOpSh,
+			[43] = DecOpSw,
+		};
+		uint_fast8_t op;
+		
+		d->rs = cpuGetRegNumS(instr);
+		d->rt = cpuGetRegNumT(instr);
+		d->rd = cpuGetRegNumD(instr);
+		d->imm = cpuGetSImm(instr);
+		
+		switch (instr >> 26) {
+			case 0:
+				op = special[instr & 0x3f];
+				d->imm = cpuGetRegNumA(instr);
+				break;
+			
+			case 1:
+				op = (d->rt == 0) ? DecOpBltz : (d->rt == 1) ? DecOpBgez : DecOpGeneric;
+				d->imm <<= 2;
+				break;
+			
+			case 2:
+			case 3:
+				op = primary[instr >> 26];
+				d->imm = (instr << 2) & 0x0ffffffful;
+				break;
+			
+			case 4 ... 7:
+				op = primary[instr >> 26];
+				d->imm <<= 2;
+				break;
+			
+			case 12 ... 15:
+				op = primary[instr >> 26];
+				d->imm = cpuGetUImm(instr);
+				if (op == DecOpLui)
+					d->imm <<= 16;
+				d->rd = d->rt;
+				break;
+			
+			default:
+				op = primary[instr >> 26];
+				d->rd = d->rt;
+				break;
+		}
+		
+		//whatever has no handler, and the corner cases the handlers do not bother with, go the slow way
+		switch (op) {
+			case DecOpUndecoded:
+				op = DecOpGeneric;
+				break;
+			
+			case DecOpJalr:
+				if (!d->rd)
+					op = DecOpJr;
+				break;
+			
+			case DecOpLb ... DecOpLhu:		//loads to $zero still access memory and may fault
+				if (!d->rd)
+					op = DecOpGeneric;
+				break;
+			
+			default:
+				break;
+		}
+		
+		//writes of $zero that have no other effects
+		switch (op) {
+			case DecOpSll ... DecOpSrav:
+			case DecOpMfhi:
+			case DecOpMflo:
+			case DecOpAddu ... DecOpSltu:
+			case DecOpAddiu ... DecOpLui:
+				if (!d->rd)
+					op = DecOpNop;
+				break;
+			
+			default:
+				break;
+		}
+		
+		d->instr = instr;
+		d->op = op;
+	}
+
+#endif
+
 static bool report = 0;
 //static bool report = 1;
 
@@ -1075,48 +1619,20 @@ void cpuReportCy(void)
 uint32_t whileCount = 3000;//1800;//1696 //362;
 uint32_t cycleCount = 0;
 
-void cpuCycle(uint32_t ramAmount)
+static volatile bool mServiceRequested;
+
+void cpuRequestService(void)
+{
+	mServiceRequested = true;
+}
+
+//runs the instr at pc, whatever it is: pc and npc are updated, or an exception is taken
+static void cpuPrvExecute(uint32_t instr)
 {
 	uint32_t i32a, i32b, i32c, i32d;
-	uint32_t instr;
 	uint16_t i16;
 	uint8_t i8;
 	
-	(void)ramAmount;
-
-	//handling interrupts while an instr in branch delay slot is executing is slow (emulation required)
-	//to make life easier we do not report IRQs in the delay slot
-	if (!cpu.inDelaySlot &&
-		(cpu.status & CP0_STATUS_IE) &&
-#ifdef R4000
-		!(cpu.status & CP0_STATUS_EXL) &&
-#endif
-		cpuPrvIrqsPending()) {
-		
-		return cpuPrvTakeIrq();
-	}
-	
-	if (!cpuPrvInstrFetchCached(&instr))
-		return;
-		
-	if (whileCount == 0) report = 1; else report = 0;
-
-	if (report) {
-		int i;
-		fprintf(stderr, "[%08X]=%08X {", cpu.pc, instr);
-		for (i = 0; i < 32; i++) {
-			if (!(i & 7))
-				fprintf(stderr, "%u: ", i);
-			fprintf(stderr, " %08X", cpu.regs[i]);
-		}
-		fprintf(stderr, "}\n");
-	}
-
-	//if ((whileCount--) == 0) while (1) {}
-	//printf("c: %07d i: %08x sw: %d\r\n", cycleCount, instr, instr >> 26);
-	cycleCount++;
-	//if (instr == HYPERCALL) printf("Hypercall at: %d\r\n", cycleCount);
-	
 	switch (instr >> 26) {
 		case 0:
 			switch (instr & 0x3f) {
@@ -1538,9 +2054,7 @@ void cpuCycle(uint32_t ramAmount)
 							break;
 						
 						case 10:
-							i32a = cpu.entryHi;
 							cpu.entryHi = cpuGetRegT(instr);
-							cpuPrvMaybeAsidChanded(i32a);
 							break;
 
 						case 12:
@@ -1578,18 +2092,22 @@ void cpuCycle(uint32_t ramAmount)
 						goto invalid;
 					switch (instr & 0x3f) {
 						case 1: //TLBR
+							perfInc(mPerfCounters.tlbr);
 							cpuPrvTlbr();
 							break;
 						
 						case 2: //TLBWI
+							perfInc(mPerfCounters.tlbwi);
 							cpuPrvTlbwi();
 							break;
 						
 						case 6: //TLBWR
+							perfInc(mPerfCounters.tlbwr);
 							cpuPrvTlbwr();
 							break;
 						
 						case 8: //TLBP
+							perfInc(mPerfCounters.tlbp);
 							cpuPrvTlbp();
 							break;
 #ifdef R4000
@@ -1668,6 +2186,9 @@ void cpuCycle(uint32_t ramAmount)
 				goto invalid;
 			if (instr != MIPS_HYPERCALL)
 				goto invalid;
+		#ifdef DCACHE_NUM_SETS_ORDER
+			cpuPrvDcacheFlushEntire();	//hypercalls touch RAM directly (disk DMA)
+		#endif
 			if (!cpuExtHypercall())
 				goto invalid;
 			break;
@@ -2042,6 +2563,557 @@ invalid_nowarn:
 	return cpuPrvTakeReservedInstrExc();
 }
 
+static bool cpuPrvIrqTakeable(void)
+{
+	//handling interrupts while an instr in branch delay slot is executing is slow (emulation required)
+	//to make life easier we do not report IRQs in the delay slot
+	return !cpu.inDelaySlot &&
+		(cpu.status & CP0_STATUS_IE) &&
+#ifdef R4000
+		!(cpu.status & CP0_STATUS_EXL) &&
+#endif
+		cpuPrvIrqsPending();
+}
+
+static bool cpuPrvPreInstr(void)	//false if an irq was taken in place of the next instr
+{
+	if (mServiceRequested && !cpu.inDelaySlot) {
+		
+		mServiceRequested = false;
+		cpuExtService();
+	}
+	
+	if (cpuPrvIrqTakeable()) {
+		
+		cpuPrvTakeIrq();
+		return false;
+	}
+	
+	return true;
+}
+
+bool cpuIsIdle(void)
+{
+	//an irq must be able to end the wait, and none may be due already
+	if (cpu.inDelaySlot || mServiceRequested || (cpu.status & CP0_STATUS_ISC) || !(cpu.status & CP0_STATUS_IE) || cpuPrvIrqsPending())
+		return false;
+#ifdef R4000
+	if (cpu.status & CP0_STATUS_EXL)
+		return false;
+#endif
+	
+	return cpuIdleCheck(cpu.regs, cpu.pc);
+}
+
+static void cpuPrvTrace(uint32_t instr)
+{
+	if (whileCount == 0) report = 1; else report = 0;
+
+	if (report) {
+		int i;
+		fprintf(stderr, "[%08X]=%08X {", cpu.pc, instr);
+		for (i = 0; i < 32; i++) {
+			if (!(i & 7))
+				fprintf(stderr, "%u: ", i);
+			fprintf(stderr, " %08X", cpu.regs[i]);
+		}
+		fprintf(stderr, "}\n");
+	}
+
+	//if ((whileCount--) == 0) while (1) {}
+	//printf("c: %07d i: %08x sw: %d\r\n", cycleCount, instr, instr >> 26);
+	cycleCount++;
+	//if (instr == HYPERCALL) printf("Hypercall at: %d\r\n", cycleCount);
+}
+
+#ifdef CPU_JIT
+
+	static bool cpuPrvJitStep(uint32_t instr, uint32_t pc, uint32_t npc, uint32_t inDelaySlot)
+	{
+		uint32_t flushes = gCpuJitFlushes, exceptions = mJitExceptions;
+		
+		cpu.pc = pc;
+		cpu.npc = npc;
+		cpu.inDelaySlot = inDelaySlot;
+		cpuPrvExecute(instr);
+		
+		//the block goes on only if this fell through like any other instr, and left nothing for the dispatcher to see
+		//to: no exception, no irq now takeable, no service request, and no flush (that block might be what was flushed)
+		return mJitExceptions == exceptions && cpu.pc == npc && cpu.npc == npc + 4 && gCpuJitFlushes == flushes &&
+			!mServiceRequested && !cpuPrvIrqTakeable();
+	}
+	
+	static bool cpuPrvJitFetch(uint32_t va, uint32_t *instrP, uint32_t *paP)
+	{
+		return cpuPrvMemTranslateExternal(paP, va, false, CpuAccessAsCurrent) && cpuPrvMemAccess(*paP, sizeof(uint32_t), false, instrP, false);
+	}
+	
+	//blocks are only entered where the interpreter would look an instr up anew, and only if all of it fits in the
+	//budget. they are keyed like icache lines, so the one thing left to check is that fetching from pc is legal
+	static bool cpuPrvJitRun(uint32_t *numInstrsP)
+	{
+		CpuJitBlockF code;
+		uint32_t n;
+		uint64_t ret;
+		
+		if (cpu.inDelaySlot || (cpu.pc & 3) || (cpu.status & CP0_STATUS_ISC) || (cpu.pc >= 0x80000000 && !cpuPrvIsInKernelMode()))
+			return false;
+		
+		code = cpuJitFind(cpu.pc, cpuPrvIcacheAsidFor(cpu.pc), *numInstrsP);
+		if (!code)
+			return false;
+		
+		ret = code();
+		n = ret >> 32;
+		if (n & CPU_JIT_EXIT_STATE_SET)
+			n &=~ CPU_JIT_EXIT_STATE_SET;
+		else {
+			cpu.pc = (uint32_t)ret;
+			cpu.npc = cpu.pc + 4;
+			cpu.inDelaySlot = false;
+		}
+		*numInstrsP -= n;
+		
+		return true;
+	}
+
+#endif
+
+#ifdef DECODED_CACHE
+
+	//threaded: each handler jumps to the next instr's handler without coming back out to a loop. straight line
+	//code that cannot have touched the icache goes on in the same line without looking it up again. instrs still
+	//come from the icache, as ever, the decoded copy is only a way to run them
+	void cpuRun(uint32_t ramAmount, uint32_t numInstrs)
+	{
+		static const void* const handlers[DecOpNum] = {
+			[DecOpUndecoded] = &&dec_undecoded,	[DecOpGeneric] = &&dec_generic,	[DecOpNop] = &&dec_seq,
+			[DecOpSll] = &&dec_sll,		[DecOpSrl] = &&dec_srl,		[DecOpSra] = &&dec_sra,		[DecOpSllv] = &&dec_sllv,
+			[DecOpSrlv] = &&dec_srlv,	[DecOpSrav] = &&dec_srav,	[DecOpJr] = &&dec_jr,		[DecOpJalr] = &&dec_jalr,
+			[DecOpMfhi] = &&dec_mfhi,	[DecOpMthi] = &&dec_mthi,	[DecOpMflo] = &&dec_mflo,	[DecOpMtlo] = &&dec_mtlo,
+			[DecOpMult] = &&dec_mult,	[DecOpMultu] = &&dec_multu,	[DecOpDiv] = &&dec_div,		[DecOpDivu] = &&dec_divu,
+			[DecOpAddu] = &&dec_addu,	[DecOpSubu] = &&dec_subu,	[DecOpAnd] = &&dec_and,		[DecOpOr] = &&dec_or,
+			[DecOpXor] = &&dec_xor,		[DecOpNor] = &&dec_nor,		[DecOpSlt] = &&dec_slt,		[DecOpSltu] = &&dec_sltu,
+			[DecOpBltz] = &&dec_bltz,	[DecOpBgez] = &&dec_bgez,	[DecOpJ] = &&dec_j,			[DecOpJal] = &&dec_jal,
+			[DecOpBeq] = &&dec_beq,		[DecOpBne] = &&dec_bne,		[DecOpBlez] = &&dec_blez,	[DecOpBgtz] = &&dec_bgtz,
+			[DecOpAddiu] = &&dec_addiu,	[DecOpSlti] = &&dec_slti,	[DecOpSltiu] = &&dec_sltiu,	[DecOpAndi] = &&dec_andi,
+			[DecOpOri] = &&dec_ori,		[DecOpXori] = &&dec_xori,	[DecOpLui] = &&dec_lui,		[DecOpLb] = &&dec_lb,
+			[DecOpLh] = &&dec_lh,		[DecOpLw] = &&dec_lw,		[DecOpLbu] = &&dec_lbu,		[DecOpLhu] = &&dec_lhu,
+			[DecOpSb] = &&dec_sb,		[DecOpSh] = &&dec_sh,		[DecOpSw] = &&dec_sw,
+		};
+		struct DecodedInstr *d;
+		struct IcacheLine *line;
+		uint32_t instr, i32a, i32d;
+		uint_fast8_t idx;
+		uint16_t i16;
+		uint8_t i8;
+		
+		(void)ramAmount;
+		
+		if (!numInstrs)
+			return;
+		perfAdd(mPerfCounters.instrs, numInstrs);
+		goto fetch;
+	
+	next:		//pc and npc are set for the next instr
+		if (!--numInstrs)
+			return;
+	
+	fetch:
+		if (!cpuPrvPreInstr())
+			goto next;
+	#ifdef CPU_JIT
+		if (cpuPrvJitRun(&numInstrs)) {
+			
+			if (!numInstrs)
+				return;
+			goto fetch;
+		}
+	#endif
+		if (!(line = cpuPrvIcacheLineFetch()))
+			goto next;
+		idx = (cpu.pc % ICACHE_LINE_SZ) / sizeof(uint32_t);
+		d = cpuPrvDecodedSlot(line->pa + idx * sizeof(uint32_t));
+	
+	exec:
+		instr = ((const uint32_t*)line->icache)[idx];
+		cpuPrvTrace(instr);
+		if (d->instr != instr)
+			goto dec_undecoded;
+		goto *handlers[d->op];		//$zero is never written by the handlers (see cpuPrvDecode)
+	
+	dec_undecoded:
+		cpuPrvDecode(d, instr);
+		goto *handlers[d->op];
+	
+	dec_generic:
+		cpuPrvExecute(instr);
+		goto next;
+	
+	dec_sll:
+		cpu.regs[d->rd] = cpu.regs[d->rt] << d->imm;
+		goto dec_seq;
+	
+	dec_srl:
+		cpu.regs[d->rd] = cpu.regs[d->rt] >> d->imm;
+		goto dec_seq;
+	
+	dec_sra:
+		cpu.regs[d->rd] = ((int32_t)cpu.regs[d->rt]) >> d->imm;
+		goto dec_seq;
+	
+	dec_sllv:
+		cpu.regs[d->rd] = cpu.regs[d->rt] << (0x1F & cpu.regs[d->rs]);
+		goto dec_seq;
+	
+	dec_srlv:
+		cpu.regs[d->rd] = cpu.regs[d->rt] >> (0x1F & cpu.regs[d->rs]);
+		goto dec_seq;
+	
+	dec_srav:
+		cpu.regs[d->rd] = ((int32_t)cpu.regs[d->rt]) >> (0x1F & cpu.regs[d->rs]);
+		goto dec_seq;
+	
+	dec_jr:
+		cpuPrvBranchTo(cpu.regs[d->rs]);
+		goto dec_cont;
+	
+	dec_jalr:
+		i32a = cpu.regs[d->rs];
+		cpu.regs[d->rd] = cpu.pc + 8;
+		cpuPrvBranchTo(i32a);
+		goto dec_cont;
+	
+	dec_mfhi:
+		cpu.regs[d->rd] = cpu.hi;
+		goto dec_seq;
+	
+	dec_mthi:
+		cpu.hi = cpu.regs[d->rs];
+		goto dec_seq;
+	
+	dec_mflo:
+		cpu.regs[d->rd] = cpu.lo;
+		goto dec_seq;
+	
+	dec_mtlo:
+		cpu.lo = cpu.regs[d->rs];
+		goto dec_seq;
+	
+	dec_mult:
+		cpu.hilo64 = (int64_t)(int32_t)cpu.regs[d->rs] * (int64_t)(int32_t)cpu.regs[d->rt];
+		goto dec_seq;
+	
+	dec_multu:
+		cpu.hilo64 = (uint64_t)cpu.regs[d->rs] * (uint64_t)cpu.regs[d->rt];
+		goto dec_seq;
+	
+	dec_div:
+		i32a = cpu.regs[d->rt];
+		if (i32a) {
+			int32_t num = cpu.regs[d->rs];
+			cpu.lo = num / (int32_t)i32a;
+			cpu.hi = num % (int32_t)i32a;
+		}
+		goto dec_seq;
+	
+	dec_divu:
+		i32a = cpu.regs[d->rt];
+		if (i32a) {
+			cpu.lo = cpu.regs[d->rs] / i32a;
+			cpu.hi = cpu.regs[d->rs] % i32a;
+		}
+		goto dec_seq;
+	
+	dec_addu:
+		cpu.regs[d->rd] = cpu.regs[d->rs] + cpu.regs[d->rt];
+		goto dec_seq;
+	
+	dec_subu:
+		cpu.regs[d->rd] = cpu.regs[d->rs] - cpu.regs[d->rt];
+		goto dec_seq;
+	
+	dec_and:
+		cpu.regs[d->rd] = cpu.regs[d->rs] & cpu.regs[d->rt];
+		goto dec_seq;
+	
+	dec_or:
+		cpu.regs[d->rd] = cpu.regs[d->rs] | cpu.regs[d->rt];
+		goto dec_seq;
+	
+	dec_xor:
+		cpu.regs[d->rd] = cpu.regs[d->rs] ^ cpu.regs[d->rt];
+		goto dec_seq;
+	
+	dec_nor:
+		cpu.regs[d->rd] = ~(cpu.regs[d->rs] | cpu.regs[d->rt]);
+		goto dec_seq;
+	
+	dec_slt:
+		cpu.regs[d->rd] = ((int32_t)cpu.regs[d->rs] < (int32_t)cpu.regs[d->rt]) ? 1 : 0;
+		goto dec_seq;
+	
+	dec_sltu:
+		cpu.regs[d->rd] = (cpu.regs[d->rs] < cpu.regs[d->rt]) ? 1 : 0;
+		goto dec_seq;
+	
+	dec_bltz:
+		if (((int32_t)cpu.regs[d->rs]) >= 0)
+			goto dec_seq;
+		cpuPrvBranchTo(cpu.npc + d->imm);
+		goto dec_cont;
+	
+	dec_bgez:
+		if (((int32_t)cpu.regs[d->rs]) < 0)
+			goto dec_seq;
+		cpuPrvBranchTo(cpu.npc + d->imm);
+		goto dec_cont;
+	
+	dec_jal:
+		cpu.regs[MIPS_REG_RA] = cpu.pc + 8;
+		//fallthrough
+	
+	dec_j:
+		cpuPrvBranchTo((cpu.npc & 0xf0000000ul) | d->imm);
+		goto dec_cont;
+	
+	dec_beq:
+		if (cpu.regs[d->rs] != cpu.regs[d->rt])
+			goto dec_seq;
+		cpuPrvBranchTo(cpu.npc + d->imm);
+		goto dec_cont;
+	
+	dec_bne:
+		if (cpu.regs[d->rs] == cpu.regs[d->rt])
+			goto dec_seq;
+		cpuPrvBranchTo(cpu.npc + d->imm);
+		goto dec_cont;
+	
+	dec_blez:
+		if ((int32_t)cpu.regs[d->rs] > 0)
+			goto dec_seq;
+		cpuPrvBranchTo(cpu.npc + d->imm);
+		goto dec_cont;
+	
+	dec_bgtz:
+		if ((int32_t)cpu.regs[d->rs] <= 0)
+			goto dec_seq;
+		cpuPrvBranchTo(cpu.npc + d->imm);
+		goto dec_cont;
+	
+	dec_addiu:
+		cpu.regs[d->rd] = cpu.regs[d->rs] + d->imm;
+		goto dec_seq;
+	
+	dec_slti:
+		cpu.regs[d->rd] = ((int32_t)cpu.regs[d->rs] < (int32_t)d->imm) ? 1 : 0;
+		goto dec_seq;
+	
+	dec_sltiu:
+		cpu.regs[d->rd] = (cpu.regs[d->rs] < d->imm) ? 1 : 0;
+		goto dec_seq;
+	
+	dec_andi:
+		cpu.regs[d->rd] = cpu.regs[d->rs] & d->imm;
+		goto dec_seq;
+	
+	dec_ori:
+		cpu.regs[d->rd] = cpu.regs[d->rs] | d->imm;
+		goto dec_seq;
+	
+	dec_xori:
+		cpu.regs[d->rd] = cpu.regs[d->rs] ^ d->imm;
+		goto dec_seq;
+	
+	dec_lui:
+		cpu.regs[d->rd] = d->imm;
+		goto dec_seq;
+	
+	dec_lb:
+		if (!cpuPrvDataAccess(&i8, cpu.regs[d->rs] + d->imm, 1, false))
+			goto next;
+		cpu.regs[d->rd] = (int32_t)(int8_t)i8;
+		goto dec_seq;
+	
+	dec_lh:
+		if (!cpuPrvDataAccess(&i16, cpu.regs[d->rs] + d->imm, 2, false))
+			goto next;
+		cpu.regs[d->rd] = (int32_t)(int16_t)i16;
+		goto dec_seq;
+	
+	dec_lw:
+		if (!cpuPrvDataAccess(&i32d, cpu.regs[d->rs] + d->imm, 4, false))
+			goto next;
+		cpu.regs[d->rd] = i32d;
+		goto dec_seq;
+	
+	dec_lbu:
+		if (!cpuPrvDataAccess(&i8, cpu.regs[d->rs] + d->imm, 1, false))
+			goto next;
+		cpu.regs[d->rd] = i8;
+		goto dec_seq;
+	
+	dec_lhu:
+		if (!cpuPrvDataAccess(&i16, cpu.regs[d->rs] + d->imm, 2, false))
+			goto next;
+		cpu.regs[d->rd] = i16;
+		goto dec_seq;
+	
+	dec_sb:
+		i8 = cpu.regs[d->rt];
+		if (!cpuPrvDataAccess(&i8, cpu.regs[d->rs] + d->imm, 1, true))
+			goto next;
+		goto dec_seq;
+	
+	dec_sh:
+		i16 = cpu.regs[d->rt];
+		if (!cpuPrvDataAccess(&i16, cpu.regs[d->rs] + d->imm, 2, true))
+			goto next;
+		goto dec_seq;
+	
+	dec_sw:
+		i32d = cpu.regs[d->rt];
+		if (!cpuPrvDataAccess(&i32d, cpu.regs[d->rs] + d->imm, 4, true))
+			goto next;
+		//fallthrough
+	
+	dec_seq:	//did not branch
+		cpuPrvNoBranchTaken();
+		//fallthrough
+	
+	dec_cont:
+		if (!--numInstrs)
+			return;
+		
+		//if the next instr is in the line we just ran from, it need not be looked up again. had anything flushed
+		//that line meanwhile (a TLB refill, an isolated cache store) its tag would no longer match
+		if (cpu.pc / ICACHE_LINE_SZ != line->addr || mServiceRequested || cpuPrvIrqTakeable())
+			goto fetch;
+		d -= idx;
+		idx = (cpu.pc % ICACHE_LINE_SZ) / sizeof(uint32_t);
+		d += idx;
+		goto exec;
+	}
+	
+	void cpuCycle(uint32_t ramAmount)
+	{
+		cpuRun(ramAmount, 1);
+	}
+
+#else
+
+	void cpuCycle(uint32_t ramAmount)
+	{
+		uint32_t instr;
+		
+		(void)ramAmount;
+		
+		perfInc(mPerfCounters.instrs);
+		if (!cpuPrvPreInstr() || !cpuPrvInstrFetchCached(&instr))
+			return;
+		
+		cpuPrvTrace(instr);
+		cpuPrvExecute(instr);
+	}
+	
+	void cpuRun(uint32_t ramAmount, uint32_t numInstrs)
+	{
+		while (numInstrs--)
+			cpuCycle(ramAmount);
+	}
+
+#endif
+
+void cpuGetState(struct CpuState *st)
+{
+	uint_fast8_t i;
+	
+	memset(st, 0, sizeof(*st));
+	
+#ifdef DCACHE_NUM_SETS_ORDER
+	cpuPrvDcacheFlushEntire();		//whoever wants our state will want RAM to match
+#endif
+	
+	memcpy(st->regs, cpu.regs, sizeof(st->regs));
+	st->pc = cpu.pc;
+	st->npc = cpu.npc;
+	st->lo = cpu.lo;
+	st->hi = cpu.hi;
+	st->index = cpu.index;
+	st->random = cpu.randomSeed;
+	st->cause = cpu.cause;
+	st->status = cpu.status;
+	st->epc = cpu.epc;
+	st->badva = cpu.badva;
+	st->entryHi = cpu.entryHi;
+	st->entryLo = cpu.entryLo;
+	st->context = cpu.context;
+	
+	for (i = 0; i < NUM_TLB_ENTRIES; i++) {
+		
+		st->tlbHi[i] = cpu.tlb[i].va | (((uint32_t)cpu.tlb[i].asid) << TLB_ENTRYHI_ASID_SHIFT);
+		st->tlbLo[i] = cpu.tlb[i].pa | (((uint32_t)cpu.tlb[i].flagsAsByte) << TLB_ENTRYLO_FLAGS_SHIFT);
+	}
+	
+#if defined(FPU_SUPPORT_FULL) || defined(FPU_SUPPORT_MINIMAL)
+	memcpy(st->fpr, cpu.fpu.i, sizeof(st->fpr));
+	st->fcr = cpu.fpu.fcr;
+#endif
+	
+	st->inDelaySlot = cpu.inDelaySlot;
+	st->llBit = cpu.llbit;
+}
+
+void cpuSetState(const struct CpuState *st)
+{
+	uint_fast8_t i;
+	
+#ifdef DCACHE_NUM_SETS_ORDER
+	cpuPrvDcacheFlushEntire();		//RAM is about to be replaced under us
+#endif
+	
+	memcpy(cpu.regs, st->regs, sizeof(cpu.regs));
+	cpu.regs[MIPS_REG_ZERO] = 0;
+	cpu.pc = st->pc;
+	cpu.npc = st->npc;
+	cpu.lo = st->lo;
+	cpu.hi = st->hi;
+	cpu.index = st->index;
+	cpu.randomSeed = st->random;
+	cpu.cause = st->cause;
+	cpu.status = st->status;
+	cpu.epc = st->epc;
+	cpu.badva = st->badva;
+	cpu.entryHi = st->entryHi;
+	cpu.entryLo = st->entryLo;
+	cpu.context = st->context;
+	
+	for (i = 0; i < TLB_HASH_ENTRIES; i++)
+		cpu.tlbHash[i] = -1;
+	
+	for (i = 0; i < NUM_TLB_ENTRIES; i++) {
+		
+		cpu.tlb[i].va = st->tlbHi[i] & TLB_ENTRYHI_VA_MASK;
+		cpu.tlb[i].asid = (st->tlbHi[i] & TLB_ENTRYHI_ASID_MASK) >> TLB_ENTRYHI_ASID_SHIFT;
+		cpu.tlb[i].pa = st->tlbLo[i] & TLB_ENTRYLO_PA_MASK;
+		cpu.tlb[i].flagsAsByte = (st->tlbLo[i] & TLB_ENTRYLO_FLAGS_MASK) >> TLB_ENTRYLO_FLAGS_SHIFT;
+		cpuPrvTlbHashAdd(i);
+	}
+	
+#if defined(FPU_SUPPORT_FULL) || defined(FPU_SUPPORT_MINIMAL)
+	memcpy(cpu.fpu.i, st->fpr, sizeof(cpu.fpu.i));
+	cpu.fpu.fcr = st->fcr;
+#endif
+	
+	cpu.inDelaySlot = st->inDelaySlot;
+	cpu.llbit = st->llBit;
+	
+	cpuPrvIcacheFlushEntire();
+#if defined(TLB_REFILL_ACCEL) && !defined(R4000)
+	mRefillHandler = RefillHandlerUnknown;
+#endif
+}
+
 void cpuInit(uint32_t ramAmount)
 {
 	uint_fast8_t i;
@@ -2054,7 +3126,29 @@ void cpuInit(uint32_t ramAmount)
 #endif
 	cpu.pc = 0xBFC00000UL;	/* mips gets reset to this addr */
 	cpu.npc = cpu.pc + 4;
+#ifdef CPU_JIT
+	{
+		static const struct CpuJitEnv env = {
+			.regs = cpu.regs,
+			.lohi = &cpu.lo,
+			.step = cpuPrvJitStep,
+			.fetch = cpuPrvJitFetch,
+		};
+		
+		cpuJitInit(&env);
+	}
+#endif
 	cpuPrvIcacheFlushEntire();
+#if defined(TLB_REFILL_ACCEL) && !defined(R4000)
+	mRefillHandler = RefillHandlerUnknown;
+#endif
+	
+#ifdef DCACHE_NUM_SETS_ORDER
+	if (!mDcache.ramAmount)
+		atexit(cpuPrvDcacheReport);
+	cpuPrvDcacheFlushEntire();
+	mDcache.ramAmount = ramAmount;
+#endif
 	
 	//having these in a chain simplifies removal
 	for (i = 0; i < NUM_TLB_ENTRIES; i++) {
@@ -55,6 +55,19 @@ struct Cpu;
 #define MIPS_EXT_REG_NTRYLO	(MIPS_NUM_REGS + 6)	//ONLY FOR external use
 #define MIPS_EXT_REG_NTRYHI	(MIPS_NUM_REGS + 7)	//ONLY FOR external use
 
+//mode bits of MIPS_EXT_REG_STATUS
+#ifdef R4000
+	#define CP0_STATUS_UM		0x00000020	//set for user mode
+	#define CP0_STATUS_ERL		0x00000004
+	#define CP0_STATUS_EXL		0x00000002
+#else
+	#define CP0_STATUS_KUO		0x00000020
+	#define CP0_STATUS_IEO		0x00000010
+	#define CP0_STATUS_KUP		0x00000008
+	#define CP0_STATUS_IEP		0x00000004
+	#define CP0_STATUS_KUC		0x00000002	//set when in userspace
+#endif
+
 
 
 
@@ -65,6 +78,7 @@ struct Cpu;
 
 void cpuInit(uint32_t ramAmount);			//ram amount is advisory
 void cpuCycle(uint32_t ramAmount);			//may not return (in embedded case it executes forever)
+void cpuRun(uint32_t ramAmount, uint32_t numInstrs);	//same as that many cpuCycle() calls, only faster. C core only
 void cpuIrq(uint_fast8_t idx, bool raise);	//unraise when acknowledged
 
 //for debugging
@@ -80,8 +94,54 @@ bool cpuMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, e
 
 uint32_t cpuGetCyCnt(void);
 
+//icache counters, for tuning
+struct CpuIcacheStats {
+	uint32_t misses;
+	uint32_t pageFlushes;
+	uint32_t fullFlushes;
+	uint32_t iscWrites;			//stores with the cache isolated (cache flush loops)
+	uint32_t iscLineDrops;		//those of them that found something to drop
+};
+
+void cpuGetIcacheStats(struct CpuIcacheStats *statsP);
+
+//more of them, only counted if built with PERF_COUNTERS (see perf.h). all of these wrap
+struct CpuPerfCounters {
+	uint32_t instrs;			//instrs run, those that took an exception included
+	uint32_t icHits;			//icache lookups that hit. the C core does not look up every instr, the asm one does
+	uint32_t tlbRefills;		//refill exceptions, and refills done for the guest (TLB_REFILL_ACCEL)
+	uint32_t tlbr, tlbwi, tlbwr, tlbp;
+	uint32_t exceptions[32];	//by ExcCode, irqs included
+};
+
+void cpuGetPerfCounters(struct CpuPerfCounters *ctrsP);
+
+//architectural state, as needed to stop a machine and start it again elsewhere (see snapshot.h). TLB entries are as
+//tlbr would see them. only valid to get/set from cpuExtService/cpuExtHypercall or before the first cpuCycle
+struct CpuState {
+	uint32_t regs[MIPS_NUM_REGS];
+	uint32_t pc, npc, lo, hi;
+	uint32_t index, random, cause, status, epc, badva, entryHi, entryLo, context;
+	uint32_t tlbHi[64], tlbLo[64];
+	uint32_t fpr[32], fcr;		//zeroes without an FPU
+	bool inDelaySlot;			//pc is a branch delay slot, npc is the branch target
+	bool llBit;
+};
+
+void cpuGetState(struct CpuState *st);
+void cpuSetState(const struct CpuState *st);
+
+//safe to call from irq context. the cpu calls cpuExtService() before some soon-to-follow instruction
+void cpuRequestService(void);
+
+//idle detection (cpuIdle.c): true if the cpu spins in a loop that only an irq can end, so the time until the next
+//device event need not be spent running it. only valid where cpuGetState is, or between cpuRun calls
+bool cpuIsIdle(void);
+void cpuSetIdleRange(uint32_t start, uint32_t end);		//pcs in [start, end) count as idle too, if irqs are enabled
+
 //provided externally
 bool cpuExtHypercall(void);
+void cpuExtService(void);
 
 void prTLB(void);
 #endif
@@ -0,0 +1,222 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _CPU_ASM_H_
+#define _CPU_ASM_H_
+
+//layout of the asm core's state (mCpu), shared by cpuAsm.S and the C code that needs to look inside it (cpuAsmState.c)
+//only preprocessor definitions may live here
+
+/*
+	cpu struct:
+	
+0x00:
+	uint32_t regs[32];	//required to be first
+0x80:
+	uint32_t space;	//for loads and stores, also stores ram amount between init and cycle and between saveState/restoreState
+	uint8_t inDelaySlot
+	uint8_t haveIrqs	//MUST be either 0 or 4
+	uint8_t llBit
+	uint8_t inFpuOp		//for irq stuffs
+	uint32_t pc, npc;
+0x90:
+	uint32_t lo, hi, index, cause
+0xa0:
+	uint32_t status, epc, badva, entryHi
+0xb0:
+	uint32_t entryLo, context, random, memLimit
+0xc0:
+	uint32_t icTagXor;	//current ASID, xored into tags of user icache lines
+0xc4:
+	uint32_t svcReq;	//0 or 4. cpuRequestService() was called. folded into haveIrqs wherever that is calculated
+0xc8:
+	//tlb
+	struct TlbEntry {
+		uint32_t va;	//top-aligned, bottom zero
+		uint32_t pa;	//top-aligned, bottom zero
+		uint8_t asid;	//in proper bit place, all other parts zeroes
+		union{
+			struct {
+				
+				uint8_t	enabled :1;	//cache of "asid == curAsid || g"
+				uint8_t rfu		:3;
+				uint8_t g		:1;
+				uint8_t v		:1;
+				uint8_t d		:1;
+				uint8_t n		:1;
+			};
+			uint8_t flagsAsByte;
+		}
+		uint8_t prevIdx;	//element index if top bit clear, bucket index if this is the first element
+		uint8_t nextIdx;	//0xff if this is the last element
+	}[NUM_TLB_ENTRIES]		//0x0c each
+	
+0x4c0:
+	uint8_t hashBuckets[NUM_TLB_BUCKETS];	//0xff if empty
+	
+0x540:
+	struct {
+		uint8_t icache[ICACHE_LINE_SIZE]
+		uint32_t addr;	//kept as LSRed by ICACHE_LINE_SIZE, so 0xfffffffe is a valid "empty "sentinel
+	} [ICACHE_NUM_WAYS * ICACHE_NUM_SETS]
+
+#if defined(FPU_SUPPORT_FULL) || defined(FPU_SUPPORT_MINIMAL)
+
+0xe40:
+	union {
+		uint32_t iRegs[32];
+		float fRegs[32];
+		double dRegs[16];
+	};
+	uint32_t fcr
+
+#endif
+
+	struct CpuIcacheStats icStats;
+	uint32_t icMissesAtLastIscFlush;
+#ifdef PERF_COUNTERS
+	uint32_t instrs, tlbRefills, tlbr, tlbwi, tlbwr, tlbp, exceptions[32];
+#endif
+
+*/
+
+#define NUM_REGS				32
+
+#define OFST_PART2				(NUM_REGS * 4)
+#define OFST_TLB				(OFST_PART2 + 0x48)
+
+#define OFST_TLB_HASH_MIN		(OFST_TLB + NUM_TLB_ENTRIES * SIZEOF_TLB_ENTRY)
+#define OFST_TLB_HASH			((OFST_TLB_HASH_MIN + 15) / 16 * 16)	//make it easy to generate without a literal load
+
+#define OFST_ICACHE_MIN			(OFST_TLB_HASH + NUM_TLB_BUCKETS)
+#define OFST_ICACHE				((OFST_ICACHE_MIN + 15) / 16 * 16)	//make it easy to generate without a literal load
+
+
+#define OFST_ICACHE_ADDR		(ICACHE_LINE_SIZE)
+
+//allf of these are from the second half!
+#define OFST_SPACE				0x00
+#define OFST_IN_DELAY_SLOT		0x04		//only used when state is saved
+#define OFST_HAVE_IRQ			0x05
+#define OFST_LLBIT				0x06
+#define OFST_IN_FPU_OP			0x07
+#define OFST_PC					0x08
+#define OFST_NPC				0x0c
+#define OFST_LO					0x10
+#define OFST_HI					0x14
+#define OFST_CP0_INDEX			0x18
+#define OFST_CP0_CAUSE			0x1c
+#define OFST_CP0_STATUS			0x20
+#define OFST_CP0_EPC			0x24
+#define OFST_CP0_BADVA			0x28
+#define OFST_CP0_ENTRYHI		0x2c
+#define OFST_CP0_ENTRYLO		0x30
+#define OFST_CP0_CONTEXT		0x34
+#define OFST_RANDOM				0x38
+#define OFST_MEMLIMIT			0x3c
+#define OFST_ICACHE_TAG_XOR		0x40
+#define OFST_SVC_REQ			0x44
+
+
+//each entry is 0x10 bytes
+#define OFST_TLB_VA				0x00
+#define OFST_TLB_PA				0x04
+#define OFST_TLB_ASID			0x08
+#define OFST_TLB_BITS			0x09		//flags in top 4 bits, enabled bit in lowest bit
+#define OFST_TLB_HASH_PREV_IDX	0x0a
+#define OFST_TLB_HASH_NEXT_IDX	0x0b
+#define SIZEOF_TLB_ENTRY		0x0c
+
+#define TLB_FLAGS_BIT_G			4
+#define TLB_FLAGS_BIT_V			5
+#define TLB_FLAGS_BIT_D			6
+#define TLB_FLAGS_BIT_N			7
+
+#define OFST_FPU_FCR			128
+
+#define FPU_FIR					0x300
+
+#define FCR_UNIMPL				0x00020000
+#define FCR_INVAL_OP			0x10
+#define FCR_CEF_DIV0			0x08
+#define FCR_CEF_OVERFLOW		0x04
+#define FCR_CEF_UDERFLOW		0x02
+#define FCR_CEF_INEXACT			0x01
+
+#define FCR_SHIFT_FLAGS			2
+#define FCR_SHIFT_ENABLES		7
+#define FCR_SHIFT_CAUSE			12
+#define FPU_FCR_C_SHIFT			23
+
+#define FCR_PEROP_FLAGS			(((FCR_INVAL_OP | FCR_CEF_DIV0 | FCR_CEF_OVERFLOW | FCR_CEF_UDERFLOW | FCR_CEF_INEXACT) << FCR_SHIFT_CAUSE) | FCR_UNIMPL)
+
+
+#define OFST_FPU				(OFST_ICACHE + ICACHE_LINE_STOR_SZ * ICACHE_NUM_WAYS * ICACHE_NUM_SETS)
+
+#if defined(FPU_SUPPORT_FULL) || defined(FPU_SUPPORT_MINIMAL)
+	#define SIZEOF_FPU			(32*4+4)
+#else
+	#define SIZEOF_FPU			0
+#endif
+
+#define OFST_STATS				(OFST_FPU + SIZEOF_FPU)
+
+//struct CpuIcacheStats, same order as in cpu.h
+#define OFST_STATS_IC_MISSES	0x00
+#define OFST_STATS_IC_PG_FLUSH	0x04
+#define OFST_STATS_IC_FULL_FLUSH	0x08
+#define OFST_STATS_IC_ISC_WRITES	0x0c
+#define OFST_STATS_IC_ISC_DROPS	0x10
+#define OFST_STATS_IC_ISC_MISSES	0x14	//not in the struct: misses as of the last isolated store that flushed
+#ifdef PERF_COUNTERS			//not in struct CpuPerfCounters order, cpuGetPerfCounters sorts them out
+	#define OFST_STATS_INSTRS		0x18
+	#define OFST_STATS_TLB_REFILLS	0x1c
+	#define OFST_STATS_TLBR			0x20
+	#define OFST_STATS_TLBWI		0x24
+	#define OFST_STATS_TLBWR		0x28
+	#define OFST_STATS_TLBP			0x2c
+	#define OFST_STATS_EXC			0x30	//one per ExcCode, indexed by cause as the core keeps it (code << 2)
+	#define SIZEOF_STATS			0xb0
+#else
+	#define SIZEOF_STATS			0x18
+#endif
+
+#define CPU_SIZE				(OFST_STATS + SIZEOF_STATS)
+
+
+#define PRID_VALUE				0x0220	//R3000
+
+#define MIPS_REGNO_RA			31
+
+#define ORDER_NUM_TLB_BUCKETS	7
+#define NUM_TLB_BUCKETS			(1 << ORDER_NUM_TLB_BUCKETS)
+
+#define ORDER_NUM_TLB_ENTRIES	6
+#define NUM_TLB_ENTRIES			(1 << ORDER_NUM_TLB_ENTRIES)
+#define NUM_WIRED_ENTRIES		8
+#define NUM_IRQS				8		//lower 2 are sw irqs
+
+#define PAGE_ORDER				12
+
+#define ICACHE_NUM_WAYS_ORDER	0
+#define ICACHE_NUM_WAYS			(1 << ICACHE_NUM_WAYS_ORDER)	//number of lines a given va can be in
+
+#define ICACHE_NUM_SETS			(1 << ICACHE_NUM_SETS_ORDER)	//number of buckets of VAs
+#define ICACHE_LINE_SZ_ORDER	5
+#define ICACHE_LINE_SIZE		(1 << ICACHE_LINE_SZ_ORDER)
+#define ICACHE_LINE_STOR_SZ		(ICACHE_LINE_SIZE + 4)
+
+/*
+	user lines are tagged with (va >> ICACHE_LINE_SZ_ORDER) ^ asid. that puts the ASID into the set index
+	bits of the tag, which all lines of a set share anyways, so tags stay unique as long as we have at least
+	as many set index bits as the ASID has. Kernel addresses (va >= 0x80000000) are tagged by va alone. This
+	way ASID changes do not need to toss user lines
+*/
+#if ICACHE_NUM_SETS_ORDER >= 6
+	#define ICACHE_ASID_TAGGED
+#endif
+
+
+#endif
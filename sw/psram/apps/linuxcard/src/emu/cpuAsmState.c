@@ -0,0 +1,178 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <string.h>
+#include "cpuIdle.h"
+#include "cpuAsm.h"
+#include "cpu.h"
+
+
+//state get/set for the asm core. nothing here is speed critical, so it is C poking at mCpu using the offsets
+//cpuAsm.S itself uses. only called between instructions, when everything the core keeps in regs is saved
+
+#define CP0_STATUS_IE			0x00000001
+#define CP0_STATUS_IM_MASK		0x0000ff00
+#define CP0_STATUS_ISC			0x00010000
+
+#define TLB_ENTRYHI_VA_MASK		0xfffff000
+#define TLB_ENTRYHI_ASID_MASK	0x00000fc0
+#define TLB_ENTRYHI_ASID_SHIFT	6
+
+#define TLB_ENTRYLO_PA_MASK		0xfffff000
+#define TLB_ENTRYLO_FLAGS_MASK	0x00000ff0
+#define TLB_ENTRYLO_FLAGS_SHIFT	4
+
+
+extern uint8_t mCpu[];
+
+
+static uint32_t* cpuPrvU32(uint32_t ofst)
+{
+	return (uint32_t*)(mCpu + ofst);
+}
+
+static uint8_t* cpuPrvTlbEntry(uint_fast8_t idx)
+{
+	return mCpu + OFST_TLB + idx * SIZEOF_TLB_ENTRY;
+}
+
+static uint_fast8_t cpuPrvTlbHash(uint32_t va)	//same as tlbDoHash in cpuM0.inc
+{
+	return (((va >> PAGE_ORDER) ^ va) >> PAGE_ORDER) % NUM_TLB_BUCKETS;
+}
+
+void cpuGetState(struct CpuState *st)
+{
+	uint_fast8_t i;
+	
+	memset(st, 0, sizeof(*st));
+	
+	memcpy(st->regs, mCpu, sizeof(st->regs));
+	st->pc = *cpuPrvU32(OFST_PART2 + OFST_PC);
+	st->npc = *cpuPrvU32(OFST_PART2 + OFST_NPC);
+	st->lo = *cpuPrvU32(OFST_PART2 + OFST_LO);
+	st->hi = *cpuPrvU32(OFST_PART2 + OFST_HI);
+	st->index = *cpuPrvU32(OFST_PART2 + OFST_CP0_INDEX);
+	st->random = *cpuPrvU32(OFST_PART2 + OFST_RANDOM);
+	st->cause = *cpuPrvU32(OFST_PART2 + OFST_CP0_CAUSE);
+	st->status = *cpuPrvU32(OFST_PART2 + OFST_CP0_STATUS);
+	st->epc = *cpuPrvU32(OFST_PART2 + OFST_CP0_EPC);
+	st->badva = *cpuPrvU32(OFST_PART2 + OFST_CP0_BADVA);
+	st->entryHi = *cpuPrvU32(OFST_PART2 + OFST_CP0_ENTRYHI);
+	st->entryLo = *cpuPrvU32(OFST_PART2 + OFST_CP0_ENTRYLO);
+	st->context = *cpuPrvU32(OFST_PART2 + OFST_CP0_CONTEXT);
+	
+	//va keeps some asid bits below the page number (see tlbWrite), they are not part of the state
+	for (i = 0; i < NUM_TLB_ENTRIES; i++) {
+		
+		const uint8_t *e = cpuPrvTlbEntry(i);
+		
+		st->tlbHi[i] = (*(const uint32_t*)(e + OFST_TLB_VA) & TLB_ENTRYHI_VA_MASK) | (((uint32_t)e[OFST_TLB_ASID]) << TLB_ENTRYHI_ASID_SHIFT);
+		st->tlbLo[i] = *(const uint32_t*)(e + OFST_TLB_PA) | (((uint32_t)(e[OFST_TLB_BITS] & 0xf0)) << TLB_ENTRYLO_FLAGS_SHIFT);
+	}
+	
+#if defined(FPU_SUPPORT_FULL) || defined(FPU_SUPPORT_MINIMAL)
+	memcpy(st->fpr, mCpu + OFST_FPU, sizeof(st->fpr));
+	st->fcr = *cpuPrvU32(OFST_FPU + OFST_FPU_FCR);
+#endif
+	
+	st->inDelaySlot = !mCpu[OFST_PART2 + OFST_IN_DELAY_SLOT];
+	st->llBit = mCpu[OFST_PART2 + OFST_LLBIT];
+}
+
+void cpuSetState(const struct CpuState *st)
+{
+	uint_fast8_t i, curAsid = (st->entryHi & TLB_ENTRYHI_ASID_MASK) >> TLB_ENTRYHI_ASID_SHIFT;
+	uint8_t *buckets = mCpu + OFST_TLB_HASH;
+	bool irqs;
+	
+	//start clean: this empties the icache, and the stats might as well restart too
+	cpuInit(*cpuPrvU32(OFST_PART2 + OFST_MEMLIMIT));
+	
+	memcpy(mCpu, st->regs, sizeof(st->regs));
+	*cpuPrvU32(MIPS_REG_ZERO) = 0;
+	*cpuPrvU32(OFST_PART2 + OFST_PC) = st->pc;
+	*cpuPrvU32(OFST_PART2 + OFST_NPC) = st->npc;
+	*cpuPrvU32(OFST_PART2 + OFST_LO) = st->lo;
+	*cpuPrvU32(OFST_PART2 + OFST_HI) = st->hi;
+	*cpuPrvU32(OFST_PART2 + OFST_CP0_INDEX) = st->index;
+	*cpuPrvU32(OFST_PART2 + OFST_RANDOM) = st->random;
+	*cpuPrvU32(OFST_PART2 + OFST_CP0_CAUSE) = st->cause;
+	*cpuPrvU32(OFST_PART2 + OFST_CP0_STATUS) = st->status;
+	*cpuPrvU32(OFST_PART2 + OFST_CP0_EPC) = st->epc;
+	*cpuPrvU32(OFST_PART2 + OFST_CP0_BADVA) = st->badva;
+	*cpuPrvU32(OFST_PART2 + OFST_CP0_ENTRYHI) = st->entryHi;
+	*cpuPrvU32(OFST_PART2 + OFST_CP0_ENTRYLO) = st->entryLo;
+	*cpuPrvU32(OFST_PART2 + OFST_CP0_CONTEXT) = st->context;
+#ifdef ICACHE_ASID_TAGGED
+	*cpuPrvU32(OFST_PART2 + OFST_ICACHE_TAG_XOR) = curAsid;
+#endif
+	
+	//rebuild the hash chains the way tlbWrite would have: new entries go at the head of their bucket
+	memset(buckets, 0xff, NUM_TLB_BUCKETS);
+	for (i = 0; i < NUM_TLB_ENTRIES; i++) {
+		
+		uint8_t *e = cpuPrvTlbEntry(i);
+		uint32_t va = st->tlbHi[i] & TLB_ENTRYHI_VA_MASK;
+		uint_fast8_t asid = (st->tlbHi[i] & TLB_ENTRYHI_ASID_MASK) >> TLB_ENTRYHI_ASID_SHIFT;
+		uint_fast8_t bits = ((st->tlbLo[i] & TLB_ENTRYLO_FLAGS_MASK) >> TLB_ENTRYLO_FLAGS_SHIFT) & 0xf0;
+		uint_fast8_t bucket = cpuPrvTlbHash(va);
+		
+		if ((bits & (1 << TLB_FLAGS_BIT_G)) || asid == curAsid)
+			bits++;		//"enabled"
+		
+		*(uint32_t*)(e + OFST_TLB_VA) = va;
+		*(uint32_t*)(e + OFST_TLB_PA) = st->tlbLo[i] & TLB_ENTRYLO_PA_MASK;
+		e[OFST_TLB_ASID] = asid;
+		e[OFST_TLB_BITS] = bits;
+		e[OFST_TLB_HASH_PREV_IDX] = 0x80 + bucket;
+		e[OFST_TLB_HASH_NEXT_IDX] = buckets[bucket];
+		if (buckets[bucket] != 0xff)
+			cpuPrvTlbEntry(buckets[bucket])[OFST_TLB_HASH_PREV_IDX] = i;
+		buckets[bucket] = i;
+	}
+	
+#if defined(FPU_SUPPORT_FULL) || defined(FPU_SUPPORT_MINIMAL)
+	memcpy(mCpu + OFST_FPU, st->fpr, sizeof(st->fpr));
+	*cpuPrvU32(OFST_FPU + OFST_FPU_FCR) = st->fcr;
+#endif
+	
+	mCpu[OFST_PART2 + OFST_IN_DELAY_SLOT] = st->inDelaySlot ? 0 : 4;
+	mCpu[OFST_PART2 + OFST_LLBIT] = st->llBit;
+	
+	//same as calcIrqWSta. cpuCycle picks its first jump from this
+	irqs = (st->status & CP0_STATUS_IE) && (st->status & st->cause & CP0_STATUS_IM_MASK);
+	mCpu[OFST_PART2 + OFST_HAVE_IRQ] = (irqs || *cpuPrvU32(OFST_PART2 + OFST_SVC_REQ)) ? 4 : 0;
+}
+
+bool cpuIsIdle(void)
+{
+	uint32_t status = *cpuPrvU32(OFST_PART2 + OFST_CP0_STATUS), cause = *cpuPrvU32(OFST_PART2 + OFST_CP0_CAUSE);
+	
+	//same as the C core's: an irq must be able to end the wait, and none may be due already
+	if (!mCpu[OFST_PART2 + OFST_IN_DELAY_SLOT] || *cpuPrvU32(OFST_PART2 + OFST_SVC_REQ) || (status & CP0_STATUS_ISC) ||
+			!(status & CP0_STATUS_IE) || (status & cause & CP0_STATUS_IM_MASK))
+		return false;
+	
+	return cpuIdleCheck((const uint32_t*)mCpu, *cpuPrvU32(OFST_PART2 + OFST_PC));
+}
+
+void cpuGetPerfCounters(struct CpuPerfCounters *ctrsP)
+{
+	memset(ctrsP, 0, sizeof(*ctrsP));
+	
+#ifdef PERF_COUNTERS
+	ctrsP->instrs = *cpuPrvU32(OFST_STATS + OFST_STATS_INSTRS);
+	#ifndef DISABLE_ICACHE
+		ctrsP->icHits = ctrsP->instrs - *cpuPrvU32(OFST_STATS + OFST_STATS_IC_MISSES);	//every instr is looked up once
+	#endif
+	ctrsP->tlbRefills = *cpuPrvU32(OFST_STATS + OFST_STATS_TLB_REFILLS);
+	ctrsP->tlbr = *cpuPrvU32(OFST_STATS + OFST_STATS_TLBR);
+	ctrsP->tlbwi = *cpuPrvU32(OFST_STATS + OFST_STATS_TLBWI);
+	ctrsP->tlbwr = *cpuPrvU32(OFST_STATS + OFST_STATS_TLBWR);
+	ctrsP->tlbp = *cpuPrvU32(OFST_STATS + OFST_STATS_TLBP);
+	memcpy(ctrsP->exceptions, mCpu + OFST_STATS + OFST_STATS_EXC, sizeof(ctrsP->exceptions));
+#endif
+}
@@ -0,0 +1,202 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <string.h>
+#include "cpuIdle.h"
+#include "cpu.h"
+
+
+//idle loop recognition, the same for both cores. one pass of the loop we are in is run here on a copy of the regs.
+//if it goes right back to where it started, stores nothing, reads only RAM, and uses no reg value left over from
+//the pass before, the next pass will do exactly the same, as will every one after it, until an irq is taken or RAM
+//changes (and with the cpu spinning, only an irq handler could change it)
+
+#define IDLE_MAX_LOOP_INSTRS	16			//branch delay slot included
+#define IDLE_RAM_LIMIT			0x10000000	//PAs below this are RAM or the framebuffer, never device regs
+
+
+static uint32_t mIdleRangeStart, mIdleRangeEnd;
+
+
+void cpuSetIdleRange(uint32_t start, uint32_t end)
+{
+	mIdleRangeStart = start;
+	mIdleRangeEnd = end;
+}
+
+static bool cpuIdlePrvRead(uint32_t va, uint_fast8_t sz, bool signExt, uint32_t *valP)
+{
+	uint32_t v32;
+	uint16_t v16;
+	uint8_t v8;
+	
+	//kseg0 only: there is no TLB to consult, and nothing a read there could set off
+	if ((va >> 29) != 4 || (va & 0x1fffffff) >= IDLE_RAM_LIMIT || (va & (sz - 1)))
+		return false;
+	
+	switch (sz) {
+		case 1:
+			if (!cpuMemAccessExternal(&v8, va, 1, false, CpuAccessAsKernel))
+				return false;
+			*valP = signExt ? (uint32_t)(int32_t)(int8_t)v8 : v8;
+			break;
+		
+		case 2:
+			if (!cpuMemAccessExternal(&v16, va, 2, false, CpuAccessAsKernel))
+				return false;
+			*valP = signExt ? (uint32_t)(int32_t)(int16_t)v16 : v16;
+			break;
+		
+		default:
+			if (!cpuMemAccessExternal(&v32, va, 4, false, CpuAccessAsKernel))
+				return false;
+			*valP = v32;
+			break;
+	}
+	
+	return true;
+}
+
+bool cpuIdleCheck(const uint32_t *regs, uint32_t pc)
+{
+	uint32_t r[MIPS_NUM_REGS], npc = pc + 4, head = 0, readFirst = 0, written = 0, instr, val = 0, to = 0, uses;
+	bool inDelaySlot = false, inPass = false;
+	uint_fast8_t i, rs, rt, sa, dst, op;
+	int32_t simm;
+	
+	if (pc >= mIdleRangeStart && pc < mIdleRangeEnd)
+		return true;
+	
+	memcpy(r, regs, sizeof(r));
+	
+	//the rest of the pass we are in, then a whole one
+	for (i = 0; i < 2 * IDLE_MAX_LOOP_INSTRS; i++) {
+		
+		bool branch = false, taken = false;
+		
+		if (!cpuIdlePrvRead(pc, 4, false, &instr))
+			return false;
+		
+		rs = (instr >> 21) & 0x1f;
+		rt = (instr >> 16) & 0x1f;
+		sa = (instr >> 6) & 0x1f;
+		simm = (int16_t)instr;
+		op = instr >> 26;
+		dst = rt;
+		uses = 1u << rs;
+		
+		switch (op) {
+			case 0:		//SPECIAL: shifts and 3-reg ALU ops only. no jumps, no lo/hi, nothing that may trap
+				dst = (instr >> 11) & 0x1f;
+				uses |= 1u << rt;
+				switch (instr & 0x3f) {
+					case 0:	val = r[rt] << sa;	uses = 1u << rt;	break;
+					case 2:	val = r[rt] >> sa;	uses = 1u << rt;	break;
+					case 3:	val = ((int32_t)r[rt]) >> sa;	uses = 1u << rt;	break;
+					case 4:	val = r[rt] << (r[rs] & 0x1f);	break;
+					case 6:	val = r[rt] >> (r[rs] & 0x1f);	break;
+					case 7:	val = ((int32_t)r[rt]) >> (r[rs] & 0x1f);	break;
+					case 33:	val = r[rs] + r[rt];	break;
+					case 35:	val = r[rs] - r[rt];	break;
+					case 36:	val = r[rs] & r[rt];	break;
+					case 37:	val = r[rs] | r[rt];	break;
+					case 38:	val = r[rs] ^ r[rt];	break;
+					case 39:	val = ~(r[rs] | r[rt]);	break;
+					case 42:	val = (int32_t)r[rs] < (int32_t)r[rt];	break;
+					case 43:	val = r[rs] < r[rt];	break;
+					default:	return false;
+				}
+				break;
+			
+			case 1:		//BLTZ, BGEZ
+				if (rt > 1)
+					return false;
+				branch = true;
+				taken = ((int32_t)r[rs] < 0) == !rt;
+				to = npc + (simm << 2);
+				dst = 0;
+				break;
+			
+			case 2:		//J
+				branch = taken = true;
+				to = (npc & 0xf0000000ul) | ((instr << 2) & 0x0ffffffful);
+				dst = 0;
+				uses = 0;
+				break;
+			
+			case 4:		//BEQ, BNE, BLEZ, BGTZ
+			case 5:
+			case 6:
+			case 7:
+				branch = true;
+				if (op < 6) {
+					uses |= 1u << rt;
+					taken = (r[rs] == r[rt]) == (op == 4);
+				}
+				else
+					taken = ((int32_t)r[rs] <= 0) == (op == 6);
+				to = npc + (simm << 2);
+				dst = 0;
+				break;
+			
+			case 9:		val = r[rs] + simm;						break;	//ADDIU
+			case 10:	val = (int32_t)r[rs] < simm;			break;	//SLTI
+			case 11:	val = r[rs] < (uint32_t)simm;			break;	//SLTIU
+			case 12:	val = r[rs] & (uint16_t)instr;			break;	//ANDI
+			case 13:	val = r[rs] | (uint16_t)instr;			break;	//ORI
+			case 14:	val = r[rs] ^ (uint16_t)instr;			break;	//XORI
+			case 15:	val = instr << 16;	uses = 0;			break;	//LUI
+			
+			case 32:	//LB, LH, LW, LBU, LHU
+			case 33:
+			case 35:
+			case 36:
+			case 37:
+				if (!cpuIdlePrvRead(r[rs] + simm, (op & 3) == 3 ? 4 : (op & 3) + 1, op < 36, &val))
+					return false;
+				break;
+			
+			default:	//stores, cop instrs, and all the rest
+				return false;
+		}
+		
+		if (inPass) {
+			readFirst |= uses &~ written;
+			written |= (uint32_t)1 << dst;
+		}
+		if (dst)
+			r[dst] = val;
+		
+		if (branch && inDelaySlot)
+			return false;
+		
+		if (branch && taken) {
+			
+			//only a short branch back keeps us in the loop. in a whole pass, it must be back to where that pass began
+			if (to > pc || pc - to > (IDLE_MAX_LOOP_INSTRS - 2) * sizeof(uint32_t) || (inPass && to != head))
+				return false;
+			
+			pc = npc;
+			npc = to;
+			inDelaySlot = true;
+			continue;
+		}
+		
+		if (inDelaySlot) {		//the delay slot of the branch back: a pass ends here
+			
+			if (inPass)
+				return !(readFirst & written & ~1u);		//$zero is "written" by branches, harmlessly
+			
+			inPass = true;
+			head = npc;
+		}
+		
+		pc = npc;
+		npc += 4;
+		inDelaySlot = false;
+	}
+	
+	return false;
+}
@@ -0,0 +1,18 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _CPU_IDLE_H_
+#define _CPU_IDLE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//for the cores' own cpuIsIdle(), once they have checked that irqs are enabled, none is pending, and pc is not in a
+//branch delay slot. regs are all MIPS_NUM_REGS of them
+bool cpuIdleCheck(const uint32_t *regs, uint32_t pc);
+
+
+#endif
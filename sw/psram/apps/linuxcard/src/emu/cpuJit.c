@@ -0,0 +1,834 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifdef CPU_JIT
+
+#include <sys/mman.h>
+#include <string.h>
+#include <stdio.h>
+#include "cpuJit.h"
+#include "cpu.h"
+
+
+//guest state lives where cpu.c keeps it, rbx points at the regs and rbp at lo/hi for the whole block. a block has one
+//stack slot of its own: the branch condition at [rsp] and a register branch target at [rsp + 4]. blocks stop at page
+//ends, so each comes from one page of PA
+
+#define JIT_CODE_SZ				(16 << 20)
+#define JIT_BLOCK_MAX_CODE		(CPU_JIT_MAX_BLOCK_INSTRS * 64 + 256)	//worst case is a step per instr, with room to spare
+#define JIT_NUM_BLOCKS			65536
+#define JIT_NUM_PAGES			1024
+#define JIT_PAGE_SZ				4096
+#define JIT_NUM_SUCCESSORS		2
+#define JIT_UNTRANSLATABLE		((struct JitBlock*)1)
+
+#define X86_EAX					0
+#define X86_ECX					1
+#define X86_EDX					2
+
+#define X86_OP_ADD				0x03	//op r32, r/m32
+#define X86_OP_OR				0x0b
+#define X86_OP_AND				0x23
+#define X86_OP_SUB				0x2b
+#define X86_OP_XOR				0x33
+#define X86_OP_CMP				0x3b
+#define X86_OP_STORE			0x89
+#define X86_OP_LOAD				0x8b
+
+#define X86_OP_EAX_ADD_IMM		0x05	//op eax, imm32
+#define X86_OP_EAX_OR_IMM		0x0d
+#define X86_OP_EAX_AND_IMM		0x25
+#define X86_OP_EAX_XOR_IMM		0x35
+#define X86_OP_EAX_CMP_IMM		0x3d
+
+#define X86_SHIFT_SHL			4		//modrm reg field of the shift group
+#define X86_SHIFT_SHR			5
+#define X86_SHIFT_SAR			7
+
+#define X86_CC_B				0x2
+#define X86_CC_E				0x4
+#define X86_CC_NE				0x5
+#define X86_CC_L				0xc
+#define X86_CC_GE				0xd
+#define X86_CC_LE				0xe
+#define X86_CC_G				0xf
+
+#define STACK_OFST_COND			0
+#define STACK_OFST_TARGET		4
+
+#define LOHI_OFST_LO			0
+#define LOHI_OFST_HI			4
+
+enum JitKind {
+	JitKindNative,			//done inline
+	JitKindBranch,			//done inline, along with its delay slot. ends the block
+	JitKindStep,			//handed to the interpreter
+	JitKindStepLast,		//handed to the interpreter, and ends the block (may change mode or address space)
+	JitKindNever,			//left to the interpreter, outside of any block
+};
+
+struct JitBlock {
+	CpuJitBlockF code;
+	uint32_t numInstrs;
+	
+	//the blocks that followed this one, so that most hops need no page lookup. only valid while chainFlushes matches
+	uint32_t chainFlushes;
+	uint32_t succVa[JIT_NUM_SUCCESSORS];
+	uint8_t succAsid[JIT_NUM_SUCCESSORS];
+	uint8_t succNext;
+	struct JitBlock *succ[JIT_NUM_SUCCESSORS];
+};
+
+//direct-mapped by VA page and ASID. a page only counts if its generation is current
+struct JitPage {
+	uint32_t generation;
+	uint32_t pageNo;
+	uint8_t asid;
+	struct JitBlock *blocks[JIT_PAGE_SZ / sizeof(uint32_t)];	//by instr, NULL if not tried yet
+};
+
+static struct CpuJitEnv mEnv;
+static uint8_t *mCode, *mOut;
+static struct JitBlock mBlocks[JIT_NUM_BLOCKS];
+static uint32_t mNumBlocks;
+static struct JitPage mPages[JIT_NUM_PAGES];
+static uint8_t mVaPages[(1ull << 32) / JIT_PAGE_SZ / 8];	//VA pages that may have a JitPage, so TLB writes mostly need no search
+static uint32_t mGeneration;
+static struct JitBlock *mPrevBlock;
+static bool mDirty;
+
+uint32_t gCpuJitFlushes;
+uint8_t gCpuJitCodePages[CPU_JIT_RAM_LIMIT / 4096 / 8];
+
+
+bool cpuJitInit(const struct CpuJitEnv *env)
+{
+	mEnv = *env;
+	
+	if (!mCode) {
+		
+		void *code = mmap(NULL, JIT_CODE_SZ, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		
+		if (code == MAP_FAILED) {
+			
+			err_str("JIT: cannot map code buffer, interpreting only\n");
+			return false;
+		}
+		mCode = (uint8_t*)code;
+	}
+	
+	mDirty = true;
+	cpuJitFlushAll();
+	
+	return true;
+}
+
+void cpuJitFlushAll(void)
+{
+	//isolated cache stores flush the icache a line at a time, there is no need to do all this for each of them
+	if (!mDirty)
+		return;
+	
+	mDirty = false;
+	mGeneration++;
+	mOut = mCode;
+	mNumBlocks = 0;
+	mPrevBlock = NULL;
+	memset(mVaPages, 0, sizeof(mVaPages));
+	memset(gCpuJitCodePages, 0, sizeof(gCpuJitCodePages));
+	gCpuJitFlushes++;
+}
+
+void cpuJitFlushPage(uint32_t va, uint_fast8_t asid)
+{
+	uint32_t pageNo = va / JIT_PAGE_SZ;
+	struct JitPage *page = mPages;
+	bool found = false;
+	uint_fast16_t i;
+	
+	if (!(mVaPages[pageNo / 8] & (1 << (pageNo % 8))))
+		return;
+	
+	//same matching as the icache
+	for (i = 0; i < JIT_NUM_PAGES; i++, page++) {
+		
+		if (page->generation != mGeneration || page->pageNo != pageNo)
+			continue;
+		if (asid != CPU_JIT_ASID_ANY && page->asid != CPU_JIT_ASID_ANY && page->asid != asid)
+			continue;
+		page->generation = 0;
+		found = true;
+	}
+	
+	//the blocks themselves stay where they are until the next full flush, but nothing may lead to them any more
+	if (found)
+		gCpuJitFlushes++;
+}
+
+void cpuJitCodeWritten(uint32_t pa)
+{
+	(void)pa;
+	
+	//rare enough (the guest flushes its icache after writing code anyway) that working out which blocks came from there is not worth it
+	cpuJitFlushAll();
+}
+
+static void cpuJitPrvByte(uint_fast8_t b)
+{
+	*mOut++ = b;
+}
+
+static void cpuJitPrvU32(uint32_t v)
+{
+	memcpy(mOut, &v, sizeof(v));
+	mOut += sizeof(v);
+}
+
+static void cpuJitPrvU64(uint64_t v)
+{
+	memcpy(mOut, &v, sizeof(v));
+	mOut += sizeof(v);
+}
+
+static void cpuJitPrvRegOp(uint_fast8_t opcode, uint_fast8_t x86reg, uint_fast8_t mipsReg)	//op r32, [rbx + 4 * mipsReg]
+{
+	cpuJitPrvByte(opcode);
+	cpuJitPrvByte(0x43 | (x86reg << 3));
+	cpuJitPrvByte(mipsReg * sizeof(uint32_t));
+}
+
+static void cpuJitPrvLoHiOp(uint_fast8_t opcode, uint_fast8_t x86reg, uint_fast8_t ofst)		//op r32, [rbp + ofst]
+{
+	cpuJitPrvByte(opcode);
+	cpuJitPrvByte(0x45 | (x86reg << 3));
+	cpuJitPrvByte(ofst);
+}
+
+static void cpuJitPrvStackOp(uint_fast8_t opcode, uint_fast8_t x86reg, uint_fast8_t ofst)	//op r32, [rsp + ofst]
+{
+	cpuJitPrvByte(opcode);
+	cpuJitPrvByte(0x44 | (x86reg << 3));
+	cpuJitPrvByte(0x24);
+	cpuJitPrvByte(ofst);
+}
+
+static void cpuJitPrvRegSetImm(uint_fast8_t mipsReg, uint32_t val)	//mov dword [rbx + 4 * mipsReg], imm32
+{
+	if (!mipsReg)
+		return;
+	
+	cpuJitPrvByte(0xc7);
+	cpuJitPrvByte(0x43);
+	cpuJitPrvByte(mipsReg * sizeof(uint32_t));
+	cpuJitPrvU32(val);
+}
+
+static void cpuJitPrvMovImm(uint_fast8_t x86reg, uint32_t val)		//mov r32, imm32
+{
+	cpuJitPrvByte(0xb8 + x86reg);
+	cpuJitPrvU32(val);
+}
+
+static void cpuJitPrvEaxImm(uint_fast8_t opcode, uint32_t val)		//op eax, imm32
+{
+	cpuJitPrvByte(opcode);
+	cpuJitPrvU32(val);
+}
+
+static void cpuJitPrvTest(uint_fast8_t x86reg)						//test r32, r32
+{
+	cpuJitPrvByte(0x85);
+	cpuJitPrvByte(0xc0 | (x86reg << 3) | x86reg);
+}
+
+static void cpuJitPrvCmovnz(uint_fast8_t dst, uint_fast8_t src)		//cmovnz r32, r32
+{
+	cpuJitPrvByte(0x0f);
+	cpuJitPrvByte(0x45);
+	cpuJitPrvByte(0xc0 | (dst << 3) | src);
+}
+
+static void cpuJitPrvSetcc(uint_fast8_t cc)							//setcc al, movzx eax, al
+{
+	cpuJitPrvByte(0x0f);
+	cpuJitPrvByte(0x90 + cc);
+	cpuJitPrvByte(0xc0);
+	cpuJitPrvByte(0x0f);
+	cpuJitPrvByte(0xb6);
+	cpuJitPrvByte(0xc0);
+}
+
+static void cpuJitPrvShiftImm(uint_fast8_t kind, uint_fast8_t amt)	//shift eax, imm8
+{
+	if (!amt)
+		return;
+	
+	cpuJitPrvByte(0xc1);
+	cpuJitPrvByte(0xc0 | (kind << 3));
+	cpuJitPrvByte(amt);
+}
+
+static void cpuJitPrvShiftCl(uint_fast8_t kind)						//shift eax, cl
+{
+	cpuJitPrvByte(0xd3);
+	cpuJitPrvByte(0xc0 | (kind << 3));
+}
+
+static void cpuJitPrvPrologue(void)
+{
+	cpuJitPrvByte(0x53);						//push rbx
+	cpuJitPrvByte(0x55);						//push rbp
+	cpuJitPrvByte(0x48);						//sub rsp, 8 (also realigns the stack for calls)
+	cpuJitPrvByte(0x83);
+	cpuJitPrvByte(0xec);
+	cpuJitPrvByte(0x08);
+	cpuJitPrvByte(0x48);						//mov rbx, regs
+	cpuJitPrvByte(0xbb);
+	cpuJitPrvU64((uintptr_t)mEnv.regs);
+	cpuJitPrvByte(0x48);						//mov rbp, lohi
+	cpuJitPrvByte(0xbd);
+	cpuJitPrvU64((uintptr_t)mEnv.lohi);
+}
+
+static void cpuJitPrvEpilogue(void)
+{
+	cpuJitPrvByte(0x48);						//add rsp, 8
+	cpuJitPrvByte(0x83);
+	cpuJitPrvByte(0xc4);
+	cpuJitPrvByte(0x08);
+	cpuJitPrvByte(0x5d);						//pop rbp
+	cpuJitPrvByte(0x5b);						//pop rbx
+	cpuJitPrvByte(0xc3);						//ret
+}
+
+static void cpuJitPrvExit(uint32_t pc, uint32_t numInstrs)
+{
+	cpuJitPrvByte(0x48);						//mov rax, imm64
+	cpuJitPrvByte(0xb8);
+	cpuJitPrvU64(pc + (((uint64_t)numInstrs) << 32));
+	cpuJitPrvEpilogue();
+}
+
+static void cpuJitPrvExitPcInEax(uint32_t numInstrs)
+{
+	cpuJitPrvByte(0x48);						//mov rdx, imm64
+	cpuJitPrvByte(0xba);
+	cpuJitPrvU64(((uint64_t)numInstrs) << 32);
+	cpuJitPrvByte(0x48);						//or rax, rdx
+	cpuJitPrvByte(0x09);
+	cpuJitPrvByte(0xd0);
+	cpuJitPrvEpilogue();
+}
+
+//npc and inDelaySlot must already be in edx and ecx
+static void cpuJitPrvStepCall(uint32_t instr, uint32_t pc)
+{
+	cpuJitPrvMovImm(7 /* edi */, instr);
+	cpuJitPrvMovImm(6 /* esi */, pc);
+	cpuJitPrvByte(0x48);						//mov rax, step
+	cpuJitPrvByte(0xb8);
+	cpuJitPrvU64((uintptr_t)mEnv.step);
+	cpuJitPrvByte(0xff);						//call rax
+	cpuJitPrvByte(0xd0);
+}
+
+//if the step said to stop, return with what ran so far
+static void cpuJitPrvStepCheck(uint32_t numInstrs)
+{
+	uint8_t *jnz;
+	
+	cpuJitPrvByte(0x84);						//test al, al
+	cpuJitPrvByte(0xc0);
+	jnz = mOut;
+	cpuJitPrvByte(0x75);						//jnz over the exit
+	cpuJitPrvByte(0x00);
+	cpuJitPrvExit(0, numInstrs | CPU_JIT_EXIT_STATE_SET);
+	jnz[1] = mOut - (jnz + 2);
+}
+
+static enum JitKind cpuJitPrvClassify(uint32_t instr)
+{
+	switch (instr >> 26) {
+		case 0:
+			switch (instr & 0x3f) {
+				case 0:		//SLL
+				case 2:		//SRL
+				case 3:		//SRA
+				case 4:		//SLLV
+				case 6:		//SRLV
+				case 7:		//SRAV
+				case 16:	//MFHI
+				case 17:	//MTHI
+				case 18:	//MFLO
+				case 19:	//MTLO
+				case 24:	//MULT
+				case 25:	//MULTU
+				case 33:	//ADDU
+				case 35:	//SUBU
+				case 36:	//AND
+				case 37:	//OR
+				case 38:	//XOR
+				case 39:	//NOR
+				case 42:	//SLT
+				case 43:	//SLTU
+					return JitKindNative;
+				
+				case 8:		//JR
+				case 9:		//JALR
+					return JitKindBranch;
+				
+				default:	//may trap (ADD, SUB, DIV by zero is fine but x86 would fault on INT_MIN / -1, SYSCALL, ...)
+					return JitKindStep;
+			}
+		
+		case 1:
+			switch ((instr >> 16) & 0x1f) {
+				case 0:		//BLTZ
+				case 1:		//BGEZ
+				case 16:	//BLTZAL
+				case 17:	//BGEZAL
+					return JitKindBranch;
+				
+				case 2:		//BLTZL
+				case 3:		//BGEZL
+				case 18:	//BLTZALL
+				case 19:	//BGEZALL
+					return JitKindNever;
+				
+				default:	//traps
+					return JitKindStep;
+			}
+		
+		case 2:		//J
+		case 3:		//JAL
+		case 4:		//BEQ
+		case 5:		//BNE
+		case 6:		//BLEZ
+		case 7:		//BGTZ
+			return JitKindBranch;
+		
+		case 9:		//ADDIU
+		case 10:	//SLTI
+		case 11:	//SLTIU
+		case 12:	//ANDI
+		case 13:	//ORI
+		case 14:	//XORI
+		case 15:	//LUI
+			return JitKindNative;
+		
+		case 16:	//COP0: mode, ASID, TLB changes
+		case 19:	//COP3: hypercalls
+			return JitKindStepLast;
+		
+		case 17:	//COP1
+			return (((instr >> 21) & 0x1f) == 8) ? JitKindNever : JitKindStep;
+		
+		case 20:	//BEQL
+		case 21:	//BNEL
+		case 22:	//BLEZL
+		case 23:	//BGTZL
+			return JitKindNever;
+		
+		default:	//loads and stores, mostly
+			return JitKindStep;
+	}
+}
+
+static void cpuJitPrvEmitNative(uint32_t instr)
+{
+	uint_fast8_t rs = (instr >> 21) & 0x1f, rt = (instr >> 16) & 0x1f, rd = (instr >> 11) & 0x1f, sa = (instr >> 6) & 0x1f;
+	uint32_t simm = (int32_t)(int16_t)instr, uimm = (uint16_t)instr;
+	
+	switch (instr >> 26) {
+		case 0:
+			switch (instr & 0x3f) {
+				case 0:		//SLL
+				case 2:		//SRL
+				case 3:		//SRA
+					if (!rd)
+						return;
+					cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rt);
+					cpuJitPrvShiftImm((instr & 0x3f) == 0 ? X86_SHIFT_SHL : ((instr & 0x3f) == 2 ? X86_SHIFT_SHR : X86_SHIFT_SAR), sa);
+					cpuJitPrvRegOp(X86_OP_STORE, X86_EAX, rd);
+					return;
+				
+				case 4:		//SLLV
+				case 6:		//SRLV
+				case 7:		//SRAV
+					if (!rd)
+						return;
+					cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rt);
+					cpuJitPrvRegOp(X86_OP_LOAD, X86_ECX, rs);
+					cpuJitPrvShiftCl((instr & 0x3f) == 4 ? X86_SHIFT_SHL : ((instr & 0x3f) == 6 ? X86_SHIFT_SHR : X86_SHIFT_SAR));
+					cpuJitPrvRegOp(X86_OP_STORE, X86_EAX, rd);
+					return;
+				
+				case 16:	//MFHI
+				case 18:	//MFLO
+					if (!rd)
+						return;
+					cpuJitPrvLoHiOp(X86_OP_LOAD, X86_EAX, (instr & 0x3f) == 16 ? LOHI_OFST_HI : LOHI_OFST_LO);
+					cpuJitPrvRegOp(X86_OP_STORE, X86_EAX, rd);
+					return;
+				
+				case 17:	//MTHI
+				case 19:	//MTLO
+					cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+					cpuJitPrvLoHiOp(X86_OP_STORE, X86_EAX, (instr & 0x3f) == 17 ? LOHI_OFST_HI : LOHI_OFST_LO);
+					return;
+				
+				case 24:	//MULT
+				case 25:	//MULTU
+					cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+					cpuJitPrvRegOp(0xf7, (instr & 0x3f) == 24 ? 5 /* imul */ : 4 /* mul */, rt);
+					cpuJitPrvLoHiOp(X86_OP_STORE, X86_EAX, LOHI_OFST_LO);
+					cpuJitPrvLoHiOp(X86_OP_STORE, X86_EDX, LOHI_OFST_HI);
+					return;
+				
+				case 33:	//ADDU
+				case 35:	//SUBU
+				case 36:	//AND
+				case 37:	//OR
+				case 38:	//XOR
+				case 39:	//NOR
+					if (!rd)
+						return;
+					cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+					switch (instr & 0x3f) {
+						case 33:	cpuJitPrvRegOp(X86_OP_ADD, X86_EAX, rt);	break;
+						case 35:	cpuJitPrvRegOp(X86_OP_SUB, X86_EAX, rt);	break;
+						case 36:	cpuJitPrvRegOp(X86_OP_AND, X86_EAX, rt);	break;
+						case 38:	cpuJitPrvRegOp(X86_OP_XOR, X86_EAX, rt);	break;
+						default:	cpuJitPrvRegOp(X86_OP_OR, X86_EAX, rt);		break;
+					}
+					if ((instr & 0x3f) == 39) {
+						cpuJitPrvByte(0xf7);		//not eax
+						cpuJitPrvByte(0xd0);
+					}
+					cpuJitPrvRegOp(X86_OP_STORE, X86_EAX, rd);
+					return;
+				
+				case 42:	//SLT
+				case 43:	//SLTU
+					if (!rd)
+						return;
+					cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+					cpuJitPrvRegOp(X86_OP_CMP, X86_EAX, rt);
+					cpuJitPrvSetcc((instr & 0x3f) == 42 ? X86_CC_L : X86_CC_B);
+					cpuJitPrvRegOp(X86_OP_STORE, X86_EAX, rd);
+					return;
+			}
+			break;
+		
+		case 9:		//ADDIU
+		case 10:	//SLTI
+		case 11:	//SLTIU
+		case 12:	//ANDI
+		case 13:	//ORI
+		case 14:	//XORI
+			if (!rt)
+				return;
+			cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+			switch (instr >> 26) {
+				case 9:		cpuJitPrvEaxImm(X86_OP_EAX_ADD_IMM, simm);	break;
+				case 10:	cpuJitPrvEaxImm(X86_OP_EAX_CMP_IMM, simm);	cpuJitPrvSetcc(X86_CC_L);	break;
+				case 11:	cpuJitPrvEaxImm(X86_OP_EAX_CMP_IMM, simm);	cpuJitPrvSetcc(X86_CC_B);	break;
+				case 12:	cpuJitPrvEaxImm(X86_OP_EAX_AND_IMM, uimm);	break;
+				case 13:	cpuJitPrvEaxImm(X86_OP_EAX_OR_IMM, uimm);	break;
+				default:	cpuJitPrvEaxImm(X86_OP_EAX_XOR_IMM, uimm);	break;
+			}
+			cpuJitPrvRegOp(X86_OP_STORE, X86_EAX, rt);
+			return;
+		
+		case 15:	//LUI
+			cpuJitPrvRegSetImm(rt, uimm << 16);
+			return;
+	}
+	
+	__builtin_unreachable();	//cpuJitPrvClassify() said it was native
+}
+
+//the branch at pc, its delay slot, and the exit. numInstrs counts both
+static void cpuJitPrvEmitBranch(uint32_t instr, uint32_t pc, uint32_t dsInstr, enum JitKind dsKind, uint32_t numInstrs)
+{
+	uint_fast8_t rs = (instr >> 21) & 0x1f, rt = (instr >> 16) & 0x1f, rd = (instr >> 11) & 0x1f;
+	uint32_t ds = pc + 4, target = ds + (((int32_t)(int16_t)instr) << 2);
+	enum {
+		BranchConditional,		//to target if [rsp] is nonzero
+		BranchStatic,			//always to target
+		BranchRegister,			//always to [rsp + 4]
+	} how = BranchConditional;
+	
+	//same order of reads and writes as the interpreter, in case the link register is also the one tested
+	switch (instr >> 26) {
+		case 0:		//JR, JALR
+			cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+			cpuJitPrvStackOp(X86_OP_STORE, X86_EAX, STACK_OFST_TARGET);
+			if ((instr & 0x3f) == 9)
+				cpuJitPrvRegSetImm(rd, pc + 8);
+			how = BranchRegister;
+			break;
+		
+		case 1:		//BLTZ, BGEZ, BLTZAL, BGEZAL
+			if (rt & 0x10)
+				cpuJitPrvRegSetImm(MIPS_REG_RA, pc + 8);
+			cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+			cpuJitPrvTest(X86_EAX);
+			cpuJitPrvSetcc((rt & 1) ? X86_CC_GE : X86_CC_L);
+			break;
+		
+		case 3:		//JAL
+			cpuJitPrvRegSetImm(MIPS_REG_RA, pc + 8);
+			//fallthrough
+		
+		case 2:		//J
+			target = (ds & 0xf0000000ul) | ((instr << 2) & 0x0ffffffful);
+			how = BranchStatic;
+			break;
+		
+		case 4:		//BEQ
+		case 5:		//BNE
+			cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+			cpuJitPrvRegOp(X86_OP_CMP, X86_EAX, rt);
+			cpuJitPrvSetcc((instr >> 26) == 4 ? X86_CC_E : X86_CC_NE);
+			break;
+		
+		case 6:		//BLEZ
+		case 7:		//BGTZ
+			cpuJitPrvRegOp(X86_OP_LOAD, X86_EAX, rs);
+			cpuJitPrvTest(X86_EAX);
+			cpuJitPrvSetcc((instr >> 26) == 6 ? X86_CC_LE : X86_CC_G);
+			break;
+		
+		default:
+			__builtin_unreachable();
+	}
+	if (how == BranchConditional)
+		cpuJitPrvStackOp(X86_OP_STORE, X86_EAX, STACK_OFST_COND);
+	
+	//the delay slot. a step there needs npc and inDelaySlot as the interpreter would have them: a branch not taken
+	//leaves the delay slot looking like any other instr
+	if (dsKind == JitKindNative)
+		cpuJitPrvEmitNative(dsInstr);
+	else {
+		
+		switch (how) {
+			case BranchConditional:
+				cpuJitPrvStackOp(X86_OP_LOAD, X86_ECX, STACK_OFST_COND);
+				cpuJitPrvMovImm(X86_EDX, ds + 4);
+				cpuJitPrvMovImm(X86_EAX, target);
+				cpuJitPrvTest(X86_ECX);
+				cpuJitPrvCmovnz(X86_EDX, X86_EAX);
+				break;
+			
+			case BranchStatic:
+				cpuJitPrvMovImm(X86_ECX, 1);
+				cpuJitPrvMovImm(X86_EDX, target);
+				break;
+			
+			case BranchRegister:
+				cpuJitPrvMovImm(X86_ECX, 1);
+				cpuJitPrvStackOp(X86_OP_LOAD, X86_EDX, STACK_OFST_TARGET);
+				break;
+		}
+		cpuJitPrvStepCall(dsInstr, ds);
+		
+		//the step leaves pc at wherever the branch went
+		if (dsKind == JitKindStepLast) {
+			cpuJitPrvExit(0, numInstrs | CPU_JIT_EXIT_STATE_SET);
+			return;
+		}
+		cpuJitPrvStepCheck(numInstrs);
+	}
+	
+	switch (how) {
+		case BranchConditional:
+			cpuJitPrvStackOp(X86_OP_LOAD, X86_ECX, STACK_OFST_COND);
+			cpuJitPrvMovImm(X86_EAX, ds + 4);
+			cpuJitPrvMovImm(X86_EDX, target);
+			cpuJitPrvTest(X86_ECX);
+			cpuJitPrvCmovnz(X86_EAX, X86_EDX);
+			break;
+		
+		case BranchStatic:
+			cpuJitPrvMovImm(X86_EAX, target);
+			break;
+		
+		case BranchRegister:
+			cpuJitPrvStackOp(X86_OP_LOAD, X86_EAX, STACK_OFST_TARGET);
+			break;
+	}
+	cpuJitPrvExitPcInEax(numInstrs);
+}
+
+static struct JitBlock* cpuJitPrvTranslate(uint32_t va)
+{
+	uint32_t instrs[CPU_JIT_MAX_BLOCK_INSTRS], pa, firstPa = 0, i, n, numNative = 0;
+	enum JitKind kinds[CPU_JIT_MAX_BLOCK_INSTRS];
+	struct JitBlock *blk;
+	
+	//stop at the page end, after a branch and its delay slot, or after anything else that ends a block
+	for (n = 0; n < CPU_JIT_MAX_BLOCK_INSTRS; n++) {
+		
+		uint32_t at = va + n * sizeof(uint32_t);
+		
+		if (n && !(at % JIT_PAGE_SZ))
+			break;
+		if (!mEnv.fetch(at, &instrs[n], &pa) || pa >= CPU_JIT_RAM_LIMIT)
+			break;
+		if (!n)
+			firstPa = pa;
+		
+		kinds[n] = cpuJitPrvClassify(instrs[n]);
+		if (kinds[n] == JitKindNever)
+			break;
+		
+		if (n && kinds[n - 1] == JitKindBranch) {	//a delay slot
+			
+			if (kinds[n] != JitKindBranch)
+				n++;
+			break;
+		}
+		if (kinds[n] == JitKindStepLast) {
+			n++;
+			break;
+		}
+	}
+	
+	//a branch whose delay slot did not make it in is left for the interpreter
+	if (n && kinds[n - 1] == JitKindBranch)
+		n--;
+	
+	//nothing to gain from a block that would only call back into the interpreter
+	for (i = 0; i < n; i++) {
+		if (kinds[i] != JitKindStep && kinds[i] != JitKindStepLast)
+			numNative++;
+	}
+	if (!numNative)
+		return JIT_UNTRANSLATABLE;
+	
+	mDirty = true;
+	gCpuJitCodePages[firstPa / JIT_PAGE_SZ / 8] |= 1 << ((firstPa / JIT_PAGE_SZ) % 8);
+	
+	blk = &mBlocks[mNumBlocks++];
+	memset(blk, 0, sizeof(*blk));
+	blk->code = (CpuJitBlockF)mOut;
+	blk->numInstrs = n;
+	
+	cpuJitPrvPrologue();
+	for (i = 0; i < n; i++) {
+		
+		uint32_t at = va + i * sizeof(uint32_t);
+		
+		switch (kinds[i]) {
+			case JitKindNative:
+				cpuJitPrvEmitNative(instrs[i]);
+				break;
+			
+			case JitKindBranch:
+				cpuJitPrvEmitBranch(instrs[i], at, instrs[i + 1], kinds[i + 1], i + 2);
+				return blk;
+			
+			case JitKindStep:
+			case JitKindStepLast:
+				cpuJitPrvMovImm(X86_EDX, at + sizeof(uint32_t));
+				cpuJitPrvMovImm(X86_ECX, 0);
+				cpuJitPrvStepCall(instrs[i], at);
+				if (kinds[i] == JitKindStepLast) {
+					cpuJitPrvExit(0, (i + 1) | CPU_JIT_EXIT_STATE_SET);
+					return blk;
+				}
+				cpuJitPrvStepCheck(i + 1);
+				break;
+			
+			default:
+				__builtin_unreachable();
+		}
+	}
+	cpuJitPrvExit(va + n * sizeof(uint32_t), n);
+	
+	return blk;
+}
+
+static struct JitBlock* cpuJitPrvLookup(uint32_t va, uint_fast8_t asid)
+{
+	uint32_t pageNo = va / JIT_PAGE_SZ;
+	struct JitPage *page;
+	struct JitBlock **slotP;
+	
+	if (mNumBlocks == JIT_NUM_BLOCKS || mOut + JIT_BLOCK_MAX_CODE > mCode + JIT_CODE_SZ)
+		cpuJitFlushAll();
+	
+	page = &mPages[(pageNo ^ (((uint32_t)asid) << 4)) % JIT_NUM_PAGES];
+	if (page->generation != mGeneration || page->pageNo != pageNo || page->asid != asid) {
+		
+		//blocks of the page this slot held may be chained to, and a flush of that page would no longer find them
+		if (page->generation == mGeneration)
+			gCpuJitFlushes++;
+		page->generation = mGeneration;
+		page->pageNo = pageNo;
+		page->asid = asid;
+		memset(page->blocks, 0, sizeof(page->blocks));
+		mVaPages[pageNo / 8] |= 1 << (pageNo % 8);
+	}
+	
+	slotP = &page->blocks[(va % JIT_PAGE_SZ) / sizeof(uint32_t)];
+	if (!*slotP)
+		*slotP = cpuJitPrvTranslate(va);
+	
+	return *slotP;
+}
+
+CpuJitBlockF cpuJitFind(uint32_t va, uint_fast8_t asid, uint32_t maxInstrs)
+{
+	struct JitBlock *blk = NULL, *prev = mPrevBlock;
+	uint_fast8_t i;
+	
+	if (!mCode)
+		return NULL;
+	
+	if (prev && prev->chainFlushes == gCpuJitFlushes) {
+		
+		for (i = 0; i < JIT_NUM_SUCCESSORS; i++) {
+			
+			if (prev->succVa[i] == va && prev->succAsid[i] == asid) {
+				
+				blk = prev->succ[i];
+				break;
+			}
+		}
+	}
+	
+	if (!blk) {
+		
+		blk = cpuJitPrvLookup(va, asid);
+		
+		//that may have flushed everything, prev included
+		prev = mPrevBlock;
+		if (prev) {
+			
+			if (prev->chainFlushes != gCpuJitFlushes) {
+				
+				memset(prev->succVa, 0xff, sizeof(prev->succVa));
+				prev->chainFlushes = gCpuJitFlushes;
+			}
+			i = prev->succNext++ % JIT_NUM_SUCCESSORS;
+			prev->succVa[i] = va;
+			prev->succAsid[i] = asid;
+			prev->succ[i] = blk;
+		}
+	}
+	
+	if (blk == JIT_UNTRANSLATABLE || blk->numInstrs > maxInstrs) {
+		
+		mPrevBlock = NULL;
+		return NULL;
+	}
+	
+	mPrevBlock = blk;
+	return blk->code;
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _CPU_JIT_H_
+#define _CPU_JIT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//basic block translator for the PC build: MIPS I to x86-64. enabled by defining CPU_JIT. cpu.c owns all the state
+//and keeps running everything, translations only do the register work of common instrs natively. all else (loads,
+//stores, cop instrs, anything that may trap) is handed back to the interpreter one instr at a time, with pc set
+//as if it had gotten there itself, so exceptions are exactly where they would have been.
+//translations are keyed by VA and ASID, like icache lines, and dropped along with them (TLB writes, isolated cache
+//stores). stores to RAM pages that have been translated from drop everything as well
+
+#ifdef CPU_JIT
+
+	#if !defined(__x86_64__) || !defined(__linux__)
+		#error "the translator only emits x86-64 code, and needs linux for its code buffer"
+	#endif
+
+	#define CPU_JIT_ASID_ANY			0xff			//same as cpu.c's ICACHE_ASID_ANY
+	#define CPU_JIT_MAX_BLOCK_INSTRS	32
+	#define CPU_JIT_RAM_LIMIT			0x20000000		//code above this PA is never translated
+
+	//a translation returns the next pc in the low word and the number of instrs it ran in the high one. if that has
+	//CPU_JIT_EXIT_STATE_SET, the interpreter ran the last of them and pc/npc are already set (ignore the low word)
+	#define CPU_JIT_EXIT_STATE_SET		0x80000000
+	typedef uint64_t (*CpuJitBlockF)(void);
+
+	//run one instr, as the interpreter would. pc is where it is, npc is what follows it (the branch target in a delay
+	//slot), inDelaySlot as per cpu.c. returns true if the translation may go on with the next instr, false if it must
+	//return at once (an exception was taken, or something is due that is only checked between blocks)
+	typedef bool (*CpuJitStepF)(uint32_t instr, uint32_t pc, uint32_t npc, uint32_t inDelaySlot);
+
+	//fetch an instr for translation, with no exceptions or side effects. false if it is not accessible right now
+	typedef bool (*CpuJitFetchF)(uint32_t va, uint32_t *instrP, uint32_t *paP);
+
+	struct CpuJitEnv {
+		uint32_t *regs;			//MIPS_NUM_REGS of them, [0] always zero
+		uint32_t *lohi;			//lo, then hi
+		CpuJitStepF step;
+		CpuJitFetchF fetch;
+	};
+
+	bool cpuJitInit(const struct CpuJitEnv *env);
+
+	//code to run at va (not in a delay slot) in the given address space, translating it if need be. NULL if the
+	//interpreter should take it from here, or if the block there is longer than maxInstrs
+	CpuJitBlockF cpuJitFind(uint32_t va, uint_fast8_t asid, uint32_t maxInstrs);
+
+	void cpuJitFlushAll(void);
+	void cpuJitFlushPage(uint32_t va, uint_fast8_t asid);	//asid may be CPU_JIT_ASID_ANY
+	void cpuJitCodeWritten(uint32_t pa);
+
+	//bumped by every flush, so a helper can tell if the block that called it is still current
+	extern uint32_t gCpuJitFlushes;
+
+	//one bit per 4K page of PA that holds translated code
+	extern uint8_t gCpuJitCodePages[CPU_JIT_RAM_LIMIT / 4096 / 8];
+
+	static inline void cpuJitNoteWrite(uint32_t pa)
+	{
+		if (pa < CPU_JIT_RAM_LIMIT && (gCpuJitCodePages[pa / 4096 / 8] & (1 << ((pa / 4096) % 8))))
+			cpuJitCodeWritten(pa);
+	}
+
+#endif
+
+
+#endif
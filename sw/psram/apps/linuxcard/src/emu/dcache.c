@@ -0,0 +1,235 @@
+#include <string.h>
+#include "dcache.h"
+
+#ifdef DCACHE_NUM_SETS_ORDER
+
+#ifndef DCACHE_NUM_WAYS_ORDER
+	#define DCACHE_NUM_WAYS_ORDER	1
+#endif
+
+#ifndef DCACHE_LINE_SZ_ORDER
+	#define DCACHE_LINE_SZ_ORDER	5
+#endif
+
+#define DCACHE_NUM_SETS			(1 << DCACHE_NUM_SETS_ORDER)
+#define DCACHE_NUM_WAYS			(1 << DCACHE_NUM_WAYS_ORDER)
+#define DCACHE_LINE_SIZE		(1 << DCACHE_LINE_SZ_ORDER)
+#define DCACHE_LINE_MASK		(DCACHE_LINE_SIZE - 1)
+
+#define DCACHE_FLAG_VALID		0x01
+#define DCACHE_FLAG_DIRTY		0x02
+
+
+struct DcacheLine {
+	uint32_t addr;								//line address with DCACHE_FLAG_* in the low bits. zero is "invalid" so BSS init is all we need
+	uint32_t data[DCACHE_LINE_SIZE / sizeof(uint32_t)];
+};
+
+static struct {
+	struct DcacheLine lines[DCACHE_NUM_SETS][DCACHE_NUM_WAYS];
+	uint8_t mru[DCACHE_NUM_SETS];				//last way used per set. victim is the next one: exact LRU for 2 ways
+	uint32_t limit;
+	struct DcacheStats stats;
+	DcachePagerF pager;
+	const uint32_t *resident;
+} gDcache;
+
+
+static inline void dcachePrvCopy(void *dst, const void *src, uint_fast16_t sz)
+{
+	//guest accesses are naturally aligned, make them cheap
+	switch (sz) {
+		case 1:
+			*(uint8_t*)dst = *(const uint8_t*)src;
+			break;
+		case 2:
+			*(uint16_t*)dst = *(const uint16_t*)src;
+			break;
+		case 4:
+			*(uint32_t*)dst = *(const uint32_t*)src;
+			break;
+		default:
+			memcpy(dst, src, sz);
+			break;
+	}
+}
+
+static struct DcacheLine* dcachePrvFind(uint32_t lineAddr, uint_fast16_t set)
+{
+	struct DcacheLine *line = gDcache.lines[set];
+	uint_fast8_t i;
+	
+	for (i = 0; i < DCACHE_NUM_WAYS; i++, line++) {
+		
+		if ((line->addr &~ DCACHE_FLAG_DIRTY) == (lineAddr | DCACHE_FLAG_VALID)) {
+			
+			gDcache.mru[set] = i;
+			return line;
+		}
+	}
+	
+	return NULL;
+}
+
+static void dcachePrvPageIn(uint32_t addr)
+{
+	uint32_t page = addr >> DCACHE_PAGER_PAGE_ORDER;
+	
+	if (!(gDcache.resident[page / 32] & (1UL << (page % 32))))
+		gDcache.pager(page << DCACHE_PAGER_PAGE_ORDER);
+}
+
+static struct DcacheLine* dcachePrvAllocate(uint32_t lineAddr, uint_fast16_t set, bool needFill)
+{
+	uint_fast8_t way = (gDcache.mru[set] + 1) % DCACHE_NUM_WAYS;
+	struct DcacheLine *line = &gDcache.lines[set][way];
+	
+	if (line->addr & DCACHE_FLAG_DIRTY) {
+		
+		spiRamWrite(line->addr &~ DCACHE_LINE_MASK, line->data, DCACHE_LINE_SIZE);
+		gDcache.stats.writebacks++;
+	}
+	
+	if (needFill)
+		spiRamRead(lineAddr, line->data, DCACHE_LINE_SIZE);
+	
+	line->addr = lineAddr | DCACHE_FLAG_VALID;
+	gDcache.mru[set] = way;
+	
+	return line;
+}
+
+//only data port accesses allocate, the others just snoop the cache and go out on their own port
+static void dcachePrvAccess(uint32_t addr, uint8_t *data, uint_fast16_t sz, bool write, enum SpiRamPort port)
+{
+	bool allocate = port == SpiRamPortData;
+	
+	if (addr >= gDcache.limit) {
+		
+		if (write)
+			spiRamWritePort(addr, data, sz, port);
+		else
+			spiRamReadPort(addr, data, sz, port);
+		return;
+	}
+	
+	while (sz) {
+		
+		uint_fast16_t ofst = addr & DCACHE_LINE_MASK, now = DCACHE_LINE_SIZE - ofst, set;
+		uint32_t lineAddr = addr &~ DCACHE_LINE_MASK;
+		struct DcacheLine *line;
+		
+		if (now > sz)
+			now = sz;
+		
+		set = (addr >> DCACHE_LINE_SZ_ORDER) % DCACHE_NUM_SETS;
+		line = dcachePrvFind(lineAddr, set);
+		
+		if (!line && gDcache.pager)
+			dcachePrvPageIn(addr);
+		
+		if (allocate) {
+			
+			if (line)
+				gDcache.stats.hits++;
+			else {
+				
+				gDcache.stats.misses++;
+				line = dcachePrvAllocate(lineAddr, set, !write || now != DCACHE_LINE_SIZE);
+			}
+		}
+		
+		if (!line) {
+			
+			if (write)
+				spiRamWritePort(addr, data, now, port);
+			else
+				spiRamReadPort(addr, data, now, port);
+		}
+		else if (write) {
+			
+			dcachePrvCopy(((uint8_t*)line->data) + ofst, data, now);
+			line->addr |= DCACHE_FLAG_DIRTY;
+		}
+		else {
+			
+			dcachePrvCopy(data, ((uint8_t*)line->data) + ofst, now);
+		}
+		
+		addr += now;
+		data += now;
+		sz -= now;
+	}
+}
+
+void dcacheRead(uint32_t addr, void *data, uint_fast16_t sz)
+{
+	dcachePrvAccess(addr, data, sz, false, SpiRamPortData);
+}
+
+void dcacheWrite(uint32_t addr, const void *data, uint_fast16_t sz)
+{
+	dcachePrvAccess(addr, (uint8_t*)data, sz, true, SpiRamPortData);
+}
+
+void dcacheReadIfetch(uint32_t addr, void *data, uint_fast16_t sz)
+{
+	dcachePrvAccess(addr, data, sz, false, SpiRamPortIfetch);
+}
+
+void dcacheReadIo(uint32_t addr, void *data, uint_fast16_t sz)
+{
+	dcachePrvAccess(addr, data, sz, false, SpiRamPortIo);
+}
+
+void dcacheWriteIo(uint32_t addr, const void *data, uint_fast16_t sz)
+{
+	dcachePrvAccess(addr, (uint8_t*)data, sz, true, SpiRamPortIo);
+}
+
+void dcacheWriteIoAsync(uint32_t addr, const void *data, uint_fast16_t sz)
+{
+	const uint8_t *src = (const uint8_t*)data;
+	uint32_t at = addr;
+	uint_fast16_t left = sz;
+	
+	//lines keep their dirty state: RAM will hold the same bytes once the write lands
+	while (at < gDcache.limit && left) {
+		
+		uint_fast16_t ofst = at & DCACHE_LINE_MASK, now = DCACHE_LINE_SIZE - ofst;
+		struct DcacheLine *line;
+		
+		if (now > left)
+			now = left;
+		
+		line = dcachePrvFind(at &~ DCACHE_LINE_MASK, (at >> DCACHE_LINE_SZ_ORDER) % DCACHE_NUM_SETS);
+		if (line)
+			dcachePrvCopy(((uint8_t*)line->data) + ofst, src, now);
+		else if (gDcache.pager)		//the write must land after the page-in, not be overwritten by it
+			dcachePrvPageIn(at);
+		
+		at += now;
+		src += now;
+		left -= now;
+	}
+	
+	spiRamWriteAsync(addr, data, sz, SpiRamPortIo);
+}
+
+void dcacheSetLimit(uint32_t limit)
+{
+	gDcache.limit = limit;
+}
+
+void dcacheSetPager(DcachePagerF pager, const uint32_t *residentBitmap)
+{
+	gDcache.resident = residentBitmap;
+	gDcache.pager = pager;
+}
+
+void dcacheGetStats(struct DcacheStats *statsP)
+{
+	*statsP = gDcache.stats;
+}
+
+#endif
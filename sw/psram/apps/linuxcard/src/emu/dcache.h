@@ -0,0 +1,62 @@
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "spiRam.h"
+
+
+//write-back, write-allocate data cache for guest RAM, sitting in front of spiRam. lines are filled and
+//evicted as single bursts. it is enabled by defining DCACHE_NUM_SETS_ORDER, geometry is further set by
+//DCACHE_NUM_WAYS_ORDER and DCACHE_LINE_SZ_ORDER. without it, all of these are just spiRam calls.
+//only [0 .. limit) is cached, accesses above it (framebuffer, etc that video scans out behind our back)
+//are passed straight through. limit starts at zero, so nothing is cached until dcacheSetLimit() is called
+
+#ifdef DCACHE_NUM_SETS_ORDER
+
+	struct DcacheStats {
+		uint32_t hits;
+		uint32_t misses;
+		uint32_t writebacks;
+	};
+
+	//same rules as spiRamRead/spiRamWrite, but lines may be crossed
+	void dcacheRead(uint32_t addr, void *data, uint_fast16_t sz);
+	void dcacheWrite(uint32_t addr, const void *data, uint_fast16_t sz);
+
+	//these use cached data if present, but do not allocate on a miss: misses go out on the given RAM port
+	void dcacheReadIfetch(uint32_t addr, void *data, uint_fast16_t sz);
+	void dcacheReadIo(uint32_t addr, void *data, uint_fast16_t sz);
+	void dcacheWriteIo(uint32_t addr, const void *data, uint_fast16_t sz);
+	
+	//refreshes cached copies, then writes RAM in the background on the io port (see spiRamWriteAsync)
+	void dcacheWriteIoAsync(uint32_t addr, const void *data, uint_fast16_t sz);
+
+	void dcacheSetLimit(uint32_t limit);
+	void dcacheGetStats(struct DcacheStats *statsP);
+	
+	//demand paging of RAM below the limit (lazy snapshot restore). while a pager is set, RAM pages whose bit in the
+	//resident bitmap is clear hold garbage. before any traffic to such a page the pager is called, it must fill the
+	//page in (using spiRam directly) and set its bit. lines only ever exist for resident pages, so hits never check
+	#define DCACHE_PAGER_PAGE_ORDER		12
+	
+	typedef void (*DcachePagerF)(uint32_t pageAddr);
+	
+	void dcacheSetPager(DcachePagerF pager, const uint32_t *residentBitmap);	//NULL once every page is in
+
+#else
+
+	#define dcacheSetLimit(...)
+
+	#define dcacheRead(...)				spiRamRead(__VA_ARGS__)
+	#define dcacheWrite(...)			spiRamWrite(__VA_ARGS__)
+	#define dcacheReadIfetch(...)		spiRamReadIfetch(__VA_ARGS__)
+	#define dcacheReadIo(...)			spiRamReadPort(__VA_ARGS__, SpiRamPortIo)
+	#define dcacheWriteIo(...)			spiRamWritePort(__VA_ARGS__, SpiRamPortIo)
+	#define dcacheWriteIoAsync(...)		spiRamWriteAsync(__VA_ARGS__, SpiRamPortIo)
+
+#endif
+
+
+#endif
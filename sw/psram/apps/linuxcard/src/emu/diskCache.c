@@ -0,0 +1,352 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <string.h>
+#include "diskCache.h"
+
+#ifdef DISK_CACHE_SIZE
+
+#define DISK_CACHE_NUM_BLOCKS	(DISK_CACHE_SIZE / (DISK_CACHE_BLOCK_SECS * BLK_DEV_BLK_SZ))
+#define DISK_CACHE_MAX_HOT		(DISK_CACHE_NUM_BLOCKS * 3 / 4)		//the rest is for blocks still on trial
+#define DISK_CACHE_HASH_SZ		256									//a power of 2
+
+#define NO_BLOCK				0xffff
+#define NO_BLOCK_NO				0xffffffffUL
+
+#if DISK_CACHE_NUM_BLOCKS < 4 || DISK_CACHE_NUM_BLOCKS >= NO_BLOCK
+	#error "DISK_CACHE_SIZE is out of range"
+#endif
+#if DISK_CACHE_BLOCK_SECS > 8 || (DISK_CACHE_BLOCK_SECS & (DISK_CACHE_BLOCK_SECS - 1))
+	#error "DISK_CACHE_BLOCK_SECS must be a power of 2, at most 8"
+#endif
+
+enum DiskCacheListIdx {
+	DiskCacheCold,
+	DiskCacheHot,
+};
+
+struct DiskCacheBlock {
+	uint32_t blockNo;			//first sector / DISK_CACHE_BLOCK_SECS, NO_BLOCK_NO while unused
+	uint16_t prev, next;		//in its list, most recently used first
+	uint16_t hashNext;
+	uint8_t valid, dirty;		//a bit per sector
+	uint8_t list;				//enum DiskCacheListIdx
+};
+
+struct DiskCacheList {
+	uint16_t head, tail, num;
+};
+
+static struct {
+	struct DiskCacheBlock blocks[DISK_CACHE_NUM_BLOCKS];
+	struct DiskCacheList lists[2];
+	uint16_t hash[DISK_CACHE_HASH_SZ];
+	MassStorageF mediumF;
+	DiskCacheStoreF storeF;
+	struct DiskCacheStats stats;
+} gDiskCache;
+
+static uint8_t mBounce[DISK_CACHE_BLOCK_SECS * BLK_DEV_BLK_SZ] __attribute__((aligned(4)));	//write-backs
+
+
+static uint_fast16_t diskCachePrvHash(uint32_t blockNo)
+{
+	return (blockNo ^ (blockNo >> 8) ^ (blockNo >> 16)) % DISK_CACHE_HASH_SZ;
+}
+
+static uint32_t diskCachePrvSlot(uint_fast16_t idx, uint_fast8_t sec)
+{
+	return (uint32_t)idx * DISK_CACHE_BLOCK_SECS + sec;
+}
+
+static void diskCachePrvUnlink(uint_fast16_t idx)
+{
+	struct DiskCacheBlock *blk = &gDiskCache.blocks[idx];
+	struct DiskCacheList *list = &gDiskCache.lists[blk->list];
+	
+	if (blk->prev == NO_BLOCK)
+		list->head = blk->next;
+	else
+		gDiskCache.blocks[blk->prev].next = blk->next;
+	
+	if (blk->next == NO_BLOCK)
+		list->tail = blk->prev;
+	else
+		gDiskCache.blocks[blk->next].prev = blk->prev;
+	
+	list->num--;
+}
+
+static void diskCachePrvLinkHead(uint_fast16_t idx, enum DiskCacheListIdx which)
+{
+	struct DiskCacheBlock *blk = &gDiskCache.blocks[idx];
+	struct DiskCacheList *list = &gDiskCache.lists[which];
+	
+	blk->list = which;
+	blk->prev = NO_BLOCK;
+	blk->next = list->head;
+	
+	if (list->head == NO_BLOCK)
+		list->tail = idx;
+	else
+		gDiskCache.blocks[list->head].prev = idx;
+	
+	list->head = idx;
+	list->num++;
+}
+
+//blocks used again while cold become hot. when there are too many of those, the least recently used goes back to
+//being cold, and has to earn its place again
+static void diskCachePrvTouch(uint_fast16_t idx, bool reused)
+{
+	enum DiskCacheListIdx which = reused ? DiskCacheHot : (enum DiskCacheListIdx)gDiskCache.blocks[idx].list;
+	
+	diskCachePrvUnlink(idx);
+	diskCachePrvLinkHead(idx, which);
+	
+	if (gDiskCache.lists[DiskCacheHot].num > DISK_CACHE_MAX_HOT) {
+		
+		idx = gDiskCache.lists[DiskCacheHot].tail;
+		diskCachePrvUnlink(idx);
+		diskCachePrvLinkHead(idx, DiskCacheCold);
+	}
+}
+
+static uint_fast16_t diskCachePrvFind(uint32_t blockNo)
+{
+	uint_fast16_t idx = gDiskCache.hash[diskCachePrvHash(blockNo)];
+	
+	while (idx != NO_BLOCK && gDiskCache.blocks[idx].blockNo != blockNo)
+		idx = gDiskCache.blocks[idx].hashNext;
+	
+	return idx;
+}
+
+static bool diskCachePrvWriteBack(uint_fast16_t idx)
+{
+	struct DiskCacheBlock *blk = &gDiskCache.blocks[idx];
+	uint_fast8_t i, j;
+	
+	//each run of dirty sectors goes out in one medium access
+	for (i = 0; i < DISK_CACHE_BLOCK_SECS; i = j + 1) {
+		
+		for (j = i; j < DISK_CACHE_BLOCK_SECS && (blk->dirty & (1 << j)); j++)
+			gDiskCache.storeF(diskCachePrvSlot(idx, j), mBounce + (j - i) * BLK_DEV_BLK_SZ, false);
+		
+		if (j == i)
+			continue;
+		
+		if (!gDiskCache.mediumF(MASS_STORE_OP_WRITE, blk->blockNo * DISK_CACHE_BLOCK_SECS + i, j - i, mBounce))
+			return false;
+		
+		gDiskCache.stats.writebacks += j - i;
+	}
+	blk->dirty = 0;
+	
+	return true;
+}
+
+//the coldest block not in [keepFirst, keepLast], now for blockNo and empty. NO_BLOCK if there is none, or it could
+//not be written back. those kept are what the caller is working on: a fill has read their sectors from the medium
+//already, and must not find them gone, and their newer data with them
+static uint_fast16_t diskCachePrvAlloc(uint32_t blockNo, uint32_t keepFirst, uint32_t keepLast)
+{
+	uint_fast16_t idx = gDiskCache.lists[DiskCacheCold].tail;
+	struct DiskCacheBlock *blk;
+	uint16_t *prevP;
+	
+	while (idx != NO_BLOCK && gDiskCache.blocks[idx].blockNo - keepFirst <= keepLast - keepFirst)
+		idx = gDiskCache.blocks[idx].prev;
+	
+	if (idx == NO_BLOCK)
+		return NO_BLOCK;
+	
+	blk = &gDiskCache.blocks[idx];
+	if (blk->dirty && !diskCachePrvWriteBack(idx))
+		return NO_BLOCK;
+	
+	if (blk->blockNo != NO_BLOCK_NO) {
+		
+		for (prevP = &gDiskCache.hash[diskCachePrvHash(blk->blockNo)]; *prevP != idx; prevP = &gDiskCache.blocks[*prevP].hashNext);
+		*prevP = blk->hashNext;
+	}
+	
+	blk->blockNo = blockNo;
+	blk->valid = 0;
+	blk->hashNext = gDiskCache.hash[diskCachePrvHash(blockNo)];
+	gDiskCache.hash[diskCachePrvHash(blockNo)] = idx;
+	diskCachePrvTouch(idx, false);
+	
+	return idx;
+}
+
+uint32_t diskCacheRead(uint32_t sector, uint32_t numSec, void *buf)
+{
+	uint8_t *dst = (uint8_t*)buf;
+	uint_fast8_t i, first;
+	uint_fast16_t idx;
+	uint32_t done = 0;
+	
+	while (done < numSec) {
+		
+		idx = diskCachePrvFind((sector + done) / DISK_CACHE_BLOCK_SECS);
+		if (idx == NO_BLOCK)
+			break;
+		
+		first = i = (sector + done) % DISK_CACHE_BLOCK_SECS;
+		for (; i < DISK_CACHE_BLOCK_SECS && done < numSec && (gDiskCache.blocks[idx].valid & (1 << i)); i++, done++)
+			gDiskCache.storeF(diskCachePrvSlot(idx, i), dst + done * BLK_DEV_BLK_SZ, false);
+		
+		if (i == first)
+			break;
+		
+		diskCachePrvTouch(idx, true);
+		if (i != DISK_CACHE_BLOCK_SECS)		//the run ends here
+			break;
+	}
+	gDiskCache.stats.hits += done;
+	
+	return done;
+}
+
+void diskCacheFill(uint32_t sector, uint32_t numSec, void *buf)
+{
+	uint32_t first = sector / DISK_CACHE_BLOCK_SECS, last = (sector + numSec - 1) / DISK_CACHE_BLOCK_SECS;
+	uint8_t *src = (uint8_t*)buf;
+	struct DiskCacheBlock *blk;
+	uint_fast16_t idx;
+	uint_fast8_t i;
+	
+	while (numSec) {
+		
+		i = sector % DISK_CACHE_BLOCK_SECS;
+		idx = diskCachePrvFind(sector / DISK_CACHE_BLOCK_SECS);
+		if (idx != NO_BLOCK)
+			diskCachePrvTouch(idx, false);
+		else
+			idx = diskCachePrvAlloc(sector / DISK_CACHE_BLOCK_SECS, first, last);
+		
+		for (; i < DISK_CACHE_BLOCK_SECS && numSec; i++, numSec--, sector++, src += BLK_DEV_BLK_SZ) {
+			
+			if (idx == NO_BLOCK)		//nowhere to keep it, which only costs a later hit
+				continue;
+			
+			blk = &gDiskCache.blocks[idx];
+			if (blk->valid & (1 << i))		//what the medium gave may be stale: it was dirty, or was flushed since
+				gDiskCache.storeF(diskCachePrvSlot(idx, i), src, false);
+			else {
+				
+				gDiskCache.storeF(diskCachePrvSlot(idx, i), src, true);
+				blk->valid |= 1 << i;
+				gDiskCache.stats.misses++;
+			}
+		}
+	}
+}
+
+bool diskCacheWrite(uint32_t sector, uint32_t numSec, const void *buf)
+{
+	uint32_t first = sector / DISK_CACHE_BLOCK_SECS, last = (sector + numSec - 1) / DISK_CACHE_BLOCK_SECS;
+	const uint8_t *src = (const uint8_t*)buf;
+	struct DiskCacheBlock *blk;
+	uint_fast16_t idx;
+	uint_fast8_t i;
+	uint32_t num;
+	
+	while (numSec) {
+		
+		i = sector % DISK_CACHE_BLOCK_SECS;
+		idx = diskCachePrvFind(sector / DISK_CACHE_BLOCK_SECS);
+		if (idx != NO_BLOCK)
+			diskCachePrvTouch(idx, false);
+		else if ((idx = diskCachePrvAlloc(sector / DISK_CACHE_BLOCK_SECS, first, last)) == NO_BLOCK) {
+			
+			//nowhere to keep them, so they go straight out
+			num = DISK_CACHE_BLOCK_SECS - i;
+			if (num > numSec)
+				num = numSec;
+			if (!gDiskCache.mediumF(MASS_STORE_OP_WRITE, sector, num, (void*)src))
+				return false;
+			
+			sector += num;
+			numSec -= num;
+			src += num * BLK_DEV_BLK_SZ;
+			continue;
+		}
+		
+		blk = &gDiskCache.blocks[idx];
+		for (; i < DISK_CACHE_BLOCK_SECS && numSec; i++, numSec--, sector++, src += BLK_DEV_BLK_SZ) {
+			
+			gDiskCache.storeF(diskCachePrvSlot(idx, i), (void*)src, true);
+			blk->valid |= 1 << i;
+			blk->dirty |= 1 << i;
+		}
+	}
+	
+	return true;
+}
+
+bool diskCacheAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
+{
+	uint32_t done;
+	
+	switch (op) {
+		case MASS_STORE_OP_READ:
+			done = diskCacheRead(sector, numSec, buf);
+			if (done == numSec)
+				return true;
+			
+			//the rest may be partly cached too, diskCacheFill() sorts that out
+			buf = (uint8_t*)buf + done * BLK_DEV_BLK_SZ;
+			if (!gDiskCache.mediumF(MASS_STORE_OP_READ, sector + done, numSec - done, buf))
+				return false;
+			diskCacheFill(sector + done, numSec - done, buf);
+			return true;
+		
+		case MASS_STORE_OP_WRITE:
+			return diskCacheWrite(sector, numSec, buf);
+		
+		default:
+			return gDiskCache.mediumF(op, sector, numSec, buf);
+	}
+}
+
+bool diskCacheFlush(void)
+{
+	uint_fast16_t idx;
+	bool ret = true;
+	
+	for (idx = 0; idx < DISK_CACHE_NUM_BLOCKS; idx++) {
+		
+		if (gDiskCache.blocks[idx].dirty && !diskCachePrvWriteBack(idx))
+			ret = false;
+	}
+	
+	return ret;
+}
+
+void diskCacheGetStats(struct DiskCacheStats *statsP)
+{
+	*statsP = gDiskCache.stats;
+}
+
+void diskCacheInit(MassStorageF mediumF, DiskCacheStoreF storeF)
+{
+	uint_fast16_t idx;
+	
+	gDiskCache.mediumF = mediumF;
+	gDiskCache.storeF = storeF;
+	memset(gDiskCache.hash, 0xff, sizeof(gDiskCache.hash));
+	gDiskCache.lists[DiskCacheCold] = gDiskCache.lists[DiskCacheHot] = (struct DiskCacheList){.head = NO_BLOCK, .tail = NO_BLOCK, };
+	
+	for (idx = 0; idx < DISK_CACHE_NUM_BLOCKS; idx++) {
+		
+		gDiskCache.blocks[idx] = (struct DiskCacheBlock){.blockNo = NO_BLOCK_NO, };
+		diskCachePrvLinkHead(idx, DiskCacheCold);
+	}
+}
+
+
+#endif
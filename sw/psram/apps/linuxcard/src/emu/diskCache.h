@@ -0,0 +1,59 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _DISK_CACHE_H_
+#define _DISK_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "soc.h"
+
+
+//write-back sector cache in front of a disk's medium, kept in RAM the guest does not get (a PSRAM carve-out on the
+//board, a plain array on PC) with only its tags in SRAM. it is enabled by defining DISK_CACHE_SIZE (bytes). blocks
+//of DISK_CACHE_BLOCK_SECS sectors live on two LRU lists: new ones start on the cold list, and only one that is read
+//again while there moves to the hot one, so a long sequential read only ever pushes out other cold blocks, never the
+//hot set (the shell, the X server). dirty sectors reach the medium when their block is evicted and on
+//diskCacheFlush(), which the platform calls every DISK_CACHE_FLUSH_SECS, at exit and before snapshots. all calls
+//are from the emulation thread, only the medium may be used from elsewhere as well
+
+#ifdef DISK_CACHE_SIZE
+
+	#ifndef DISK_CACHE_BLOCK_SECS
+		#define DISK_CACHE_BLOCK_SECS	8		//a power of 2, at most 8
+	#endif
+	#ifndef DISK_CACHE_FLUSH_SECS
+		#define DISK_CACHE_FLUSH_SECS	5
+	#endif
+
+	struct DiskCacheStats {
+		uint32_t hits;			//sectors read from the cache
+		uint32_t misses;		//sectors brought into it from the medium
+		uint32_t writebacks;	//sectors written back to the medium
+	};
+
+	//moves one sector to or from the cache's RAM. slot counts sectors, [0 .. DISK_CACHE_SIZE / BLK_DEV_BLK_SZ)
+	typedef void (*DiskCacheStoreF)(uint32_t slot, void *buf, bool write);
+
+	void diskCacheInit(MassStorageF mediumF, DiskCacheStoreF storeF);
+
+	//a MassStorageF for the medium as seen through the cache
+	bool diskCacheAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf);
+
+	//for users that do their medium reads themselves (maybe elsewhere, see scsiDiskSetBackgroundIo): diskCacheRead()
+	//copies out the leading sectors that are cached and says how many. after reading the rest from the medium, give
+	//them to diskCacheFill(), which keeps them and replaces any the cache has newer versions of. writes and flushes
+	//in between are fine, but sectors evicted in between would come back as the medium had them
+	uint32_t diskCacheRead(uint32_t sector, uint32_t numSec, void *buf);
+	void diskCacheFill(uint32_t sector, uint32_t numSec, void *buf);
+	bool diskCacheWrite(uint32_t sector, uint32_t numSec, const void *buf);
+
+	bool diskCacheFlush(void);
+	void diskCacheGetStats(struct DiskCacheStats *statsP);
+
+#endif
+
+
+#endif
@@ -0,0 +1,91 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include "diskMap.h"
+#include "diskio.h"
+#include "printf.h"
+
+#ifdef DISK_FAST_MAP
+
+
+static DWORD mDiskMap[DISK_MAP_SZ];
+
+
+bool diskMapInit(FIL *fil)
+{
+	FRESULT fr;
+	
+	mDiskMap[0] = DISK_MAP_SZ;
+	fil->cltbl = mDiskMap;
+	fr = f_lseek(fil, CREATE_LINKMAP);
+	if (fr != FR_OK) {
+		
+		//too fragmented (FR_NOT_ENOUGH_CORE says we needed mDiskMap[0] DWORDs)
+		pr("disk image link map failed: %d (need %u)\n", fr, (unsigned)mDiskMap[0]);
+		fil->cltbl = NULL;
+		return false;
+	}
+	pr("disk image is in %u fragment(s)\n", (unsigned)(mDiskMap[0] - 2) / 2);
+	
+	return true;
+}
+
+uint32_t diskMapSector(const FIL *fil, uint32_t sector, LBA_t *lbaP)
+{
+	const FATFS *fs = fil->obj.fs;
+	uint32_t cl = sector / fs->csize;
+	const DWORD *tbl = fil->cltbl + 1;
+	uint64_t left = f_size(fil) / BLK_DEV_BLK_SZ;
+	uint32_t run;
+	DWORD ncl;
+	
+	if (sector >= left)
+		return 0;
+	left -= sector;
+	
+	//(length, start cluster) pairs, zero-terminated. normally a single entry
+	while ((ncl = *tbl++) != 0) {
+		
+		if (cl < ncl) {
+			
+			//the last cluster may go on past the end of the file
+			*lbaP = fs->database + (LBA_t)fs->csize * (*tbl - 2 + cl) + sector % fs->csize;
+			run = (ncl - cl) * fs->csize - sector % fs->csize;
+			
+			return run < left ? run : (uint32_t)left;
+		}
+		cl -= ncl;
+		tbl++;
+	}
+	return 0;
+}
+
+bool diskMapAccess(const FIL *fil, bool write, uint32_t sector, uint32_t numSec, void *buf)
+{
+	BYTE pdrv = fil->obj.fs->pdrv;
+	uint8_t *dst = (uint8_t*)buf;
+	uint32_t now;
+	LBA_t lba;
+	
+	while (numSec) {
+		
+		now = diskMapSector(fil, sector, &lba);
+		if (!now)
+			return false;
+		if (now > numSec)
+			now = numSec;
+		
+		if ((write ? disk_write(pdrv, dst, lba, now) : disk_read(pdrv, dst, lba, now)) != RES_OK)
+			return false;
+		
+		sector += now;
+		numSec -= now;
+		dst += now * BLK_DEV_BLK_SZ;
+	}
+	return true;
+}
+
+
+#endif
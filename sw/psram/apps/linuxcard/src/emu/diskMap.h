@@ -0,0 +1,39 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _DISK_MAP_H_
+#define _DISK_MAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+#include "soc.h"
+
+
+//a FatFs cluster link map (fast seek table) for the disk image. once built, image sectors map to card sectors
+//without walking the FAT, and accesses go straight to the card, bypassing the FIL's sector buffer. that is only
+//right because the image never changes size. needs FF_USE_FASTSEEK and FatFs sectors of BLK_DEV_BLK_SZ, this
+//defines DISK_FAST_MAP when both are there
+
+#if FF_USE_FASTSEEK && FF_MAX_SS == BLK_DEV_BLK_SZ
+
+	#define DISK_FAST_MAP
+
+	#ifndef DISK_MAP_SZ
+		#define DISK_MAP_SZ			64		//in DWORDs: 2 + 2 per fragment of the image file
+	#endif
+
+	//for an opened file. false if it is too fragmented for the map, it then keeps using plain seeks
+	bool diskMapInit(FIL *fil);
+
+	//how many sectors starting at the given one are contiguous on the card, and where they start (0 if past the end)
+	uint32_t diskMapSector(const FIL *fil, uint32_t sector, LBA_t *lbaP);
+
+	bool diskMapAccess(const FIL *fil, bool write, uint32_t sector, uint32_t numSec, void *buf);
+
+#endif
+
+
+#endif
@@ -4,6 +4,7 @@
 */
 
 #include <stdint.h>
+#include "snapshot.h"
 #include "ds1287.h"
 #include "esar.h"
 #include "mem.h"
@@ -310,6 +311,16 @@ void ds1287step(uint_fast16_t nTicks)
 	}
 }
 
+void ds1287snapshot(struct Snapshot *ss)
+{
+	snapshotSection(ss, SNAPSHOT_TAG('R', 'T', 'C', ' '));
+	snapshotBytes(ss, gRTC.direct, sizeof(gRTC.direct));
+	snapshotU16(ss, &gRTC.tickCtr);
+	
+	if (!ss->saving && ss->ok)
+		cpuIrq(SOC_IRQNO_RTC, !!(gRTC.ctrlC & RTC_CTRLC_IRQF));
+}
+
 bool ds1287init(void)
 {
 	gRTC.ctrlB = RTC_CTRLB_DM | RTC_CTRLB_2412;
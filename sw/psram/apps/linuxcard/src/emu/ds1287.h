@@ -8,10 +8,15 @@
 
 #include <stdbool.h>
 
+struct Snapshot;
+
 
 bool ds1287init(void);
 
 void ds1287step(uint_fast16_t nTicks);	//check for RTC irqs... on pc also tick 1/8192th of a sec
 
+//state is exchanged as the 128 registers in binary 24h form, so all implementations can share snapshots
+void ds1287snapshot(struct Snapshot *ss);
+
 
 #endif
@@ -6,9 +6,11 @@
 //#include "CortexEmuCpu.h"
 
 #include <stdint.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "pico/sync.h"
 #include "timebase.h"
+#include "snapshot.h"
 #include "printf.h"
 #include "ds1287.h"
 #include "esar.h"
@@ -534,6 +536,68 @@ bool rtc_callback(struct repeating_timer *t) {
 }
 
 
+void ds1287snapshot(struct Snapshot *ss)
+{
+	uint8_t regs[0x80];
+	uint16_t tickCtr = 0;		//we have no sub-second state
+	
+	asm volatile("cpsid i");
+	regs[0x00] = mCurTime.time.s;
+	regs[0x01] = mAlarmTime.s;
+	regs[0x02] = mCurTime.time.m;
+	regs[0x03] = mAlarmTime.m;
+	regs[0x04] = mCurTime.time.h;
+	regs[0x05] = mAlarmTime.h;
+	regs[0x06] = mCurTime.date.dow;
+	regs[0x07] = mCurTime.date.day;
+	regs[0x08] = mCurTime.date.month;
+	regs[0x09] = mCurTime.date.year;
+	regs[0x0a] = (mDS1287.dv << 4) | mDS1287.rs;
+	regs[0x0b] = (mDS1287.set ? RTC_CTRLB_SET : 0) | (mDS1287.pie ? RTC_CTRLB_PIE : 0) | (mDS1287.aie ? RTC_CTRLB_AIE : 0) |
+		(mDS1287.uie ? RTC_CTRLB_UIE : 0) | (mDS1287.sqwe ? RTC_CTRLB_SQWE : 0) | (mDS1287.dm ? RTC_CTRLB_DM : 0) |
+		(mDS1287.m2412 ? RTC_CTRLB_2412 : 0) | (mDS1287.dse ? RTC_CTRLB_DSE : 0);
+	regs[0x0c] = (mDS1287.irqf ? RTC_CTRLC_IRQF : 0) | (mDS1287.pf ? RTC_CTRLC_PF : 0) | (mDS1287.af ? RTC_CTRLC_AF : 0) | (mDS1287.uf ? RTC_CTRLC_UF : 0);
+	regs[0x0d] = RTC_CTRLD_VRT;
+	asm volatile("cpsie i");
+	memcpy(regs + 0x0e, mDS1287.ram, sizeof(mDS1287.ram));
+	
+	snapshotSection(ss, SNAPSHOT_TAG('R', 'T', 'C', ' '));
+	snapshotBytes(ss, regs, sizeof(regs));
+	snapshotU16(ss, &tickCtr);
+	
+	if (ss->saving || !ss->ok)
+		return;
+	
+	asm volatile("cpsid i");
+	mCurTime.time.s = regs[0x00];
+	mAlarmTime.s = regs[0x01];
+	mCurTime.time.m = regs[0x02];
+	mAlarmTime.m = regs[0x03];
+	mCurTime.time.h = regs[0x04];
+	mAlarmTime.h = regs[0x05];
+	mCurTime.date.dow = regs[0x06];
+	mCurTime.date.day = regs[0x07];
+	mCurTime.date.month = regs[0x08];
+	mCurTime.date.year = regs[0x09];
+	mDS1287.dv = (regs[0x0a] & RTC_CTRLA_DV_MASK) >> RTC_CTRLA_DV_SHIFT;
+	mDS1287.rs = (regs[0x0a] & RTC_CTRLA_RS_MASK) >> RTC_CTRLA_RS_SHIFT;		//rtc_callback picks up the new rate
+	mDS1287.set = !!(regs[0x0b] & RTC_CTRLB_SET);
+	mDS1287.pie = !!(regs[0x0b] & RTC_CTRLB_PIE);
+	mDS1287.aie = !!(regs[0x0b] & RTC_CTRLB_AIE);
+	mDS1287.uie = !!(regs[0x0b] & RTC_CTRLB_UIE);
+	mDS1287.sqwe = !!(regs[0x0b] & RTC_CTRLB_SQWE);
+	mDS1287.dm = !!(regs[0x0b] & RTC_CTRLB_DM);
+	mDS1287.m2412 = !!(regs[0x0b] & RTC_CTRLB_2412);
+	mDS1287.dse = !!(regs[0x0b] & RTC_CTRLB_DSE);
+	mDS1287.irqf = !!(regs[0x0c] & RTC_CTRLC_IRQF);
+	mDS1287.pf = !!(regs[0x0c] & RTC_CTRLC_PF);
+	mDS1287.af = !!(regs[0x0c] & RTC_CTRLC_AF);
+	mDS1287.uf = !!(regs[0x0c] & RTC_CTRLC_UF);
+	cpuIrq(SOC_IRQNO_RTC, mDS1287.pie && mDS1287.pf);
+	asm volatile("cpsie i");
+	memcpy(mDS1287.ram, regs + 0x0e, sizeof(mDS1287.ram));
+}
+
 bool ds1287init(void)
 {
 	// init data
@@ -9,6 +9,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include "snapshot.h"
 #include "printf.h"
 #include "dz11.h"
 #include "mem.h"
@@ -392,6 +393,38 @@ static bool dz11prvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void* b
 	}
 }
 
+void dz11snapshot(struct Snapshot *ss)
+{
+	uint_fast8_t i;
+	
+	snapshotSection(ss, SNAPSHOT_TAG('D', 'Z', '1', '1'));
+	
+	for (i = 0; i < NUM_UARTS; i++) {
+		
+		struct Line *line = &gDZ11.line[i];
+		
+		snapshotBytes(ss, line->buf, sizeof(line->buf));
+		snapshotField(ss, line->rxReadPtr);
+		snapshotField(ss, line->rxBytesUsed);
+		snapshotField(ss, line->nBytesRxedSinceLastRead);
+		snapshotField(ss, line->rxOvr);
+		snapshotField(ss, line->rxEna);
+	}
+	snapshotField(ss, gDZ11.enabled);
+	snapshotField(ss, gDZ11.rie);
+	snapshotField(ss, gDZ11.sae);
+	snapshotField(ss, gDZ11.tie);
+	snapshotField(ss, gDZ11.maint);
+	snapshotField(ss, gDZ11.sa);
+	snapshotField(ss, gDZ11.rdone);
+	snapshotField(ss, gDZ11.trdy);
+	snapshotField(ss, gDZ11.txLine);
+	snapshotField(ss, gDZ11.tcr);
+	
+	if (!ss->saving && ss->ok)
+		dz11PrvRecalc();
+}
+
 bool dz11init(void)
 {
 
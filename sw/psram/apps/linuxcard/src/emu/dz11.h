@@ -9,7 +9,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+struct Snapshot;
+
 bool dz11init(void);
+void dz11snapshot(struct Snapshot *ss);
 
 //feed chars
 void dz11charRx(uint_fast8_t line, uint_fast8_t chr);			//will overflow
@@ -4,6 +4,8 @@
 */
 
 #include <stdbool.h>
+#include <string.h>
+#include <float.h>
 #include <math.h>
 #include "fpu.h"
 
@@ -59,6 +61,399 @@
 
 #define FCR_PEROP_FLAGS		(((FCR_INVAL_OP | FCR_CEF_DIV0 | FCR_CEF_OVERFLOW | FCR_CEF_UDERFLOW | FCR_CEF_INEXACT) << FCR_SHIFT_CAUSE) | FCR_UNIMPL)
 
+#define FCR_RM_MASK			0x03
+
+//what invalid ops produce. unlike most everyone else's, R3000 quiet NaNs have the top mantissa bit clear
+#define FPU_DEFAULT_NAN_D	0x7ff7ffffffffffffull
+#define FPU_DEFAULT_NAN_F	0x7fbfffff
+
+
+//the math itself is plain C operators. on the RP2040 the SDK's pico_double and pico_float turn those into calls to the
+//boot ROM's routines, which only round to nearest and flush denormals to zero, and a flushed result shows up as an
+//underflow. anything that rounds while FCR asks for another rounding mode is refused as an unimplemented operation,
+//which the guest kernel's FPU emulator then does properly. the ROM has no exception flags to read back (and neither
+//has -ffast-math), so IEEE exceptions are worked out here from operands and results, and values are only classified
+//by looking at their bits
+
+//a finite nonzero value as m * 2^e, m odd, len being its bit length
+struct FpuExactVal {
+	uint64_t m;
+	int_fast16_t e;
+	uint_fast8_t len;
+};
+
+static inline uint64_t fpuPrvBitsD(double v)
+{
+	uint64_t ret;
+	
+	memcpy(&ret, &v, sizeof(ret));
+	return ret;
+}
+
+static inline uint32_t fpuPrvBitsF(float v)
+{
+	uint32_t ret;
+	
+	memcpy(&ret, &v, sizeof(ret));
+	return ret;
+}
+
+static inline double fpuPrvNanD(void)
+{
+	uint64_t bits = FPU_DEFAULT_NAN_D;
+	double ret;
+	
+	memcpy(&ret, &bits, sizeof(ret));
+	return ret;
+}
+
+static inline float fpuPrvNanF(void)
+{
+	uint32_t bits = FPU_DEFAULT_NAN_F;
+	float ret;
+	
+	memcpy(&ret, &bits, sizeof(ret));
+	return ret;
+}
+
+//floats are promoted for these, which is exact
+static inline bool fpuPrvIsNan(double v)
+{
+	return (fpuPrvBitsD(v) << 1) > (0x7ffull << 53);
+}
+
+static inline bool fpuPrvIsInf(double v)
+{
+	return (fpuPrvBitsD(v) << 1) == (0x7ffull << 53);
+}
+
+static inline bool fpuPrvIsNanF(float v)
+{
+	return (fpuPrvBitsF(v) << 1) > (0xfful << 24);
+}
+
+//signaling NaNs are the ones with the top mantissa bit set
+static inline bool fpuPrvIsSnan(double v)
+{
+	return (fpuPrvBitsD(v) << 1) >= (0xfffull << 52);
+}
+
+static inline bool fpuPrvIsSnanF(float v)
+{
+	return (fpuPrvBitsF(v) << 1) >= (0x1fful << 23);
+}
+
+static void fpuPrvSplit(double v, struct FpuExactVal *x)
+{
+	uint64_t bits = fpuPrvBitsD(v);
+	uint_fast16_t bexp = (bits >> 52) & 0x7ff;
+	uint_fast8_t sh;
+	
+	x->m = bits & 0x000fffffffffffffull;
+	x->e = -1074;
+	if (bexp) {
+		x->m += 1ull << 52;
+		x->e += bexp - 1;
+	}
+	sh = __builtin_ctzll(x->m);
+	x->m >>= sh;
+	x->e += sh;
+	x->len = 64 - __builtin_clzll(x->m);
+}
+
+//would a * b fit a double (or a float) as is
+static bool fpuPrvProdExact(const struct FpuExactVal *a, const struct FpuExactVal *b, bool dbl)
+{
+	uint_fast8_t prec = dbl ? 53 : 24;
+	uint64_t prod;
+	
+	if (a->len + b->len - 1 > prec)		//odd times odd is at least this long, and if it is not longer, it fits in 64 bits
+		return false;
+	prod = a->m * b->m;
+	
+	return 64 - __builtin_clzll(prod) <= prec && a->e + b->e >= (dbl ? -1074 : -149);
+}
+
+//is q * b exactly a
+static bool fpuPrvProdIs(const struct FpuExactVal *q, const struct FpuExactVal *b, const struct FpuExactVal *a)
+{
+	if (q->len + b->len - 1 > a->len)
+		return false;
+	
+	return q->m * b->m == a->m && q->e + b->e == a->e;
+}
+
+//fast2sum: with the bigger one first, s - a is exact, and is b if s was
+static bool fpuPrvSumExactD(double a, double b, double s)
+{
+	volatile double diff;		//so that -ffast-math does not go and decide it knows the answer
+	
+	if (fabs(a) < fabs(b)) {
+		double t = a;
+		
+		a = b;
+		b = t;
+	}
+	diff = s - a;
+	
+	return diff == b;
+}
+
+static bool fpuPrvSumExactF(float a, float b, float s)
+{
+	volatile float diff;
+	
+	if (fabsf(a) < fabsf(b)) {
+		float t = a;
+		
+		a = b;
+		b = t;
+	}
+	diff = s - a;
+	
+	return diff == b;
+}
+
+//exceptions for a finite result that had to be rounded
+static uint_fast8_t fpuPrvInexact(double ret, bool dbl)
+{
+	return FCR_CEF_INEXACT | ((fabs(ret) < (dbl ? DBL_MIN : FLT_MIN)) ? FCR_CEF_UDERFLOW : 0);
+}
+
+//exceptions of a op b = ret, for non-NaN a and b. ret was rounded to a float if dbl is clear
+static uint_fast8_t fpuPrvExcAdd(double a, double b, double ret, bool dbl)
+{
+	if (fpuPrvIsInf(a) || fpuPrvIsInf(b))
+		return (fpuPrvIsInf(a) && fpuPrvIsInf(b) && ((fpuPrvBitsD(a) ^ fpuPrvBitsD(b)) >> 63)) ? FCR_INVAL_OP : 0;
+	if (fpuPrvIsInf(ret))
+		return FCR_CEF_OVERFLOW | FCR_CEF_INEXACT;
+	if (dbl ? fpuPrvSumExactD(a, b, ret) : fpuPrvSumExactF(a, b, ret))
+		return 0;
+	
+	return fpuPrvInexact(ret, dbl);
+}
+
+static uint_fast8_t fpuPrvExcMul(double a, double b, double ret, bool dbl)
+{
+	struct FpuExactVal xa, xb;
+	
+	if ((fpuPrvIsInf(a) && !b) || (fpuPrvIsInf(b) && !a))
+		return FCR_INVAL_OP;
+	if (fpuPrvIsInf(a) || fpuPrvIsInf(b) || !a || !b)
+		return 0;
+	if (fpuPrvIsInf(ret))
+		return FCR_CEF_OVERFLOW | FCR_CEF_INEXACT;
+	if (!ret)
+		return FCR_CEF_UDERFLOW | FCR_CEF_INEXACT;
+	
+	fpuPrvSplit(a, &xa);
+	fpuPrvSplit(b, &xb);
+	if (fpuPrvProdExact(&xa, &xb, dbl))
+		return 0;
+	
+	return fpuPrvInexact(ret, dbl);
+}
+
+static uint_fast8_t fpuPrvExcDiv(double a, double b, double ret, bool dbl)
+{
+	struct FpuExactVal xa, xb, xq;
+	
+	if ((!a && !b) || (fpuPrvIsInf(a) && fpuPrvIsInf(b)))
+		return FCR_INVAL_OP;
+	if (!b)
+		return fpuPrvIsInf(a) ? 0 : FCR_CEF_DIV0;
+	if (fpuPrvIsInf(a) || fpuPrvIsInf(b) || !a)
+		return 0;
+	if (fpuPrvIsInf(ret))
+		return FCR_CEF_OVERFLOW | FCR_CEF_INEXACT;
+	if (!ret)
+		return FCR_CEF_UDERFLOW | FCR_CEF_INEXACT;
+	
+	fpuPrvSplit(a, &xa);
+	fpuPrvSplit(b, &xb);
+	fpuPrvSplit(ret, &xq);
+	if (fpuPrvProdIs(&xq, &xb, &xa))
+		return 0;
+	
+	return fpuPrvInexact(ret, dbl);
+}
+
+//ADD, SUB, MUL, DIV. quiet NaNs pass through without complaint, invalid ops produce the default NaN
+static uint_fast8_t fpuPrvArithD(uint_fast8_t op, double s, double t, double *retP)
+{
+	uint_fast8_t exc;
+	double ret;
+	
+	if (fpuPrvIsSnan(s) || fpuPrvIsSnan(t)) {
+		
+		*retP = fpuPrvNanD();
+		return FCR_INVAL_OP;
+	}
+	if (fpuPrvIsNan(s) || fpuPrvIsNan(t)) {
+		
+		*retP = fpuPrvIsNan(s) ? s : t;
+		return 0;
+	}
+	
+	switch (op) {
+		case 0b000000:
+			ret = s + t;
+			exc = fpuPrvExcAdd(s, t, ret, true);
+			break;
+		
+		case 0b000001:
+			ret = s - t;
+			exc = fpuPrvExcAdd(s, -t, ret, true);
+			break;
+		
+		case 0b000010:
+			ret = s * t;
+			exc = fpuPrvExcMul(s, t, ret, true);
+			break;
+		
+		case 0b000011:
+			ret = s / t;
+			exc = fpuPrvExcDiv(s, t, ret, true);
+			break;
+		
+		default:
+			__builtin_unreachable();
+			break;
+	}
+	
+	*retP = (exc & FCR_INVAL_OP) ? fpuPrvNanD() : ret;
+	return exc;
+}
+
+static uint_fast8_t fpuPrvArithF(uint_fast8_t op, float s, float t, float *retP)
+{
+	uint_fast8_t exc;
+	float ret;
+	
+	if (fpuPrvIsSnanF(s) || fpuPrvIsSnanF(t)) {
+		
+		*retP = fpuPrvNanF();
+		return FCR_INVAL_OP;
+	}
+	if (fpuPrvIsNanF(s) || fpuPrvIsNanF(t)) {
+		
+		*retP = fpuPrvIsNanF(s) ? s : t;
+		return 0;
+	}
+	
+	switch (op) {
+		case 0b000000:
+			ret = s + t;
+			exc = fpuPrvExcAdd(s, t, ret, false);
+			break;
+		
+		case 0b000001:
+			ret = s - t;
+			exc = fpuPrvExcAdd(s, -t, ret, false);
+			break;
+		
+		case 0b000010:
+			ret = s * t;
+			exc = fpuPrvExcMul(s, t, ret, false);
+			break;
+		
+		case 0b000011:
+			ret = s / t;
+			exc = fpuPrvExcDiv(s, t, ret, false);
+			break;
+		
+		default:
+			__builtin_unreachable();
+			break;
+	}
+	
+	*retP = (exc & FCR_INVAL_OP) ? fpuPrvNanF() : ret;
+	return exc;
+}
+
+//CVT.S.D
+static uint_fast8_t fpuPrvNarrow(double d, float *retP)
+{
+	float ret;
+	
+	if (fpuPrvIsNan(d)) {
+		
+		*retP = fpuPrvNanF();
+		return fpuPrvIsSnan(d) ? FCR_INVAL_OP : 0;
+	}
+	
+	*retP = ret = d;
+	if (fpuPrvIsInf(d) || !d)
+		return 0;
+	if (fpuPrvIsInf(ret))
+		return FCR_CEF_OVERFLOW | FCR_CEF_INEXACT;
+	if (!ret)
+		return FCR_CEF_UDERFLOW | FCR_CEF_INEXACT;
+	if ((double)ret == d)
+		return 0;
+	
+	return fpuPrvInexact(ret, false);
+}
+
+//CVT.S.W, floats have 24 bits to hold it in
+static uint_fast8_t fpuPrvWordToF(int32_t w, float *retP)
+{
+	uint32_t mag = w < 0 ? -(uint32_t)w : (uint32_t)w;
+	
+	*retP = w;
+	
+	return (mag && 32 - __builtin_clz(mag) - __builtin_ctz(mag) > 24) ? FCR_CEF_INEXACT : 0;
+}
+
+//CVT.W.fmt and friends, rounding as rm says (FCR's encoding). NaNs and whatever does not fit produce the largest int
+static uint_fast8_t fpuPrvToWord(double src, uint_fast8_t rm, uint32_t *dstP)
+{
+	double rounded;
+	
+	if (fpuPrvIsNan(src) || fpuPrvIsInf(src))
+		goto invalid;
+	
+	switch (rm) {
+		case 0:	//round to nearest, ties to even
+			rounded = rint(src);
+			break;
+		
+		case 1:	//round to zero
+			rounded = trunc(src);
+			break;
+		
+		case 2:	//round to +inf
+			rounded = ceil(src);
+			break;
+		
+		case 3:	//round to -inf
+			rounded = floor(src);
+			break;
+		
+		default:
+			__builtin_unreachable();
+			break;
+	}
+	
+	if (rounded < -2147483648.0 || rounded > 2147483647.0)
+		goto invalid;
+	
+	*dstP = (int32_t)rounded;
+	return (rounded != src) ? FCR_CEF_INEXACT : 0;
+	
+invalid:
+	*dstP = 0x7fffffff;
+	return FCR_INVAL_OP;
+}
+
+//note the exceptions in FCR, returns true if any of them traps
+static bool fpuPrvRaise(struct FpuState *fpu, uint_fast8_t exc)
+{
+	fpu->fcr |= (((uint32_t)exc) << FCR_SHIFT_CAUSE) | (((uint32_t)exc) << FCR_SHIFT_FLAGS);
+	
+	return !!(fpu->fcr & (((uint32_t)exc) << FCR_SHIFT_ENABLES));
+}
+
 static inline uint_fast8_t fpuPrvGetFpRegNumT(uint32_t instr)
 {
 	return (instr >> 16) & 0x1f;
@@ -95,14 +490,12 @@ static inline void cpuSetRegT(uint32_t instr, uint32_t val, uint32_t *cpuRegs)
 enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 {
 	bool isDouble = false, isFloat = false, isFixed = false;
-	uint_fast8_t op;
+	uint_fast8_t op, exc;
 	
 	//the minute anyone enables any trapping we cnanot easily support, we are GTFOing and letting the FPU emulator take it on...
 	if (fpu->fcr & ((FCR_INVAL_OP | FCR_CEF_OVERFLOW | FCR_CEF_UDERFLOW | FCR_CEF_INEXACT) << FCR_SHIFT_ENABLES))
 		goto inval;
 	
-	fpu->fcr &=~ FCR_PEROP_FLAGS;
-	
 	switch ((instr >> 21) & 0x1f) {
 		
 		case 0:	//MFC
@@ -184,128 +577,45 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 	#ifdef FPU_SUPPORT_MINIMAL
 		return FpuCoprocUseException;	
 	#endif
+	
+	//cause bits are left alone by moves and branches, so that they can still be read after the op that set them
+	fpu->fcr &=~ FCR_PEROP_FLAGS;
 
 	switch (op = (instr & 0x3f)) {
 	
 		case 0b000000:	//ADD.fmt
-			if (isDouble) {
-				double ret;
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2] + fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
-				
-				LOG("d%02u (%f) + d%02u (%f) -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)] + fpu->f[fpuPrvGetFpRegNumT(instr)];
-				
-				LOG("f%02u (%f) + f%02u (%f) -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				return FpuRetInstrInval;
-			break;
-		
 		case 0b000001:	//SUB.fmt
-			if (isDouble) {
-				double ret;
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2] - fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
-				
-				LOG("d%02u (%f) - d%02u (%f) -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)] - fpu->f[fpuPrvGetFpRegNumT(instr)];
-				
-				LOG("f%02u (%f) + f%02u (%f) -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				return FpuRetInstrInval;
-			break;
-		
 		case 0b000010:	//MUL.fmt
-			if (isDouble) {
-				double ret;
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2] * fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
-				
-				LOG("d%02u (%f) * d%02u (%f) -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)] * fpu->f[fpuPrvGetFpRegNumT(instr)];
-				
-				LOG("f%02u (%f) * f%02u (%f) -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				return FpuRetInstrInval;
-			break;
-		
 		case 0b000011:	//DIV.fmt
+			if (fpu->fcr & FCR_RM_MASK)		//we can only round to nearest
+				goto inval;
 			if (isDouble) {
-				
-				double denom = fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
 				double ret;
 				
-				if (!denom) {
-					fpu->fcr |= ((FCR_CEF_DIV0 << FCR_SHIFT_CAUSE) | (FCR_CEF_DIV0 << FCR_SHIFT_FLAGS));
-					if (fpu->fcr & (FCR_CEF_DIV0 << FCR_SHIFT_ENABLES))
-						return FpuRetExcTaken;
-				}
+				exc = fpuPrvArithD(op, fpu->d[fpuPrvGetFpRegNumS(instr) / 2], fpu->d[fpuPrvGetFpRegNumT(instr) / 2], &ret);
 				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2] / denom;
-				LOG("d%02u (%f) / d%02u (%f) -> d%02u (%f)\r\n",
+				LOG("d%02u (%f) %c d%02u (%f) -> d%02u (%f), exc %02x\r\n",
 					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
+					"+-*/"[op],
 					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
+					fpuPrvGetFpRegNumD(instr) / 2, ret, exc);
+				if (fpuPrvRaise(fpu, exc))
+					return FpuRetExcTaken;
 				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
 			}
 			else if (isFloat) {
 				
-				float denom = fpu->f[fpuPrvGetFpRegNumT(instr)];
 				float ret;
 				
-				if (!denom) {
-					fpu->fcr |= ((FCR_CEF_DIV0 << FCR_SHIFT_CAUSE) | (FCR_CEF_DIV0 << FCR_SHIFT_FLAGS));
-					if (fpu->fcr & (FCR_CEF_DIV0 << FCR_SHIFT_ENABLES))
-						return FpuRetExcTaken;
-				}
+				exc = fpuPrvArithF(op, fpu->f[fpuPrvGetFpRegNumS(instr)], fpu->f[fpuPrvGetFpRegNumT(instr)], &ret);
 				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)] / denom;
-				LOG("f%02u (%f) / f%02u (%f) -> f%02u (%f)\r\n",
+				LOG("f%02u (%f) %c f%02u (%f) -> f%02u (%f), exc %02x\r\n",
 					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
+					"+-*/"[op],
 					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
+					fpuPrvGetFpRegNumD(instr), ret, exc);
+				if (fpuPrvRaise(fpu, exc))
+					return FpuRetExcTaken;
 				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
 			}
 			else
@@ -391,137 +701,50 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 				goto inval;
 			break;
 	
-	#ifdef SUPPORT_FPU_R4000
-		
-		case 0b001100:	//round.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				ret = round(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-				LOG("d%02u (%f) ROUND -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				ret = roundf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-				LOG("f%02u (%f) ROUND -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b001101:	//trunc.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
-				LOG("d%02u (%f) TRUNC -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)];
-				LOG("f%02u (%f) TRUNC -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
+		case 0b100000:	//CVT.S.fmt
+			if (fpu->fcr & FCR_RM_MASK)
 				goto inval;
-			break;
-		
-		case 0b001110:	//ceil.W.fmt
 			if (isDouble) {
 				
-				int32_t ret;
-				
-				ret = ceil(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-				LOG("d%02u (%f) CEIL -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				ret = ceilf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-				LOG("f%02u (%f) CEIL -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b001111:	//floor.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				ret = floor(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-				LOG("d%02u (%f) FLOOR -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				ret = floorf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-				LOG("f%02u (%f) FLOOR -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;	
-	
-	#endif
-	
-		case 0b100000:	//CVT.S.fmt
-			if (isDouble) {
+				float ret;
 				
-				float ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
+				exc = fpuPrvNarrow(fpu->d[fpuPrvGetFpRegNumS(instr) / 2], &ret);
 				
-				LOG("d%02u (%f) CVT.S.D -> f%02u (%f)\r\n",
+				LOG("d%02u (%f) CVT.S.D -> f%02u (%f), exc %02x\r\n",
 					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
+					fpuPrvGetFpRegNumD(instr), ret, exc);
+				if (fpuPrvRaise(fpu, exc))
+					return FpuRetExcTaken;
 				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
 			}
 			else if (isFixed) {
 				
-				float ret = (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)];
+				float ret;
 				
-				LOG("f%02u (%d) CVT.S.W -> f%02u (%f)\r\n",
+				exc = fpuPrvWordToF((int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)], &ret);
+				
+				LOG("f%02u (%d) CVT.S.W -> f%02u (%f), exc %02x\r\n",
 					fpuPrvGetFpRegNumS(instr), (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
+					fpuPrvGetFpRegNumD(instr), ret, exc);
+				if (fpuPrvRaise(fpu, exc))
+					return FpuRetExcTaken;
 				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
 			}
 			else
 				goto inval;
 			break;
 		
-		case 0b100001:	//CVT.D.fmt
+		case 0b100001:	//CVT.D.fmt, always exact
 			if (isFloat) {
 				double ret = fpu->f[fpuPrvGetFpRegNumS(instr)];
 				
+				if (fpuPrvIsNanF(fpu->f[fpuPrvGetFpRegNumS(instr)])) {
+					
+					ret = fpuPrvNanD();
+					if (fpuPrvIsSnanF(fpu->f[fpuPrvGetFpRegNumS(instr)]) && fpuPrvRaise(fpu, FCR_INVAL_OP))
+						return FpuRetExcTaken;
+				}
+				
 				LOG("f%02u (%f) CVT.D.S -> d%02u (%f)\r\n",
 					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
 					fpuPrvGetFpRegNumD(instr) / 2, ret);
@@ -539,72 +762,36 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 				goto inval;
 			break;
 		
+	#ifdef SUPPORT_FPU_R4000
+		case 0b001100:	//round.W.fmt
+		case 0b001101:	//trunc.W.fmt
+		case 0b001110:	//ceil.W.fmt
+		case 0b001111:	//floor.W.fmt
+	#endif
 		case 0b100100:	//CVT.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				switch (fpu->fcr & 3) {
-					case 0:	//round to nearest
-						ret = round(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-						break;
-					
-					case 1:	//round to zero
-						ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
-						break;
-					
-					case 2:	//round to +inf
-						ret = ceil(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-						break;
-					
-					case 3:	//round to -inf
-						ret = floor(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-						break;
-					
-					default:
-						__builtin_unreachable();
-						break;
-				}
-				
-				LOG("d%02u (%f) CVT.W.D -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				switch (fpu->fcr & 3) {
-					case 0:	//round to nearest
-						ret = roundf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-						break;
-					
-					case 1:	//round to zero
-						ret = fpu->f[fpuPrvGetFpRegNumS(instr)];
-						break;
-					
-					case 2:	//round to +inf
-						ret = ceilf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-						break;
-					
-					case 3:	//round to -inf
-						ret = floorf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-						break;
-					
-					default:
-						__builtin_unreachable();
-						break;
-				}
-				
-				LOG("f%02u (%f) CVT.W.S -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
+		{
+			//the R4000 ones have the rounding mode in the opcode, encoded just like in FCR
+			uint_fast8_t rm = (op == 0b100100) ? (fpu->fcr & FCR_RM_MASK) : (op & FCR_RM_MASK);
+			uint32_t ret;
+			double src;
+			
+			if (isDouble)
+				src = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
+			else if (isFloat)
+				src = fpu->f[fpuPrvGetFpRegNumS(instr)];
 			else
 				goto inval;
+			
+			exc = fpuPrvToWord(src, rm, &ret);
+			
+			LOG("%c%02u (%f) CVT.W rm%u -> f%02u (%d), exc %02x\r\n",
+				isDouble ? 'd' : 'f', isDouble ? fpuPrvGetFpRegNumS(instr) / 2 : fpuPrvGetFpRegNumS(instr), src,
+				rm, fpuPrvGetFpRegNumD(instr), (int32_t)ret, exc);
+			if (fpuPrvRaise(fpu, exc))
+				return FpuRetExcTaken;
+			fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
 			break;
+		}
 	
 		//compares (specializing these might gain speed)
 		//see page 670 of r4000 doc!!!
@@ -627,6 +814,7 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 		{
 			static const char *names[] = {"f", "un", "eq", "ueq", "olt", "ult",  "ole", "ule", "sf", "ngle", "seq", "ngl", "lt", "nge", "le", "ngt", };
 			uint_fast8_t cond = 0;
+			bool snan = false;
 			
 			(void)names;
 			
@@ -635,7 +823,8 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 				double s = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
 				double t = fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
 				
-				if (isnan(s) || isnan(t))
+				snan = fpuPrvIsSnan(s) || fpuPrvIsSnan(t);
+				if (fpuPrvIsNan(s) || fpuPrvIsNan(t))
 					cond += 1;
 				else {
 					
@@ -657,7 +846,8 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 				float s = fpu->f[fpuPrvGetFpRegNumS(instr)];
 				float t = fpu->f[fpuPrvGetFpRegNumT(instr)];
 				
-				if (isnan(s) || isnan(t))
+				snan = fpuPrvIsSnanF(s) || fpuPrvIsSnanF(t);
+				if (fpuPrvIsNanF(s) || fpuPrvIsNanF(t))
 					cond += 1;
 				else {
 					
@@ -677,11 +867,9 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 			else
 				goto inval;
 			
-			if ((cond & 1) && (op & 0b1000)) {
-				
-				fpu->fcr |= ((FCR_INVAL_OP << FCR_SHIFT_CAUSE) | (FCR_INVAL_OP << FCR_SHIFT_FLAGS));
+			//the signaling ones complain about any NaN, the rest only about signaling NaNs
+			if ((cond & 1) && ((op & 0b1000) || snan) && fpuPrvRaise(fpu, FCR_INVAL_OP))
 				return FpuRetExcTaken;
-			}
 			
 			if (op & cond)
 				fpu->fcr |= FCR_C;
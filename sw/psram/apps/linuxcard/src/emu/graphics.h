@@ -9,6 +9,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+struct Snapshot;
+
 
 #define SCREEN_WIDTH				(1024)
 #define SCREEN_HEIGHT				(864)
@@ -38,6 +40,7 @@
 bool graphicsInit(void);
 void graphicsPeriodic(void);
 void graphicsSetStart(uint32_t mFbBase, uint32_t mPaletteBase, uint32_t mCursorBase);
+void graphicsSnapshot(struct Snapshot *ss);		//palette, cursor, VDAC and framebuffer contents
 
 
 #endif
@@ -4,11 +4,14 @@
 */
 
 #include <stdio.h>
+#include "hardware/irq.h"
 #include "fb_mono.h"
+#include "snapshot.h"
 #include "graphics.h"
 #include "spiRam.h"
 #include "mem.h"
 #include "printf.h"
+#include "core1.h"
 #include "cpu.h"
 
 #define CURSOR_X_OFST		(212)
@@ -42,6 +45,11 @@ static bool mRedrawDue;
 
 static uint32_t mPalette[256], mOverlayColors[16];
 static uint8_t mColorPlaneMask;
+
+static struct VdacAccessWindow mVdacWindows[2] = {
+	[0] = {.data = mPalette, .inProgressWrite = 0x01000000, .numItemsMask = 0xff, },
+	[1] = {.data = mOverlayColors, .inProgressWrite = 0x01000000, .numItemsMask = 0x0f, },
+};
 //static uint8_t mFramebuffer[SCREEN_BYTES];
 
 extern uint32_t mFbBase, mPaletteBase, mCursorBase;
@@ -286,11 +294,6 @@ static bool gfxPrvColorPlaneMask(uint32_t paOfst, uint_fast8_t size, bool write,
 
 static bool gfxPrvVdac(uint32_t paOfst, uint_fast8_t size, bool write, void* buf)
 {
-
-	static struct VdacAccessWindow windows[2] = {
-		[0] = {.data = mPalette, .inProgressWrite = 0x01000000, .numItemsMask = 0xff, },
-		[1] = {.data = mOverlayColors, .inProgressWrite = 0x01000000, .numItemsMask = 0x0f, },
-	};
 	struct VdacAccessWindow *win;
 	bool changed = false;
 	uint_fast16_t v;
@@ -314,7 +317,7 @@ static bool gfxPrvVdac(uint32_t paOfst, uint_fast8_t size, bool write, void* buf
 	if (paOfst >= 0x20)		//not documented but accessed by prom
 		return write;
 	
-	win = &windows[paOfst >> 4];
+	win = &mVdacWindows[paOfst >> 4];
 	switch ((paOfst / 4) & 3) {
 		case 0:		//WA
 			if (write)
@@ -487,6 +490,70 @@ static bool graphicsMemAccess(uint32_t pa, uint_fast8_t size, bool write, void*
 	return false;
 }
 
+static void gfxPrvSnapshotFramebuffer(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice)
+{
+	uint8_t *data = (uint8_t*)buf;
+	uint32_t now;
+	
+	(void)userData;
+	
+	for (; len; len -= now, ofst += now, data += now) {
+		
+		now = len > 1024 ? 1024 : len;		//no 1K boundary crossings
+		if (toDevice)
+			spiRamWritePort(mFbBase + ofst, data, now, SpiRamPortIo);
+		else
+			spiRamReadPort(mFbBase + ofst, data, now, SpiRamPortIo);
+	}
+}
+
+void graphicsSnapshot(struct Snapshot *ss)
+{
+	uint_fast8_t i;
+	
+	snapshotSection(ss, SNAPSHOT_TAG('G', 'F', 'X', ' '));
+	snapshotBytes(ss, mPalette, sizeof(mPalette));				//we are LE, as is the file
+	snapshotBytes(ss, mOverlayColors, sizeof(mOverlayColors));
+	snapshotField(ss, mColorPlaneMask);
+	for (i = 0; i < 2; i++) {
+		
+		snapshotField(ss, mVdacWindows[i].inProgressWrite);
+		snapshotField(ss, mVdacWindows[i].inProgressRead);
+		snapshotField(ss, mVdacWindows[i].mapWA);
+		snapshotField(ss, mVdacWindows[i].mapRA);
+	}
+	snapshotBool(ss, &mCursorEnabled);
+	snapshotField(ss, mCursorX);
+	snapshotField(ss, mCursorY);
+	snapshotField(ss, mCursorWritePtr);
+	for (i = 0; i < 16; i++) {
+		
+		snapshotField(ss, cursor_planeA[i]);
+		snapshotField(ss, cursor_planeB[i]);
+	}
+	snapshotBulk(ss, SCREEN_BYTES, gfxPrvSnapshotFramebuffer, NULL);
+	
+	if (!ss->saving && ss->ok) {
+		
+		fb_mono_set_cursor_pos(mCursorX - CURSOR_X_OFST, mCursorY - CURSOR_Y_OFST);
+		fb_mono_set_overlay_color(1, mOverlayColors[4]);
+		fb_mono_set_overlay_color(2, mOverlayColors[8]);
+		fb_mono_set_overlay_color(3, mOverlayColors[12]);
+	}
+}
+
+#ifndef NO_FRAMEBUFFER
+
+	//runs on core1: from now on the vsync irq (and the cursor compositing it does) interrupts it instead of the cpu
+	static void gfxPrvVsyncIrqToCore1(void *userData, uint32_t irq)
+	{
+		(void)userData;
+		
+		irq_set_enabled(irq, true);
+	}
+
+#endif
+
 bool graphicsInit(void)
 {
 
@@ -508,6 +575,13 @@ bool graphicsInit(void)
 	  fb_mono_cb_addr = graphicsPeriodic;
 	  pr("cb: %08x\n", (uint32_t)fb_mono_cb_addr);
 	  (*fb_mono_cb_addr)();
+	  
+	  //fb_mono_init() enabled it here, on core0. the handler is in the vector table both cores share
+	  uint irq = (_inst.pio_vid == pio0) ? PIO0_IRQ_0 : PIO1_IRQ_0;
+	  
+	  irq_set_enabled(irq, false);
+	  if (!core1Call(gfxPrvVsyncIrqToCore1, NULL, irq))
+	    irq_set_enabled(irq, true);
 	} else {
 	  pr("Video mode setup error or video not enabled\n");
 	}
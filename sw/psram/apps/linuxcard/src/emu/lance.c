@@ -4,6 +4,8 @@
 */
 
 #include <stdio.h>
+#include <string.h>
+#include "snapshot.h"
 #include "printf.h"
 #include "lance.h"
 #include "mem.h"
@@ -23,16 +25,25 @@ struct Lance {
 	uint32_t acon	: 1;
 	uint32_t bcon	: 1;
 	uint16_t csr0;
+	
+#ifndef MICRO_LANCE
+	//from the init block
+	uint16_t mode;
+	uint8_t padr[6];
+	uint8_t ladrf[8];
+	uint16_t rdra, tdra;		//ring bases, within the buffer
+	uint8_t rlenOrder, tlenOrder;
+	
+	//next descriptor each ring will look at
+	uint8_t rxIdx, txIdx;
+	
+	const struct LanceBackend *backend;
+	void *backendData;
+#endif
 };
 
-#define LANCE_BUFFER_SIZE		(65536)
-
 static struct Lance mLance;
 
-#ifndef MICRO_LANCE
-	static uint8_t mLanceBuffer[LANCE_BUFFER_SIZE];
-#endif
-
 #define LANCE_CSR0_ERR			0x8000
 #define LANCE_CSR0_BABL			0x4000
 #define LANCE_CSR0_CERR			0x2000
@@ -54,6 +65,36 @@ static struct Lance mLance;
 #define LANCE_CSR3_ACON			0x0002
 #define LANCE_CSR3_BCON			0x0001
 
+#define LANCE_MODE_PROM			0x8000
+#define LANCE_MODE_INTL			0x0040
+#define LANCE_MODE_LOOP			0x0004
+#define LANCE_MODE_DTX			0x0002
+#define LANCE_MODE_DRX			0x0001
+
+//descriptor word 1 (RMD1/TMD1)
+#define LANCE_DESC_OWN			0x8000
+#define LANCE_DESC_ERR			0x4000
+#define LANCE_RMD1_FRAM			0x2000
+#define LANCE_RMD1_OFLO			0x1000
+#define LANCE_RMD1_CRC			0x0800
+#define LANCE_RMD1_BUFF			0x0400
+#define LANCE_TMD1_MORE			0x1000
+#define LANCE_TMD1_ONE			0x0800
+#define LANCE_TMD1_DEF			0x0400
+#define LANCE_DESC_STP			0x0200
+#define LANCE_DESC_ENP			0x0100
+#define LANCE_DESC_HADR_MASK	0x00ff
+
+//TMD3
+#define LANCE_TMD3_BUFF			0x8000
+#define LANCE_TMD3_UFLO			0x4000
+
+#define LANCE_MIN_FRAME			64		//with FCS
+#define LANCE_MAX_FRAME			1518	//with FCS
+#define LANCE_FCS_LEN			4
+
+#define LANCE_SNAPSHOT_RING_STATE_SZ	(7 * sizeof(uint32_t) + 6 + 8)		//init block and ring position fields, as saved
+
 static void lancePrvIrqRecalc(void)
 {
 	cpuIrq(SOC_IRQNO_ETHERNET, (mLance.csr0 & (LANCE_CSR0_INTR | LANCE_CSR0_INEA)) == (LANCE_CSR0_INTR | LANCE_CSR0_INEA));
@@ -74,10 +115,345 @@ static void lancePrvCsr0recalc(void)
 	lancePrvIrqRecalc();
 }
 
-static void lancePrvDoInit(void)
-{
-	///todo
-}
+#ifndef MICRO_LANCE
+
+	static uint8_t mFrame[LANCE_MAX_FRAME];		//one frame on its way in or out
+	
+	//chip DMA into/out of the buffer. false (MERR) if outside of it
+	static bool lancePrvDmaRead(uint32_t addr, uint8_t *dst, uint32_t len)
+	{
+		if (addr >= LANCE_BUFFER_SIZE || LANCE_BUFFER_SIZE - addr < len)
+			return false;
+		
+		if (len && (addr & 1)) {
+			
+			*dst++ = lancePrvBufferRead(addr / 2) >> 8;
+			addr++;
+			len--;
+		}
+		if (len >= 2) {
+			
+			lancePrvBufferReadBlock(addr / 2, dst, len / 2);
+			dst += len &~ 1;
+			addr += len &~ 1;
+			len &= 1;
+		}
+		if (len)
+			*dst = lancePrvBufferRead(addr / 2);
+		
+		return true;
+	}
+	
+	static bool lancePrvDmaWrite(uint32_t addr, const uint8_t *src, uint32_t len)
+	{
+		if (addr >= LANCE_BUFFER_SIZE || LANCE_BUFFER_SIZE - addr < len)
+			return false;
+		
+		if (len && (addr & 1)) {
+			
+			lancePrvBufferWrite(addr / 2, (lancePrvBufferRead(addr / 2) & 0x00ff) + (((uint_fast16_t)*src++) << 8));
+			addr++;
+			len--;
+		}
+		if (len >= 2) {
+			
+			lancePrvBufferWriteBlock(addr / 2, src, len / 2);
+			src += len &~ 1;
+			addr += len &~ 1;
+			len &= 1;
+		}
+		if (len)
+			lancePrvBufferWrite(addr / 2, (lancePrvBufferRead(addr / 2) & 0xff00) + *src);
+		
+		return true;
+	}
+	
+	static uint32_t lancePrvDesc(uint16_t ring, uint_fast8_t lenOrder, uint_fast8_t idx)
+	{
+		return (uint16_t)(ring + (idx & ((1 << lenOrder) - 1)) * 8);
+	}
+	
+	static uint_fast16_t lancePrvDescRead(uint32_t desc, uint_fast8_t word)
+	{
+		return lancePrvBufferRead(desc / 2 + word);
+	}
+	
+	static void lancePrvDescWrite(uint32_t desc, uint_fast8_t word, uint_fast16_t val)
+	{
+		lancePrvBufferWrite(desc / 2 + word, val);
+	}
+	
+	static uint32_t lancePrvDescBufAddr(uint32_t desc)
+	{
+		return lancePrvDescRead(desc, 0) + (((uint32_t)(lancePrvDescRead(desc, 1) & LANCE_DESC_HADR_MASK)) << 16);
+	}
+	
+	static uint32_t lancePrvDescBufLen(uint32_t desc)		//BCNT is a negative 12-bit number
+	{
+		uint32_t len = (0 - lancePrvDescRead(desc, 2)) & 0x0fff;
+		
+		return len ? len : 0x1000;
+	}
+	
+	static bool lancePrvRxAccept(const uint8_t *dst)
+	{
+		static const uint8_t bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+		uint32_t crc = 0xffffffff;
+		uint_fast8_t i, j;
+		
+		if (mLance.mode & LANCE_MODE_PROM)
+			return true;
+		
+		if (!(dst[0] & 1))
+			return !memcmp(dst, mLance.padr, sizeof(mLance.padr));
+		
+		if (!memcmp(dst, bcast, sizeof(bcast)))
+			return true;
+		
+		//multicast: top 6 bits of the (LE) ethernet CRC of the address index LADRF
+		for (i = 0; i < 6; i++) {
+			
+			crc ^= dst[i];
+			for (j = 0; j < 8; j++)
+				crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+		}
+		crc >>= 26;
+		
+		return (mLance.ladrf[crc / 8] >> (crc % 8)) & 1;
+	}
+	
+	static void lancePrvRxFrame(uint32_t len)		//frame is in mFrame, without FCS
+	{
+		uint_fast8_t i, n, ringLen = 1 << mLance.rlenOrder;
+		uint32_t desc, total, done = 0, now;
+		uint_fast16_t rmd1;
+		bool merr = false;
+		
+		if (!(mLance.csr0 & LANCE_CSR0_RXON) || len < 14 || len > LANCE_MAX_FRAME - LANCE_FCS_LEN || !lancePrvRxAccept(mFrame))
+			return;
+		
+		//pad runts, append an FCS (nobody checks it)
+		total = len + LANCE_FCS_LEN;
+		if (total < LANCE_MIN_FRAME)
+			total = LANCE_MIN_FRAME;
+		memset(mFrame + len, 0, total - len);
+		
+		//fill as many buffers as it takes
+		for (n = 0; n < ringLen && done < total; n++) {
+			
+			desc = lancePrvDesc(mLance.rdra, mLance.rlenOrder, mLance.rxIdx + n);
+			if (!(lancePrvDescRead(desc, 1) & LANCE_DESC_OWN))
+				break;
+			
+			now = lancePrvDescBufLen(desc);
+			if (now > total - done)
+				now = total - done;
+			
+			if (!lancePrvDmaWrite(lancePrvDescBufAddr(desc), mFrame + done, now)) {
+				
+				merr = true;
+				n++;
+				break;
+			}
+			done += now;
+		}
+		
+		if (!n) {
+			
+			mLance.csr0 |= LANCE_CSR0_MISS;
+			return;
+		}
+		
+		if (merr)
+			mLance.csr0 |= LANCE_CSR0_MERR;
+		
+		//give the buffers back, first one last so the driver never sees half a frame
+		for (i = n; i-- > 0;) {
+			
+			desc = lancePrvDesc(mLance.rdra, mLance.rlenOrder, mLance.rxIdx + i);
+			rmd1 = lancePrvDescRead(desc, 1) & LANCE_DESC_HADR_MASK;
+			if (!i)
+				rmd1 |= LANCE_DESC_STP;
+			if (i == n - 1) {
+				
+				if (done == total) {
+					
+					rmd1 |= LANCE_DESC_ENP;
+					lancePrvDescWrite(desc, 3, total);
+				}
+				else		//ran out of buffers
+					rmd1 |= LANCE_DESC_ERR | LANCE_RMD1_BUFF;
+			}
+			lancePrvDescWrite(desc, 1, rmd1);
+		}
+		mLance.rxIdx = (mLance.rxIdx + n) & (ringLen - 1);
+		mLance.csr0 |= LANCE_CSR0_RINT;
+	}
+	
+	static void lancePrvTxFrame(uint32_t len)		//frame is in mFrame
+	{
+		if (mLance.mode & LANCE_MODE_LOOP)			//internal or external, either way it comes straight back
+			lancePrvRxFrame(len);
+		else if (mLance.backend)
+			(void)mLance.backend->txFrame(mLance.backendData, mFrame, len);
+	}
+	
+	static void lancePrvTxPoll(void)
+	{
+		uint_fast8_t i, n, ringLen = 1 << mLance.tlenOrder;
+		uint32_t desc, len, frameLen;
+		uint_fast16_t tmd1, tmd3;
+		
+		if (!(mLance.csr0 & LANCE_CSR0_TXON))
+			return;
+		
+		while (1) {
+			
+			//only go once the driver has handed over the whole frame
+			for (n = 0; n < ringLen; n++) {
+				
+				tmd1 = lancePrvDescRead(lancePrvDesc(mLance.tdra, mLance.tlenOrder, mLance.txIdx + n), 1);
+				if (!(tmd1 & LANCE_DESC_OWN))
+					return;
+				if (tmd1 & LANCE_DESC_ENP)
+					break;
+			}
+			if (n++ == ringLen)		//no ENP anywhere
+				return;
+			
+			//gather it
+			tmd3 = 0;
+			frameLen = 0;
+			for (i = 0; i < n && !tmd3; i++) {
+				
+				desc = lancePrvDesc(mLance.tdra, mLance.tlenOrder, mLance.txIdx + i);
+				len = lancePrvDescBufLen(desc);
+				
+				if (len > sizeof(mFrame) - frameLen)
+					tmd3 = LANCE_TMD3_BUFF;
+				else if (!lancePrvDmaRead(lancePrvDescBufAddr(desc), mFrame + frameLen, len)) {
+					
+					tmd3 = LANCE_TMD3_BUFF;
+					mLance.csr0 |= LANCE_CSR0_MERR;
+				}
+				frameLen += len;
+			}
+			
+			if (!tmd3)
+				lancePrvTxFrame(frameLen);
+			else if (VERBOSE)
+				err_str("LANCE dropping TX frame\r\n");
+			
+			//hand the descriptors back
+			for (i = 0; i < n; i++) {
+				
+				desc = lancePrvDesc(mLance.tdra, mLance.tlenOrder, mLance.txIdx + i);
+				tmd1 = lancePrvDescRead(desc, 1) &~ (LANCE_DESC_OWN | LANCE_DESC_ERR | LANCE_TMD1_MORE | LANCE_TMD1_ONE | LANCE_TMD1_DEF);
+				if (tmd3 && i == n - 1)
+					tmd1 |= LANCE_DESC_ERR;
+				lancePrvDescWrite(desc, 3, tmd3);
+				lancePrvDescWrite(desc, 1, tmd1);
+			}
+			mLance.txIdx = (mLance.txIdx + n) & (ringLen - 1);
+			mLance.csr0 |= LANCE_CSR0_TINT;
+		}
+	}
+	
+	static void lancePrvRxPoll(void)
+	{
+		uint_fast8_t n, ringLen = 1 << mLance.rlenOrder;
+		uint32_t len;
+		
+		if (!mLance.backend || !mLance.backend->rxFrame)
+			return;
+		
+		//leave frames with the backend while we have nowhere to put them
+		for (n = 0; n < ringLen && (mLance.csr0 & LANCE_CSR0_RXON); n++) {
+			
+			if (!(lancePrvDescRead(lancePrvDesc(mLance.rdra, mLance.rlenOrder, mLance.rxIdx), 1) & LANCE_DESC_OWN))
+				break;
+			
+			len = mLance.backend->rxFrame(mLance.backendData, mFrame, sizeof(mFrame) - LANCE_FCS_LEN);
+			if (!len)
+				break;
+			
+			lancePrvRxFrame(len);
+		}
+	}
+	
+	static bool lancePrvDoInit(void)
+	{
+		uint16_t ib[12];
+		
+		if (!lancePrvDmaRead(mLance.iadr, (uint8_t*)ib, sizeof(ib)))		//works if we're LE
+			return false;
+		
+		mLance.mode = ib[0];
+		memcpy(mLance.padr, ib + 1, sizeof(mLance.padr));
+		memcpy(mLance.ladrf, ib + 4, sizeof(mLance.ladrf));
+		mLance.rdra = ib[8] &~ 7;
+		mLance.rlenOrder = ib[9] >> 13;
+		mLance.tdra = ib[10] &~ 7;
+		mLance.tlenOrder = ib[11] >> 13;
+		mLance.rxIdx = 0;
+		mLance.txIdx = 0;
+		
+		if (VERBOSE)
+			err_str("LANCE init: mode 0x%04x, %u RX descrs @ 0x%04x, %u TX descrs @ 0x%04x\r\n", mLance.mode, 1 << mLance.rlenOrder, mLance.rdra, 1 << mLance.tlenOrder, mLance.tdra);
+		
+		return true;
+	}
+	
+	static void lancePrvStart(void)
+	{
+		if (!(mLance.mode & LANCE_MODE_DRX))
+			mLance.csr0 |= LANCE_CSR0_RXON;
+		if (!(mLance.mode & LANCE_MODE_DTX))
+			mLance.csr0 |= LANCE_CSR0_TXON;
+	}
+	
+	void lanceSetBackend(const struct LanceBackend *backend, void *userData)
+	{
+		mLance.backend = backend;
+		mLance.backendData = userData;
+	}
+	
+	void lancePoll(void)
+	{
+		if (mLance.csr0 & LANCE_CSR0_STOP)
+			return;
+		
+		lancePrvTxPoll();
+		lancePrvRxPoll();
+		lancePrvCsr0recalc();
+	}
+
+#else
+
+	static bool lancePrvDoInit(void)
+	{
+		return true;
+	}
+	
+	static void lancePrvStart(void)
+	{
+	}
+	
+	static void lancePrvTxPoll(void)
+	{
+	}
+	
+	void lanceSetBackend(const struct LanceBackend *backend, void *userData)
+	{
+		(void)backend;
+		(void)userData;
+	}
+	
+	void lancePoll(void)
+	{
+	}
+
+#endif
 
 static bool lancePrvCsrWrite(uint_fast16_t v)
 {
@@ -90,21 +466,34 @@ static bool lancePrvCsrWrite(uint_fast16_t v)
 		mLance.csr0 |= v & (LANCE_CSR0_INEA | LANCE_CSR0_TDMD);
 		if (v & LANCE_CSR0_STOP)
 			mLance.csr0 = LANCE_CSR0_STOP;
-		else if (v & LANCE_CSR0_STRT) {
-	//		if (!(mLance.csr0 & LANCE_CSR0_STOP))
-	//			return false;
-			mLance.csr0 &=~ LANCE_CSR0_STOP;
-			mLance.csr0 |= LANCE_CSR0_STRT;
-		}
-		else if (v & LANCE_CSR0_INIT) {
-	//		if (!(mLance.csr0 & LANCE_CSR0_STOP))
-	//			return false;
-			mLance.csr0 &=~ LANCE_CSR0_STOP;
-			mLance.csr0 |= LANCE_CSR0_INIT;
+		else {
 			
-			lancePrvDoInit();
+			if (v & LANCE_CSR0_INIT) {
+		//		if (!(mLance.csr0 & LANCE_CSR0_STOP))
+		//			return false;
+				mLance.csr0 &=~ LANCE_CSR0_STOP;
+				mLance.csr0 |= LANCE_CSR0_INIT;
+				
+				if (lancePrvDoInit())
+					mLance.csr0 |= LANCE_CSR0_IDON;
+				else
+					mLance.csr0 |= LANCE_CSR0_MERR;
+			}
+			if (v & LANCE_CSR0_STRT) {
+		//		if (!(mLance.csr0 & LANCE_CSR0_STOP))
+		//			return false;
+				mLance.csr0 &=~ LANCE_CSR0_STOP;
+				mLance.csr0 |= LANCE_CSR0_STRT;
+				
+				lancePrvStart();
+			}
+		}
+		
+		//transmit demand: look at the TX ring now rather than at the next poll
+		if (mLance.csr0 & LANCE_CSR0_TDMD) {
 			
-			mLance.csr0 |= LANCE_CSR0_IDON;
+			lancePrvTxPoll();
+			mLance.csr0 &=~ LANCE_CSR0_TDMD;
 		}
 		lancePrvCsr0recalc();
 		
@@ -197,18 +586,25 @@ static bool lancePrvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void*
 			if (write) {
 				
 				//assume host is LE - i am lazy, so sue me
-				*(uint16_t*)(mLanceBuffer + pa) = v;
+				if (size == 1)
+					v = (lancePrvBufferRead(pa / 2) & 0xff00) + *(uint8_t*)buf;
+				lancePrvBufferWrite(pa / 2, v);
 				if (VERY_VERBOSE)
-					err_str("LANCERAM[0x%04x] <- 0x%04x\r\n", pa / 2, *vP);
+					err_str("LANCERAM[0x%04x] <- 0x%04x\r\n", pa / 2, (unsigned)v);
 			}
 			else {
 				
-				if (size == 4)		//works if we're LE
-					vP[1] = 0;
-				
-				*vP = *(uint16_t*)(mLanceBuffer + pa);
+				v = lancePrvBufferRead(pa / 2);
+				if (size == 1)
+					*(uint8_t*)buf = v;
+				else {
+					
+					if (size == 4)		//works if we're LE
+						vP[1] = 0;
+					*vP = v;
+				}
 				if (VERY_VERBOSE)
-					err_str("LANCERAM[0x%04x] -> 0x%04x\r\n", pa / 2, *vP);
+					err_str("LANCERAM[0x%04x] -> 0x%04x\r\n", pa / 2, (unsigned)v);
 			}
 		#endif
 		
@@ -258,6 +654,53 @@ static bool lancePrvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void*
 	return ret;
 }
 
+#ifndef MICRO_LANCE
+
+	static void lancePrvSnapshotBuffer(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice)
+	{
+		(void)userData;
+		
+		if (toDevice)
+			lancePrvBufferWriteBlock(ofst / sizeof(uint16_t), buf, len / sizeof(uint16_t));
+		else
+			lancePrvBufferReadBlock(ofst / sizeof(uint16_t), buf, len / sizeof(uint16_t));
+	}
+
+#endif
+
+void lanceSnapshot(struct Snapshot *ss)
+{
+	snapshotSection(ss, SNAPSHOT_TAG('L', 'N', 'C', 'E'));
+	snapshotField(ss, mLance.iadr);
+	snapshotField(ss, mLance.csrNo);
+	snapshotField(ss, mLance.bswp);
+	snapshotField(ss, mLance.acon);
+	snapshotField(ss, mLance.bcon);
+	snapshotField(ss, mLance.csr0);
+	
+	#ifdef MICRO_LANCE
+	
+		snapshotZeros(ss, LANCE_SNAPSHOT_RING_STATE_SZ + LANCE_BUFFER_SIZE);
+	
+	#else
+	
+		snapshotField(ss, mLance.mode);
+		snapshotBytes(ss, mLance.padr, sizeof(mLance.padr));
+		snapshotBytes(ss, mLance.ladrf, sizeof(mLance.ladrf));
+		snapshotField(ss, mLance.rdra);
+		snapshotField(ss, mLance.tdra);
+		snapshotField(ss, mLance.rlenOrder);
+		snapshotField(ss, mLance.tlenOrder);
+		snapshotField(ss, mLance.rxIdx);
+		snapshotField(ss, mLance.txIdx);
+		snapshotBulk(ss, LANCE_BUFFER_SIZE, lancePrvSnapshotBuffer, NULL);
+	
+	#endif
+	
+	if (!ss->saving && ss->ok)
+		lancePrvIrqRecalc();
+}
+
 bool lanceInit(void)
 {
 	mLance.csr0 = LANCE_CSR0_STOP;
@@ -9,12 +9,32 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+struct Snapshot;
+
 
 //if MICRO_LANCE is defined, lance is inoperative but will fool ultrix into happiness
 
+#define LANCE_BUFFER_SIZE		(65536)
+
+struct LanceBackend {		//moves whole frames (no FCS) between the chip and the outside world
+
+	bool (*txFrame)(void *userData, const uint8_t *frame, uint32_t len);
+	uint32_t (*rxFrame)(void *userData, uint8_t *frame, uint32_t maxLen);	//return 0 if nothing is waiting
+};
+
 bool lanceInit(void);
+void lanceSetBackend(const struct LanceBackend *backend, void *userData);	//NULL for an unplugged cable
+void lancePoll(void);		//call periodically: polls the TX ring (like the chip does) and the backend for RX
+void lanceSnapshot(struct Snapshot *ss);	//MICRO_LANCE builds store the same layout, with zeroes for what they lack
 
+//host backends (lanceNetPC.c). spec is "tap:<ifname>", "loop", or "pcap:<file>" (records TX)
+bool lanceNetPcInit(const char *spec);
 
+//externally provided (unless MICRO_LANCE): the buffer RAM, as seen by the chip. words are little endian
+void lancePrvBufferWrite(uint_fast16_t wordIdx, uint_fast16_t val);
+uint_fast16_t lancePrvBufferRead(uint_fast16_t wordIdx);
+void lancePrvBufferWriteBlock(uint_fast16_t wordIdx, const uint8_t *src, uint_fast16_t numWords);
+void lancePrvBufferReadBlock(uint_fast16_t wordIdx, uint8_t *dst, uint_fast16_t numWords);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,191 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <linux/if_tun.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include "lance.h"
+
+
+#define LOOP_QUEUE_LEN		16
+#define MAX_FRAME_LEN		1514
+
+
+//TAP: frames go to/from a host interface (bridge it or give it an address)
+static bool netTapPrvTx(void *userData, const uint8_t *frame, uint32_t len)
+{
+	return write((int)(intptr_t)userData, frame, len) == (ssize_t)len;
+}
+
+static uint32_t netTapPrvRx(void *userData, uint8_t *frame, uint32_t maxLen)
+{
+	ssize_t ret = read((int)(intptr_t)userData, frame, maxLen);
+
+	if (ret < 0 && errno != EAGAIN)
+		perror("tap read");
+
+	return ret > 0 ? ret : 0;
+}
+
+static const struct LanceBackend mTapBackend = {
+	.txFrame = netTapPrvTx,
+	.rxFrame = netTapPrvRx,
+};
+
+static bool netTapPrvInit(const char *ifName)
+{
+	struct ifreq ifr = {};
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+
+		perror("cannot open /dev/net/tun");
+		return false;
+	}
+
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy(ifr.ifr_name, ifName, IFNAMSIZ - 1);
+	if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+
+		perror("cannot attach to tap interface");
+		close(fd);
+		return false;
+	}
+
+	lanceSetBackend(&mTapBackend, (void*)(intptr_t)fd);
+	fprintf(stderr, "LANCE attached to tap interface '%s'\n", ifr.ifr_name);
+
+	return true;
+}
+
+
+//loopback plug: everything sent is received back
+static struct {
+	uint16_t len[LOOP_QUEUE_LEN];
+	uint8_t frame[LOOP_QUEUE_LEN][MAX_FRAME_LEN];
+	uint8_t readIdx, numUsed;
+} mLoop;
+
+static bool netLoopPrvTx(void *userData, const uint8_t *frame, uint32_t len)
+{
+	uint_fast8_t idx;
+
+	(void)userData;
+
+	if (mLoop.numUsed == LOOP_QUEUE_LEN || len > MAX_FRAME_LEN)
+		return false;
+
+	idx = (mLoop.readIdx + mLoop.numUsed++) % LOOP_QUEUE_LEN;
+	memcpy(mLoop.frame[idx], frame, len);
+	mLoop.len[idx] = len;
+
+	return true;
+}
+
+static uint32_t netLoopPrvRx(void *userData, uint8_t *frame, uint32_t maxLen)
+{
+	uint32_t len;
+
+	(void)userData;
+
+	if (!mLoop.numUsed)
+		return 0;
+
+	len = mLoop.len[mLoop.readIdx];
+	if (len > maxLen)
+		len = maxLen;
+	memcpy(frame, mLoop.frame[mLoop.readIdx], len);
+	mLoop.readIdx = (mLoop.readIdx + 1) % LOOP_QUEUE_LEN;
+	mLoop.numUsed--;
+
+	return len;
+}
+
+static const struct LanceBackend mLoopBackend = {
+	.txFrame = netLoopPrvTx,
+	.rxFrame = netLoopPrvRx,
+};
+
+
+//pcap: a capture of everything the guest sends, nothing is received
+static bool netPcapPrvTx(void *userData, const uint8_t *frame, uint32_t len)
+{
+	FILE *f = (FILE*)userData;
+	struct timeval tv;
+	uint32_t hdr[4];
+
+	gettimeofday(&tv, NULL);
+	hdr[0] = tv.tv_sec;
+	hdr[1] = tv.tv_usec;
+	hdr[2] = len;		//captured
+	hdr[3] = len;		//on the wire
+
+	return fwrite(hdr, sizeof(hdr), 1, f) == 1 && fwrite(frame, len, 1, f) == 1 && !fflush(f);
+}
+
+static const struct LanceBackend mPcapBackend = {
+	.txFrame = netPcapPrvTx,
+};
+
+static bool netPcapPrvInit(const char *path)
+{
+	static const uint32_t fileHdr[] = {
+		0xa1b2c3d4,			//magic (native endian, microsecond timestamps)
+		0x00040002,			//version 2.4
+		0,					//GMT offset
+		0,					//timestamp accuracy
+		65535,				//snap length
+		1,					//link type: ethernet
+	};
+	FILE *f = fopen(path, "wb");
+
+	if (!f) {
+
+		perror("cannot create pcap file");
+		return false;
+	}
+
+	if (fwrite(fileHdr, sizeof(fileHdr), 1, f) != 1) {
+
+		fclose(f);
+		return false;
+	}
+
+	lanceSetBackend(&mPcapBackend, f);
+	fprintf(stderr, "LANCE TX frames captured to '%s'\n", path);
+
+	return true;
+}
+
+
+bool lanceNetPcInit(const char *spec)
+{
+	if (!spec || !*spec)
+		return true;		//cable unplugged
+
+	if (!strncmp(spec, "tap:", 4))
+		return netTapPrvInit(spec + 4);
+
+	if (!strcmp(spec, "loop")) {
+
+		lanceSetBackend(&mLoopBackend, NULL);
+		return true;
+	}
+
+	if (!strncmp(spec, "pcap:", 5))
+		return netPcapPrvInit(spec + 5);
+
+	fprintf(stderr, "unknown network spec '%s'. try 'tap:<ifname>', 'loop', or 'pcap:<file>'\n", spec);
+
+	return false;
+}
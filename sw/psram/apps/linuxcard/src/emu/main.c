@@ -16,6 +16,7 @@
 #include <signal.h>
 #include <termios.h>
 #include "decPointingDevice.h"
+#include "consoleEsc.h"
 #include "lk401.h"
 #include "dz11.h"
 #include "soc.h"
@@ -34,7 +35,7 @@ static bool gCtlCSeen = false;
 
 
 
-static bool massStorageAccess(uint8_t op, uint32_t sector, void *buf)
+static bool massStorageAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
 {
 	switch (op) {
 		case MASS_STORE_OP_GET_SZ:
@@ -43,10 +44,10 @@ static bool massStorageAccess(uint8_t op, uint32_t sector, void *buf)
 			 return true;
 		case MASS_STORE_OP_READ:
 			fseeko64(gDiskFile, (off64_t)sector * (off64_t)BLK_DEV_BLK_SZ, SEEK_SET);
-			return fread(buf, 1, BLK_DEV_BLK_SZ, gDiskFile) == BLK_DEV_BLK_SZ;
+			return fread(buf, BLK_DEV_BLK_SZ, numSec, gDiskFile) == numSec;
 		case MASS_STORE_OP_WRITE:
 			fseeko64(gDiskFile, (off64_t)sector * (off64_t)BLK_DEV_BLK_SZ, SEEK_SET);
-			return fwrite(buf, 1, BLK_DEV_BLK_SZ, gDiskFile) == BLK_DEV_BLK_SZ;
+			return fwrite(buf, BLK_DEV_BLK_SZ, numSec, gDiskFile) == numSec;
 	}
 	return false;
 }
@@ -208,10 +209,20 @@ void socInputCheck(void)
 	
     if (1 == select(1, &set, NULL, NULL, & limit)) {
     	
-    	char ch;
+    	uint8_t buf[64];
+    	uint_fast8_t space = dz11numBytesFreeInRxBuffer(3);
+    	ssize_t i, n;
     	
-    	if (1 == read(0, &ch, 1))
-    		dz11charRx(3, (uint8_t)ch);
+    	//take as much as the line can hold in one go, the rest stays in the tty until next time
+    	if (space > sizeof(buf))
+    		space = sizeof(buf);
+    	if (space && (n = read(0, buf, space)) > 0) {
+    		
+    		for (i = 0; i < n; i++) {
+    			if (consoleEscRx(buf[i]))
+    				dz11charRx(3, buf[i]);
+    		}
+    	}
     }
 }
 
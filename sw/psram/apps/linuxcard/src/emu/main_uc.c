@@ -13,19 +13,29 @@
 
 //#include <stdio.h>
 //#include <string.h>
-//#include "pico/stdlib.h"
+#include "pico/stdlib.h"
+#include "pico/mutex.h"
 #include "hw_config.h"
 #include "sd_card.h"
 #include "ff.h"
+#include "diskio.h"
 #include "f_util.h"
 #include "ff_stdio.h"
 #include "r3k_config.h"
 #include "../hypercall.h"
 #include "scsiNothing.h"
+#include "diskCache.h"
+#include "diskMap.h"
+#include "ramDisk.h"
 #include "scsiDisk.h"
+#include "consoleEsc.h"
+#include "snapshot.h"
 #include "graphics.h"
+#include "profiler.h"
 #include "timebase.h"
+#include "core1.h"
 #include "spiRam.h"
+#include "dcache.h"
 #include "printf.h"
 #include "decBus.h"
 #include "ds1287.h"
@@ -33,6 +43,7 @@
 #include "usart.h"
 #include "ucHw.h"
 #include "sdHw.h"
+#include "perf.h"
 #include "dz11.h"
 #include "soc.h"
 #include "mem.h"
@@ -41,8 +52,9 @@
 #include "usbHID.h"
 
 uint32_t mFbBase, mPaletteBase, mCursorBase;
-static uint32_t mSiiRamBase, mRamTop;
-static uint8_t mDiskBuf[SD_BLOCK_SIZE];
+static uint32_t mSiiRamBase, mLanceRamBase, mRamTop;
+static uint8_t mDiskBuf[SD_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint8_t mScsiBuf[SCSI_DISK_BUF_SECS * BLK_DEV_BLK_SZ] __attribute__((aligned(4)));
 static struct ScsiNothing gNoDisk;
 static struct ScsiDisk gDisk;
 
@@ -50,6 +62,13 @@ static sd_card_t *pSD0;
 
 static FIL gDiskFile;
 
+//core1 does the SCSI disk's accesses (see diskPrvBgStart), core0 the rest (boot ROM's, snapshots), one at a time
+auto_init_mutex(mSdLock);
+
+#ifdef DISK_FAST_MAP
+	static bool mDiskMapped;
+#endif
+
 static const uint8_t gRom[] = 
 {
 	#include "loader.inc"
@@ -323,8 +342,434 @@ void dz11charPut(uint_fast8_t line, uint_fast8_t chr)
 
 #endif
 #endif
+#ifdef RAM_DISK_SIZE
+
+	static struct ScsiDisk gRamDisk;
+	static uint8_t mRamDiskBuf[SCSI_DISK_BUF_SECS * BLK_DEV_BLK_SZ] __attribute__((aligned(4)));
+	static uint32_t mRamDiskBase;
+	
+	static bool ramDiskPrvInit(void)
+	{
+		ramDiskInit(mRamDiskBase);
+		
+		return scsiDiskInit(&gRamDisk, RAM_DISK_SCSI_ID, ramDiskAccess, mRamDiskBuf, sizeof(mRamDiskBuf), false);
+	}
+
+#endif
+
+//whole-machine snapshots live in a file next to the disk image. the snapshot is only valid for the disk image as
+//it was when saved, so the first disk write after a save or a resume marks it as no longer resumable
+#define SNAPSHOT_FILE_NAME		"UMIPS.SNP"
+
+static FIL gSnapshotFile;
+static bool mSnapshotLive;
+
+#ifdef DCACHE_NUM_SETS_ORDER
+
+	//lazy resume: cpu and devices are loaded up front, RAM pages come in from the still-open file on first touch
+	//(see dcacheSetPager), and a timer has the rest streamed in from cpuExtService() a slice at a time
+	#define SNAPSHOT_LAZY_PAGE_SZ		(1UL << DCACHE_PAGER_PAGE_ORDER)
+	#define SNAPSHOT_LAZY_MAX_PAGES		(((uint32_t)EMULATOR_RAM_MB << 20) / SNAPSHOT_LAZY_PAGE_SZ)
+	#define SNAPSHOT_LAZY_TICK_MS		10
+	#define SNAPSHOT_LAZY_SLICE_TICKS	(TICKS_PER_SECOND / 500)		//how long each streaming step may take
+	
+	static uint32_t mLazyResident[(SNAPSHOT_LAZY_MAX_PAGES + 31) / 32];
+	static uint8_t mLazyBuf[1024] __attribute__((aligned(4)));
+	static uint32_t mLazyRamOfst, mLazyRamSz, mLazyPagesLeft, mLazyNextPage, mLazyFaults;
+	static volatile bool mLazyStreamDue;
+	static struct repeating_timer mLazyTimer;
+	static bool mLazyActive;
+
+#endif
+
+static bool snapshotPrvFileIo(void *userData, void *buf, uint32_t len, bool write)
+{
+	FRESULT fr;
+	UINT done;
+	
+	(void)userData;
+	
+	if (write)
+		fr = f_write(&gSnapshotFile, buf, len, &done);
+	else
+		fr = f_read(&gSnapshotFile, buf, len, &done);
+	
+	return fr == FR_OK && done == len;
+}
+
+static void snapshotPrvRamIo(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice)
+{
+	uint8_t *data = (uint8_t*)buf;
+	uint32_t now;
+	
+	(void)userData;
+	
+	//through the dcache, so dirty lines are seen on save and cached copies are refreshed on load
+	for (; len; len -= now, ofst += now, data += now) {
+		
+		now = len > 1024 ? 1024 : len;		//no 1K boundary crossings
+		if (toDevice)
+			dcacheWriteIo(ofst, data, now);
+		else
+			dcacheReadIo(ofst, data, now);
+	}
+}
+
+#ifdef DCACHE_NUM_SETS_ORDER
+
+	static bool snapshotPrvFileSkip(void *userData, uint32_t len)
+	{
+		(void)userData;
+		
+		return f_lseek(&gSnapshotFile, f_tell(&gSnapshotFile) + len) == FR_OK;
+	}
+	
+	static void snapshotPrvLazyPageIn(uint32_t pageAddr)
+	{
+		uint32_t page = pageAddr / SNAPSHOT_LAZY_PAGE_SZ, ofst;
+		UINT done;
+		
+		mutex_enter_blocking(&mSdLock);
+		
+		//RAM past the end of the image is zeroes
+		if (pageAddr >= mLazyRamSz)
+			memset(mLazyBuf, 0, sizeof(mLazyBuf));
+		else if (f_lseek(&gSnapshotFile, mLazyRamOfst + pageAddr) != FR_OK)
+			goto fail;
+		
+		for (ofst = 0; ofst < SNAPSHOT_LAZY_PAGE_SZ; ofst += sizeof(mLazyBuf)) {
+			
+			if (pageAddr < mLazyRamSz && (f_read(&gSnapshotFile, mLazyBuf, sizeof(mLazyBuf), &done) != FR_OK || done != sizeof(mLazyBuf)))
+				goto fail;
+			spiRamWritePort(pageAddr + ofst, mLazyBuf, sizeof(mLazyBuf), SpiRamPortIo);
+		}
+		mutex_exit(&mSdLock);
+		
+		mLazyResident[page / 32] |= 1UL << (page % 32);
+		mLazyPagesLeft--;
+		return;
+	
+	fail:
+		//the machine is already running on the restored cpu state, there is no going back to a clean boot
+		pr("snapshot page 0x%08x unreadable\n", (unsigned)pageAddr);
+		hwError(8);
+		while(1);
+	}
+	
+	static void snapshotPrvLazyFinish(void)
+	{
+		dcacheSetPager(NULL, NULL);
+		mLazyActive = false;
+		mutex_enter_blocking(&mSdLock);
+		f_close(&gSnapshotFile);
+		mutex_exit(&mSdLock);
+		pr("snapshot RAM all in, %u pages were demand faulted\n", (unsigned)mLazyFaults);
+	}
+	
+	static void snapshotPrvLazyFault(uint32_t pageAddr)
+	{
+		mLazyFaults++;
+		snapshotPrvLazyPageIn(pageAddr);
+	}
+	
+	static void snapshotPrvLazyStream(bool all)
+	{
+		uint64_t till = getTime() + SNAPSHOT_LAZY_SLICE_TICKS;
+		
+		while (mLazyPagesLeft && (all || getTime() < till)) {
+			
+			uint32_t page = mLazyNextPage++;
+			
+			if (!(mLazyResident[page / 32] & (1UL << (page % 32))))
+				snapshotPrvLazyPageIn(page * SNAPSHOT_LAZY_PAGE_SZ);
+		}
+		
+		if (!mLazyPagesLeft)
+			snapshotPrvLazyFinish();
+	}
+	
+	static bool snapshotPrvLazyTimer(struct repeating_timer *t)
+	{
+		(void)t;
+		
+		if (!mLazyActive)
+			return false;
+		
+		mLazyStreamDue = true;
+		cpuRequestService();
+		return true;
+	}
+
+#endif
+
+static bool snapshotPrvRun(bool saving, bool lazy)
+{
+	uint32_t diskSecs = (uint32_t)(f_size(&gDiskFile) / (uint64_t)BLK_DEV_BLK_SZ);
+	struct Snapshot ss;
+	bool ret;
+	
+	if (f_open(&gSnapshotFile, SNAPSHOT_FILE_NAME, saving ? (FA_WRITE | FA_CREATE_ALWAYS) : (FA_READ | FA_WRITE)) != FR_OK)
+		return false;
+	
+	//the disk's staging buffer is free while the bus is, and makes a good bounce buffer
+	snapshotInit(&ss, saving, snapshotPrvFileIo, NULL, mScsiBuf, sizeof(mScsiBuf));
+#ifdef DCACHE_NUM_SETS_ORDER
+	if (lazy && mRamTop <= SNAPSHOT_LAZY_MAX_PAGES * SNAPSHOT_LAZY_PAGE_SZ)
+		ss.lazyRamSkip = snapshotPrvFileSkip;
+#endif
+	snapshotMachine(&ss, mRamTop, diskSecs, snapshotPrvRamIo, NULL);
+	scsiDiskSnapshot(&gDisk, &ss);
+#ifdef RAM_DISK_SIZE
+	scsiDiskSnapshot(&gRamDisk, &ss);
+	snapshotBulk(&ss, RAM_DISK_SIZE, ramDiskSnapshot, NULL);
+#endif
+	ret = snapshotEnd(&ss);
+	scsiDiskDropCache(&gDisk);
+	
+#ifdef DCACHE_NUM_SETS_ORDER
+	if (ret && ss.lazyRamSkip) {
+		
+		//keep the file open, and start paging
+		memset(mLazyResident, 0, sizeof(mLazyResident));
+		mLazyRamOfst = ss.lazyRamOfst;
+		mLazyRamSz = ss.lazyRamSz;
+		mLazyPagesLeft = mRamTop / SNAPSHOT_LAZY_PAGE_SZ;
+		mLazyNextPage = 0;
+		mLazyFaults = 0;
+		mLazyActive = true;
+		dcacheSetPager(snapshotPrvLazyFault, mLazyResident);
+		add_repeating_timer_ms(-SNAPSHOT_LAZY_TICK_MS, snapshotPrvLazyTimer, NULL, &mLazyTimer);
+		mSnapshotLive = true;
+		return true;
+	}
+#endif
+	
+	if (f_close(&gSnapshotFile) != FR_OK)
+		ret = false;
+	
+	mSnapshotLive = ret;
+	return ret;
+}
+
+static void snapshotPrvInvalidate(void)
+{
+	uint32_t flags = 0;		//same in LE and BE
+	bool wasOpen = false;
+	UINT done;
+	
+	mSnapshotLive = false;
+	
+#ifdef DCACHE_NUM_SETS_ORDER
+	wasOpen = mLazyActive;		//still paging from it, and it may only be opened once
+#endif
+	if (!wasOpen && f_open(&gSnapshotFile, SNAPSHOT_FILE_NAME, FA_WRITE) != FR_OK)
+		return;
+	if (f_lseek(&gSnapshotFile, SNAPSHOT_FLAGS_OFST) != FR_OK || f_write(&gSnapshotFile, &flags, sizeof(flags), &done) != FR_OK || done != sizeof(flags))
+		pr("failed to invalidate snapshot\n");
+	if (!wasOpen)
+		f_close(&gSnapshotFile);
+}
+
+#if IDLE_SLEEP
+
+	//core0 sleeps while the guest waits in its idle loop (see cpuIsIdle), instead of running it and contending with
+	//the vsync irq for PSRAM. a timer has cpuExtService() look now and then. time here is kept by timers, not counted
+	//in instrs, so nothing needs moving forward after a sleep
+	#define IDLE_CHECK_MS		2
+	
+	static volatile bool mIdleCheckDue;
+	static struct repeating_timer mIdleTimer;
+	static uint32_t mIdleSleeps;
+	
+	static bool idlePrvTimer(struct repeating_timer *t)
+	{
+		(void)t;
+		
+		mIdleCheckDue = true;
+		cpuRequestService();
+		return true;
+	}
+	
+	static void idlePrvSleep(void)
+	{
+		uint32_t irqState;
+		
+		//irqs stay masked from the last check to the WFI, so none can slip in between unseen (a pending one still wakes
+		//it). the first check is with irqs on, as reads of RAM not yet paged in from a snapshot may need them. the idle
+		//timer's own irq ends the sleep too, with a service request, so no sleep is longer than its period
+		while (cpuIsIdle()) {
+			
+			irqState = save_and_disable_interrupts();
+			if (cpuIsIdle()) {
+				mIdleSleeps++;
+				__wfi();
+			}
+			restore_interrupts(irqState);
+			
+			//if it was core1's doorbell that woke us, what it sent may well be what the guest waits for
+			core1Poll();
+		}
+	}
+
+#endif
+
+#ifdef PROFILER
+
+	static struct repeating_timer mProfilerTimer;
+	
+	static bool profilerPrvTimer(struct repeating_timer *t)
+	{
+		(void)t;
+		
+		profilerRequestSample();
+		return true;
+	}
+
+#endif
+
+#if defined(PERF_COUNTERS) && PERF_DUMP_SECS
+
+	static struct repeating_timer mPerfTimer;
+	
+	static bool perfPrvTimer(struct repeating_timer *t)
+	{
+		(void)t;
+		
+		perfRequestDump();
+		return true;
+	}
+
+#endif
+
+#ifdef DISK_CACHE_SIZE
+
+	//the disk cache's sectors are in a PSRAM carve-out above the guest's RAM. the PSRAM ports are not safe for two
+	//cores at once, so the cache is used by core0 alone, core1 only ever does the SD accesses of misses for it
+	static uint32_t mDiskCacheBase;
+	static volatile bool mDiskFlushDue;
+	static struct repeating_timer mDiskFlushTimer;
+	
+	static void diskCachePrvStore(uint32_t slot, void *buf, bool write)		//all buffers it sees are word aligned
+	{
+		uint32_t addr = mDiskCacheBase + slot * BLK_DEV_BLK_SZ;
+		
+		if (write)
+			spiRamWriteAsync(addr, buf, BLK_DEV_BLK_SZ, SpiRamPortIo);
+		else
+			spiRamReadPort(addr, buf, BLK_DEV_BLK_SZ, SpiRamPortIo);
+	}
+	
+	static bool diskCachePrvTimer(struct repeating_timer *t)
+	{
+		(void)t;
+		
+		mDiskFlushDue = true;
+		cpuRequestService();
+		return true;
+	}
+	
+	static void diskCachePrvFlush(void)
+	{
+		if (!diskCacheFlush())
+			pr("disk cache flush failed\n");
+	}
+
+#endif
+
+//the chip walks its TX ring every so often on its own, not only on a transmit demand. there is no frame backend on
+//the board (no PIO state machine is left for an RMII PHY), so frames only go anywhere in loopback
+#define LANCE_POLL_MS			2
+
+static volatile bool mLancePollDue;
+static struct repeating_timer mLanceTimer;
+
+static bool lancePrvPollTimer(struct repeating_timer *t)
+{
+	(void)t;
+	
+	mLancePollDue = true;
+	cpuRequestService();
+	return true;
+}
+
+void cpuExtService(void)
+{
+	bool ret;
+	
+	core1Poll();
+	
+#ifdef DCACHE_NUM_SETS_ORDER
+	if (mLazyStreamDue) {
+		
+		mLazyStreamDue = false;
+		if (mLazyActive)
+			snapshotPrvLazyStream(false);
+	}
+#endif
+	
+#ifdef PROFILER
+	profilerService(prRaw);		//before any idle sleep, so idle time is sampled as such
+#endif
+#ifdef PERF_COUNTERS
+	perfService(prRaw);
+#endif
+	
+#ifdef DISK_CACHE_SIZE
+	if (mDiskFlushDue) {
+		
+		mDiskFlushDue = false;
+		diskCachePrvFlush();
+	}
+#endif
+	
+	if (mLancePollDue) {
+		
+		mLancePollDue = false;
+		lancePoll();
+	}
+	
+#if IDLE_SLEEP
+	if (mIdleCheckDue) {
+		
+		mIdleCheckDue = false;
+		idlePrvSleep();
+	}
+#endif
+	
+	if (!snapshotSaveRequested())
+		return;
+	
+	if (!siiBusIdle()) {		//mid-command, or the disk is away doing it: look again after the next instruction
+		
+		cpuRequestService();
+		return;
+	}
+	
+	snapshotSaveDone();
+	
+#ifdef DCACHE_NUM_SETS_ORDER
+	if (mLazyActive) {		//the new snapshot replaces the file the old one is still paging from
+		
+		pr("finishing resume first...\n");
+		snapshotPrvLazyStream(true);
+	}
+#endif
+	
+	pr("saving snapshot...\n");
+#ifdef DISK_CACHE_SIZE
+	diskCachePrvFlush();		//the snapshot goes with the disk image as it is on the card
+#endif
+	mutex_enter_blocking(&mSdLock);
+	ret = snapshotPrvRun(true, false);
+	mutex_exit(&mSdLock);
+	if (ret)
+		pr("snapshot saved\n");
+	else
+		pr("snapshot save failed\n");
+}
+
 // rp2040 FAT file system level access
-static bool massStorageAccess(uint8_t op, uint32_t sector, void *buf)
+static bool massStoragePrvAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
 {
   FRESULT fr;
   unsigned int br;
@@ -335,18 +780,80 @@ static bool massStorageAccess(uint8_t op, uint32_t sector, void *buf)
 		  return true;
 		  
 		case MASS_STORE_OP_READ:
+#ifdef DISK_FAST_MAP
+		  //the image never changes size, so sectors can go straight to the card, bypassing the FIL sector buffer
+		  if (mDiskMapped)
+			  return diskMapAccess(&gDiskFile, false, sector, numSec, buf);
+#endif
 		  f_lseek(&gDiskFile, (uint64_t)sector * (uint64_t)BLK_DEV_BLK_SZ);
-		  f_read(&gDiskFile, buf, BLK_DEV_BLK_SZ, &br);
-		  return br == BLK_DEV_BLK_SZ;
+		  f_read(&gDiskFile, buf, numSec * BLK_DEV_BLK_SZ, &br);
+		  return br == numSec * BLK_DEV_BLK_SZ;
 
 		case MASS_STORE_OP_WRITE:
+#ifdef DISK_FAST_MAP
+		  if (mDiskMapped)
+			  return diskMapAccess(&gDiskFile, true, sector, numSec, buf);
+#endif
 		  f_lseek(&gDiskFile, (uint64_t)sector * (uint64_t)BLK_DEV_BLK_SZ);
-		  f_write(&gDiskFile, buf, BLK_DEV_BLK_SZ, &br);
-		  return br == BLK_DEV_BLK_SZ;
+		  f_write(&gDiskFile, buf, numSec * BLK_DEV_BLK_SZ, &br);
+		  return br == numSec * BLK_DEV_BLK_SZ;
 	}
 	return false;
 }
 
+static bool massStorageAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
+{
+	bool ret;
+	
+	mutex_enter_blocking(&mSdLock);
+	//never true on core1, diskPrvBgStart sees to that
+	if (op == MASS_STORE_OP_WRITE && mSnapshotLive)
+		snapshotPrvInvalidate();
+	ret = massStoragePrvAccess(op, sector, numSec, buf);
+	mutex_exit(&mSdLock);
+	
+	return ret;
+}
+
+static void diskPrvBgDone(void *userData, uint32_t param)
+{
+	(void)param;
+	
+	scsiDiskBackgroundDone((struct ScsiDisk*)userData);
+}
+
+static void diskPrvBgWork(void *userData, uint32_t param)		//on core1
+{
+	(void)param;
+	
+	scsiDiskBackgroundWork((struct ScsiDisk*)userData);
+	while (!core1Reply(diskPrvBgDone, userData, 0));		//core0 empties the ring as soon as it hears the doorbell
+}
+
+//the SD card's latency is paid by core1, while the guest gets on with other things
+static bool diskPrvBgStart(struct ScsiDisk *disk)
+{
+	//the snapshot is marked stale before a write is handed over: that uses FatFs and may print, core1 may do neither
+	if (mSnapshotLive && scsiDiskBackgroundWrites(disk)) {
+		
+		mutex_enter_blocking(&mSdLock);
+		snapshotPrvInvalidate();
+		mutex_exit(&mSdLock);
+	}
+	
+	return core1Call(diskPrvBgWork, disk, 0);
+}
+
+//the boot ROM's disk accesses see the disk as the SCSI disk does
+static bool romPrvDiskAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
+{
+#ifdef DISK_CACHE_SIZE
+	return diskCacheAccess(op, sector, numSec, buf);
+#else
+	return massStorageAccess(op, sector, numSec, buf);
+#endif
+}
+
 
 static bool accessRom(uint32_t pa, uint_fast8_t size, bool write, void* buf)
 {
@@ -372,9 +879,9 @@ static bool accessRam(uint32_t pa, uint_fast8_t size, bool write, void* buf)
 {	
 
 	if (write)
-		spiRamWrite(pa, buf, size);
+		dcacheWrite(pa, buf, size);
 	else
-		spiRamRead(pa, buf, size);
+		dcacheRead(pa, buf, size);
 
 #if 0
 	if (write) {
@@ -434,7 +941,7 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 			break;
 		
 		case H_STOR_GET_SZ:
-			if (!massStorageAccess(MASS_STORE_OP_GET_SZ, 0, &t))
+			if (!romPrvDiskAccess(MASS_STORE_OP_GET_SZ, 0, 0, &t))
 				return false;
 			cpuSetRegExternal(MIPS_REG_V0, t);
 			break;
@@ -442,9 +949,14 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 		case H_STOR_READ:
 			blk = cpuGetRegExternal(MIPS_REG_A0);
 			pa = cpuGetRegExternal(MIPS_REG_A1);
-			ret = massStorageAccess(MASS_STORE_OP_READ, blk, mDiskBuf);
-			for (ofst = 0; ofst < SD_BLOCK_SIZE; ofst += OPTIMAL_RAM_WR_SZ)
-				spiRamWrite(pa + ofst, mDiskBuf + ofst, OPTIMAL_RAM_WR_SZ);
+			ret = romPrvDiskAccess(MASS_STORE_OP_READ, blk, 1, mDiskBuf);
+			for (ofst = 0; ofst < SD_BLOCK_SIZE; ofst += t) {		//goes out while the guest carries on
+				
+				t = 1024 - ((pa + ofst) & 1023);		//no 1K boundary crossings
+				if (t > SD_BLOCK_SIZE - ofst)
+					t = SD_BLOCK_SIZE - ofst;
+				dcacheWriteIoAsync(pa + ofst, mDiskBuf + ofst, t);
+			}
 			cpuSetRegExternal(MIPS_REG_V0, ret);
 
 #if 0
@@ -475,8 +987,9 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 			blk = cpuGetRegExternal(MIPS_REG_A0);
 			pa = cpuGetRegExternal(MIPS_REG_A1);
 			for (ofst = 0; ofst < SD_BLOCK_SIZE; ofst += OPTIMAL_RAM_RD_SZ)
-				spiRamRead(pa + ofst, mDiskBuf + ofst, OPTIMAL_RAM_RD_SZ);
-			ret = massStorageAccess(MASS_STORE_OP_WRITE, blk, mDiskBuf);
+				dcacheReadIo(pa + ofst, mDiskBuf + ofst, OPTIMAL_RAM_RD_SZ);
+			ret = romPrvDiskAccess(MASS_STORE_OP_WRITE, blk, 1, mDiskBuf);
+			scsiDiskDropCache(&gDisk);
 			cpuSetRegExternal(MIPS_REG_V0, ret);
 			if (!ret) {
 				
@@ -485,8 +998,52 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 			}
 			break;
 		
+#ifdef PROFILER
+		case H_PROFILE:
+			cpuSetRegExternal(MIPS_REG_V0, profilerHypercall(cpuGetRegExternal(MIPS_REG_A0), prRaw));
+			break;
+#endif
+		
+#ifdef PERF_COUNTERS
+		case H_PERF:
+			cpuSetRegExternal(MIPS_REG_V0, perfHypercall(cpuGetRegExternal(MIPS_REG_A0), cpuGetRegExternal(MIPS_REG_A1), prRaw));
+			break;
+#endif
+		
 		case H_TERM:
 			pr("termination requested\n");
+			{
+				struct CpuIcacheStats is;
+				
+				cpuGetIcacheStats(&is);
+				pr("icache: %u misses, %u page flushes, %u full flushes, %u isolated stores (%u dropping lines)\n",
+					is.misses, is.pageFlushes, is.fullFlushes, is.iscWrites, is.iscLineDrops);
+			}
+#if IDLE_SLEEP
+			pr("idle: %u sleeps\n", mIdleSleeps);
+#endif
+#ifdef DCACHE_NUM_SETS_ORDER
+			{
+				struct DcacheStats ds;
+				
+				dcacheGetStats(&ds);
+				pr("dcache: %u hits, %u misses, %u writebacks\n", ds.hits, ds.misses, ds.writebacks);
+			}
+#endif
+#ifdef DISK_CACHE_SIZE
+			{
+				struct DiskCacheStats dcs;
+				
+				diskCachePrvFlush();
+				diskCacheGetStats(&dcs);
+				pr("disk cache: %u sectors hit, %u missed, %u written back\n", dcs.hits, dcs.misses, dcs.writebacks);
+			}
+#endif
+			pr("uart: %u rx bytes dropped\n", (unsigned)usartGetRxOverflows());
+			pr("usb hid: %u reports dropped\n", (unsigned)usbhidGetRxDrops());
+#ifdef PERF_COUNTERS
+			perfDump(prRaw);
+#endif
 			hwError(7);
 			break;
 
@@ -521,7 +1078,13 @@ void cycleReport(uint32_t instr, uint32_t addr)
 
 void usartExtRx(uint8_t val)
 {
-  dz11charRx(3, val);
+  if (consoleEscRx(val))
+    dz11charRx(3, val);
+}
+
+uint_fast8_t usartExtRxSpace(void)
+{
+  return dz11numBytesFreeInRxBuffer(3);
 }
 
 void reportInvalid(uint32_t pc, uint32_t instr)
@@ -579,7 +1142,8 @@ static void usartPutSmallDecimal(uint_fast8_t val)
 
 void dz11rxSpaceNowAvail(uint_fast8_t line)
 {
-	(void)line;
+	if (line == 3)
+		usartRxPump();
 }
 
 int main(void)
@@ -592,6 +1156,7 @@ int main(void)
 
 	usartInit();
 
+	core1Init();
 	usbhid_init();
 
 	// This must be called before sd_get_drive_prefix:
@@ -634,6 +1199,10 @@ int main(void)
 	else pr("Opened %s\n", "linux.wheezy");
 #endif
 
+#ifdef DISK_FAST_MAP
+	mDiskMapped = diskMapInit(&gDiskFile);
+#endif
+
 
 #if 0
 	//	while(1) {
@@ -644,7 +1213,7 @@ int main(void)
 
 
 	uint32_t buff;
-	massStorageAccess(MASS_STORE_OP_GET_SZ,  0, (void *)&buff);
+	massStorageAccess(MASS_STORE_OP_GET_SZ,  0, 0, (void *)&buff);
 	pr("size: %d\n", buff);
 
 	pr("size: %llu\n", f_size(&gDiskFile));
@@ -699,8 +1268,15 @@ int main(void)
 
 		uint_fast8_t i;
 		
-		//divvy up the RAM
+		//divvy up the RAM. soc.h works out the same guest RAM size for the PC build's RP2040_GUEST, keep them in step
+#ifdef DISK_CACHE_SIZE
+		mDiskCacheBase = ramAmt -= DISK_CACHE_SIZE;
+#endif
+#ifdef RAM_DISK_SIZE
+		mRamDiskBase = ramAmt -= RAM_DISK_SIZE;
+#endif
 		mSiiRamBase = ramAmt -= SII_BUFFER_SIZE;
+		mLanceRamBase = ramAmt -= LANCE_BUFFER_SIZE;
 		mFbBase = ramAmt -= SCREEN_BYTES;
 		mPaletteBase = ramAmt -= SCREEN_PALETTE_BYTES;
 		mCursorBase = ramAmt -= SCREEN_CURSOR_BYTES;
@@ -708,6 +1284,7 @@ int main(void)
 		graphicsSetStart(mFbBase, mPaletteBase, mCursorBase);
 		//round usable ram to page size
 		mRamTop = ramAmt = (ramAmt >> 12) << 12;
+		dcacheSetLimit(mRamTop);
 		pr("ramtop: %d\n", mRamTop/(1024*1024));
 
 		pr("ram:         0x%08x - 0x%08x\n", 0x0, mRamTop - 1);
@@ -715,6 +1292,14 @@ int main(void)
 		   mPaletteBase, mPaletteBase + SCREEN_PALETTE_BYTES - 1);
 		pr("framebuffer: 0x%08x - 0x%08x\n",
 		   mFbBase, mFbBase + SCREEN_BYTES - 1);
+#ifdef DISK_CACHE_SIZE
+		pr("disk cache:  0x%08x - 0x%08x\n",
+		   mDiskCacheBase, mDiskCacheBase + DISK_CACHE_SIZE - 1);
+#endif
+#ifdef RAM_DISK_SIZE
+		pr("RAM disk:    0x%08x - 0x%08x\n",
+		   mRamDiskBase, mRamDiskBase + RAM_DISK_SIZE - 1);
+#endif
 		
 #if 0
 		extern uint32_t *mCpu;
@@ -727,7 +1312,7 @@ int main(void)
 
 		if (!memRegionAdd(RAM_BASE, ramAmt, accessRam))
 			pr("failed to init %s\n", "RAM");
-		else if (!memRegionAdd(DS_ROM_BASE & 0x1FFFFFFFUL, sizeof(gRom), accessRom))
+		else if (!memRegionAddDirect(DS_ROM_BASE & 0x1FFFFFFFUL, sizeof(gRom), accessRom, (void*)gRom, false))
 			pr("failed to init %s\n", "ROM");
 		else if (!decBusInit())
 			pr("failed to init %s\n", "DEC BUS");
@@ -735,10 +1320,24 @@ int main(void)
 			pr("failed to init %s\n", "DZ11");
 		else if (!siiInit(7))
 			pr("failed to init %s\n", "SII");
-		else if (!scsiDiskInit(&gDisk, 6, massStorageAccess, mDiskBuf, false))
+		else if (!scsiDiskInit(&gDisk, 6, massStorageAccess, mScsiBuf, sizeof(mScsiBuf), false))
 			pr("failed to init %s\n", "SCSI disc");
+#ifdef RAM_DISK_SIZE
+		else if (!ramDiskPrvInit())
+			pr("failed to init %s\n", "RAM disk");
+#endif
 		else {
+			scsiDiskSetBackgroundIo(&gDisk, diskPrvBgStart);
+#ifdef DISK_CACHE_SIZE
+			diskCacheInit(massStorageAccess, diskCachePrvStore);
+			scsiDiskUseCache(&gDisk);
+#endif
+			
 			for (i = 0; i < 6; i++) {
+#ifdef RAM_DISK_SIZE
+				if (i == RAM_DISK_SCSI_ID)
+					continue;
+#endif
 				if (!scsiNothingInit(&gNoDisk, i)) {
 					
 					pr("failed to init %s\n", "SCSI dummy");
@@ -772,7 +1371,27 @@ int main(void)
 #endif					
 					printRegions();
 
+					snapshotConsoleInit();
 					cpuInit(ramAmt);
+					if (snapshotPrvRun(false, true))
+						pr("resumed from snapshot\n");
+					else	//missing, stale, or for another machine. a partial load leaves nothing the boot ROM will not redo
+						cpuInit(ramAmt);
+#ifdef PROFILER
+					profilerConsoleInit();
+					add_repeating_timer_us(-PROFILER_SAMPLE_US, profilerPrvTimer, NULL, &mProfilerTimer);
+#endif
+#if defined(PERF_COUNTERS) && PERF_DUMP_SECS
+					add_repeating_timer_ms(-PERF_DUMP_SECS * 1000, perfPrvTimer, NULL, &mPerfTimer);
+#endif
+#ifdef DISK_CACHE_SIZE
+					add_repeating_timer_ms(-DISK_CACHE_FLUSH_SECS * 1000, diskCachePrvTimer, NULL, &mDiskFlushTimer);
+#endif
+					add_repeating_timer_ms(-LANCE_POLL_MS, lancePrvPollTimer, NULL, &mLanceTimer);
+#if IDLE_SLEEP
+					cpuSetIdleRange(IDLE_PC_START, IDLE_PC_END);
+					add_repeating_timer_ms(-IDLE_CHECK_MS, idlePrvTimer, NULL, &mIdleTimer);
+#endif
 					while(1) {
 					  cy++;
 					  cpuCycle(ramAmt);
@@ -792,18 +1411,54 @@ void siiPrvBufferWrite(uint_fast16_t wordIdx, uint_fast16_t val)
 	uint32_t addr = mSiiRamBase + wordIdx * 2;
 	uint16_t v = val;
 	
-	spiRamWrite(addr, &v, 2);
+	spiRamWritePort(addr, &v, 2, SpiRamPortIo);
 }
 
 uint_fast16_t siiPrvBufferRead(uint_fast16_t wordIdx)
 {
 	uint16_t ret;
 	
-	spiRamRead(mSiiRamBase + wordIdx * 2, &ret, 2);
+	spiRamReadPort(mSiiRamBase + wordIdx * 2, &ret, 2, SpiRamPortIo);
+	
+	return ret;
+}
+
+void siiPrvBufferWriteBlock(uint_fast16_t wordIdx, const uint8_t *src, uint_fast16_t numWords)
+{
+	spiRamWriteBlock(mSiiRamBase + wordIdx * 2, src, numWords * 2, SpiRamPortIo);
+}
+
+void siiPrvBufferReadBlock(uint_fast16_t wordIdx, uint8_t *dst, uint_fast16_t numWords)
+{
+	spiRamReadBlock(mSiiRamBase + wordIdx * 2, dst, numWords * 2, SpiRamPortIo);
+}
+
+void lancePrvBufferWrite(uint_fast16_t wordIdx, uint_fast16_t val)
+{
+	uint16_t v = val;
+	
+	spiRamWritePort(mLanceRamBase + wordIdx * 2, &v, 2, SpiRamPortIo);
+}
+
+uint_fast16_t lancePrvBufferRead(uint_fast16_t wordIdx)
+{
+	uint16_t ret;
+	
+	spiRamReadPort(mLanceRamBase + wordIdx * 2, &ret, 2, SpiRamPortIo);
 	
 	return ret;
 }
 
+void lancePrvBufferWriteBlock(uint_fast16_t wordIdx, const uint8_t *src, uint_fast16_t numWords)
+{
+	spiRamWriteBlock(mLanceRamBase + wordIdx * 2, src, numWords * 2, SpiRamPortIo);
+}
+
+void lancePrvBufferReadBlock(uint_fast16_t wordIdx, uint8_t *dst, uint_fast16_t numWords)
+{
+	spiRamReadBlock(mLanceRamBase + wordIdx * 2, dst, numWords * 2, SpiRamPortIo);
+}
+
 
 void __attribute__((used)) report_hard_fault(uint32_t* regs, uint32_t ret_lr, uint32_t *user_sp)
 {
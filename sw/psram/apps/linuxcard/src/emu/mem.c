@@ -4,25 +4,59 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "printf.h"
+#include "perf.h"
 #include "mem.h"
 
+//the physical space below MEM_PAGED_LIMIT (where everything we emulate lives) is split into pages, each
+//mapping to the one region that covers it. pages that more than one region touch are scanned
+#define MEM_PAGE_ORDER		20
+#define MEM_PAGED_LIMIT		0x20000000UL
+#define MEM_NUM_PAGES		(MEM_PAGED_LIMIT >> MEM_PAGE_ORDER)
+
+#define MEM_PAGE_NONE		0xff
+#define MEM_PAGE_SHARED		0xfe
+
 typedef struct {
 
 	uint32_t pa;
 	uint32_t sz;
 	MemAccessF aF;
+	uint8_t *host;
+	bool hostWritable;
 
 } MemRegion;
 
 struct {
 
 	MemRegion regions[MAX_MEM_REGIONS];
+	uint8_t pages[MEM_NUM_PAGES];
 
 } gMem = { };
 
 
-bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF aF){
+static void memPrvPagesRebuild(void){
+
+	uint32_t pg, first, last;
+	uint8_t i;
+	
+	memset(gMem.pages, MEM_PAGE_NONE, sizeof(gMem.pages));
+	
+	for(i = 0; i < MAX_MEM_REGIONS; i++){
+		
+		if(!gMem.regions[i].sz || gMem.regions[i].pa >= MEM_PAGED_LIMIT) continue;
+		
+		first = gMem.regions[i].pa >> MEM_PAGE_ORDER;
+		last = (gMem.regions[i].pa + gMem.regions[i].sz - 1) >> MEM_PAGE_ORDER;
+		if(last >= MEM_NUM_PAGES) last = MEM_NUM_PAGES - 1;
+		
+		for(pg = first; pg <= last; pg++)
+			gMem.pages[pg] = gMem.pages[pg] == MEM_PAGE_NONE ? i : MEM_PAGE_SHARED;
+	}
+}
+
+static bool memPrvRegionAdd(uint32_t pa, uint32_t sz, MemAccessF aF, void *host, bool hostWritable){
 
 	uint8_t i;
 	
@@ -46,6 +80,9 @@ bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF aF){
 			gMem.regions[i].pa = pa;
 			gMem.regions[i].sz = sz;
 			gMem.regions[i].aF = aF;
+			gMem.regions[i].host = host;
+			gMem.regions[i].hostWritable = hostWritable;
+			memPrvPagesRebuild();
 		
 			return true;
 		}
@@ -57,6 +94,26 @@ bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF aF){
 	return false;	
 }
 
+bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF aF){
+
+	return memPrvRegionAdd(pa, sz, aF, NULL, false);
+}
+
+bool memRegionAddDirect(uint32_t pa, uint32_t sz, MemAccessF aF, void *host, bool writable){
+
+	return memPrvRegionAdd(pa, sz, aF, host, writable);
+}
+
+bool memRegionGet(uint_fast8_t idx, uint32_t *paP, uint32_t *szP){
+
+	if(idx >= MAX_MEM_REGIONS || !gMem.regions[idx].sz)
+		return false;
+	
+	*paP = gMem.regions[idx].pa;
+	*szP = gMem.regions[idx].sz;
+	return true;
+}
+
 bool memRegionDel(uint32_t pa, uint32_t sz){
 
 	uint8_t i;
@@ -65,6 +122,7 @@ bool memRegionDel(uint32_t pa, uint32_t sz){
 		if(gMem.regions[i].pa == pa && gMem.regions[i].sz ==sz){
 		
 			gMem.regions[i].sz = 0;
+			memPrvPagesRebuild();
 			return true;
 		}
 	}
@@ -91,19 +149,74 @@ void memReport(uint32_t addr, uint32_t size, bool write, uint32_t extra){
 
 }
 
+static MemRegion* memPrvFind(uint32_t addr){
+
+	uint_fast8_t i;
+	
+	for(i = 0; i < MAX_MEM_REGIONS; i++){
+		if(addr - gMem.regions[i].pa < gMem.regions[i].sz)
+			return &gMem.regions[i];
+	}
+	
+	return NULL;
+}
+
 bool memAccess(uint32_t addr, uint_fast8_t size, bool write, void* buf){
 	
-	uint_fast8_t i;
+	MemRegion *r = NULL;
+	uint_fast8_t idx;
 
 	//pr("mem %c of %ub @ 0x%08X\r\n", write ? 'W' : 'R', size, addr);
 
-	for(i = 0; i < MAX_MEM_REGIONS; i++){
-		if(gMem.regions[i].pa <= addr && gMem.regions[i].pa + gMem.regions[i].sz > addr){
+	if(addr < MEM_PAGED_LIMIT){
+		
+		idx = gMem.pages[addr >> MEM_PAGE_ORDER];
+		if(idx < MAX_MEM_REGIONS){
+			
+			r = &gMem.regions[idx];
+			if(addr - r->pa >= r->sz)		//region ends part way into the page
+				r = NULL;
+		}
+		else if(idx == MEM_PAGE_SHARED)
+			r = memPrvFind(addr);
+	}
+	else
+		r = memPrvFind(addr);
+	
+	if(r){
 		
-			return gMem.regions[i].aF(addr, size, write & 0x7F, buf);
+		perfInc(gPerf.memAccesses[r - gMem.regions]);
+		if(r->host && (!(write & 0x7F) || r->hostWritable)){
+			
+			uint8_t *mem = r->host + (addr - r->pa);
+			
+			if(write & 0x7F){
+				if(size == 4)
+					*(uint32_t*)mem = *(uint32_t*)buf;
+				else if(size == 1)
+					*mem = *(uint8_t*)buf;
+				else if(size == 2)
+					*(uint16_t*)mem = *(uint16_t*)buf;
+				else
+					memcpy(mem, buf, size);
+			}
+			else{
+				if(size == 4)
+					*(uint32_t*)buf = *(uint32_t*)mem;
+				else if(size == 1)
+					*(uint8_t*)buf = *mem;
+				else if(size == 2)
+					*(uint16_t*)buf = *(uint16_t*)mem;
+				else
+					memcpy(buf, mem, size);
+			}
+			return true;
 		}
+		
+		return r->aF(addr, size, write & 0x7F, buf);
 	}
 	
+	perfInc(gPerf.memAccesses[MAX_MEM_REGIONS]);
 	err_str("\nMemory %s of %u bytes at physical addr 0x%08x fails\r\n", (write & 0x7F) ? "write" : "read", size, (unsigned)addr);
 	
 	return false;
@@ -18,6 +18,10 @@ typedef bool (*MemAccessF)(uint32_t pa, uint_fast8_t size, bool write, void* buf
 
 bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF af);
 bool memRegionDel(uint32_t pa, uint32_t sz);
+bool memRegionGet(uint_fast8_t idx, uint32_t *paP, uint32_t *szP);		//false if that slot is unused
+
+//for RAM-like regions: reads (and writes, if "writable") are served straight from host memory at "host", "af" only sees the rest
+bool memRegionAddDirect(uint32_t pa, uint32_t sz, MemAccessF af, void *host, bool writable);
 
 bool memAccess(uint32_t addr, uint_fast8_t size, bool write, void* buf);
 
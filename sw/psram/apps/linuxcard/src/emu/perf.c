@@ -0,0 +1,138 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include "perf.h"
+#include "cpu.h"
+#include "mem.h"
+
+#ifdef PERF_COUNTERS
+
+
+//all the counters, as H_PERF numbers them: one word each, in this order
+struct PerfAll {
+	struct CpuPerfCounters cpu;
+	struct CpuIcacheStats ic;
+	struct PerfCounters dev;
+};
+
+#define PERF_ITEM(nm, fld)		{.name = nm, .ofst = offsetof(struct PerfAll, fld), .num = sizeof(((struct PerfAll*)0)->fld) / sizeof(uint32_t)}
+
+static const struct PerfItem {
+	const char *name;
+	uint16_t ofst;
+	uint8_t num;
+} mPerfItems[] = {
+	PERF_ITEM("instrs", cpu.instrs),
+	PERF_ITEM("icHits", cpu.icHits),
+	PERF_ITEM("icMisses", ic.misses),
+	PERF_ITEM("icPageFlushes", ic.pageFlushes),
+	PERF_ITEM("icFullFlushes", ic.fullFlushes),
+	PERF_ITEM("icIscWrites", ic.iscWrites),
+	PERF_ITEM("icIscDrops", ic.iscLineDrops),
+	PERF_ITEM("tlbRefills", cpu.tlbRefills),
+	PERF_ITEM("tlbr", cpu.tlbr),
+	PERF_ITEM("tlbwi", cpu.tlbwi),
+	PERF_ITEM("tlbwr", cpu.tlbwr),
+	PERF_ITEM("tlbp", cpu.tlbp),
+	PERF_ITEM("exc", cpu.exceptions),
+	PERF_ITEM("mem", dev.memAccesses),
+	PERF_ITEM("ramReads", dev.ramReads),
+	PERF_ITEM("ramReadBytes", dev.ramReadBytes),
+	PERF_ITEM("ramWrites", dev.ramWrites),
+	PERF_ITEM("ramWriteBytes", dev.ramWriteBytes),
+	PERF_ITEM("siiDmaInBytes", dev.siiDmaInBytes),
+	PERF_ITEM("siiDmaOutBytes", dev.siiDmaOutBytes),
+	PERF_ITEM("diskReads", dev.diskReads),
+	PERF_ITEM("diskReadSecs", dev.diskReadSecs),
+	PERF_ITEM("diskWrites", dev.diskWrites),
+	PERF_ITEM("diskWriteSecs", dev.diskWriteSecs),
+};
+
+struct PerfCounters gPerf;
+static struct PerfAll mPerfLast;		//as of the last dump
+static volatile bool mPerfDumpDue;
+
+
+static void perfPrvGather(struct PerfAll *all)
+{
+	cpuGetPerfCounters(&all->cpu);
+	cpuGetIcacheStats(&all->ic);
+	all->dev = gPerf;
+}
+
+void perfDump(PerfPrintF printF)
+{
+	struct PerfAll now;
+	uint_fast8_t i, j;
+	uint32_t pa, sz;
+	
+	perfPrvGather(&now);
+	
+	printF("perf: totals, and change since the last dump\n");
+	for (i = 0; i < sizeof(mPerfItems) / sizeof(*mPerfItems); i++) {
+		
+		const uint32_t *vals = (const uint32_t*)((const uint8_t*)&now + mPerfItems[i].ofst);
+		const uint32_t *prevs = (const uint32_t*)((const uint8_t*)&mPerfLast + mPerfItems[i].ofst);
+		
+		for (j = 0; j < mPerfItems[i].num; j++) {
+			
+			if (!vals[j])
+				continue;
+			
+			if (mPerfItems[i].num == 1)
+				printF("perf %-16s %10u +%u\n", mPerfItems[i].name, (unsigned)vals[j], (unsigned)(vals[j] - prevs[j]));
+			else if (vals == now.dev.memAccesses && memRegionGet(j, &pa, &sz))	//regions are better known by where they are
+				printF("perf mem@%08x    %10u +%u\n", (unsigned)pa, (unsigned)vals[j], (unsigned)(vals[j] - prevs[j]));
+			else
+				printF("perf %-12s[%2u] %10u +%u\n", mPerfItems[i].name, j, (unsigned)vals[j], (unsigned)(vals[j] - prevs[j]));
+		}
+	}
+	printF("perf end\n");
+	
+	mPerfLast = now;
+}
+
+void perfRequestDump(void)
+{
+	mPerfDumpDue = true;
+	cpuRequestService();
+}
+
+void perfService(PerfPrintF printF)
+{
+	if (mPerfDumpDue) {
+		
+		mPerfDumpDue = false;
+		perfDump(printF);
+	}
+}
+
+uint32_t perfHypercall(uint32_t op, uint32_t arg, PerfPrintF printF)
+{
+	struct PerfAll all;
+	
+	switch (op) {
+		case 0:
+			return sizeof(all) / sizeof(uint32_t);
+		
+		case 1:
+			if (arg >= sizeof(all) / sizeof(uint32_t))
+				return 0;
+			perfPrvGather(&all);
+			return ((const uint32_t*)&all)[arg];
+		
+		case 2:
+			perfDump(printF);
+			return 0;
+		
+		default:
+			return 0;
+	}
+}
+
+
+#endif
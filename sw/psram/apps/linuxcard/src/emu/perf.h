@@ -0,0 +1,56 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mem.h"
+
+
+//emulator perf counters, enabled by defining PERF_COUNTERS. the cpu keeps its own (see cpuGetPerfCounters), the
+//rest are counted here by whoever does the work. all of them are 32 bits and wrap, readers diff them. they can be
+//read one by one with the H_PERF hypercall, and are dumped to the console every PERF_DUMP_SECS and on request,
+//showing how much each went up since the dump before it
+
+#ifdef PERF_COUNTERS
+
+	#ifndef PERF_DUMP_SECS
+		#define PERF_DUMP_SECS		10		//0 for no periodic dumps
+	#endif
+
+	struct PerfCounters {
+		uint32_t memAccesses[MAX_MEM_REGIONS + 1];	//memAccess() calls by region, the last is for those that hit none
+		uint32_t ramReads, ramReadBytes;			//PSRAM transactions, all ports
+		uint32_t ramWrites, ramWriteBytes;
+		uint32_t siiDmaInBytes, siiDmaOutBytes;		//SII buffer traffic, to the guest and from it
+		uint32_t diskReads, diskReadSecs;			//what SCSI disks asked of their backing store
+		uint32_t diskWrites, diskWriteSecs;
+	};
+
+	extern struct PerfCounters gPerf;
+
+	#define perfInc(ctr)			((ctr)++)
+	#define perfAdd(ctr, n)			((ctr) += (n))
+
+	typedef void (*PerfPrintF)(const char *fmtStr, ...);
+
+	//safe from irq or signal context. the dump is printed from perfService(), called from cpuExtService()
+	void perfRequestDump(void);
+	void perfService(PerfPrintF printF);
+
+	void perfDump(PerfPrintF printF);
+	uint32_t perfHypercall(uint32_t op, uint32_t arg, PerfPrintF printF);	//H_PERF, see hypercall.h
+
+#else
+
+	#define perfInc(ctr)			((void)0)
+	#define perfAdd(ctr, n)			((void)0)
+
+#endif
+
+
+#endif
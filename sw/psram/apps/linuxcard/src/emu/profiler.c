@@ -0,0 +1,162 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <string.h>
+#include "consoleEsc.h"
+#include "profiler.h"
+#include "cpu.h"
+
+
+#define PROFILER_MAX_PROBES		16
+#define PROFILER_KEY_USED		0x00000002	//so that no key is zero, the pc grain leaves these two bits free
+#define PROFILER_KEY_USER		0x00000001
+
+#define CONSOLE_PROFILE_CHAR		'p'		//dump the profile
+#define CONSOLE_PROFILE_CLR_CHAR	'P'		//dump it and start over
+
+
+static struct ProfilerSlot {
+	uint32_t key;		//pc without its grain bits, plus the PROFILER_KEY_* flags. zero if free
+	uint32_t count;
+} mProfSlots[PROFILER_NUM_SLOTS];
+
+static uint32_t mProfSamples, mProfLost;
+static volatile bool mProfSampleDue, mProfDumpDue, mProfClearDue;
+static bool mProfOff;
+
+
+void profilerRequestSample(void)
+{
+	mProfSampleDue = true;
+	cpuRequestService();
+}
+
+void profilerRequestDump(bool clear)
+{
+	mProfClearDue = clear;
+	mProfDumpDue = true;
+	cpuRequestService();
+}
+
+static void profilerPrvConsoleKey(uint8_t ch)
+{
+	profilerRequestDump(ch == CONSOLE_PROFILE_CLR_CHAR);
+}
+
+void profilerConsoleInit(void)
+{
+	(void)consoleEscRegister(CONSOLE_PROFILE_CHAR, profilerPrvConsoleKey);
+	(void)consoleEscRegister(CONSOLE_PROFILE_CLR_CHAR, profilerPrvConsoleKey);
+}
+
+void profilerEnable(bool on)
+{
+	mProfOff = !on;
+}
+
+void profilerClear(void)
+{
+	memset(mProfSlots, 0, sizeof(mProfSlots));
+	mProfSamples = 0;
+	mProfLost = 0;
+}
+
+uint32_t profilerNumSamples(void)
+{
+	return mProfSamples;
+}
+
+static void profilerPrvRecord(uint32_t pc, bool user)
+{
+	uint32_t key = ((pc >> PROFILER_PC_GRAIN_ORDER) << PROFILER_PC_GRAIN_ORDER) | PROFILER_KEY_USED | (user ? PROFILER_KEY_USER : 0);
+	uint32_t idx = ((key >> PROFILER_PC_GRAIN_ORDER) * 0x9e3779b1ul) >> 16;
+	uint_fast8_t i;
+	
+	mProfSamples++;
+	
+	for (i = 0; i < PROFILER_MAX_PROBES; i++, idx++) {
+		
+		struct ProfilerSlot *slot = &mProfSlots[idx % PROFILER_NUM_SLOTS];
+		
+		if (!slot->key)
+			slot->key = key;
+		else if (slot->key != key)
+			continue;
+		
+		slot->count++;
+		return;
+	}
+	
+	mProfLost++;
+}
+
+void profilerDump(ProfilerPrintF printF)
+{
+	uint32_t i;
+	
+	printF("profile: %u samples, %u lost\n", (unsigned)mProfSamples, (unsigned)mProfLost);
+	for (i = 0; i < PROFILER_NUM_SLOTS; i++) {
+		
+		if (!mProfSlots[i].key)
+			continue;
+		
+		printF("prof %c %08x %u\n", (mProfSlots[i].key & PROFILER_KEY_USER) ? 'u' : 'k',
+			(unsigned)(mProfSlots[i].key >> PROFILER_PC_GRAIN_ORDER << PROFILER_PC_GRAIN_ORDER), (unsigned)mProfSlots[i].count);
+	}
+	printF("profile end\n");
+}
+
+uint32_t profilerHypercall(uint32_t op, ProfilerPrintF printF)
+{
+	switch (op) {
+		case 0:
+			profilerEnable(false);
+			break;
+		
+		case 1:
+			profilerEnable(true);
+			break;
+		
+		case 2:
+			profilerDump(printF);
+			break;
+		
+		case 3:
+			profilerClear();
+			break;
+		
+		default:
+			break;
+	}
+	
+	return profilerNumSamples();
+}
+
+static bool profilerPrvStatusIsUser(uint32_t status)
+{
+#ifdef R4000
+	return !(status & (CP0_STATUS_ERL | CP0_STATUS_EXL)) && (status & CP0_STATUS_UM);
+#else
+	return !!(status & CP0_STATUS_KUC);
+#endif
+}
+
+void profilerService(ProfilerPrintF printF)
+{
+	if (mProfSampleDue) {
+		
+		mProfSampleDue = false;
+		if (!mProfOff)
+			profilerPrvRecord(cpuGetRegExternal(MIPS_EXT_REG_PC), profilerPrvStatusIsUser(cpuGetRegExternal(MIPS_EXT_REG_STATUS)));
+	}
+	
+	if (mProfDumpDue) {
+		
+		mProfDumpDue = false;
+		profilerDump(printF);
+		if (mProfClearDue)
+			profilerClear();
+	}
+}
@@ -0,0 +1,42 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//sampling profiler for guest code, enabled by defining PROFILER. something periodic (a timer, a signal) calls
+//profilerRequestSample(), and the next cpuExtService() has profilerService() note where the guest is. samples are
+//counted per PROFILER_PC_GRAIN_ORDER-sized piece of code, kernel and user mode apart, in a hash table that simply
+//stops taking new addresses once it fills. dumps are text, one line per address, for profsym.py to put names to
+
+#ifndef PROFILER_NUM_SLOTS
+	#define PROFILER_NUM_SLOTS		1024		//power of 2, 8 bytes each
+#endif
+#define PROFILER_PC_GRAIN_ORDER		4
+#define PROFILER_SAMPLE_US			1009		//odd, so as not to beat against the guest's own clock tick
+
+typedef void (*ProfilerPrintF)(const char *fmtStr, ...);
+
+//safe from irq or signal context. a dump is printed from profilerService(), then cleared if asked to
+void profilerRequestSample(void);
+void profilerRequestDump(bool clear);
+
+void profilerService(ProfilerPrintF printF);	//from cpuExtService()
+
+void profilerConsoleInit(void);				//has ^] p dump the profile and ^] P dump and clear it (see consoleEsc.h)
+
+void profilerEnable(bool on);					//on at start. off keeps what was gathered, but takes no more samples
+void profilerClear(void);
+void profilerDump(ProfilerPrintF printF);
+uint32_t profilerNumSamples(void);
+
+uint32_t profilerHypercall(uint32_t op, ProfilerPrintF printF);	//H_PROFILE, see hypercall.h
+
+
+#endif
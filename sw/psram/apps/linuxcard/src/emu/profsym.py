@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+#
+#	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+#	Non-commercial use only OR licensing@dmitry.gr
+#
+
+#puts names to a profiler dump (see profiler.h). takes the guest kernel's symbols as System.map or "nm -n" output
+#(for ultrix: nm -n /vmunix), and a console log with one or more dumps in it. the last dump in the log is used
+#usage: profsym.py <symbols> <log> [lines to show]
+
+import bisect
+import sys
+
+
+def loadSyms(path):
+	syms = []
+	with open(path, errors="replace") as f:
+		for line in f:
+			parts = line.split()
+			if len(parts) < 3 or parts[1] in ("a", "A", "U", "w", "v"):
+				continue
+			try:
+				syms.append((int(parts[0], 16) & 0xffffffff, parts[2]))
+			except ValueError:
+				continue
+	syms.sort()
+	return [a for a, n in syms], [n for a, n in syms]
+
+
+def loadDump(path):
+	entries, header = None, None
+	with open(path, errors="replace") as f:
+		for line in f:
+			line = line.strip("\r\n ")
+			if line.startswith("profile:"):
+				entries, header = [], line
+			elif line.startswith("prof ") and entries is not None:
+				parts = line.split()
+				if len(parts) == 4:
+					entries.append((parts[1], int(parts[2], 16), int(parts[3])))
+	if entries is None:
+		sys.exit("no profile dump found in " + path)
+	return header, entries
+
+
+def main():
+	if len(sys.argv) not in (3, 4):
+		sys.exit("usage: %s <System.map or nm -n output> <log> [lines to show]" % sys.argv[0])
+
+	addrs, names = loadSyms(sys.argv[1])
+	header, entries = loadDump(sys.argv[2])
+	maxLines = int(sys.argv[3]) if len(sys.argv) > 3 else 50
+
+	counts = {}
+	total = 0
+	for mode, pc, count in entries:
+		if mode == "u":
+			name = "[user]"
+		else:
+			i = bisect.bisect_right(addrs, pc) - 1
+			name = names[i] if i >= 0 else "[kernel 0x%08x]" % pc
+		counts[name] = counts.get(name, 0) + count
+		total += count
+
+	print(header)
+	for name, count in sorted(counts.items(), key=lambda kv: -kv[1])[:maxLines]:
+		print("%6.2f%% %8u  %s" % (100.0 * count / max(total, 1), count, name))
+
+
+if __name__ == "__main__":
+	main()
@@ -2,7 +2,7 @@
 #define _R3K_CONFIG_H
 
 /******************/
-/* Emulator config
+/* Emulator config */
 /******************/
 
 // RAM size in megabytes
@@ -17,10 +17,18 @@
 // Enable USB CDC console
 #define CONSOLE_CDC 0
 
+// Sleep core0 while the guest sits in its idle loop, waiting for an interrupt
+#define IDLE_SLEEP 1
+
+// Guest PC range [start, end) to also treat as idle (with interrupts enabled), for idle loops
+// that are not recognised on their own. Both 0 for none
+#define IDLE_PC_START 0
+#define IDLE_PC_END 0
+
 #if CONSOLE_UART
 
 /******************/
-/* UART config
+/* UART config */
 /******************/
 
 // UART instance
@@ -36,7 +44,7 @@
 #endif
 
 /****************/
-/* SD card config
+/* SD card config */
 /***************/
 
 // Set to 1 to use SDIO interface for the SD. Set to 0 to use SPI.
@@ -45,7 +53,7 @@
 #if SD_USE_SDIO
 
 /****************/
-/* SDIO interface
+/* SDIO interface */
 /****************/
 
 // Pins for the SDIO interface (if used)
@@ -60,7 +68,7 @@
 #else
 
 /*******************/
-/* SD SPI interface
+/* SD SPI interface */
 /******************/
 
 // SPI instance used for SD (if used)
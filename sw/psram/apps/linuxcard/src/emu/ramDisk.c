@@ -0,0 +1,64 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <string.h>
+#include "ramDisk.h"
+#include "spiRam.h"
+
+#ifdef RAM_DISK_SIZE
+
+
+static uint32_t mRamDiskBase;
+
+
+bool ramDiskAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
+{
+	const uint32_t numSecsTotal = RAM_DISK_SIZE / BLK_DEV_BLK_SZ;
+	uint32_t addr = mRamDiskBase + sector * BLK_DEV_BLK_SZ;
+	uint8_t *data = (uint8_t*)buf;
+	
+	switch (op) {
+		case MASS_STORE_OP_GET_SZ:
+			*(uint32_t*)buf = numSecsTotal;
+			return true;
+		
+		case MASS_STORE_OP_READ:
+		case MASS_STORE_OP_WRITE:
+			if (sector >= numSecsTotal || numSec > numSecsTotal - sector)
+				return false;
+			
+			while (numSec--) {
+				
+				if (op == MASS_STORE_OP_WRITE)
+					spiRamWriteAsync(addr, data, BLK_DEV_BLK_SZ, SpiRamPortIo);
+				else
+					spiRamReadPort(addr, data, BLK_DEV_BLK_SZ, SpiRamPortIo);
+				addr += BLK_DEV_BLK_SZ;
+				data += BLK_DEV_BLK_SZ;
+			}
+			return true;
+	}
+	return false;
+}
+
+void ramDiskSnapshot(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice)
+{
+	(void)userData;
+	
+	(void)ramDiskAccess(toDevice ? MASS_STORE_OP_WRITE : MASS_STORE_OP_READ, ofst / BLK_DEV_BLK_SZ, len / BLK_DEV_BLK_SZ, buf);
+}
+
+void ramDiskInit(uint32_t base)
+{
+	static uint32_t zeroes[BLK_DEV_BLK_SZ / sizeof(uint32_t)];
+	uint32_t sector;
+	
+	mRamDiskBase = base;
+	for (sector = 0; sector < RAM_DISK_SIZE / BLK_DEV_BLK_SZ; sector++)
+		(void)ramDiskAccess(MASS_STORE_OP_WRITE, sector, 1, zeroes);
+}
+
+
+#endif
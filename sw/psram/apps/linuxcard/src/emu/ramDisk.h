@@ -0,0 +1,29 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _RAM_DISK_H_
+#define _RAM_DISK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "soc.h"
+
+
+//the board's RAM disk (see soc.h) is a PSRAM carve-out of its own. its sectors are moved as single bursts on the io
+//port (none crosses a 1K boundary), and all on core0: it gets no background io, a burst is quicker than handing it
+//to core1, which could not touch PSRAM anyway. buffers must be word aligned
+
+#ifdef RAM_DISK_SIZE
+
+	void ramDiskInit(uint32_t base);		//RAM_DISK_SIZE bytes from there (1K aligned), zeroed
+	bool ramDiskAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf);		//its MassStorageF
+	
+	//its contents, for snapshotBulk(). chunks are multiples of 1K at 1K-aligned offsets, so whole sectors too
+	void ramDiskSnapshot(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice);
+
+#endif
+
+
+#endif
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include "scsiPublic.h"
 #include "scsiDevice.h"
+#include "snapshot.h"
 #include "printf.h"
 #include "sii.h"
 
@@ -23,6 +24,7 @@ static bool scsiDevicePrvDeviceSelected(void *userData)
 	if (dev->state == DeviceIdle) {
 		
 		dev->state = DeviceSelected;
+		dev->mayDisconnect = false;		//until the initiator's IDENTIFY says so
 		return true;
 	}
 	err_str("unexpected select in idle\r\n");
@@ -35,6 +37,9 @@ static void scsiDevicePrvBusResetted(void *userData)
 	
 	dev->state = DeviceIdle;
 	dev->dataOutLen = 0;
+	dev->reconnectDue = false;
+	if (dev->hlFuncs->ScsiHlBusResetted)
+		dev->hlFuncs->ScsiHlBusResetted(dev->hlUserData);
 	//xxx: more?
 }
 
@@ -126,6 +131,21 @@ static void scsiDevicePrvHandleNextStep(struct ScsiDevice *dev, enum ScsiHlCmdRe
 				siiDevSetReq(true);
 			}
 			break;
+		
+		case ScsiHlCmdResultDisconnect:
+			if (VERBOSE)
+				err_str(" $$ disconnecting\r\n");
+			
+			//we resume where we left off, so the pointers are worth saving
+			dev->curMsgIn[0] = SCSI_MSG_SAVE_DATA_POINTER;
+			dev->curMsgIn[1] = SCSI_MSG_DISCONNECT;
+			
+			dev->dataOutPtr = dev->curMsgIn;
+			dev->dataOutLen = 2;
+			dev->dataOutIndex = 0;
+			dev->afterMsgIn = AfterMsgInDisconnect;
+			scsiDevicePrvSendMsgIn(dev);
+			break;
 	}
 }
 
@@ -296,7 +316,7 @@ static void scsiDevicePrvMsgByteOut(struct ScsiDevice *dev, uint8_t val)
 					dev->dataOutPtr = dev->curMsgIn;
 					dev->dataOutLen = 5;
 					dev->dataOutIndex = 0;
-					dev->busFreeAfterMsgIn = false;
+					dev->afterMsgIn = AfterMsgInRequestCommand;
 					scsiDevicePrvSendMsgIn(dev);
 					return;
 				}
@@ -319,6 +339,8 @@ static void scsiDevicePrvMsgByteOut(struct ScsiDevice *dev, uint8_t val)
 		if (VERBOSE)
 			err_str(" ** got identify for LUN %u, reconnect %ssupported\r\n", lun, SCSI_IDENT_SUPPORTS_RECONNECT(val) ? "": "not ");
 		
+		dev->lun = lun;
+		dev->mayDisconnect = SCSI_IDENT_SUPPORTS_RECONNECT(val);
 		dev->hlFuncs->ScsiHlSetLun(dev->hlUserData, lun);
 	}
 	else if (val == SCSI_MSG_ABORT) {
@@ -356,23 +378,41 @@ static void scsiDevicePrvDataInDone(struct ScsiDevice *dev)
 				dev->dataOutPtr = dev->curMsgIn;
 				dev->dataOutLen = 1;
 				dev->dataOutIndex = 0;
-				dev->busFreeAfterMsgIn = true;
+				dev->afterMsgIn = AfterMsgInBusFree;
 				scsiDevicePrvSendMsgIn(dev);
 				break;
 			
 			case DeviceWaitForMessageIn:
-				if (dev->busFreeAfterMsgIn) {
-					if (VERBOSE)
-						err_str(" $$ going bus free as message in is done\r\n");
+				switch (dev->afterMsgIn) {
+					case AfterMsgInBusFree:
+						if (VERBOSE)
+							err_str(" $$ going bus free as message in is done\r\n");
+						
+						dev->state = DeviceIdle;
+						siiDevSetState(ScsiStateFree);
+						break;
 					
-					dev->state = DeviceIdle;
-					siiDevSetState(ScsiStateFree);
-				}
-				else {
-				
-					if (VERBOSE)
-						err_str(" $$ requesting command as message in is done\r\n");
-					scsiDisPrvRequestCommand(dev);
+					case AfterMsgInRequestCommand:
+						if (VERBOSE)
+							err_str(" $$ requesting command as message in is done\r\n");
+						scsiDisPrvRequestCommand(dev);
+						break;
+					
+					case AfterMsgInDisconnect:
+						if (VERBOSE)
+							err_str(" $$ disconnected\r\n");
+						
+						dev->state = DeviceDisconnected;
+						siiDevDisconnect();
+						if (dev->reconnectDue)		//HL was quick
+							siiDevReselect(dev->scsiId);
+						break;
+					
+					case AfterMsgInResume:
+						if (VERBOSE)
+							err_str(" $$ resuming command after reselection\r\n");
+						scsiDevicePrvHandleNextStep(dev, dev->hlFuncs->ScsiHlXferDone(dev->hlUserData));
+						break;
 				}
 				break;
 			
@@ -414,13 +454,16 @@ static uint32_t scsiDevicePrvDmaIn(void *userData, uint_fast16_t dmaWordIdx, uin
 			maxBytes--;
 			lenAvail--;
 		}
-		while (maxBytes >= 2) {
+		if (maxBytes >= 2) {
 			
-			siiPrvBufferWrite(dmaWordIdx++, (((uint_fast16_t)dev->dataOutPtr[1]) << 8) + dev->dataOutPtr[0]);
-			dev->dataOutPtr += 2;
-			dev->dataOutIndex += 2;
-			maxBytes -= 2;
-			lenAvail -= 2;
+			uint32_t numWords = maxBytes / 2;
+			
+			siiPrvBufferWriteBlock(dmaWordIdx, dev->dataOutPtr, numWords);
+			dmaWordIdx += numWords;
+			dev->dataOutPtr += numWords * 2;
+			dev->dataOutIndex += numWords * 2;
+			maxBytes -= numWords * 2;
+			lenAvail -= numWords * 2;
 		}
 		
 		if (maxBytes) {	//need to provide extra byte out to dma
@@ -482,16 +525,16 @@ static uint32_t scsiDevicePrvDmaOut(void *userData, uint_fast16_t dmaWordIdx, ui
 			spaceAvail--;
 			numBytes--;
 		}
-		while (numBytes >= 2) {
+		if (numBytes >= 2) {
 			
-			uint_fast16_t v = siiPrvBufferRead(dmaWordIdx++);
+			uint32_t numWords = numBytes / 2;
 			
-			dev->dataInPtr[0] = v;
-			dev->dataInPtr[1] = v >> 8;
-			dev->dataInPtr += 2;
-			dev->dataInIndex += 2;
-			spaceAvail -= 2;
-			numBytes -= 2;
+			siiPrvBufferReadBlock(dmaWordIdx, dev->dataInPtr, numWords);
+			dmaWordIdx += numWords;
+			dev->dataInPtr += numWords * 2;
+			dev->dataInIndex += numWords * 2;
+			spaceAvail -= numWords * 2;
+			numBytes -= numWords * 2;
 		}
 		if (numBytes) {		//space byte
 			
@@ -558,6 +601,28 @@ static void scsiDevicePrvByteInConsumed(void *userData)
 }
 
 
+static void scsiDevicePrvReselected(void *userData)
+{
+	struct ScsiDevice *dev = (struct ScsiDevice*)userData;
+	
+	if (dev->state != DeviceDisconnected) {
+		
+		err_str("reselected while not disconnected\r\n");
+		while(1);
+	}
+	
+	dev->reconnectDue = false;
+	dev->curAtn = 0;
+	
+	//say who is back (the initiator knows us by id, the IDENTIFY names the LUN. disconnect privilege is the initiator's to give)
+	dev->curMsgIn[0] = SCSI_MSG_IDENTIFY(false, dev->lun);
+	dev->dataOutPtr = dev->curMsgIn;
+	dev->dataOutLen = 1;
+	dev->dataOutIndex = 0;
+	dev->afterMsgIn = AfterMsgInResume;
+	scsiDevicePrvSendMsgIn(dev);
+}
+
 static void scsiDevicePrvByteOut(void *userData, uint8_t val)
 {
 	struct ScsiDevice *dev = (struct ScsiDevice*)userData;
@@ -582,11 +647,45 @@ static void scsiDevicePrvByteOut(void *userData, uint8_t val)
 	}
 }	
 
+void scsiDeviceSnapshot(struct ScsiDevice *dev, struct Snapshot *ss)
+{
+	if (ss->saving && dev->state != DeviceIdle)
+		ss->ok = false;
+	
+	snapshotBytes(ss, dev->syncAgreement, sizeof(dev->syncAgreement));
+	
+	if (!ss->saving && ss->ok) {
+		
+		dev->state = DeviceIdle;
+		dev->curAtn = 0;
+		dev->afterMsgIn = AfterMsgInBusFree;
+		dev->reconnectDue = 0;
+		dev->dataOutLen = 0;
+	}
+}
+
+bool scsiDeviceMayDisconnect(struct ScsiDevice *dev)
+{
+	return dev->mayDisconnect && siiDevCanReselect();
+}
+
+void scsiDeviceReconnect(struct ScsiDevice *dev)
+{
+	//after a bus reset there is nothing to come back to
+	if (dev->state == DeviceIdle)
+		return;
+	
+	dev->reconnectDue = true;
+	if (dev->state == DeviceDisconnected)
+		siiDevReselect(dev->scsiId);
+}
+
 bool scsiDeviceInit(struct ScsiDevice *dev, uint_fast8_t scsiId, const struct ScsiHlFuncs *funcs, void *userData)
 {
 	static const struct ScsiDeviceFuncs diskDev = {
 		.ScsiBusResetted = scsiDevicePrvBusResetted,
 		.ScsiDeviceSelected = scsiDevicePrvDeviceSelected,
+		.ScsiDeviceReselected = scsiDevicePrvReselected,
 		.ScsiDeviceAtnState = scsiDevicePrvAtnState,
 		.ScsiDeviceByteOut = scsiDevicePrvByteOut,
 		.ScsiDeviceByteInConsumed = scsiDevicePrvByteInConsumed,
@@ -596,6 +695,7 @@ bool scsiDeviceInit(struct ScsiDevice *dev, uint_fast8_t scsiId, const struct Sc
 	
 	dev->hlFuncs = funcs;
 	dev->hlUserData = userData;
+	dev->scsiId = scsiId;
 	
 	return siiDeviceAdd(scsiId, &diskDev, dev);
 }
@@ -12,17 +12,20 @@
 
 
 struct ScsiDevice;
+struct Snapshot;
 
 enum ScsiHlCmdResult {
 	ScsiHlCmdResultGoToDataIn,
 	ScsiHlCmdResultGoToDataOut,
 	ScsiHlCmdResultGoToStatus,
+	ScsiHlCmdResultDisconnect,		//only if scsiDeviceMayDisconnect(). call scsiDeviceReconnect() when done, ScsiHlXferDone() says what is next then
 };
 
 struct ScsiHlFuncs {
 	void (*ScsiHlSetLun)(void *userData, uint_fast8_t lun);	//return true to allow
 	enum ScsiHlCmdResult (*ScsiHlCmdRxed)(void *userData, const uint8_t *cmd, uint_fast8_t len);
 	enum ScsiHlCmdResult (*ScsiHlXferDone)(void *userData);
+	void (*ScsiHlBusResetted)(void *userData);		//optional. any command in progress, disconnected or not, is gone
 };
 
 bool scsiDeviceInit(struct ScsiDevice *dev, uint_fast8_t scsiId, const struct ScsiHlFuncs *funcs, void *userData);
@@ -30,4 +33,10 @@ bool scsiDeviceInit(struct ScsiDevice *dev, uint_fast8_t scsiId, const struct Sc
 void scsiDeviceSetDataToTx(struct ScsiDevice *dev, const void *data, uint32_t len);
 void scsiDeviceSetRxDataBuffer(struct ScsiDevice *dev, void *data, uint32_t len);
 
+//for HLs with slow work to do mid-command, so the initiator may use the bus meanwhile
+bool scsiDeviceMayDisconnect(struct ScsiDevice *dev);
+void scsiDeviceReconnect(struct ScsiDevice *dev);		//may come before the disconnect is over, it will wait for it
+
+void scsiDeviceSnapshot(struct ScsiDevice *dev, struct Snapshot *ss);	//only with the bus free, so the device is idle
+
 #endif
@@ -19,6 +19,14 @@ enum DiskState {
 	DeviceTxStatus,
 	DeviceTxDataIn,
 	DeviceRxDataOut,
+	DeviceDisconnected,		//off the bus mid-command, the HL is busy
+};
+
+enum DeviceAfterMsgIn {
+	AfterMsgInRequestCommand,
+	AfterMsgInBusFree,
+	AfterMsgInDisconnect,
+	AfterMsgInResume,		//reselected, carry on with the command
 };
 
 
@@ -27,7 +35,11 @@ struct ScsiDevice {
 	enum DiskState state;
 	uint8_t syncAgreement[2];
 	uint8_t curAtn				: 1;	//current state of ATN line
-	uint8_t busFreeAfterMsgIn	: 1;
+	uint8_t afterMsgIn			: 2;	//enum DeviceAfterMsgIn
+	uint8_t mayDisconnect		: 1;	//initiator's IDENTIFY allowed it
+	uint8_t reconnectDue		: 1;	//HL is done with what it disconnected for
+	uint8_t scsiId				: 3;
+	uint8_t lun					: 3;
 	
 	//ext msg tx
 	uint8_t curMsgIn[8];
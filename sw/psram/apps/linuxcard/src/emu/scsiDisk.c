@@ -5,8 +5,11 @@
 
 #include "scsiPublic.h"
 #include "scsiDevice.h"
+#include "diskCache.h"
 #include "scsiDisk.h"
+#include "snapshot.h"
 #include "printf.h"
+#include "perf.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -279,48 +282,204 @@ static bool diskPrvHandleRequestSense(struct ScsiDisk *disk, uint_fast16_t alloc
 	return true;
 }
 
-static bool diskPrvContinueMultiblockOp(struct ScsiDisk *disk)		//called BEFORE xferring each read sector to initiator, and AFTER xferring each write sector from target
+static uint32_t diskPrvFillCount(struct ScsiDisk *disk)		//how many sectors to bring into the staging buffer at disk->nextLba
 {
+	uint32_t num = disk->numLbasLeft;
+	
+	if (disk->nextLba >= disk->numSecs)
+		return 0;
+	
+	//a sequential stream will want what follows, so fetch a whole buffer while we are at it
+	if (num > disk->bufNumSec || disk->nextLba == disk->seqLba)
+		num = disk->bufNumSec;
+	if (num > disk->numSecs - disk->nextLba)
+		num = disk->numSecs - disk->nextLba;
+	
+	return num;
+}
+
+static bool diskPrvFillBuffer(struct ScsiDisk *disk)		//bring disk->nextLba into the staging buffer
+{
+	uint32_t num = diskPrvFillCount(disk);
+	
+	disk->bufNumValid = 0;
+	
+	if (!num)
+		return false;
+	
+	if (VERBOSE)
+		err_str(" ### reading %u disk sectors at %u\r\n", num, disk->nextLba);
+	
+	if (!disk->diskF(MASS_STORE_OP_READ, disk->nextLba, num, disk->buffer))
+		return false;
+	perfInc(gPerf.diskReads);
+	perfAdd(gPerf.diskReadSecs, num);
+	
+	disk->bufLba = disk->nextLba;
+	disk->bufNumValid = num;
+	
+	return true;
+}
+
+static void diskPrvStageWrite(struct ScsiDisk *disk)
+{
+	uint32_t num = disk->numLbasLeft;
+	
+	if (num > disk->bufNumSec)
+		num = disk->bufNumSec;
+	
+	disk->numLbasStaged = num;
+	scsiDeviceSetRxDataBuffer(&disk->scsiDevice, disk->buffer, num * diskPrvGetActualSectorSize(disk));
+}
+
+static bool diskPrvNeedsMedium(struct ScsiDisk *disk)		//does the next step of the multiblock op need diskPrvMediumAccess()?
+{
+	//read index is huge if before the buffer, so that is a miss too
+	return disk->multiblockState == MultiblockWrite || disk->nextLba - disk->bufLba >= disk->bufNumValid;
+}
+
+static bool diskPrvMediumAccess(struct ScsiDisk *disk)		//may run off the emulation thread, see scsiDiskSetBackgroundIo()
+{
+	bool ok;
+	
+	if (disk->multiblockState == MultiblockRead)
+		return diskPrvFillBuffer(disk);
+	
+	if (VERBOSE)
+		err_str(" ### writing %u disk sectors at %u\r\n", disk->numLbasStaged, disk->nextLba);
+	
+	ok = disk->diskF(MASS_STORE_OP_WRITE, disk->nextLba, disk->numLbasStaged, disk->buffer);
+	perfInc(gPerf.diskWrites);
+	perfAdd(gPerf.diskWriteSecs, disk->numLbasStaged);
+	
+	return ok;
+}
+
+#ifdef DISK_CACHE_SIZE
+
+	//do the next step of the multiblock op in the cache if it can be. the cache takes all writes
+	static bool diskPrvCacheAccess(struct ScsiDisk *disk, bool *okP)
+	{
+		uint32_t num;
+		
+		if (!disk->cached)
+			return false;
+		
+		if (disk->multiblockState == MultiblockWrite) {
+			
+			*okP = diskCacheWrite(disk->nextLba, disk->numLbasStaged, disk->buffer);
+			return true;
+		}
+		
+		num = diskCacheRead(disk->nextLba, diskPrvFillCount(disk), disk->buffer);
+		if (!num)
+			return false;
+		
+		disk->bufLba = disk->nextLba;
+		disk->bufNumValid = num;
+		*okP = true;
+		
+		return true;
+	}
+	
+	static void diskPrvCacheFill(struct ScsiDisk *disk)		//after a medium read
+	{
+		if (disk->cached)
+			diskCacheFill(disk->bufLba, disk->bufNumValid, disk->buffer);
+	}
+
+#else
+
+	#define diskPrvCacheAccess(disk, okP)		false
+	#define diskPrvCacheFill(disk)				((void)0)
+
+#endif
+
+static bool diskPrvStartBackground(struct ScsiDisk *disk)
+{
+	if (!disk->bgStartF || !scsiDeviceMayDisconnect(&disk->scsiDevice))
+		return false;
+	
+	disk->bgState = DiskBgBusy;
+	if (disk->bgStartF(disk))
+		return true;
+	
+	disk->bgState = DiskBgIdle;
+	return false;
+}
+
+static enum ScsiHlCmdResult diskPrvContinueMultiblockOp(struct ScsiDisk *disk)		//called BEFORE xferring each run of read sectors to initiator, and AFTER xferring each run of write sectors from target
+{
+	bool ok = true, medium = false;
+	uint32_t idx, num;
+	
 	if (disk->multiblockState == MultiblockIdle) {
 		
 		err_str(" ### unexpected multi continue\r\n");
 		while(1);
 	}
 	
-	if (VERBOSE)
-		err_str(" ### %sing disk sector %u, %u more left\r\n",
-			disk->multiblockState == MultiblockRead ? "read" : "writ",
-				disk->nextLba, disk->numLbasLeft - ((disk->multiblockState == MultiblockRead) ? 0 : 1));
+	if (disk->bgState == DiskBgDone) {		//back from doing it in the background
+		
+		disk->bgState = DiskBgIdle;
+		ok = disk->bgOk;
+		medium = true;
+	}
+	else if (diskPrvNeedsMedium(disk) && !diskPrvCacheAccess(disk, &ok)) {
+		
+		if (diskPrvStartBackground(disk))
+			return ScsiHlCmdResultDisconnect;
+		ok = diskPrvMediumAccess(disk);
+		medium = true;
+	}
 	
-	if (!disk->diskF(disk->multiblockState == MultiblockRead ? MASS_STORE_OP_READ : MASS_STORE_OP_WRITE, disk->nextLba++, disk->buffer)) {
+	if (ok && medium && disk->multiblockState == MultiblockRead)
+		diskPrvCacheFill(disk);
+	
+	if (!ok) {
 		
 		disk->multiblockState = MultiblockIdle;
 		disk->senseKey = SCSI_SENSE_KEY_MEDIUM_ERROR;
 		disk->ASC = SCSI_ASC_Q_INTERNAL_TARGET_ERROR;
+		disk->nextStatusOut = SCSI_STATUS_CHECK_CONDITION;
 		
-		return false;
+		return ScsiHlCmdResultGoToStatus;
 	}
 	
-	disk->numLbasLeft--;
-	
 	if (disk->multiblockState == MultiblockRead) {
 		
-		scsiDeviceSetDataToTx(&disk->scsiDevice, disk->buffer, diskPrvGetActualSectorSize(disk));
-		if (!disk->numLbasLeft)
+		idx = disk->nextLba - disk->bufLba;
+		
+		//hand over as much as we have buffered in one go
+		num = disk->bufNumValid - idx;
+		if (num > disk->numLbasLeft)
+			num = disk->numLbasLeft;
+		
+		scsiDeviceSetDataToTx(&disk->scsiDevice, disk->buffer + idx * diskPrvGetActualSectorSize(disk), num * diskPrvGetActualSectorSize(disk));
+		disk->nextLba += num;
+		disk->numLbasLeft -= num;
+		if (!disk->numLbasLeft) {
+			
 			disk->multiblockState = MultiblockIdle;
-	}
-	else if (disk->numLbasLeft) {
+			disk->seqLba = disk->nextLba;
+		}
 		
-		scsiDeviceSetRxDataBuffer(&disk->scsiDevice, disk->buffer, diskPrvGetActualSectorSize(disk));
-
+		return ScsiHlCmdResultGoToDataIn;
 	}
 	else {
-
+		
+		disk->nextLba += disk->numLbasStaged;
+		disk->numLbasLeft -= disk->numLbasStaged;
+		
+		if (disk->numLbasLeft) {
+			
+			diskPrvStageWrite(disk);
+			return ScsiHlCmdResultGoToDataOut;
+		}
+		
 		disk->multiblockState = MultiblockIdle;
-		return false;	//will go to idle
+		return ScsiHlCmdResultGoToStatus;	//will go to idle
 	}
-	
-	return true;
 }
 
 static bool diskPrvStatWrite(struct ScsiDisk *disk, uint32_t lba, uint_fast16_t nBlocks)
@@ -331,20 +490,22 @@ static bool diskPrvStatWrite(struct ScsiDisk *disk, uint32_t lba, uint_fast16_t
 	disk->multiblockState = MultiblockWrite;
 	disk->nextLba = lba;
 	disk->numLbasLeft = nBlocks;
+	disk->bufNumValid = 0;		//buffer is about to hold write data
 	
-	scsiDeviceSetRxDataBuffer(&disk->scsiDevice, disk->buffer, diskPrvGetActualSectorSize(disk));
+	diskPrvStageWrite(disk);
 
 	return true;
 }
 	
-static bool diskPrvRead(struct ScsiDisk *disk, uint32_t lba, uint_fast16_t nBlocks)
+static enum ScsiHlCmdResult diskPrvRead(struct ScsiDisk *disk, uint32_t lba, uint_fast16_t nBlocks)
 {
 	if (diskPrvSignalInvalidLunIfNeeded(disk))
-		return false;
+		return ScsiHlCmdResultGoToStatus;
 	
 	//for CDROM
 	nBlocks *= diskPrvGetReportedSectorSize(disk) / diskPrvGetActualSectorSize(disk);
 	
+	disk->nextStatusOut = SCSI_STATUS_GOOD;
 	disk->multiblockState = MultiblockRead;
 	disk->nextLba = lba;
 	disk->numLbasLeft = nBlocks;
@@ -359,7 +520,7 @@ static bool diskPrvReadCapacity(struct ScsiDisk *disk)
 	if (diskPrvSignalInvalidLunIfNeeded(disk))
 		return false;
 	
-	if (!disk->diskF(MASS_STORE_OP_GET_SZ, 0, &t) || !t) {
+	if (!disk->diskF(MASS_STORE_OP_GET_SZ, 0, 0, &t) || !t) {
 		
 		disk->senseKey = SCSI_SENSE_KEY_MEDIUM_ERROR;
 		disk->ASC = SCSI_ASC_Q_INCOMPAT_MEDIUM_INSTALLED;
@@ -405,6 +566,17 @@ static enum ScsiHlCmdResult diskPrvScsiHlCmdRxed(void *userData, const uint8_t *
 	disk->nextStatusOut = SCSI_STATUS_CHECK_CONDITION;
 	ret = ScsiHlCmdResultGoToStatus;
 	
+	if (disk->bgState != DiskBgIdle) {		//a bus reset left the medium access of a command before it running
+		
+		disk->nextStatusOut = SCSI_STATUS_BUSY;
+		scsiDeviceSetDataToTx(&disk->scsiDevice, &disk->nextStatusOut, 1);
+		return ret;
+	}
+	
+	//everything but reads may reuse the staging buffer
+	if (cmd[0] != SCSI_CMD_READ && cmd[0] != SCSI_CMD_READ_EXTENDED)
+		disk->bufNumValid = 0;
+	
 	if (cmd[len - 1] & 3) {	//handle control byte's FLAG and LINK fields
 		
 		err_str(" ## flag or link bits seen\r\n");
@@ -428,10 +600,7 @@ static enum ScsiHlCmdResult diskPrvScsiHlCmdRxed(void *userData, const uint8_t *
 				len = cmd[4];
 				if (!len)
 					len = 256;
-				if (diskPrvRead(disk, lba, len)) {
-					disk->nextStatusOut = SCSI_STATUS_GOOD;
-					ret = ScsiHlCmdResultGoToDataIn;
-				}
+				ret = diskPrvRead(disk, lba, len);
 				break;
 			
 			case SCSI_CMD_READ_EXTENDED:
@@ -439,10 +608,8 @@ static enum ScsiHlCmdResult diskPrvScsiHlCmdRxed(void *userData, const uint8_t *
 				len = (((uint32_t)cmd[7]) << 8) + cmd[8];
 				if (!len)	//valid
 					ret = ScsiHlCmdResultGoToStatus;
-				if (diskPrvRead(disk, lba, len)) {
-					disk->nextStatusOut = SCSI_STATUS_GOOD;
-					ret = ScsiHlCmdResultGoToDataIn;
-				}
+				else
+					ret = diskPrvRead(disk, lba, len);
 				break;
 			
 			case SCSI_CMD_WRITE:
@@ -518,27 +685,98 @@ static enum ScsiHlCmdResult diskPrvScsiHlCmdRxed(void *userData, const uint8_t *
 static enum ScsiHlCmdResult diskPrvScsiHlXferDone(void *userData)
 {
 	struct ScsiDisk *disk = (struct ScsiDisk*)userData;
+	enum ScsiHlCmdResult ret = ScsiHlCmdResultGoToStatus;
 	
-	switch (disk->multiblockState) {
-		case MultiblockIdle:
-			break;
+	if (disk->multiblockState != MultiblockIdle)
+		ret = diskPrvContinueMultiblockOp(disk);
+	
+	if (ret == ScsiHlCmdResultGoToStatus)
+		scsiDeviceSetDataToTx(&disk->scsiDevice, &disk->nextStatusOut, 1);
+	
+	return ret;
+}
+
+static void diskPrvScsiHlBusResetted(void *userData)
+{
+	struct ScsiDisk *disk = (struct ScsiDisk*)userData;
+	
+	if (disk->bgState == DiskBgBusy)		//it still owns the buffer, scsiDiskBackgroundDone() tidies up
+		disk->bgState = DiskBgAborted;
+	else if (disk->bgState == DiskBgDone) {
 		
-		case MultiblockRead:
-			if (diskPrvContinueMultiblockOp(disk))
-				return ScsiHlCmdResultGoToDataIn;
-			break;
-			
-		case MultiblockWrite:
-			if (diskPrvContinueMultiblockOp(disk))
-				return ScsiHlCmdResultGoToDataOut;
-			break;
+		disk->bgState = DiskBgIdle;
+		disk->multiblockState = MultiblockIdle;
 	}
 	
-	scsiDeviceSetDataToTx(&disk->scsiDevice, &disk->nextStatusOut, 1);
-	return ScsiHlCmdResultGoToStatus;
+#ifdef DISK_CACHE_SIZE
+	if (disk->cached)		//the guest may be rebooting, or about to be switched off
+		diskCacheFlush();
+#endif
 }
 
-bool scsiDiskInit(struct ScsiDisk *disk, uint_fast8_t scsiId, MassStorageF diskF, void *buf512, bool isCDROM)
+void scsiDiskDropCache(struct ScsiDisk *disk)
+{
+	disk->bufNumValid = 0;
+}
+
+#ifdef DISK_CACHE_SIZE
+
+	void scsiDiskUseCache(struct ScsiDisk *disk)
+	{
+		disk->cached = true;
+	}
+
+#endif
+
+void scsiDiskSetBackgroundIo(struct ScsiDisk *disk, ScsiDiskBgStartF startF)
+{
+	disk->bgStartF = startF;
+}
+
+void scsiDiskBackgroundWork(struct ScsiDisk *disk)
+{
+	disk->bgOk = diskPrvMediumAccess(disk);
+}
+
+bool scsiDiskBackgroundWrites(const struct ScsiDisk *disk)
+{
+	return disk->multiblockState == MultiblockWrite;
+}
+
+void scsiDiskBackgroundDone(struct ScsiDisk *disk)
+{
+	if (disk->bgState == DiskBgAborted) {
+		
+		disk->bgState = DiskBgIdle;
+		disk->multiblockState = MultiblockIdle;
+		disk->bufNumValid = 0;		//a write may have been half done, a read may have filled it, either way: gone
+		return;
+	}
+	
+	disk->bgState = DiskBgDone;
+	scsiDeviceReconnect(&disk->scsiDevice);
+}
+
+void scsiDiskSnapshot(struct ScsiDisk *disk, struct Snapshot *ss)
+{
+	snapshotSection(ss, SNAPSHOT_TAG('D', 'I', 'S', 'K'));
+	scsiDeviceSnapshot(&disk->scsiDevice, ss);
+	snapshotField(ss, disk->curLun);
+	snapshotField(ss, disk->ASC);
+	snapshotField(ss, disk->senseKey);
+	snapshotField(ss, disk->nextStatusOut);
+	
+	if (!ss->saving && ss->ok) {
+		
+		disk->multiblockState = MultiblockIdle;
+		disk->numLbasLeft = 0;
+		disk->seqLba = 0xffffffff;
+		disk->bgState = DiskBgIdle;
+		scsiDiskDropCache(disk);
+	}
+}
+
+bool scsiDiskInit(struct ScsiDisk *disk, uint_fast8_t scsiId, MassStorageF diskF, void *buf, uint32_t bufSz, bool isCDROM)
 {
 	uint32_t diskSz, numCyl = 1, numHeads = 1, numSecPerTrack = 1, diskSzOrig;
 	
@@ -546,13 +784,27 @@ bool scsiDiskInit(struct ScsiDisk *disk, uint_fast8_t scsiId, MassStorageF diskF
 		.ScsiHlSetLun = diskPrvScsiHlSetLun,
 		.ScsiHlCmdRxed = diskPrvScsiHlCmdRxed,
 		.ScsiHlXferDone = diskPrvScsiHlXferDone,
+		.ScsiHlBusResetted = diskPrvScsiHlBusResetted,
 	};
 
 	disk->diskF = diskF;
-	disk->buffer = buf512;
+	disk->bgStartF = NULL;
+	disk->bgState = DiskBgIdle;
+#ifdef DISK_CACHE_SIZE
+	disk->cached = false;
+#endif
+	disk->buffer = buf;
+	disk->bufNumSec = bufSz / BLK_DEV_BLK_SZ;
+	disk->bufNumValid = 0;
+	disk->seqLba = 0xffffffff;
+	
+	if (!disk->bufNumSec)
+		return false;
 	
-	if (!disk->diskF(MASS_STORE_OP_GET_SZ, 0, &diskSzOrig))
+	if (!disk->diskF(MASS_STORE_OP_GET_SZ, 0, 0, &diskSzOrig))
 		return false;
+	
+	disk->numSecs = diskSzOrig;
 
 #if CDROM_SUPORTED
 	disk->isCDROM = isCDROM;
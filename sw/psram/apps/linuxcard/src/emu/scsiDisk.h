@@ -11,10 +11,33 @@
 #include "scsiDiskPrivate.h"
 #include "soc.h"
 
-struct ScsiDisk;
-
+//staging buffer size (in sectors) for multi-sector transfers and read-ahead
+#ifndef SCSI_DISK_BUF_SECS
+	#define SCSI_DISK_BUF_SECS		8
+#endif
 
-bool scsiDiskInit(struct ScsiDisk *disk, uint_fast8_t scsiId, MassStorageF diskF, void *buf512, bool isCDROM);
+struct ScsiDisk;
+struct Snapshot;
+
+
+bool scsiDiskInit(struct ScsiDisk *disk, uint_fast8_t scsiId, MassStorageF diskF, void *buf, uint32_t bufSz, bool isCDROM);	//bufSz is a multiple of BLK_DEV_BLK_SZ
+void scsiDiskDropCache(struct ScsiDisk *disk);		//call if the medium was written behind the disk's back
+void scsiDiskSnapshot(struct ScsiDisk *disk, struct Snapshot *ss);
+
+//medium accesses may be done off the emulation thread (another core, a host thread) if the platform gives a way to,
+//with the disk disconnected from the bus meanwhile, if the initiator allows that. startF() has
+//scsiDiskBackgroundWork() run elsewhere (false if it cannot now), and scsiDiskBackgroundDone() called back on the
+//emulation thread afterwards. the disk's staging buffer and diskF() are then used from there, they must cope
+void scsiDiskSetBackgroundIo(struct ScsiDisk *disk, ScsiDiskBgStartF startF);
+void scsiDiskBackgroundWork(struct ScsiDisk *disk);
+void scsiDiskBackgroundDone(struct ScsiDisk *disk);
+bool scsiDiskBackgroundWrites(const struct ScsiDisk *disk);		//for startF(): will the work it starts write the medium?
+
+#ifdef DISK_CACHE_SIZE
+	//the disk's reads and writes go through the disk cache (see diskCache.h), which must be in front of its diskF().
+	//medium reads are still done by diskF(), maybe in the background, the cache only ever sees the emulation thread
+	void scsiDiskUseCache(struct ScsiDisk *disk);
+#endif
 
 
 
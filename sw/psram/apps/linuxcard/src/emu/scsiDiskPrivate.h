@@ -18,11 +18,25 @@ enum MultiblockState {
 	MultiblockWrite,
 };
 
+enum DiskBgState {
+	DiskBgIdle,
+	DiskBgBusy,			//medium access under way elsewhere, we are disconnected
+	DiskBgDone,			//and it is over, we are on our way back
+	DiskBgAborted,		//bus was reset while busy, the result goes nowhere
+};
+
+struct ScsiDisk;
+
+typedef bool (*ScsiDiskBgStartF)(struct ScsiDisk *disk);
+
 struct ScsiDisk {
 	
 	struct ScsiDevice scsiDevice;
 	MassStorageF diskF;
+	ScsiDiskBgStartF bgStartF;
 	uint8_t *buffer;
+	uint32_t bufNumSec;		//staging buffer size, in sectors
+	uint32_t numSecs;
 	
 	//geometry (sigh...)
 	struct {
@@ -34,8 +48,21 @@ struct ScsiDisk {
 	//read/write progress
 	uint32_t nextLba;
 	uint32_t numLbasLeft;
+	uint32_t numLbasStaged;		//writes: how many sectors the current data-out phase collects
 	enum MultiblockState multiblockState;
 	
+	//staging buffer contents (reads only). anything else that uses the buffer drops it
+	uint32_t bufLba, bufNumValid;
+	uint32_t seqLba;			//where the previous read ended. reads starting here get read-ahead
+	
+	//background medium access
+	uint8_t bgState;			//enum DiskBgState
+	bool bgOk;
+	
+#ifdef DISK_CACHE_SIZE
+	bool cached;				//goes through the disk cache, see scsiDiskUseCache()
+#endif
+	
 	//err state
 	uint8_t curLun;
 	uint16_t ASC;
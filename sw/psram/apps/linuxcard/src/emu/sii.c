@@ -6,7 +6,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "snapshot.h"
 #include "printf.h"
+#include "perf.h"
 #include "mem.h"
 #include "soc.h"
 #include "sii.h"
@@ -127,6 +129,7 @@ struct Sii {
 //our bus is error-free - no BER bit
 	uint32_t csSch			: 1;
 	uint32_t csCon			: 1;
+	uint32_t csDst			: 1;		//we were (re)selected, by the target in destat
 	uint32_t csTgt			: 1;		//may not need this, if my assumptions are right and doc is vague
 	uint32_t csSwa			: 1;
 	uint32_t csSip			: 1;
@@ -153,6 +156,11 @@ struct Sii {
 	uint8_t rxByte;
 	uint8_t busByte;	//we fake this rather poorly
 	
+	//targets that disconnected to come back later, and those of them that are ready to, by id
+	uint8_t disconnected;
+	uint8_t reselPending;
+	uint8_t destat;
+	
 	struct ScsiDeviceStruct *curDev;
 	//must be last
 	struct ScsiDeviceStruct devs[NUM_SCSI_DEVICES];
@@ -231,6 +239,10 @@ static void siiPrvBusReset(void)
 	mSii.csSip = 0;	//selection not in progress
 	mSii.csSch = 1;
 	mSii.csRst = 1;
+	mSii.csCon = 0;
+	mSii.csDst = 0;
+	mSii.disconnected = 0;		//they forgot all about it
+	mSii.reselPending = 0;
 //	mSii.portEn = 0;
 	mSii.curDev = NULL;
 	
@@ -243,6 +255,31 @@ static void siiPrvHardReset(void)
 	siiPrvRecalcIrqs();
 }
 
+static void siiPrvTryResel(void)
+{
+	uint_fast8_t id;
+	
+	//the bus must be free, and the initiator done looking at the change that freed it
+	if (!mSii.reselPending || mSii.scsiState != ScsiStateFree || mSii.csSch || !mSii.portEn || !(mSii.csr & REG_CSR_RSE))
+		return;
+	
+	id = 31 - __builtin_clz(mSii.reselPending);		//highest id wins arbitration
+	mSii.reselPending &=~ (1 << id);
+	mSii.disconnected &=~ (1 << id);
+	
+	mSii.scsiState = ScsiStateConnected;
+	mSii.destat = id;
+	mSii.csSch = 1;
+	mSii.csCon = 1;
+	mSii.csDst = 1;
+	mSii.curDev = mSii.devs + id;
+	if (VERBOSE)
+		err_str("reselected by device %u\r\n", id);
+	siiPrvRecalcCi();
+	
+	mSii.curDev->funcs->ScsiDeviceReselected(mSii.curDev->userData);
+}
+
 static void siiPrvSelect(void)
 {
 	if (mSii.scsiState != ScsiStateFree) {
@@ -267,6 +304,7 @@ static void siiPrvSelect(void)
 		mSii.csSip = 0;	//not in progress
 		mSii.csSch = 1;
 		mSii.csCon = 1;
+		mSii.csDst = 0;
 		mSii.curDev = mSii.devs + mSii.slcsr;
 		if (VERBOSE)
 			err_str("selected device %u\r\n", mSii.slcsr);
@@ -340,6 +378,7 @@ static bool siiPrvInfoXfer(void)
 				}
 				
 				mSii.dmaLotc -= numBytesDone;
+				perfAdd(gPerf.siiDmaInBytes, numBytesDone);
 				mSii.dsDne = true;
 				siiPrvRecalcDi();
 				
@@ -419,6 +458,7 @@ static bool siiPrvInfoXfer(void)
 				}
 				
 				mSii.dmaLotc -= numBytesDone;
+				perfAdd(gPerf.siiDmaOutBytes, numBytesDone);
 				mSii.dsDne = true;
 				siiPrvRecalcDi();
 				
@@ -595,6 +635,10 @@ static bool siiPrvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void* bu
 				break;
 					
 			case REG_ADDR_DESTAT / 4:
+				if (!write) {
+					*vP = mSii.destat;
+					ret = true;
+				}
 				break;
 	
 			case REG_ADDR_DATA / 4:
@@ -666,6 +710,8 @@ static bool siiPrvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void* bu
 						v += REG_CSTAT_SCH;
 					if (mSii.csCon)
 						v += REG_CSTAT_CON;
+					if (mSii.csDst)
+						v += REG_CSTAT_DST;
 					if (mSii.csTgt)
 						v += REG_CSTAT_TGT;
 					if (mSii.csSwa)
@@ -740,6 +786,7 @@ static bool siiPrvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void* bu
 							mSii.csSip = 0;	//selection not in progress
 							mSii.csSch = 1;
 							mSii.csCon = 0;
+							mSii.csDst = 0;
 							mSii.curDev = NULL;
 							siiPrvRecalcCi();
 							cmd &=~ 2;
@@ -806,6 +853,10 @@ static bool siiPrvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void* bu
 				break;
 		}
 		
+		//that may have acked a bus change, or let us take reselections
+		if (write)
+			siiPrvTryResel();
+		
 		if (VERY_VERBOSE) {
 				
 			static const char *mRegnames[] = {
@@ -860,11 +911,35 @@ void siiDevSetState(enum ScsiState desiredState)
 		
 		mSii.csSch = 1;
 		mSii.csCon = 0;
+		mSii.csDst = 0;
 	}
 
 	siiPrvRecalcCi();
 }
 
+bool siiDevCanReselect(void)
+{
+	return mSii.portEn && (mSii.csr & REG_CSR_RSE);
+}
+
+void siiDevDisconnect(void)
+{
+	if (mSii.curDev)
+		mSii.disconnected |= 1 << (mSii.curDev - mSii.devs);
+	siiDevSetState(ScsiStateFree);
+}
+
+void siiDevReselect(uint_fast8_t devId)
+{
+	if (!(mSii.disconnected & (1 << devId))) {
+		
+		err_str("device %u reselecting without having disconnected\r\n", devId);
+		return;
+	}
+	mSii.reselPending |= 1 << devId;
+	siiPrvTryResel();
+}
+
 void siiDevSetReq(bool set)
 {
 	if (set && mSii.haveReq) {
@@ -899,6 +974,62 @@ bool siiInit(uint_fast8_t ownDevId)
 	return memRegionAdd(0x1a000000, 0x02000000, siiPrvMemAccess);
 }
 
+bool siiBusIdle(void)
+{
+	return mSii.scsiState == ScsiStateFree && !mSii.disconnected;
+}
+
+static void siiPrvSnapshotBuffer(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice)
+{
+	(void)userData;
+	
+	if (toDevice)
+		siiPrvBufferWriteBlock(ofst / sizeof(uint16_t), buf, len / sizeof(uint16_t));
+	else
+		siiPrvBufferReadBlock(ofst / sizeof(uint16_t), buf, len / sizeof(uint16_t));
+}
+
+void siiSnapshot(struct Snapshot *ss)
+{
+	snapshotSection(ss, SNAPSHOT_TAG('S', 'I', 'I', ' '));
+	snapshotField(ss, mSii.id);
+	snapshotField(ss, mSii.csr);
+	snapshotField(ss, mSii.portEn);
+	snapshotField(ss, mSii.slcsr);
+	snapshotField(ss, mSii.scsiState);
+	snapshotField(ss, mSii.dmctrl);
+	snapshotField(ss, mSii.haveReq);
+	snapshotField(ss, mSii.csRst);
+	snapshotField(ss, mSii.csSch);
+	snapshotField(ss, mSii.csCon);
+	snapshotField(ss, mSii.csTgt);
+	snapshotField(ss, mSii.csSwa);
+	snapshotField(ss, mSii.csSip);
+	snapshotField(ss, mSii.dsDne);
+	snapshotField(ss, mSii.dsTbe);
+	snapshotField(ss, mSii.dsIbf);
+	snapshotField(ss, mSii.dsObb);
+	snapshotField(ss, mSii.dsMis);
+	snapshotField(ss, mSii.comm);
+	snapshotField(ss, mSii.dmaByte);
+	snapshotField(ss, mSii.dmaLotc);
+	snapshotField(ss, mSii.dmaAddr);
+	snapshotField(ss, mSii.txByte);
+	snapshotField(ss, mSii.rxByte);
+	snapshotField(ss, mSii.busByte);
+	snapshotBulk(ss, SII_BUFFER_SIZE, siiPrvSnapshotBuffer, NULL);
+	
+	if (!ss->saving && ss->ok) {
+		
+		mSii.curDev = NULL;		//saves only happen with the bus free and nobody away
+		mSii.csDst = 0;
+		mSii.disconnected = 0;
+		mSii.reselPending = 0;
+		mSii.ci = mSii.csRst || mSii.csSch;
+		siiPrvRecalcDi();
+	}
+}
+
 bool siiDeviceAdd(uint_fast8_t devId, const struct ScsiDeviceFuncs *devFuncs, void *userData)
 {
 	if (devId >= NUM_SCSI_DEVICES || mSii.devs[devId].funcs)
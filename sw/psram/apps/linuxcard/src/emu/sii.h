@@ -9,6 +9,8 @@
 
 #include <stdbool.h>
 
+struct Snapshot;
+
 #define SII_BUFFER_SIZE			0x20000
 
 #define NUM_SCSI_DEVICES		8
@@ -78,6 +80,7 @@ struct ScsiDeviceFuncs {	//provided by subscribed clients
 	
 	void (*ScsiBusResetted)(void *userData);			//optional
 	bool (*ScsiDeviceSelected)(void *userData);		//return true if device accepts being selected
+	void (*ScsiDeviceReselected)(void *userData);		//only for devices that call siiDevReselect(). it is connected again, and drives the bus
 	void (*ScsiDeviceAtnState)(void *userData, bool hi);
 	void (*ScsiDeviceByteOut)(void *userData, uint8_t val);
 	void (*ScsiDeviceByteInConsumed)(void *userData);
@@ -91,15 +94,30 @@ bool siiDeviceAdd(uint_fast8_t devId, const struct ScsiDeviceFuncs *devFuncs, vo
 
 bool siiInit(uint_fast8_t ownDevId);
 
+//only valid while the bus is free and no target is away disconnected, devices are saved by their owners
+bool siiBusIdle(void);
+void siiSnapshot(struct Snapshot *ss);
+
 
 //for devices
 void siiDevSetState(enum ScsiState desiredState);
 void siiDevSetDB(uint8_t val);
 void siiDevSetReq(bool set);
 
+//targets may disconnect mid-command (only if the initiator allowed it in its IDENTIFY, and the SII takes
+//reselections) to do slow work without holding the bus, then reselect the initiator to finish. a reselection asked
+//for while the bus is busy, or before the initiator saw the last bus change, waits until that is no longer so
+bool siiDevCanReselect(void);
+void siiDevDisconnect(void);						//like siiDevSetState(ScsiStateFree), but the target will be back
+void siiDevReselect(uint_fast8_t devId);
+
 //externally provided
 void siiPrvBufferWrite(uint_fast16_t wordIdx, uint_fast16_t val);
 uint_fast16_t siiPrvBufferRead(uint_fast16_t wordIdx);
 
+//bulk versions. buffer words are little endian, so this is a plain byte copy. no alignment requirements
+void siiPrvBufferWriteBlock(uint_fast16_t wordIdx, const uint8_t *src, uint_fast16_t numWords);
+void siiPrvBufferReadBlock(uint_fast16_t wordIdx, uint8_t *dst, uint_fast16_t numWords);
+
 
 #endif
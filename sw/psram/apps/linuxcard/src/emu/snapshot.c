@@ -0,0 +1,263 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <string.h>
+#include "snapshot.h"
+#include "graphics.h"
+#include "consoleEsc.h"
+#include "ds1287.h"
+#include "lance.h"
+#include "dz11.h"
+#include "cpu.h"
+#include "sii.h"
+
+
+#define CONSOLE_SAVE_CHAR		's'
+
+
+static volatile bool mSaveRequested;
+
+
+void snapshotInit(struct Snapshot *ss, bool saving, SnapshotIoF io, void *ioUserData, void *scratch, uint32_t scratchSz)
+{
+	ss->io = io;
+	ss->ioUserData = ioUserData;
+	ss->scratch = (uint8_t*)scratch;
+	ss->scratchSz = scratchSz;
+	ss->pos = 0;
+	ss->saving = saving;
+	ss->ok = true;
+	ss->lazyRamSkip = NULL;
+}
+
+void snapshotBytes(struct Snapshot *ss, void *buf, uint32_t len)
+{
+	if (ss->ok && len) {
+		
+		ss->ok = ss->io(ss->ioUserData, buf, len, ss->saving);
+		ss->pos += len;
+	}
+}
+
+void snapshotU8(struct Snapshot *ss, uint8_t *valP)
+{
+	snapshotBytes(ss, valP, 1);
+}
+
+void snapshotU16(struct Snapshot *ss, uint16_t *valP)
+{
+	uint8_t b[2];
+	
+	b[0] = *valP;
+	b[1] = *valP >> 8;
+	snapshotBytes(ss, b, sizeof(b));
+	if (!ss->saving && ss->ok)
+		*valP = b[0] + (((uint_fast16_t)b[1]) << 8);
+}
+
+void snapshotU32(struct Snapshot *ss, uint32_t *valP)
+{
+	uint8_t b[4];
+	
+	b[0] = *valP;
+	b[1] = *valP >> 8;
+	b[2] = *valP >> 16;
+	b[3] = *valP >> 24;
+	snapshotBytes(ss, b, sizeof(b));
+	if (!ss->saving && ss->ok)
+		*valP = b[0] + (((uint32_t)b[1]) << 8) + (((uint32_t)b[2]) << 16) + (((uint32_t)b[3]) << 24);
+}
+
+void snapshotBool(struct Snapshot *ss, bool *valP)
+{
+	uint8_t v = *valP;
+	
+	snapshotU8(ss, &v);
+	if (!ss->saving && ss->ok)
+		*valP = !!v;
+}
+
+void snapshotSection(struct Snapshot *ss, uint32_t tag)
+{
+	uint32_t t = tag;
+	
+	snapshotU32(ss, &t);
+	if (t != tag)
+		ss->ok = false;
+}
+
+static void snapshotPrvBulkRange(struct Snapshot *ss, uint32_t ofst, uint32_t len, SnapshotBulkF f, void *userData)
+{
+	while (ss->ok && len) {
+		
+		uint32_t now = len > ss->scratchSz ? ss->scratchSz : len;
+		
+		if (ss->saving)
+			f(userData, ofst, ss->scratch, now, false);
+		snapshotBytes(ss, ss->scratch, now);
+		if (!ss->saving && ss->ok)
+			f(userData, ofst, ss->scratch, now, true);
+		
+		ofst += now;
+		len -= now;
+	}
+}
+
+void snapshotBulk(struct Snapshot *ss, uint32_t len, SnapshotBulkF f, void *userData)
+{
+	snapshotPrvBulkRange(ss, 0, len, f, userData);
+}
+
+void snapshotZeros(struct Snapshot *ss, uint32_t len)
+{
+	while (ss->ok && len) {
+		
+		uint32_t now = len > ss->scratchSz ? ss->scratchSz : len;
+		
+		memset(ss->scratch, 0, now);
+		snapshotBytes(ss, ss->scratch, now);
+		len -= now;
+	}
+}
+
+static void snapshotPrvCpu(struct Snapshot *ss)
+{
+	struct CpuState st;
+	uint_fast8_t i;
+	
+	if (ss->saving)
+		cpuGetState(&st);
+	
+	snapshotSection(ss, SNAPSHOT_TAG('C', 'P', 'U', ' '));
+	for (i = 0; i < MIPS_NUM_REGS; i++)
+		snapshotU32(ss, &st.regs[i]);
+	snapshotU32(ss, &st.pc);
+	snapshotU32(ss, &st.npc);
+	snapshotU32(ss, &st.lo);
+	snapshotU32(ss, &st.hi);
+	snapshotU32(ss, &st.index);
+	snapshotU32(ss, &st.random);
+	snapshotU32(ss, &st.cause);
+	snapshotU32(ss, &st.status);
+	snapshotU32(ss, &st.epc);
+	snapshotU32(ss, &st.badva);
+	snapshotU32(ss, &st.entryHi);
+	snapshotU32(ss, &st.entryLo);
+	snapshotU32(ss, &st.context);
+	for (i = 0; i < sizeof(st.tlbHi) / sizeof(*st.tlbHi); i++) {
+		snapshotU32(ss, &st.tlbHi[i]);
+		snapshotU32(ss, &st.tlbLo[i]);
+	}
+	for (i = 0; i < sizeof(st.fpr) / sizeof(*st.fpr); i++)
+		snapshotU32(ss, &st.fpr[i]);
+	snapshotU32(ss, &st.fcr);
+	snapshotBool(ss, &st.inDelaySlot);
+	snapshotBool(ss, &st.llBit);
+	
+	if (!ss->saving && ss->ok)
+		cpuSetState(&st);
+}
+
+//a bigger machine's RAM may only come here if we have all of what it used, a smaller one's gets zero-padded
+static void snapshotPrvRam(struct Snapshot *ss, uint32_t ramSz, uint32_t imageRamSz, SnapshotBulkF ramF, void *ramUserData)
+{
+	uint32_t common = ramSz < imageRamSz ? ramSz : imageRamSz, ofst;
+	
+	snapshotSection(ss, SNAPSHOT_TAG('R', 'A', 'M', ' '));
+	
+	//lazy loads cannot check that an image bigger than us has zeroes past our end, so they do not take them
+	if (!ss->saving && ss->lazyRamSkip) {
+		
+		if (imageRamSz > ramSz)
+			ss->ok = false;
+		if (!ss->ok)
+			return;
+		
+		ss->lazyRamOfst = ss->pos;
+		ss->lazyRamSz = imageRamSz;
+		ss->ok = ss->lazyRamSkip(ss->ioUserData, imageRamSz);
+		ss->pos += imageRamSz;
+		return;
+	}
+	
+	snapshotPrvBulkRange(ss, 0, common, ramF, ramUserData);
+	
+	for (ofst = common; ss->ok && ofst < imageRamSz; ofst += ss->scratchSz) {
+		
+		uint32_t i, now = imageRamSz - ofst > ss->scratchSz ? ss->scratchSz : imageRamSz - ofst;
+		
+		snapshotBytes(ss, ss->scratch, now);
+		for (i = 0; ss->ok && i < now; i++) {
+			if (ss->scratch[i])
+				ss->ok = false;
+		}
+	}
+	
+	if (!ss->saving) {
+		
+		memset(ss->scratch, 0, ss->scratchSz);
+		for (ofst = common; ss->ok && ofst < ramSz; ofst += ss->scratchSz)
+			ramF(ramUserData, ofst, ss->scratch, ramSz - ofst > ss->scratchSz ? ss->scratchSz : ramSz - ofst, true);
+	}
+}
+
+void snapshotMachine(struct Snapshot *ss, uint32_t ramSz, uint32_t diskSecs, SnapshotBulkF ramF, void *ramUserData)
+{
+	uint32_t magic = SNAPSHOT_MAGIC, version = SNAPSHOT_VERSION, flags = SNAPSHOT_FLAG_RESUMABLE;
+	uint32_t imageRamSz = ramSz, fbBytes = SCREEN_BYTES, imageDiskSecs = diskSecs;
+	
+	snapshotU32(ss, &magic);
+	snapshotU32(ss, &version);
+	snapshotU32(ss, &flags);
+	snapshotU32(ss, &imageRamSz);
+	snapshotU32(ss, &fbBytes);
+	snapshotU32(ss, &imageDiskSecs);
+	
+	if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION || !(flags & SNAPSHOT_FLAG_RESUMABLE) || fbBytes != SCREEN_BYTES || imageDiskSecs != diskSecs)
+		ss->ok = false;
+	
+	snapshotPrvCpu(ss);
+	snapshotPrvRam(ss, ramSz, imageRamSz, ramF, ramUserData);
+	dz11snapshot(ss);
+	ds1287snapshot(ss);
+	siiSnapshot(ss);
+	lanceSnapshot(ss);
+	graphicsSnapshot(ss);
+}
+
+bool snapshotEnd(struct Snapshot *ss)
+{
+	snapshotSection(ss, SNAPSHOT_TAG('E', 'N', 'D', ' '));
+	
+	return ss->ok;
+}
+
+static void snapshotPrvConsoleKey(uint8_t ch)
+{
+	(void)ch;
+	
+	snapshotRequestSave();
+}
+
+void snapshotConsoleInit(void)
+{
+	(void)consoleEscRegister(CONSOLE_SAVE_CHAR, snapshotPrvConsoleKey);
+}
+
+void snapshotRequestSave(void)
+{
+	mSaveRequested = true;
+	cpuRequestService();
+}
+
+bool snapshotSaveRequested(void)
+{
+	return mSaveRequested;
+}
+
+void snapshotSaveDone(void)
+{
+	mSaveRequested = false;
+}
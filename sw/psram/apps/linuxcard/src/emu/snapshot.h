@@ -0,0 +1,86 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//whole-machine snapshots: cpu, guest RAM and every device, streamed to/from a file in one pass. the same code
+//saves and loads, each piece of state being visited in the same order either way. all values are stored little
+//endian with fixed sizes, so a snapshot taken by the PC build can be resumed on the board and vice versa (given
+//the same disk image, and a PC build made with MACHINE=rp2040, for the board's RAM size and framebuffer type)
+
+#define SNAPSHOT_MAGIC				0x53534d75	//"uMSS"
+#define SNAPSHOT_VERSION			1
+
+#define SNAPSHOT_FLAGS_OFST			8			//file offset of the flags word, so it can be cleared in place
+#define SNAPSHOT_FLAG_RESUMABLE		0x00000001	//cleared once the disk is written, the snapshot no longer matches it
+
+#define SNAPSHOT_TAG(a, b, c, d)	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+typedef bool (*SnapshotIoF)(void *userData, void *buf, uint32_t len, bool write);
+
+//copy [ofst, ofst + len) of some large memory to (toDevice clear) or from (toDevice set) buf. len is at most the scratch size
+typedef void (*SnapshotBulkF)(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice);
+
+//move the file position forward by len without reading
+typedef bool (*SnapshotSkipF)(void *userData, uint32_t len);
+
+struct Snapshot {
+	SnapshotIoF io;
+	void *ioUserData;
+	uint8_t *scratch;		//word aligned, for bulk copies
+	uint32_t scratchSz;		//a multiple of 1K
+	uint32_t pos;			//file offset of the next byte
+	bool saving;
+	bool ok;				//once clear, all further calls do nothing
+	
+	//lazy loads: set lazyRamSkip after snapshotInit() and guest RAM is skipped over instead of loaded. the caller then
+	//pages it in from the file itself: the image starts at lazyRamOfst, and is lazyRamSz bytes (the rest of RAM is zero)
+	SnapshotSkipF lazyRamSkip;
+	uint32_t lazyRamOfst;
+	uint32_t lazyRamSz;
+};
+
+void snapshotInit(struct Snapshot *ss, bool saving, SnapshotIoF io, void *ioUserData, void *scratch, uint32_t scratchSz);
+
+//these save *valP or load into it
+void snapshotBytes(struct Snapshot *ss, void *buf, uint32_t len);
+void snapshotU8(struct Snapshot *ss, uint8_t *valP);
+void snapshotU16(struct Snapshot *ss, uint16_t *valP);
+void snapshotU32(struct Snapshot *ss, uint32_t *valP);
+void snapshotBool(struct Snapshot *ss, bool *valP);
+void snapshotBulk(struct Snapshot *ss, uint32_t len, SnapshotBulkF f, void *userData);
+void snapshotZeros(struct Snapshot *ss, uint32_t len);		//placeholder for state a given build lacks. loads discard it
+void snapshotSection(struct Snapshot *ss, uint32_t tag);	//loads fail if the tag does not match
+
+//any integer lvalue, bitfields included. stored as 32 bits
+#define snapshotField(ss, lval)											\
+	do {																\
+		uint32_t snapshotFieldTmp_ = (lval);							\
+																		\
+		snapshotU32((ss), &snapshotFieldTmp_);							\
+		if (!(ss)->saving)												\
+			(lval) = snapshotFieldTmp_;									\
+	} while (0)
+
+//header, cpu, RAM, and all the devices that every build has. disks are added by the caller, then snapshotEnd()
+//a load only proceeds past the header if it is resumable and matches this machine
+void snapshotMachine(struct Snapshot *ss, uint32_t ramSz, uint32_t diskSecs, SnapshotBulkF ramF, void *ramUserData);
+bool snapshotEnd(struct Snapshot *ss);
+
+//has ^] s request a save (see consoleEsc.h)
+void snapshotConsoleInit(void);
+
+//a save request is served from cpuExtService(), when the machine is in a state that can be saved
+void snapshotRequestSave(void);
+bool snapshotSaveRequested(void);
+void snapshotSaveDone(void);
+
+
+#endif
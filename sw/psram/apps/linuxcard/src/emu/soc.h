@@ -6,7 +6,18 @@
 #ifndef _SOC_H_
 #define _SOC_H_
 
-#define RAM_AMOUNT	(32<<20)
+//guest RAM of the PC build. with RP2040_GUEST (MACHINE=rp2040 in the Makefile) it is what main_uc.c leaves the guest of
+//the board's PSRAM once the devices' carve-outs come off the top, so that snapshots go between the two builds. the
+//board's optional disk cache and RAM disk carve-outs are not counted, with either on the board refuses PC snapshots
+#ifdef RP2040_GUEST
+	#include "r3k_config.h"
+	#include "graphics.h"
+	#include "lance.h"
+	#include "sii.h"
+	#define RAM_AMOUNT	((((uint32_t)EMULATOR_RAM_MB << 20) - SII_BUFFER_SIZE - LANCE_BUFFER_SIZE - SCREEN_BYTES - SCREEN_PALETTE_BYTES - SCREEN_CURSOR_BYTES) &~ 0xfffUL)
+#else
+	#define RAM_AMOUNT	(32<<20)
+#endif
 #define RAM_BASE	0x00000000UL
 #define DS_ROM_BASE	0x1FC00000UL	/* as per spec */
 
@@ -15,12 +26,23 @@
 
 
 #define MASS_STORE_OP_GET_SZ	0	//in blocks
-#define MASS_STORE_OP_READ	1
+#define MASS_STORE_OP_READ	1	//numBlocks consecutive blocks starting at val
 #define MASS_STORE_OP_WRITE	2
 #define MASS_STORE_OP_BUF_RW	3
 #define BLK_DEV_BLK_SZ		512
 
-typedef bool (*MassStorageF)(uint8_t op, uint32_t val, void *buf);
+typedef bool (*MassStorageF)(uint8_t op, uint32_t val, uint32_t numBlocks, void *buf);
+
+//defining RAM_DISK_SIZE (bytes) adds a second disk held in RAM the guest does not get, for swap and /tmp. it is
+//empty at each start. IDs below the boot disk's 6 are found first, so the guest's disk names shift when it is added
+#ifdef RAM_DISK_SIZE
+	#ifndef RAM_DISK_SCSI_ID
+		#define RAM_DISK_SCSI_ID	5
+	#endif
+	#if (RAM_DISK_SIZE) % 1024 || (RAM_DISK_SCSI_ID) > 5
+		#error "RAM_DISK_SIZE must be a multiple of 1K, RAM_DISK_SCSI_ID in 0..5"
+	#endif
+#endif
 
 
 bool socInit(MassStorageF diskF);
@@ -3,19 +3,28 @@
 	Non-commercial use only OR licensing@dmitry.gr
 */
 
+#include <sys/time.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <signal.h>
 #include <stdio.h>
+#include <time.h>
 #include "../hypercall.h"
 #include "inputSDL.h"
 #include "scsiNothing.h"
+#include "diskCache.h"
 #include "scsiDisk.h"
+#include "snapshot.h"
 #include "graphics.h"
+#include "profiler.h"
 #include "decBus.h"
 #include "ds1287.h"
 #include "printf.h"
 #include "lance.h"
+#include "perf.h"
 #include "dz11.h"
 #include "soc.h"
 #include "cpu.h"
@@ -26,12 +35,15 @@
 
 
 static uint16_t mSiiBuffer[SII_BUFFER_SIZE / sizeof(uint16_t)];
-static MassStorageF gDiskF;
+static uint16_t mLanceBuffer[LANCE_BUFFER_SIZE / sizeof(uint16_t)];
+static MassStorageF gDiskF, gDiskRawF;	//the first one is what everyone uses, it passes through to the second
+static MassStorageF gDiskRomF;			//the boot ROM's hypercalls, they see the disk as the SCSI disk does
 static uint8_t gRam[RAM_AMOUNT];
 static uint8_t gRom[256*1024];
-static uint8_t gScsiBuf[512];
+static uint8_t gScsiBuf[SCSI_DISK_BUF_SECS * BLK_DEV_BLK_SZ];
 static struct ScsiDisk gDisk;
 static struct ScsiNothing gNoDisk;
+static uint64_t mIdleSkipped;		//instrs not run because the guest was idle
 
 
 
@@ -73,6 +85,93 @@ static bool accessRamRom(uint32_t pa, uint_fast8_t size, bool write, void* buf,
 	return true;
 }
 
+#if defined(PROFILER) || defined(PERF_COUNTERS)
+
+	static void socPrvPrint(const char *fmtStr, ...)
+	{
+		va_list vl;
+		
+		va_start(vl, fmtStr);
+		vfprintf(stderr, fmtStr, vl);
+		va_end(vl);
+	}
+
+#endif
+
+#ifdef PROFILER
+
+	static void socPrvProfilerTick(int sig)
+	{
+		(void)sig;
+		
+		profilerRequestSample();
+	}
+	
+	//samples are taken every so much cpu time we use, as good a clock as any for where guest time goes
+	static bool socPrvProfilerInit(void)
+	{
+		struct itimerval itv = {.it_interval = {.tv_usec = PROFILER_SAMPLE_US}, .it_value = {.tv_usec = PROFILER_SAMPLE_US}};
+		struct sigaction sa = {.sa_handler = socPrvProfilerTick, .sa_flags = SA_RESTART};
+		
+		sigemptyset(&sa.sa_mask);
+		profilerConsoleInit();
+		
+		return !sigaction(SIGPROF, &sa, NULL) && !setitimer(ITIMER_PROF, &itv, NULL);
+	}
+
+#endif
+
+#ifdef DISK_CACHE_SIZE
+
+	//the cache's sectors live in an array of their own, as the board's do in PSRAM the guest does not get
+	static uint8_t gDiskCacheRam[DISK_CACHE_SIZE];
+	static time_t mDiskCacheFlushed;
+	
+	static void socPrvDiskCacheStore(uint32_t slot, void *buf, bool write)
+	{
+		if (write)
+			memcpy(gDiskCacheRam + slot * BLK_DEV_BLK_SZ, buf, BLK_DEV_BLK_SZ);
+		else
+			memcpy(buf, gDiskCacheRam + slot * BLK_DEV_BLK_SZ, BLK_DEV_BLK_SZ);
+	}
+	
+	static void socPrvDiskCacheFlush(void)
+	{
+		mDiskCacheFlushed = time(NULL);
+		if (!diskCacheFlush())
+			fprintf(stderr, "disk cache flush failed\n");
+	}
+	
+	static void socPrvDiskCachePeriodic(void)		//by wall time, like the board's
+	{
+		if (time(NULL) - mDiskCacheFlushed >= DISK_CACHE_FLUSH_SECS)
+			socPrvDiskCacheFlush();
+	}
+
+#endif
+
+#if defined(PERF_COUNTERS) && PERF_DUMP_SECS
+
+	static void socPrvPerfTick(int sig)
+	{
+		(void)sig;
+		
+		perfRequestDump();
+	}
+	
+	//unlike samples, dumps go by wall time, like the board's
+	static bool socPrvPerfInit(void)
+	{
+		struct itimerval itv = {.it_interval = {.tv_sec = PERF_DUMP_SECS}, .it_value = {.tv_sec = PERF_DUMP_SECS}};
+		struct sigaction sa = {.sa_handler = socPrvPerfTick, .sa_flags = SA_RESTART};
+		
+		sigemptyset(&sa.sa_mask);
+		
+		return !sigaction(SIGALRM, &sa, NULL) && !setitimer(ITIMER_REAL, &itv, NULL);
+	}
+
+#endif
+
 bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0, if any
 {
 	uint32_t hyperNum = cpuGetRegExternal(MIPS_REG_AT), t;
@@ -111,7 +210,7 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 			break;
 		
 		case H_STOR_GET_SZ:
-			if (!gDiskF(MASS_STORE_OP_GET_SZ, 0, &t))
+			if (!gDiskRomF(MASS_STORE_OP_GET_SZ, 0, 0, &t))
 				return false;
 			cpuSetRegExternal(MIPS_REG_V0, t);
 			break;
@@ -119,7 +218,7 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 		case H_STOR_READ:
 			blk = cpuGetRegExternal(MIPS_REG_A0);
 			pa = cpuGetRegExternal(MIPS_REG_A1);
-			ret = pa < RAM_AMOUNT && RAM_AMOUNT - pa >= 512 && gDiskF(MASS_STORE_OP_READ, blk, gRam + pa);
+			ret = pa < RAM_AMOUNT && RAM_AMOUNT - pa >= 512 && gDiskRomF(MASS_STORE_OP_READ, blk, 1, gRam + pa);
 			cpuSetRegExternal(MIPS_REG_V0, ret);
 	//		fprintf(stderr, " rd_block(%u, 0x%08x) -> %d\r\n", blk, pa, ret);
 		
@@ -128,12 +227,45 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 		case H_STOR_WRITE:
 			blk = cpuGetRegExternal(MIPS_REG_A0);
 			pa = cpuGetRegExternal(MIPS_REG_A1);
-			ret = pa < RAM_AMOUNT && RAM_AMOUNT - pa >= 512 && gDiskF(MASS_STORE_OP_WRITE, blk, gRam + pa);
+			ret = pa < RAM_AMOUNT && RAM_AMOUNT - pa >= 512 && gDiskRomF(MASS_STORE_OP_WRITE, blk, 1, gRam + pa);
+			scsiDiskDropCache(&gDisk);
 			cpuSetRegExternal(MIPS_REG_V0, ret);
 	//		fprintf(stderr, " wr_block(%u, 0x%08x) -> %d\r\n", blk, pa, ret);
 			break;
 		
+	#ifdef PROFILER
+		case H_PROFILE:
+			cpuSetRegExternal(MIPS_REG_V0, profilerHypercall(cpuGetRegExternal(MIPS_REG_A0), socPrvPrint));
+			break;
+	#endif
+		
+	#ifdef PERF_COUNTERS
+		case H_PERF:
+			cpuSetRegExternal(MIPS_REG_V0, perfHypercall(cpuGetRegExternal(MIPS_REG_A0), cpuGetRegExternal(MIPS_REG_A1), socPrvPrint));
+			break;
+	#endif
+		
 		case H_TERM:
+			{
+				struct CpuIcacheStats is;
+				
+				cpuGetIcacheStats(&is);
+				fprintf(stderr, "icache: %u misses, %u page flushes, %u full flushes, %u isolated stores (%u dropping lines)\n",
+					is.misses, is.pageFlushes, is.fullFlushes, is.iscWrites, is.iscLineDrops);
+				fprintf(stderr, "idle: %llu instrs skipped\n", (unsigned long long)mIdleSkipped);
+			}
+		#ifdef DISK_CACHE_SIZE
+			{
+				struct DiskCacheStats dcs;
+				
+				socPrvDiskCacheFlush();
+				diskCacheGetStats(&dcs);
+				fprintf(stderr, "disk cache: %u sectors hit, %u missed, %u written back\n", dcs.hits, dcs.misses, dcs.writebacks);
+			}
+		#endif
+		#ifdef PERF_COUNTERS
+			perfDump(socPrvPrint);
+		#endif
 			exit(0);
 			break;
 		
@@ -147,8 +279,9 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 #if CDROM_SUPORTED
 
 	static struct ScsiDisk gCDROM;
+	static uint8_t gCdromBuf[SCSI_DISK_BUF_SECS * BLK_DEV_BLK_SZ];
 	
-	static bool cdromStorageAccess(uint8_t op, uint32_t sector, void *buf)
+	static bool cdromStorageAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
 	{
 		const uint32_t blockSz = 512;
 		
@@ -170,7 +303,7 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 				 return true;
 			case MASS_STORE_OP_READ:
 				fseeko64(f, (off64_t)sector * (off64_t)blockSz, SEEK_SET);
-				return fread(buf, 1, blockSz, f) == blockSz;
+				return fread(buf, blockSz, numSec, f) == numSec;
 			case MASS_STORE_OP_WRITE:
 				return false;
 		}
@@ -179,6 +312,47 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 
 #endif
 
+#ifdef RAM_DISK_SIZE
+
+	//a disk that is only an array, for swap and /tmp. it starts out zeroed each run, its contents go in snapshots
+	static struct ScsiDisk gRamDisk;
+	static uint8_t gRamDiskBuf[SCSI_DISK_BUF_SECS * BLK_DEV_BLK_SZ];
+	static uint8_t gRamDiskRam[RAM_DISK_SIZE];
+	
+	static bool socPrvRamDiskAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
+	{
+		const uint32_t numSecsTotal = RAM_DISK_SIZE / BLK_DEV_BLK_SZ;
+		
+		switch (op) {
+			case MASS_STORE_OP_GET_SZ:
+				*(uint32_t*)buf = numSecsTotal;
+				return true;
+			
+			case MASS_STORE_OP_READ:
+			case MASS_STORE_OP_WRITE:
+				if (sector >= numSecsTotal || numSec > numSecsTotal - sector)
+					return false;
+				if (op == MASS_STORE_OP_WRITE)
+					memcpy(gRamDiskRam + sector * BLK_DEV_BLK_SZ, buf, numSec * BLK_DEV_BLK_SZ);
+				else
+					memcpy(buf, gRamDiskRam + sector * BLK_DEV_BLK_SZ, numSec * BLK_DEV_BLK_SZ);
+				return true;
+		}
+		return false;
+	}
+	
+	static void socPrvRamDiskSnapshot(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice)
+	{
+		(void)userData;
+		
+		if (toDevice)
+			memcpy(gRamDiskRam + ofst, buf, len);
+		else
+			memcpy(buf, gRamDiskRam + ofst, len);
+	}
+
+#endif
+
 static bool accessRam(uint32_t pa, uint_fast8_t size, bool write, void* buf)
 {
 	return accessRamRom(pa, size, write, buf, (void*)1);
@@ -189,16 +363,215 @@ static bool accessRom(uint32_t pa, uint_fast8_t size, bool write, void* buf)
 	return accessRamRom(pa, size, write, buf, (void*)0);
 }
 
+//whole-machine snapshots. UMIPS_SNAPSHOT names the file. it is resumed at start if valid, ^] s on the console saves
+//it. the first disk write after a save or a resume marks it stale, since it only matches the disk as it was
+#define SNAPSHOT_DEFAULT_FILE	"umips.snp"
+
+static uint8_t gSnapshotScratch[64 * 1024];
+static bool mSnapshotLive;
+
+static const char* socPrvSnapshotName(void)
+{
+	const char *name = getenv("UMIPS_SNAPSHOT");
+	
+	return name ? name : SNAPSHOT_DEFAULT_FILE;
+}
+
+static bool socPrvSnapshotIo(void *userData, void *buf, uint32_t len, bool write)
+{
+	FILE *f = (FILE*)userData;
+	
+	return (write ? fwrite(buf, 1, len, f) : fread(buf, 1, len, f)) == len;
+}
+
+static void socPrvSnapshotRam(void *userData, uint32_t ofst, void *buf, uint32_t len, bool toDevice)
+{
+	(void)userData;
+	
+	if (toDevice)
+		memcpy(gRam + ofst, buf, len);
+	else
+		memcpy(buf, gRam + ofst, len);
+}
+
+static bool socPrvSnapshot(bool saving)
+{
+	struct Snapshot ss;
+	uint32_t diskSecs;
+	FILE *f;
+	bool ret;
+	
+	if (!gDiskF(MASS_STORE_OP_GET_SZ, 0, 0, &diskSecs))
+		return false;
+	
+	#ifdef DISK_CACHE_SIZE
+		if (saving)		//the snapshot goes with the image file as it is on disk
+			socPrvDiskCacheFlush();
+	#endif
+	
+	f = fopen(socPrvSnapshotName(), saving ? "wb" : "rb");
+	if (!f)
+		return false;
+	
+	snapshotInit(&ss, saving, socPrvSnapshotIo, f, gSnapshotScratch, sizeof(gSnapshotScratch));
+	snapshotMachine(&ss, RAM_AMOUNT, diskSecs, socPrvSnapshotRam, NULL);
+	scsiDiskSnapshot(&gDisk, &ss);
+	#if CDROM_SUPORTED
+		scsiDiskSnapshot(&gCDROM, &ss);
+	#endif
+	#ifdef RAM_DISK_SIZE
+		scsiDiskSnapshot(&gRamDisk, &ss);
+		snapshotBulk(&ss, RAM_DISK_SIZE, socPrvRamDiskSnapshot, NULL);
+	#endif
+	ret = snapshotEnd(&ss);
+	
+	if (fclose(f))
+		ret = false;
+	
+	mSnapshotLive = ret;
+	return ret;
+}
+
+static void socPrvSnapshotInvalidate(void)
+{
+	static const uint8_t zeroFlags[4] = {};
+	FILE *f;
+	
+	mSnapshotLive = false;
+	
+	f = fopen(socPrvSnapshotName(), "r+b");
+	if (!f)
+		return;
+	if (fseek(f, SNAPSHOT_FLAGS_OFST, SEEK_SET) || fwrite(zeroFlags, 1, sizeof(zeroFlags), f) != sizeof(zeroFlags))
+		fprintf(stderr, "failed to invalidate snapshot\n");
+	fclose(f);
+}
+
+//the disk's own accesses are done by a thread (see scsiDiskSetBackgroundIo), the boot ROM's hypercalls by the one the
+//cpu runs on. the image file's position is shared, so they take turns
+static pthread_mutex_t mDiskLock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool socPrvDiskAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
+{
+	bool ret;
+	
+	pthread_mutex_lock(&mDiskLock);
+	if (op == MASS_STORE_OP_WRITE && mSnapshotLive)
+		socPrvSnapshotInvalidate();
+	
+	ret = gDiskRawF(op, sector, numSec, buf);
+	pthread_mutex_unlock(&mDiskLock);
+	
+	return ret;
+}
+
+//one access at a time is in the thread's hands, disks that find it busy do theirs in place
+static pthread_mutex_t mDiskBgLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mDiskBgWorkCond = PTHREAD_COND_INITIALIZER, mDiskBgDoneCond = PTHREAD_COND_INITIALIZER;
+static struct ScsiDisk *mDiskBgWork, *mDiskBgDone;
+
+static void* socPrvDiskBgThread(void *param)
+{
+	struct ScsiDisk *disk;
+	
+	(void)param;
+	
+	pthread_mutex_lock(&mDiskBgLock);
+	while (true) {
+		
+		while (!mDiskBgWork)
+			pthread_cond_wait(&mDiskBgWorkCond, &mDiskBgLock);
+		disk = mDiskBgWork;
+		pthread_mutex_unlock(&mDiskBgLock);
+		
+		scsiDiskBackgroundWork(disk);
+		
+		pthread_mutex_lock(&mDiskBgLock);
+		mDiskBgWork = NULL;
+		mDiskBgDone = disk;
+		pthread_cond_signal(&mDiskBgDoneCond);
+		cpuRequestService();
+	}
+	
+	return NULL;
+}
+
+static bool socPrvDiskBgStart(struct ScsiDisk *disk)
+{
+	bool ret = false;
+	
+	pthread_mutex_lock(&mDiskBgLock);
+	if (!mDiskBgWork && !mDiskBgDone) {
+		
+		mDiskBgWork = disk;
+		pthread_cond_signal(&mDiskBgWorkCond);
+		ret = true;
+	}
+	pthread_mutex_unlock(&mDiskBgLock);
+	
+	return ret;
+}
+
+//hands a finished access back to its disk. with wait, one still under way is waited for first. returns false if
+//there was none either way
+static bool socPrvDiskBgCollect(bool wait)
+{
+	struct ScsiDisk *disk;
+	
+	pthread_mutex_lock(&mDiskBgLock);
+	while (wait && mDiskBgWork)
+		pthread_cond_wait(&mDiskBgDoneCond, &mDiskBgLock);
+	disk = mDiskBgDone;
+	mDiskBgDone = NULL;
+	pthread_mutex_unlock(&mDiskBgLock);
+	
+	if (!disk)
+		return false;
+	
+	scsiDiskBackgroundDone(disk);
+	return true;
+}
+
+void cpuExtService(void)
+{
+	socPrvDiskBgCollect(false);
+	
+	#ifdef PROFILER
+		profilerService(socPrvPrint);
+	#endif
+	#ifdef PERF_COUNTERS
+		perfService(socPrvPrint);
+	#endif
+	
+	if (!snapshotSaveRequested())
+		return;
+	
+	if (!siiBusIdle()) {		//mid-command, or a disk is away doing it: look again after the next instruction
+		
+		cpuRequestService();
+		return;
+	}
+	
+	snapshotSaveDone();
+	if (socPrvSnapshot(true))
+		fprintf(stderr, "\r\nsnapshot saved to '%s'\r\n", socPrvSnapshotName());
+	else
+		fprintf(stderr, "\r\nsnapshot save to '%s' failed\r\n", socPrvSnapshotName());
+}
+
 bool socInit(MassStorageF diskF)
 {
+	pthread_t diskBgThread;
 	uint_fast8_t i;
 	
-	gDiskF = diskF;
+	gDiskRawF = diskF;
+	gDiskF = socPrvDiskAccess;
+	gDiskRomF = gDiskF;
 	
-	if (!memRegionAdd(RAM_BASE, sizeof(gRam), accessRam))
+	if (!memRegionAddDirect(RAM_BASE, sizeof(gRam), accessRam, gRam, true))
 		return false;
 	
-	if (!memRegionAdd(DS_ROM_BASE & 0x1FFFFFFFUL, sizeof(gRom), accessRom))
+	if (!memRegionAddDirect(DS_ROM_BASE & 0x1FFFFFFFUL, sizeof(gRom), accessRom, gRom, true))
 		return false;
 	
 	if (!decBusInit())
@@ -213,19 +586,38 @@ bool socInit(MassStorageF diskF)
 	if (!graphicsInit())
 		return false;
 	
-	if (!scsiDiskInit(&gDisk, 6, gDiskF, gScsiBuf, false))
+	if (!scsiDiskInit(&gDisk, 6, gDiskF, gScsiBuf, sizeof(gScsiBuf), false))
 		return false;
 	
+	if (!pthread_create(&diskBgThread, NULL, socPrvDiskBgThread, NULL))
+		scsiDiskSetBackgroundIo(&gDisk, socPrvDiskBgStart);
+	
+	#ifdef DISK_CACHE_SIZE
+		diskCacheInit(gDiskF, socPrvDiskCacheStore);
+		scsiDiskUseCache(&gDisk);
+		gDiskRomF = diskCacheAccess;
+		mDiskCacheFlushed = time(NULL);
+	#endif
+	
 	#if CDROM_SUPORTED
-		if (!scsiDiskInit(&gCDROM, 0, cdromStorageAccess, gScsiBuf, true))
+		if (!scsiDiskInit(&gCDROM, 0, cdromStorageAccess, gCdromBuf, sizeof(gCdromBuf), true))
 			return false;
 		i = 1;
 	#else
 		i = 0;
 	#endif
 	
+	#ifdef RAM_DISK_SIZE		//no background io: a copy is quicker than handing it to the thread
+		if (!scsiDiskInit(&gRamDisk, RAM_DISK_SCSI_ID, socPrvRamDiskAccess, gRamDiskBuf, sizeof(gRamDiskBuf), false))
+			return false;
+	#endif
+	
 	for (;i < 6; i++) {
 		
+		#ifdef RAM_DISK_SIZE
+			if (i == RAM_DISK_SCSI_ID)
+				continue;
+		#endif
 		if (!scsiNothingInit(&gNoDisk, i))
 			return false;
 	}
@@ -233,9 +625,34 @@ bool socInit(MassStorageF diskF)
 	if (!lanceInit())
 		return false;
 	
+	if (!lanceNetPcInit(getenv("UMIPS_NET")))
+		return false;
+	
 	if (!ds1287init())
 		return false;
 	
+	snapshotConsoleInit();
+	
+	#ifdef PROFILER
+		if (!socPrvProfilerInit())
+			return false;
+	#endif
+	
+	#if defined(PERF_COUNTERS) && PERF_DUMP_SECS
+		if (!socPrvPerfInit())
+			return false;
+	#endif
+	
+	//"start:end" in hex, for idle loops not recognised on their own
+	if (getenv("UMIPS_IDLE_PC")) {
+		
+		unsigned start, end;
+		
+		if (sscanf(getenv("UMIPS_IDLE_PC"), "%x:%x", &start, &end) != 2)
+			return false;
+		cpuSetIdleRange(start, end);
+	}
+	
 	cpuInit(RAM_AMOUNT);
 	
 	return true;
@@ -252,32 +669,69 @@ void socStop(void)
 	singleStep = true;
 }
 
+//instrs per cpuRun(). divides all the periods below, so devices are stepped exactly as if we went one at a time
+#define SOC_CPU_RUN_LEN		64
+
+static void socPrvDevicesStep(uint_fast16_t cy)
+{
+	if (!(cy & 0x0fff))
+		ds1287step(1);
+	
+	if (!(cy & 0x1fff)) {
+		socInputCheck();
+		lancePoll();
+	}
+	
+	if (!(cy & 0xfff))
+		sdlInputPoll();
+	
+	if (!(cy & 0xfffff)) {
+		graphicsPeriodic();
+		#ifdef DISK_CACHE_SIZE
+			socPrvDiskCachePeriodic();
+		#endif
+	}
+}
+
 void socRun(int gdbPort)
 {
+	uint_fast16_t runLen = SOC_CPU_RUN_LEN;
 	uint16_t cy = 0;
 	
 	(void)gdbPort;
 	
+	#ifdef GDB_SUPPORT
+		if (gdbPort)
+			runLen = 1;		//breakpoints and single steps are per instr
+	#endif
+	
+	if (socPrvSnapshot(false))
+		fprintf(stderr, "resumed from snapshot '%s'\r\n", socPrvSnapshotName());
+	else	//missing, stale, or for another machine. a partial load leaves nothing the boot ROM will not redo
+		cpuInit(RAM_AMOUNT);
+	
 	while(true) {
-		cy++;
+		cy += runLen;
 		
 		#ifdef GDB_SUPPORT
 			gdbCmdWait(gdbPort, &singleStep);
 		#endif
 		
-		cpuCycle(RAM_AMOUNT);
+		cpuRun(RAM_AMOUNT, runLen);
+		socPrvDevicesStep(cy);
 		
-		if (!(cy & 0x0fff))
-			ds1287step(1);
-		
-		if (!(cy & 0x1fff))
-			socInputCheck();
-		
-		if (!(cy & 0xfff))
-			sdlInputPoll();
+		//while the guest waits for an irq, nothing it does matters, so skip right to the next device step. time is
+		//counted in instrs here, so this is all it takes to move time forward. not with gdb, it may have breakpoints
+		while (runLen == SOC_CPU_RUN_LEN && cpuIsIdle()) {
+			
+			//but not past a disk access under way: guest time is instrs, and it would not see any pass for one done in place
+			if (socPrvDiskBgCollect(true))
+				continue;
 			
-		if (!(cy & 0xfffff))
-			graphicsPeriodic();
+			mIdleSkipped += 0x1000 - (cy & 0x0fff);
+			cy = (cy | 0x0fff) + 1;
+			socPrvDevicesStep(cy);
+		}
 	}
 }
 
@@ -291,6 +745,36 @@ uint_fast16_t siiPrvBufferRead(uint_fast16_t wordIdx)
 	return mSiiBuffer[wordIdx];
 }
 
+void siiPrvBufferWriteBlock(uint_fast16_t wordIdx, const uint8_t *src, uint_fast16_t numWords)
+{
+	memcpy(mSiiBuffer + wordIdx, src, numWords * sizeof(uint16_t));
+}
+
+void siiPrvBufferReadBlock(uint_fast16_t wordIdx, uint8_t *dst, uint_fast16_t numWords)
+{
+	memcpy(dst, mSiiBuffer + wordIdx, numWords * sizeof(uint16_t));
+}
+
+void lancePrvBufferWrite(uint_fast16_t wordIdx, uint_fast16_t val)
+{
+	mLanceBuffer[wordIdx] = val;
+}
+
+uint_fast16_t lancePrvBufferRead(uint_fast16_t wordIdx)
+{
+	return mLanceBuffer[wordIdx];
+}
+
+void lancePrvBufferWriteBlock(uint_fast16_t wordIdx, const uint8_t *src, uint_fast16_t numWords)
+{
+	memcpy(mLanceBuffer + wordIdx, src, numWords * sizeof(uint16_t));
+}
+
+void lancePrvBufferReadBlock(uint_fast16_t wordIdx, uint8_t *dst, uint_fast16_t numWords)
+{
+	memcpy(dst, mLanceBuffer + wordIdx, numWords * sizeof(uint16_t));
+}
+
 
 
 
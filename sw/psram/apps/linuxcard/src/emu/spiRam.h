@@ -18,6 +18,32 @@ uint32_t spiRamGetAmt(void);
 void spiRamRead(uint32_t addr, void *data, uint_fast16_t sz);
 void spiRamWrite(uint32_t addr, const void *data, uint_fast16_t sz);
 
+//where the RAM has several independent ports (RP2040: one PIO state machine each), each class of traffic gets its
+//own so they can be queued at once. a write on any port is visible to later accesses on all of them
+enum SpiRamPort {
+	SpiRamPortData,			//cpu loads and stores, what spiRamRead/spiRamWrite use
+	SpiRamPortIfetch,		//icache fills
+	SpiRamPortIo,			//disk and SII buffers, bulk copies
+};
+
+void spiRamReadPort(uint32_t addr, void *data, uint_fast16_t sz, enum SpiRamPort port);
+void spiRamWritePort(uint32_t addr, const void *data, uint_fast16_t sz, enum SpiRamPort port);
+void spiRamReadIfetch(uint32_t addr, void *data, uint_fast16_t sz);		//for asm
+
+//any halfword-aligned address and even size, any buffer alignment: split up so no access crosses a 1K boundary
+void spiRamReadBlock(uint32_t addr, void *data, uint_fast16_t sz, enum SpiRamPort port);
+void spiRamWriteBlock(uint32_t addr, const void *data, uint_fast16_t sz, enum SpiRamPort port);
+
+//block transfers that run in the background (data word aligned, sz a multiple of 4 and at most SPI_RAM_ASYNC_MAX_SZ,
+//no 1K boundary crossings - these ARE checked, with assert()).
+//one at a time per port. write data is copied before the call returns, a read's buffer is only valid after
+//spiRamWaitPort(). later accesses on any port see a background write
+#define SPI_RAM_ASYNC_MAX_SZ	512
+
+void spiRamReadAsync(uint32_t addr, void *data, uint_fast16_t sz, enum SpiRamPort port);
+void spiRamWriteAsync(uint32_t addr, const void *data, uint_fast16_t sz, enum SpiRamPort port);
+void spiRamWaitPort(enum SpiRamPort port);
+
 
 
 #endif
@@ -1,7 +1,14 @@
 //#include <stdio.h>
+#include <assert.h>
+#include <string.h>
 #include "r3k_config.h"
 #include "hyperram.h"
+#include "spiRam.h"
 #include "printf.h"
+#include "perf.h"
+
+// Background transfer state, one per port
+static hyperram_async_t mAsync[SpiRamPortIo + 1];
 
 bool spiRamInit(uint8_t *eachChipSzP, uint8_t *numChipsP, uint8_t *chipWidthP) {
 
@@ -11,6 +18,9 @@ bool spiRamInit(uint8_t *eachChipSzP, uint8_t *numChipsP, uint8_t *chipWidthP) {
 	  return false;
 	}
 
+	for (unsigned i = 0; i < sizeof(mAsync) / sizeof(*mAsync); i++)
+	  hyperram_async_init(&mAsync[i]);
+
 	return true;
 }
 
@@ -18,46 +28,127 @@ uint32_t spiRamGetAmt(void) {
         return (EMULATOR_RAM_MB << 20);
 }
 
+// Each RAM port is its own PSRAM SM. Video refresh has the fourth.
+static const hyperram_port_t mPorts[] = {
+  [SpiRamPortData] = HRAM_PORT_CPU,
+  [SpiRamPortIfetch] = HRAM_PORT_IFETCH,
+  [SpiRamPortIo] = HRAM_PORT_IO,
+};
+
 //crossing chip boundary is not permitted AND not checked for. Crossing 1K coundary is not permitted and not checked for. Enjoy...
-void spiRamRead(uint32_t addr, void *data, uint_fast16_t sz) {
+void spiRamReadPort(uint32_t addr, void *data, uint_fast16_t sz, enum SpiRamPort port) {
 
+  perfInc(gPerf.ramReads);
+  perfAdd(gPerf.ramReadBytes, sz);
   if (sz < 4) {
-    uint8_t localdata[4];
+    // From the word it is in, so it stays inside the 1K page unless the data itself does not
+    uint8_t localdata[8];
     uint8_t* dataptr = (uint8_t *)data;
-    uint32_t align;
+    uint32_t align = addr & 0x3;
 
     //pr("Read addr/size: %08x %d\n", addr, sz);
-    hyperram_read(addr, localdata, 4);
-    align = addr & 0x1;
+    hyperram_port_read(mPorts[port], addr - align, localdata, align + sz > 4 ? 8 : 4);
 
     for(int i = 0; i < sz; i++) {
       *dataptr++ = localdata[align + i];
     }
   } else {
-    hyperram_read(addr, data, sz);
+    hyperram_port_read(mPorts[port], addr, data, sz);
   }
   
 }
 
-void spiRamWrite(uint32_t addr, const void *data, uint_fast16_t sz) {
+void spiRamWritePort(uint32_t addr, const void *data, uint_fast16_t sz, enum SpiRamPort port) {
 
+  perfInc(gPerf.ramWrites);
+  perfAdd(gPerf.ramWriteBytes, sz);
   if (sz < 4) {
-    // Do RMW
-    uint8_t rmwdata[4];
+    // Masked write: one write transaction, RWDS masks the bytes not stored
+    uint8_t wrdata[4] = {0};
     uint8_t *dptr = (uint8_t *)data;
-    uint32_t start_wr = addr & 0x1;
+    uint32_t start_wr = (addr & 0x3) + sz <= 4 ? addr & 0x3 : addr & 0x1;   // within its word where it fits, like reads
+    uint32_t wrval;
 
     //if (sz > 1) pr("Write addr/size: %08x %d\n", addr, sz);
 
-    hyperram_read(addr, rmwdata, 4);
-
     for (int i = 0; i < sz; i++) {
-      rmwdata[i + start_wr] = *dptr++;
-    } 
+      wrdata[i + start_wr] = *dptr++;
+    }
+    memcpy(&wrval, wrdata, 4);
 
-    hyperram_write(addr, rmwdata, 4);
+    hyperram_port_write_mask(mPorts[port], addr - start_wr, wrval, ((1u << sz) - 1) << start_wr);
   } else {
-    hyperram_write(addr, data, sz);
+    hyperram_port_write(mPorts[port], addr, data, sz);
+  }
+}
+
+void spiRamRead(uint32_t addr, void *data, uint_fast16_t sz) {
+  spiRamReadPort(addr, data, sz, SpiRamPortData);
+}
+
+void spiRamWrite(uint32_t addr, const void *data, uint_fast16_t sz) {
+  spiRamWritePort(addr, data, sz, SpiRamPortData);
+}
+
+void spiRamReadIfetch(uint32_t addr, void *data, uint_fast16_t sz) {
+  spiRamReadPort(addr, data, sz, SpiRamPortIfetch);
+}
+
+// Bursts go through an aligned bounce buffer: the caller's pointer is often odd, and RAM bursts are whole words
+#define BLOCK_BURST_SZ 128
+
+static uint_fast16_t spiRamPrvBlockChunk(uint32_t addr, uint_fast16_t left) {
+  uint_fast16_t now = 1024 - (addr & 1023);   // no 1K boundary crossings
+
+  if (now > BLOCK_BURST_SZ)
+    now = BLOCK_BURST_SZ;
+  if (now > left)
+    now = left;
+  if (now > 2)
+    now &= ~3;                                // a trailing halfword goes on its own
+
+  return now;
+}
+
+void spiRamWriteBlock(uint32_t addr, const void *data, uint_fast16_t sz, enum SpiRamPort port) {
+  uint32_t bounce[BLOCK_BURST_SZ / sizeof(uint32_t)];
+  const uint8_t *src = (const uint8_t *)data;
+  uint_fast16_t now;
+
+  for (; sz; addr += now, src += now, sz -= now) {
+    now = spiRamPrvBlockChunk(addr, sz);
+    memcpy(bounce, src, now);
+    spiRamWritePort(addr, bounce, now, port);
   }
 }
 
+void spiRamReadBlock(uint32_t addr, void *data, uint_fast16_t sz, enum SpiRamPort port) {
+  uint32_t bounce[BLOCK_BURST_SZ / sizeof(uint32_t)];
+  uint8_t *dst = (uint8_t *)data;
+  uint_fast16_t now;
+
+  for (; sz; addr += now, dst += now, sz -= now) {
+    now = spiRamPrvBlockChunk(addr, sz);
+    spiRamReadPort(addr, bounce, now, port);
+    memcpy(dst, bounce, now);
+  }
+}
+
+void spiRamReadAsync(uint32_t addr, void *data, uint_fast16_t sz, enum SpiRamPort port) {
+  assert((addr & 1023) + sz <= 1024);	// no 1K boundary crossings, see spiRam.h
+  perfInc(gPerf.ramReads);
+  perfAdd(gPerf.ramReadBytes, sz);
+  hyperram_port_read_async(mPorts[port], addr, data, sz, &mAsync[port]);
+}
+
+void spiRamWriteAsync(uint32_t addr, const void *data, uint_fast16_t sz, enum SpiRamPort port) {
+  assert((addr & 1023) + sz <= 1024);	// no 1K boundary crossings, see spiRam.h
+  perfInc(gPerf.ramWrites);
+  perfAdd(gPerf.ramWriteBytes, sz);
+  hyperram_port_write_async(mPorts[port], addr, data, sz, &mAsync[port]);
+}
+
+void spiRamWaitPort(enum SpiRamPort port) {
+  hyperram_async_wait(&mAsync[port]);
+}
+
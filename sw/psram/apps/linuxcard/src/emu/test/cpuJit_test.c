@@ -0,0 +1,156 @@
+// Guest-level test of the translator's block chaining (cpuJit.c): a call site
+// is chained to the block at a mapped VA, the JitPage slot of that VA is taken
+// over by another page, and the VA is then remapped to different code. The
+// next call through the chain must run the new code.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "mem.h"
+
+#define CHECK(c, ...)	do { if (!(c)) { fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } } while (0)
+
+#define RAM_SZ		0x40000
+
+// guest registers and cop0 registers
+#define V0	2
+#define T0	8
+#define T1	9
+#define T2	10
+#define S0	16
+#define S1	17
+#define T9	25
+#define RA	31
+#define CP0_INDEX	0
+#define CP0_ENTRYLO	2
+#define CP0_ENTRYHI	10
+
+#define MAIN_PA		0x1000
+#define CALL_B_PA	0x2000		// each call site in a page of its own
+#define CALL_C_PA	0x3000
+#define CODE_X_PA	0x10000		// returns 1
+#define CODE_Y_PA	0x11000		// returns 2
+#define CODE_Z_PA	0x12000		// returns 3
+
+// B and C share a JitPage slot: pages 1024 apart, same ASID
+#define VA_B		0x00400000
+#define VA_C		0x00800000
+
+static uint32_t mRam[RAM_SZ / 4];
+static bool mDone;
+
+bool memAccess(uint32_t pa, uint_fast8_t size, bool write, void *buf)
+{
+	if (pa >= RAM_SZ || size > RAM_SZ - pa)
+		return false;
+	if (write)
+		memcpy((uint8_t*)mRam + pa, buf, size);
+	else
+		memcpy(buf, (uint8_t*)mRam + pa, size);
+	return true;
+}
+
+bool cpuExtHypercall(void)
+{
+	mDone = true;
+	return true;
+}
+
+void cpuExtService(void)
+{
+}
+
+void decReportBusErrorAddr(uint32_t addr)
+{
+	(void)addr;
+}
+
+static uint32_t *mOut;
+
+static void emit(uint32_t instr)
+{
+	*mOut++ = instr;
+}
+
+static void lui(uint32_t rt, uint32_t imm)		{ emit(0x3c000000 | rt << 16 | imm); }
+static void ori(uint32_t rt, uint32_t rs, uint32_t imm)	{ emit(0x34000000 | rs << 21 | rt << 16 | imm); }
+static void li(uint32_t rt, uint32_t imm)		{ emit(0x24000000 | rt << 16 | imm); }
+static void mtc0(uint32_t rt, uint32_t rd)		{ emit(0x40800000 | rt << 16 | rd << 11); }
+static void tlbwi(void)					{ emit(0x42000002); }
+static void jal(uint32_t va)				{ emit(0x0c000000 | (va & 0x0fffffff) >> 2); emit(0); }
+static void jr(uint32_t rs)				{ emit(rs << 21 | 8); emit(0); }
+static void move(uint32_t rd, uint32_t rs)		{ emit(rs << 21 | rd << 11 | 0x25); }
+
+// TLB entry idx: va -> pa, valid, ASID 0
+static void map(uint32_t idx, uint32_t va, uint32_t pa)
+{
+	lui(T0, va >> 16);
+	mtc0(T0, CP0_ENTRYHI);
+	lui(T1, pa >> 16);
+	ori(T1, T1, (pa & 0xf000) | 0x200);
+	mtc0(T1, CP0_ENTRYLO);
+	li(T2, idx << 8);
+	mtc0(T2, CP0_INDEX);
+	tlbwi();
+}
+
+static void code(uint32_t pa)
+{
+	mOut = mRam + pa / 4;
+}
+
+int main(void)
+{
+	struct CpuState st;
+	uint32_t i;
+
+	code(MAIN_PA);
+	map(8, VA_B, CODE_X_PA);
+	map(9, VA_C, CODE_Z_PA);
+	jal(0x80000000 | CALL_B_PA);
+	move(S0, V0);
+	jal(0x80000000 | CALL_C_PA);		// C's page takes over B's slot
+	map(8, VA_B, CODE_Y_PA);		// B now has other code
+	jal(0x80000000 | CALL_B_PA);		// through the chain made by the first call
+	move(S1, V0);
+	emit(MIPS_HYPERCALL);
+	emit(0x1000ffff);			// b .
+	emit(0);
+
+	code(CALL_B_PA);
+	lui(T9, VA_B >> 16);
+	jr(T9);
+	code(CALL_C_PA);
+	lui(T9, VA_C >> 16);
+	jr(T9);
+
+	code(CODE_X_PA);
+	li(V0, 1);
+	jr(RA);
+	code(CODE_Y_PA);
+	li(V0, 2);
+	jr(RA);
+	code(CODE_Z_PA);
+	li(V0, 3);
+	jr(RA);
+
+	cpuInit(RAM_SZ);
+	cpuGetState(&st);
+	st.pc = 0x80000000 | MAIN_PA;
+	st.npc = st.pc + 4;
+	cpuSetState(&st);
+
+	// budgets big enough for whole blocks
+	for (i = 0; i < 100 && !mDone; i++)
+		cpuRun(RAM_SZ, 256);
+	CHECK(mDone, "guest did not finish, pc %08x", (unsigned)cpuGetRegExternal(MIPS_EXT_REG_PC));
+
+	cpuGetState(&st);
+	CHECK(st.regs[S0] == 1, "first call returned %u", (unsigned)st.regs[S0]);
+	CHECK(st.regs[S1] == 2, "call after the remap returned %u (a stale chain runs the old code)", (unsigned)st.regs[S1]);
+
+	printf("cpuJit_test: PASS\n");
+	return 0;
+}
@@ -0,0 +1,205 @@
+// Host test of diskMap.c: an image file is laid out on a RAM card in
+// fragments, as FatFs would find it, and every sector the map gives (and
+// every access through it) is checked against a walk of the FAT chain.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskMap.h"
+#include "diskio.h"
+
+#define CHECK(c, ...)	do { if (!(c)) { fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } } while (0)
+
+#define CARD_SECS	8192
+#define DATA_START	96		// sector of cluster 2
+#define FAT_EOC		0x0fffffff
+
+static uint8_t mCard[CARD_SECS][BLK_DEV_BLK_SZ], mShadow[CARD_SECS][BLK_DEV_BLK_SZ];
+static DWORD mFat[CARD_SECS + 2];
+static FATFS mFs;
+static FIL mFil;
+static LBA_t mFileLba[CARD_SECS];	// card sector of each image sector, from the chain
+static uint32_t mSeed = 1;
+
+static uint32_t rnd(void)
+{
+	mSeed ^= mSeed << 13;
+	mSeed ^= mSeed >> 17;
+	mSeed ^= mSeed << 5;
+	return mSeed;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
+{
+	CHECK(pdrv == mFs.pdrv && count && sector >= DATA_START && sector + count <= CARD_SECS, "read of %u at %llu", count, (unsigned long long)sector);
+	memcpy(buff, mCard[sector], count * BLK_DEV_BLK_SZ);
+	return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
+{
+	CHECK(pdrv == mFs.pdrv && count && sector >= DATA_START && sector + count <= CARD_SECS, "write of %u at %llu", count, (unsigned long long)sector);
+	memcpy(mCard[sector], buff, count * BLK_DEV_BLK_SZ);
+	return RES_OK;
+}
+
+// CREATE_LINKMAP as ff.c does it
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+	DWORD *tbl = fp->cltbl, tlen = *tbl++, ulen = 2, cl = fp->obj.sclust, tcl, ncl, pcl;
+
+	CHECK(ofs == CREATE_LINKMAP, "f_lseek to %llu", (unsigned long long)ofs);
+	if (cl) {
+		do {
+			tcl = cl;
+			ncl = 0;
+			ulen += 2;
+			do {
+				pcl = cl;
+				ncl++;
+				cl = fp->obj.fs->fat[cl];
+			} while (cl == pcl + 1);
+			if (ulen <= tlen) {
+				*tbl++ = ncl;
+				*tbl++ = tcl;
+			}
+		} while (cl < fp->obj.fs->n_fatent);
+	}
+	*fp->cltbl = ulen;
+	if (ulen > tlen)
+		return FR_NOT_ENOUGH_CORE;
+	*tbl = 0;
+	return FR_OK;
+}
+
+// the card sector of every image sector, the slow way
+static void walkChain(uint32_t numClus)
+{
+	DWORD cl = mFil.obj.sclust;
+
+	for (uint32_t i = 0; i < numClus; i++, cl = mFat[cl]) {
+		CHECK(cl >= 2 && cl < mFs.n_fatent, "cluster %u past the chain", (unsigned)i);
+		for (uint32_t j = 0; j < mFs.csize; j++)
+			mFileLba[i * mFs.csize + j] = mFs.database + (LBA_t)(cl - 2) * mFs.csize + j;
+	}
+	CHECK(cl == FAT_EOC, "chain goes on past %u clusters", (unsigned)numClus);
+}
+
+// lays out a file of numClus clusters in numFrags pieces, in a random order on the card
+static void makeFile(uint32_t csize, uint32_t numClus, uint32_t numFrags, uint32_t sizeSecs)
+{
+	uint32_t lens[64], order[64], starts[64], cl = 2;
+
+	memset(mFat, 0, sizeof(mFat));
+	mFs.pdrv = 1;
+	mFs.csize = csize;
+	mFs.database = DATA_START;
+	mFs.n_fatent = (CARD_SECS - DATA_START) / csize + 2;
+	mFs.fat = mFat;
+
+	// fragment lengths, and where each goes (at least a cluster apart)
+	for (uint32_t i = 0; i < numFrags; i++) {
+		lens[i] = numClus / numFrags + (i < numClus % numFrags);
+		order[i] = i;
+	}
+	for (uint32_t i = numFrags - 1; i; i--) {
+		uint32_t j = rnd() % (i + 1), t = order[i];
+
+		order[i] = order[j];
+		order[j] = t;
+	}
+	for (uint32_t i = 0; i < numFrags; i++) {
+		cl += 1 + rnd() % 2;
+		starts[order[i]] = cl;
+		cl += lens[order[i]];
+	}
+	CHECK(cl < mFs.n_fatent, "card too small for %u clusters", (unsigned)numClus);
+
+	// chain in file order; shuffled pieces may touch, but never as the next one
+	for (uint32_t i = 0; i < numFrags; i++) {
+		for (uint32_t j = 0; j < lens[i]; j++) {
+			uint32_t next = j + 1 < lens[i] ? starts[i] + j + 1 : (i + 1 < numFrags ? starts[i + 1] : FAT_EOC);
+
+			mFat[starts[i] + j] = next;
+		}
+		CHECK(i + 1 == numFrags || starts[i + 1] != starts[i] + lens[i], "fragments %u and %u touch", (unsigned)i, (unsigned)i + 1);
+	}
+
+	memset(&mFil, 0, sizeof(mFil));
+	mFil.obj.fs = &mFs;
+	mFil.obj.sclust = starts[0];
+	mFil.obj.objsize = (FSIZE_t)sizeSecs * BLK_DEV_BLK_SZ;
+
+	for (uint32_t i = 0; i < CARD_SECS; i++)
+		for (uint32_t j = 0; j < BLK_DEV_BLK_SZ; j++)
+			mCard[i][j] = rnd();
+	memcpy(mShadow, mCard, sizeof(mCard));
+}
+
+static void testMap(uint32_t csize, uint32_t numClus, uint32_t numFrags)
+{
+	static uint8_t buf[64 * BLK_DEV_BLK_SZ];
+	uint32_t sizeSecs = numClus * csize - rnd() % csize;
+
+	makeFile(csize, numClus, numFrags, sizeSecs);
+	walkChain(numClus);
+
+	if (2 + 2 * numFrags > DISK_MAP_SZ) {
+		CHECK(!diskMapInit(&mFil) && !mFil.cltbl, "%u fragments fit a map of %u", (unsigned)numFrags, DISK_MAP_SZ);
+		return;
+	}
+	CHECK(diskMapInit(&mFil) && mFil.cltbl, "map of %u fragments", (unsigned)numFrags);
+	CHECK(mFil.cltbl[0] == 2 + 2 * numFrags, "map says %u DWORDs for %u fragments", (unsigned)mFil.cltbl[0], (unsigned)numFrags);
+
+	// every sector: where it is, and how far that run goes
+	for (uint32_t s = 0; s < sizeSecs; s++) {
+		uint32_t run = 1;
+		LBA_t lba = 0;
+
+		while (s + run < sizeSecs && mFileLba[s + run] == mFileLba[s] + run)
+			run++;
+		CHECK(diskMapSector(&mFil, s, &lba) == run && lba == mFileLba[s], "sector %u: %u at %llu, want %u at %llu", (unsigned)s, (unsigned)diskMapSector(&mFil, s, &lba), (unsigned long long)lba, (unsigned)run, (unsigned long long)mFileLba[s]);
+	}
+	CHECK(!diskMapSector(&mFil, sizeSecs, &(LBA_t){0}), "sector past the end mapped");
+
+	// accesses of any length and place, against the file's contents
+	for (uint32_t iter = 0; iter < 400; iter++) {
+		uint32_t sector = rnd() % sizeSecs, numSec = 1 + rnd() % 64;
+		bool write = rnd() & 1, fits = sector + numSec <= sizeSecs;
+
+		if (write) {
+			for (uint32_t i = 0; i < numSec * BLK_DEV_BLK_SZ; i++)
+				buf[i] = rnd();
+			CHECK(diskMapAccess(&mFil, true, sector, numSec, buf) == fits, "write of %u at %u", (unsigned)numSec, (unsigned)sector);
+			// a write past the end stores what is in the file, as the card driver would have
+			for (uint32_t i = 0; i < numSec && sector + i < sizeSecs; i++)
+				memcpy(mShadow[mFileLba[sector + i]], buf + i * BLK_DEV_BLK_SZ, BLK_DEV_BLK_SZ);
+			if (!(iter % 16))
+				CHECK(!memcmp(mCard, mShadow, sizeof(mCard)), "write of %u at %u: card differs", (unsigned)numSec, (unsigned)sector);
+		}
+		else {
+			CHECK(diskMapAccess(&mFil, false, sector, numSec, buf) == fits, "read of %u at %u", (unsigned)numSec, (unsigned)sector);
+			for (uint32_t i = 0; i < numSec && sector + i < sizeSecs; i++)
+				CHECK(!memcmp(buf + i * BLK_DEV_BLK_SZ, mShadow[mFileLba[sector + i]], BLK_DEV_BLK_SZ), "read of %u at %u: sector %u", (unsigned)numSec, (unsigned)sector, (unsigned)(sector + i));
+		}
+	}
+	CHECK(!memcmp(mCard, mShadow, sizeof(mCard)), "card differs at the end");
+}
+
+int main(void)
+{
+	static const uint16_t csizes[] = { 1, 4, 8, 64 };
+
+	for (uint32_t i = 0; i < sizeof(csizes) / sizeof(*csizes); i++) {
+		uint32_t numClus = 2000 / csizes[i];
+
+		testMap(csizes[i], numClus, 1);
+		testMap(csizes[i], numClus, 2);
+		testMap(csizes[i], numClus, numClus < 31 ? numClus : 31);
+		testMap(csizes[i], numClus, numClus < 32 ? numClus : 32);
+	}
+
+	printf("diskMap_test: PASS\n");
+	return 0;
+}
@@ -0,0 +1,416 @@
+// Host test of fpu.c: IEEE vectors for each operation it does itself, with
+// the result and FCR's cause and flag bits checked, that rounding anywhere but
+// to nearest is refused as an unimplemented operation, and (on x86-64) random
+// arithmetic against the host's own results and exception flags.
+
+#include <fenv.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fpu.h"
+
+#define CHECK(c, ...)	do { if (!(c)) { fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } } while (0)
+
+#define FMT_S		16
+#define FMT_D		17
+#define FMT_W		20
+
+#define OP_ADD		0x00
+#define OP_SUB		0x01
+#define OP_MUL		0x02
+#define OP_DIV		0x03
+#define OP_ABS		0x05
+#define OP_MOV		0x06
+#define OP_NEG		0x07
+#define OP_CVT_S	0x20
+#define OP_CVT_D	0x21
+#define OP_CVT_W	0x24
+
+// FCR exception bits: cause at 12, enables at 7, sticky flags at 2
+#define EXC_V		0x10
+#define EXC_Z		0x08
+#define EXC_O		0x04
+#define EXC_U		0x02
+#define EXC_X		0x01
+#define FCR_CAUSE(e)	((uint32_t)(e) << 12)
+#define FCR_ENABLE(e)	((uint32_t)(e) << 7)
+#define FCR_FLAGS(e)	((uint32_t)(e) << 2)
+#define FCR_UNIMPL	0x00020000u
+
+// the R3000 has quiet and signaling NaNs the other way round from x86
+#define NAN_D		0x7ff7ffffffffffffull	// what invalid ops produce
+#define SNAN_D		0x7ff8000000000000ull
+#define QNAN_D		0x7ff0000000000001ull
+#define NAN_F		0x7fbfffffull
+#define SNAN_F		0x7fc00000ull
+#define QNAN_F		0x7f800001ull
+
+#define ONE_D		0x3ff0000000000000ull
+#define TWO_D		0x4000000000000000ull
+#define THREE_D		0x4008000000000000ull
+#define HALF_D		0x3fe0000000000000ull
+#define INF_D		0x7ff0000000000000ull
+#define MAX_D		0x7fefffffffffffffull
+#define MIN_D		0x0010000000000000ull
+#define NEG_D		0x8000000000000000ull
+
+#define ONE_F		0x3f800000ull
+#define TWO_F		0x40000000ull
+#define THREE_F		0x40400000ull
+#define HALF_F		0x3f000000ull
+#define INF_F		0x7f800000ull
+#define MAX_F		0x7f7fffffull
+#define NEG_F		0x80000000ull
+
+#define POISON		0xdeadbeefu
+
+struct Vec {
+	uint8_t fmt, op, rm;
+	uint64_t a, b, r;
+	uint8_t exc;
+};
+
+static const struct Vec mVecs[] = {
+	//double arithmetic
+	{FMT_D, OP_ADD, 0, ONE_D, TWO_D, THREE_D, 0},
+	{FMT_D, OP_ADD, 0, ONE_D, 0x3ca0000000000000ull, ONE_D, EXC_X},				//1 + 2^-53 ties to even
+	{FMT_D, OP_ADD, 0, ONE_D, 0x3cb0000000000000ull, 0x3ff0000000000001ull, 0},	//1 + 2^-52
+	{FMT_D, OP_ADD, 0, NEG_D, NEG_D, NEG_D, 0},									//-0 + -0
+	{FMT_D, OP_ADD, 0, MAX_D, MAX_D, INF_D, EXC_O | EXC_X},
+	{FMT_D, OP_ADD, 0, INF_D, ONE_D, INF_D, 0},
+	{FMT_D, OP_SUB, 0, INF_D, INF_D, NAN_D, EXC_V},
+	{FMT_D, OP_SUB, 0, ONE_D, ONE_D, 0, 0},
+	{FMT_D, OP_ADD, 0, QNAN_D, ONE_D, QNAN_D, 0},
+	{FMT_D, OP_ADD, 0, ONE_D, SNAN_D, NAN_D, EXC_V},
+	{FMT_D, OP_MUL, 0, 0x7e70000000000000ull, 0x4630000000000000ull, INF_D, EXC_O | EXC_X},	//2^1000 * 2^100
+	{FMT_D, OP_MUL, 0, MIN_D, HALF_D, 0x0008000000000000ull, 0},				//exact denormal: no underflow
+	{FMT_D, OP_MUL, 0, 1, HALF_D, 0, EXC_U | EXC_X},							//half the smallest denormal ties to 0
+	{FMT_D, OP_MUL, 0, 3, HALF_D, 2, EXC_U | EXC_X},							//and 1.5 of it to 2
+	{FMT_D, OP_MUL, 0, 0, INF_D, NAN_D, EXC_V},
+	{FMT_D, OP_MUL, 0, NEG_D | TWO_D, THREE_D, NEG_D | 0x4018000000000000ull, 0},
+	{FMT_D, OP_DIV, 0, ONE_D, THREE_D, 0x3fd5555555555555ull, EXC_X},
+	{FMT_D, OP_DIV, 0, 0x4018000000000000ull, THREE_D, TWO_D, 0},
+	{FMT_D, OP_DIV, 0, ONE_D, 0, INF_D, EXC_Z},
+	{FMT_D, OP_DIV, 0, NEG_D | ONE_D, 0, NEG_D | INF_D, EXC_Z},
+	{FMT_D, OP_DIV, 0, INF_D, 0, INF_D, 0},
+	{FMT_D, OP_DIV, 0, 0, 0, NAN_D, EXC_V},
+	{FMT_D, OP_DIV, 0, INF_D, INF_D, NAN_D, EXC_V},
+	{FMT_D, OP_DIV, 0, MIN_D, 0x4090000000000000ull, 0x0000040000000000ull, 0},	//DBL_MIN / 1024
+
+	//float arithmetic
+	{FMT_S, OP_ADD, 0, ONE_F, TWO_F, THREE_F, 0},
+	{FMT_S, OP_ADD, 0, ONE_F, 0x33800000ull, ONE_F, EXC_X},						//1 + 2^-24 ties to even
+	{FMT_S, OP_MUL, 0, MAX_F, TWO_F, INF_F, EXC_O | EXC_X},
+	{FMT_S, OP_MUL, 0, 1, HALF_F, 0, EXC_U | EXC_X},
+	{FMT_S, OP_DIV, 0, ONE_F, THREE_F, 0x3eaaaaabull, EXC_X},
+	{FMT_S, OP_DIV, 0, ONE_F, 0, INF_F, EXC_Z},
+	{FMT_S, OP_SUB, 0, INF_F, INF_F, NAN_F, EXC_V},
+	{FMT_S, OP_ADD, 0, SNAN_F, ONE_F, NAN_F, EXC_V},
+	{FMT_S, OP_ADD, 0, ONE_F, QNAN_F, QNAN_F, 0},
+
+	//sign ops never complain, not even about NaNs
+	{FMT_D, OP_ABS, 0, NEG_D | THREE_D, 0, THREE_D, 0},
+	{FMT_D, OP_NEG, 0, SNAN_D, 0, NEG_D | SNAN_D, 0},
+	{FMT_S, OP_NEG, 0, ONE_F, 0, NEG_F | ONE_F, 0},
+	{FMT_S, OP_MOV, 0, SNAN_F, 0, SNAN_F, 0},
+
+	//conversions
+	{FMT_D, OP_CVT_S, 0, 0x3fd5555555555555ull, 0, 0x3eaaaaabull, EXC_X},
+	{FMT_D, OP_CVT_S, 0, HALF_D, 0, HALF_F, 0},
+	{FMT_D, OP_CVT_S, 0, MAX_D, 0, INF_F, EXC_O | EXC_X},
+	{FMT_D, OP_CVT_S, 0, 0x358dee7a4ad4b81full, 0, 0, EXC_U | EXC_X},			//1e-50
+	{FMT_D, OP_CVT_S, 0, 0x3800000000000000ull, 0, 0x00400000ull, 0},			//2^-127, an exact denormal
+	{FMT_D, OP_CVT_S, 0, SNAN_D, 0, NAN_F, EXC_V},
+	{FMT_D, OP_CVT_S, 0, QNAN_D, 0, NAN_F, 0},
+	{FMT_W, OP_CVT_S, 0, 0x01000001ull, 0, 0x4b800000ull, EXC_X},				//2^24 + 1
+	{FMT_W, OP_CVT_S, 0, 0xfffffffbull, 0, 0xc0a00000ull, 0},
+	{FMT_S, OP_CVT_D, 0, 0x3fc00000ull, 0, 0x3ff8000000000000ull, 0},
+	{FMT_S, OP_CVT_D, 0, SNAN_F, 0, NAN_D, EXC_V},
+	{FMT_S, OP_CVT_D, 0, QNAN_F, 0, NAN_D, 0},
+	{FMT_W, OP_CVT_D, 0, 0xfffffff9ull, 0, 0xc01c000000000000ull, 0},
+
+	//CVT.W rounds as FCR says
+	{FMT_D, OP_CVT_W, 0, 0x4004000000000000ull, 0, 2, EXC_X},					//2.5
+	{FMT_D, OP_CVT_W, 1, 0x4004000000000000ull, 0, 2, EXC_X},
+	{FMT_D, OP_CVT_W, 2, 0x4004000000000000ull, 0, 3, EXC_X},
+	{FMT_D, OP_CVT_W, 3, 0x4004000000000000ull, 0, 2, EXC_X},
+	{FMT_D, OP_CVT_W, 0, 0xc004000000000000ull, 0, 0xfffffffeull, EXC_X},		//-2.5
+	{FMT_D, OP_CVT_W, 1, 0xc004000000000000ull, 0, 0xfffffffeull, EXC_X},
+	{FMT_D, OP_CVT_W, 2, 0xc004000000000000ull, 0, 0xfffffffeull, EXC_X},
+	{FMT_D, OP_CVT_W, 3, 0xc004000000000000ull, 0, 0xfffffffdull, EXC_X},
+	{FMT_D, OP_CVT_W, 2, THREE_D, 0, 3, 0},
+	{FMT_D, OP_CVT_W, 0, 0xc1e0000000000000ull, 0, 0x80000000ull, 0},			//-2^31
+	{FMT_D, OP_CVT_W, 0, 0x41e0000000000000ull, 0, 0x7fffffffull, EXC_V},		//2^31
+	{FMT_D, OP_CVT_W, 1, QNAN_D, 0, 0x7fffffffull, EXC_V},
+	{FMT_S, OP_CVT_W, 2, 0x40200000ull, 0, 3, EXC_X},							//2.5f
+	{FMT_S, OP_CVT_W, 0, INF_F, 0, 0x7fffffffull, EXC_V},
+};
+
+static struct FpuState mFpu;
+static uint32_t mRegs[32];
+
+static uint32_t cop1(uint_fast8_t fmt, uint_fast8_t op, uint_fast8_t fd, uint_fast8_t fs, uint_fast8_t ft)
+{
+	return 0x44000000u | (uint32_t)fmt << 21 | (uint32_t)ft << 16 | (uint32_t)fs << 11 | (uint32_t)fd << 6 | op;
+}
+
+static bool dstIsDouble(uint_fast8_t fmt, uint_fast8_t op)
+{
+	if (op == OP_CVT_D)
+		return true;
+	if (op == OP_CVT_S || op == OP_CVT_W)
+		return false;
+
+	return fmt == FMT_D;
+}
+
+// operands in f2 and f4 (d1 and d2), the result in f6 (d3), which starts poisoned
+static enum FpuOpRet run(uint_fast8_t fmt, uint_fast8_t op, uint64_t a, uint64_t b)
+{
+	if (fmt == FMT_D) {
+		memcpy(&mFpu.d[1], &a, sizeof(a));
+		memcpy(&mFpu.d[2], &b, sizeof(b));
+	}
+	else {
+		mFpu.i[2] = a;
+		mFpu.i[4] = b;
+	}
+	mFpu.i[6] = mFpu.i[7] = POISON;
+
+	return fpuOp(cop1(fmt, op, 6, 2, 4), mRegs, &mFpu);
+}
+
+static uint64_t result(bool dbl)
+{
+	uint64_t ret;
+
+	if (!dbl)
+		return mFpu.i[6];
+	memcpy(&ret, &mFpu.d[3], sizeof(ret));
+
+	return ret;
+}
+
+static bool poisoned(void)
+{
+	return mFpu.i[6] == POISON && mFpu.i[7] == POISON;
+}
+
+static void testVectors(void)
+{
+	for (size_t i = 0; i < sizeof(mVecs) / sizeof(*mVecs); i++) {
+		const struct Vec *v = &mVecs[i];
+		enum FpuOpRet ret;
+		uint64_t r;
+
+		mFpu.fcr = v->rm;
+		ret = run(v->fmt, v->op, v->a, v->b);
+		r = result(dstIsDouble(v->fmt, v->op));
+
+		CHECK(ret == FpuRetInstrDone, "vector %zu: returned %d", i, ret);
+		CHECK(r == v->r, "vector %zu: result %016llx, expected %016llx", i, (unsigned long long)r, (unsigned long long)v->r);
+		CHECK(mFpu.fcr == (v->rm | FCR_CAUSE(v->exc) | FCR_FLAGS(v->exc)), "vector %zu: FCR %08x, expected exceptions %02x", i, mFpu.fcr, v->exc);
+	}
+}
+
+// cause is per op, flags stick until software clears them
+static void testStickyFlags(void)
+{
+	mFpu.fcr = 0;
+	run(FMT_D, OP_DIV, ONE_D, THREE_D);
+	run(FMT_D, OP_DIV, ONE_D, 0);
+	CHECK(mFpu.fcr == (FCR_CAUSE(EXC_Z) | FCR_FLAGS(EXC_Z | EXC_X)), "after 1/3, 1/0: FCR %08x", mFpu.fcr);
+	run(FMT_D, OP_ADD, ONE_D, ONE_D);
+	CHECK(mFpu.fcr == FCR_FLAGS(EXC_Z | EXC_X), "after 1+1: FCR %08x", mFpu.fcr);
+
+	//moves to and from the CPU leave cause alone, so it can still be read
+	mFpu.fcr = FCR_CAUSE(EXC_X) | FCR_FLAGS(EXC_X);
+	CHECK(fpuOp(0x44000000u | 8u << 16 | 2u << 11, mRegs, &mFpu) == FpuRetInstrDone && mRegs[8] == mFpu.i[2], "mfc1");
+	CHECK(mFpu.fcr == (FCR_CAUSE(EXC_X) | FCR_FLAGS(EXC_X)), "after mfc1: FCR %08x", mFpu.fcr);
+}
+
+static void testTraps(void)
+{
+	//an enabled exception traps with its cause bit set and the destination untouched
+	mFpu.fcr = FCR_ENABLE(EXC_Z);
+	CHECK(run(FMT_D, OP_DIV, ONE_D, 0) == FpuRetExcTaken, "div0 with div0 enabled did not trap");
+	CHECK(mFpu.fcr & FCR_CAUSE(EXC_Z), "div0 trap: FCR %08x", mFpu.fcr);
+	CHECK(poisoned(), "div0 trap wrote the destination");
+	CHECK(run(FMT_D, OP_DIV, ONE_D, THREE_D) == FpuRetInstrDone && result(true) == 0x3fd5555555555555ull, "1/3 with div0 enabled");
+
+	//the rest are not done here, everything goes to the kernel's emulator then
+	for (uint_fast8_t exc = EXC_X; exc <= EXC_V; exc <<= 1) {
+		if (exc == EXC_Z)
+			continue;
+		mFpu.fcr = FCR_ENABLE(exc);
+		CHECK(run(FMT_D, OP_ADD, ONE_D, ONE_D) == FpuRetExcTaken, "enable %02x: 1+1 did not trap", exc);
+		CHECK(mFpu.fcr & FCR_UNIMPL, "enable %02x: FCR %08x", exc, mFpu.fcr);
+		CHECK(poisoned(), "enable %02x: destination written", exc);
+	}
+}
+
+// only round to nearest is done here, rounding ops in other modes are unimplemented
+static void testRoundingModes(void)
+{
+	static const struct {
+		uint8_t fmt, op;
+	} rounds[] = {
+		{FMT_D, OP_ADD}, {FMT_D, OP_SUB}, {FMT_D, OP_MUL}, {FMT_D, OP_DIV},
+		{FMT_S, OP_ADD}, {FMT_S, OP_SUB}, {FMT_S, OP_MUL}, {FMT_S, OP_DIV},
+		{FMT_D, OP_CVT_S}, {FMT_W, OP_CVT_S},
+	}, exact[] = {
+		{FMT_D, OP_ABS}, {FMT_S, OP_NEG}, {FMT_D, OP_MOV}, {FMT_S, OP_CVT_D}, {FMT_W, OP_CVT_D},
+	};
+
+	for (uint_fast8_t rm = 1; rm < 4; rm++) {
+		for (size_t i = 0; i < sizeof(rounds) / sizeof(*rounds); i++) {
+			uint64_t one = rounds[i].fmt == FMT_D ? ONE_D : (rounds[i].fmt == FMT_S ? ONE_F : 1);
+
+			mFpu.fcr = rm | FCR_FLAGS(EXC_X);
+			CHECK(run(rounds[i].fmt, rounds[i].op, one, one) == FpuRetExcTaken, "rm %u op %02x.%u: not refused", rm, rounds[i].op, rounds[i].fmt);
+			CHECK(mFpu.fcr == (rm | FCR_FLAGS(EXC_X) | FCR_UNIMPL), "rm %u op %02x.%u: FCR %08x", rm, rounds[i].op, rounds[i].fmt, mFpu.fcr);
+			CHECK(poisoned(), "rm %u op %02x.%u: destination written", rm, rounds[i].op, rounds[i].fmt);
+		}
+		for (size_t i = 0; i < sizeof(exact) / sizeof(*exact); i++) {
+			uint64_t one = exact[i].fmt == FMT_D ? ONE_D : (exact[i].fmt == FMT_S ? ONE_F : 1);
+
+			mFpu.fcr = rm;
+			CHECK(run(exact[i].fmt, exact[i].op, one, one) == FpuRetInstrDone, "rm %u op %02x.%u: refused", rm, exact[i].op, exact[i].fmt);
+			CHECK(mFpu.fcr == rm && !poisoned(), "rm %u op %02x.%u: FCR %08x", rm, exact[i].op, exact[i].fmt, mFpu.fcr);
+		}
+	}
+}
+
+#ifdef __x86_64__
+
+static uint32_t mSeed = 1;
+
+static uint32_t rnd(void)
+{
+	mSeed ^= mSeed << 13;
+	mSeed ^= mSeed >> 17;
+	mSeed ^= mSeed << 5;
+	return mSeed;
+}
+
+// no NaNs (x86 has them the other way round), plenty of zeroes, infinities,
+// denormals, results that overflow or underflow and ones that are exact
+static uint64_t rndBits(bool dbl)
+{
+	uint_fast16_t expMax = dbl ? 0x7ff : 0xff, expMid = dbl ? 0x3ff : 0x7f, exp;
+	uint_fast8_t mantBits = dbl ? 52 : 23;
+	uint64_t mant = ((uint64_t)rnd() << 32 | rnd()) & ((1ull << mantBits) - 1);
+
+	switch (rnd() % 8) {
+		case 0:
+			exp = 0;
+			break;
+		case 1:
+			exp = rnd() % 40;
+			break;
+		case 2:
+			exp = expMax - 1 - rnd() % 40;
+			break;
+		case 3:
+			exp = expMax;
+			mant = 0;
+			break;
+		default:
+			exp = expMid - 30 + rnd() % 60;
+			break;
+	}
+	if (rnd() % 2)		//few mantissa bits, so results are often exact
+		mant &= ~((1ull << (mantBits - rnd() % 8)) - 1);
+
+	return (uint64_t)(rnd() % 2) << (dbl ? 63 : 31) | (uint64_t)exp << mantBits | mant;
+}
+
+static uint_fast8_t hostExc(void)
+{
+	int fe = fetestexcept(FE_ALL_EXCEPT);
+
+	return ((fe & FE_INVALID) ? EXC_V : 0) | ((fe & FE_DIVBYZERO) ? EXC_Z : 0) | ((fe & FE_OVERFLOW) ? EXC_O : 0) |
+		((fe & FE_UNDERFLOW) ? EXC_U : 0) | ((fe & FE_INEXACT) ? EXC_X : 0);
+}
+
+// the host computes the answer, fpu.c must agree on it and its exceptions
+static void testHost(bool dbl, uint_fast8_t op, uint32_t iters)
+{
+	for (uint32_t i = 0; i < iters; i++) {
+		uint64_t a = rndBits(dbl), b = rndBits(dbl), r, expect;
+		uint_fast8_t exc;
+		bool tinyMin;
+
+		if (dbl) {
+			volatile double va, vb, vr;
+
+			memcpy((void *)&va, &a, sizeof(a));
+			memcpy((void *)&vb, &b, sizeof(b));
+			feclearexcept(FE_ALL_EXCEPT);
+			switch (op) {
+				case OP_ADD: vr = va + vb; break;
+				case OP_SUB: vr = va - vb; break;
+				case OP_MUL: vr = va * vb; break;
+				default: vr = va / vb; break;
+			}
+			exc = hostExc();
+			memcpy(&expect, (void *)&vr, sizeof(expect));
+			tinyMin = (expect << 1) == (MIN_D << 1);
+		}
+		else {
+			volatile float va, vb, vr;
+			uint32_t t;
+
+			t = a;
+			memcpy((void *)&va, &t, sizeof(t));
+			t = b;
+			memcpy((void *)&vb, &t, sizeof(t));
+			feclearexcept(FE_ALL_EXCEPT);
+			switch (op) {
+				case OP_ADD: vr = va + vb; break;
+				case OP_SUB: vr = va - vb; break;
+				case OP_MUL: vr = va * vb; break;
+				default: vr = va / vb; break;
+			}
+			exc = hostExc();
+			memcpy(&t, (void *)&vr, sizeof(t));
+			expect = t;
+			tinyMin = (t << 1) == (0x00800000u << 1);
+		}
+		if (exc & EXC_V)
+			expect = dbl ? NAN_D : NAN_F;
+
+		//x86 decides tininess before rounding to the format's precision, fpu.c after. they only disagree
+		//about an inexact result that rounded up to the smallest normal, leave those be
+		if (tinyMin && (exc & EXC_X))
+			continue;
+
+		mFpu.fcr = 0;
+		CHECK(run(dbl ? FMT_D : FMT_S, op, a, b) == FpuRetInstrDone, "%016llx op %02x %016llx: returned", (unsigned long long)a, op, (unsigned long long)b);
+		r = result(dbl);
+		CHECK(r == expect, "%016llx op %02x.%u %016llx: %016llx, host says %016llx", (unsigned long long)a, op, dbl, (unsigned long long)b, (unsigned long long)r, (unsigned long long)expect);
+		CHECK(mFpu.fcr == (FCR_CAUSE(exc) | FCR_FLAGS(exc)), "%016llx op %02x.%u %016llx: FCR %08x, host says %02x", (unsigned long long)a, op, dbl, (unsigned long long)b, mFpu.fcr, exc);
+	}
+}
+
+#endif
+
+int main(void)
+{
+	testVectors();
+	testStickyFlags();
+	testTraps();
+	testRoundingModes();
+
+#ifdef __x86_64__
+	for (uint_fast8_t op = OP_ADD; op <= OP_DIV; op++) {
+		testHost(true, op, 200000);
+		testHost(false, op, 200000);
+	}
+#endif
+
+	printf("fpu_test: PASS\n");
+	return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef _DISKIO_H_STUB
+#define _DISKIO_H_STUB
+
+// Host stand-in for the FatFs disk layer, over the test's RAM card
+
+#include "ff.h"
+
+typedef enum { RES_OK = 0, RES_ERROR, RES_WRPRT, RES_NOTRDY, RES_PARERR } DRESULT;
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count);
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _FF_H_STUB
+#define _FF_H_STUB
+
+// Host stand-in for FatFs: the configuration, types and fields the emulator's
+// map code uses, under their FatFs names. The volume is a RAM card with a FAT
+// the test lays out itself (see diskMap_test.c), f_lseek only does
+// CREATE_LINKMAP, the way ff.c does it.
+
+#include <stdint.h>
+
+#define FF_USE_FASTSEEK		1
+#define FF_MAX_SS		512
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef unsigned int UINT;
+typedef uint64_t QWORD;
+typedef QWORD FSIZE_t;
+typedef QWORD LBA_t;
+
+typedef enum {
+	FR_OK = 0, FR_DISK_ERR, FR_INT_ERR, FR_NOT_READY, FR_NO_FILE,
+	FR_NO_PATH, FR_INVALID_NAME, FR_DENIED, FR_EXIST, FR_INVALID_OBJECT,
+	FR_WRITE_PROTECTED, FR_INVALID_DRIVE, FR_NOT_ENABLED, FR_NO_FILESYSTEM,
+	FR_MKFS_ABORTED, FR_TIMEOUT, FR_LOCKED, FR_NOT_ENOUGH_CORE,
+	FR_TOO_MANY_OPEN_FILES, FR_INVALID_PARAMETER
+} FRESULT;
+
+typedef struct {
+	BYTE pdrv;
+	WORD csize;		// sectors per cluster
+	DWORD n_fatent;		// clusters + 2
+	LBA_t database;		// first sector of cluster 2
+	DWORD *fat;		// stand-in: the FAT, in RAM
+} FATFS;
+
+typedef struct {
+	FATFS *fs;
+	DWORD sclust;
+	FSIZE_t objsize;
+} FFOBJID;
+
+typedef struct {
+	FFOBJID obj;
+	DWORD *cltbl;
+} FIL;
+
+#define f_size(fp)	((fp)->obj.objsize)
+#define CREATE_LINKMAP	((FSIZE_t)0 - 1)
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
+
+#endif
@@ -0,0 +1,537 @@
+// Host test of the LANCE descriptor rings in lance.c. The test plays the
+// driver: it writes the init block and the rings straight into the chip's
+// buffer RAM, programs the CSRs through the register window, and plugs in
+// a backend that records TX frames and hands out queued RX frames. The
+// chip may only send a frame once every descriptor up to ENP is handed
+// over, must scatter received frames over as many RX buffers as they need
+// (STP, ENP, MCNT, BUFF when it runs out), and must flag MERR for buffers
+// outside of its RAM. Random runs check the rings as they wrap.
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+#include "lance.h"
+#include "mem.h"
+#include "soc.h"
+
+#define CHECK(c, ...)	do { if (!(c)) { fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } } while (0)
+
+// the chip as the guest sees it
+#define LANCE_BASE		0x18000000
+#define LANCE_RDP		0x00
+#define LANCE_RAP		0x04
+
+#define CSR0_ERR		0x8000
+#define CSR0_MISS		0x1000
+#define CSR0_MERR		0x0800
+#define CSR0_RINT		0x0400
+#define CSR0_TINT		0x0200
+#define CSR0_IDON		0x0100
+#define CSR0_INTR		0x0080
+#define CSR0_INEA		0x0040
+#define CSR0_RXON		0x0020
+#define CSR0_TXON		0x0010
+#define CSR0_TDMD		0x0008
+#define CSR0_STOP		0x0004
+#define CSR0_STRT		0x0002
+#define CSR0_INIT		0x0001
+#define CSR0_W1C		(CSR0_MISS | CSR0_MERR | CSR0_RINT | CSR0_TINT | CSR0_IDON)
+
+#define MODE_LOOP		0x0004
+
+#define DESC_OWN		0x8000
+#define DESC_ERR		0x4000
+#define RMD1_BUFF		0x0400
+#define DESC_STP		0x0200
+#define DESC_ENP		0x0100
+#define TMD3_BUFF		0x8000
+
+// buffer RAM layout
+#define IADR			0x0000
+#define RDRA			0x0100
+#define TDRA			0x0200
+#define RX_ORDER		4
+#define TX_ORDER		3
+#define RX_NUM			(1 << RX_ORDER)
+#define TX_NUM			(1 << TX_ORDER)
+#define RX_BUFS			0x1000
+#define TX_BUFS			0xa000
+#define BUF_STRIDE		0x800
+
+#define MIN_FRAME		64		// with FCS
+#define FCS_LEN			4
+#define MAX_FRAME		1514	// without
+
+static const uint8_t mMac[6] = {0x08, 0x00, 0x2b, 0x11, 0x22, 0x33};
+
+static MemAccessF mLanceAccess;
+static bool mIrq;
+static uint8_t mBuf[LANCE_BUFFER_SIZE];
+
+static uint8_t mTxFrame[2048];
+static uint32_t mTxLen, mTxCount;
+
+static struct {
+	uint8_t data[MAX_FRAME];
+	uint32_t len;
+} mRxQ[8];
+static unsigned mRxHead, mRxNum;
+
+static unsigned mRxIdx, mTxIdx;		// where the driver expects the chip to be
+static uint32_t mSeed = 1;
+
+static uint32_t rnd(void)
+{
+	mSeed ^= mSeed << 13;
+	mSeed ^= mSeed >> 17;
+	mSeed ^= mSeed << 5;
+	return mSeed;
+}
+
+// what lance.c needs from the rest of the emulator
+
+bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF af)
+{
+	CHECK(pa == LANCE_BASE && !mLanceAccess, "unexpected region at %08x", (unsigned)pa);
+	mLanceAccess = af;
+	return true;
+}
+
+void cpuIrq(uint_fast8_t idx, bool raise)
+{
+	CHECK(idx == SOC_IRQNO_ETHERNET, "irq %u", idx);
+	mIrq = raise;
+}
+
+void lancePrvBufferWrite(uint_fast16_t wordIdx, uint_fast16_t val)
+{
+	mBuf[wordIdx * 2] = val;
+	mBuf[wordIdx * 2 + 1] = val >> 8;
+}
+
+uint_fast16_t lancePrvBufferRead(uint_fast16_t wordIdx)
+{
+	return mBuf[wordIdx * 2] + (mBuf[wordIdx * 2 + 1] << 8);
+}
+
+void lancePrvBufferWriteBlock(uint_fast16_t wordIdx, const uint8_t *src, uint_fast16_t numWords)
+{
+	memcpy(mBuf + wordIdx * 2, src, numWords * 2);
+}
+
+void lancePrvBufferReadBlock(uint_fast16_t wordIdx, uint8_t *dst, uint_fast16_t numWords)
+{
+	memcpy(dst, mBuf + wordIdx * 2, numWords * 2);
+}
+
+// no snapshots are taken here
+void snapshotSection(struct Snapshot *ss, uint32_t tag) { CHECK(0, "snapshot"); }
+void snapshotBytes(struct Snapshot *ss, void *buf, uint32_t len) { CHECK(0, "snapshot"); }
+void snapshotU32(struct Snapshot *ss, uint32_t *valP) { CHECK(0, "snapshot"); }
+void snapshotBulk(struct Snapshot *ss, uint32_t len, SnapshotBulkF f, void *userData) { CHECK(0, "snapshot"); }
+
+// the wire
+
+static bool backendTx(void *userData, const uint8_t *frame, uint32_t len)
+{
+	CHECK(len <= sizeof(mTxFrame), "TX frame of %u", (unsigned)len);
+	memcpy(mTxFrame, frame, len);
+	mTxLen = len;
+	mTxCount++;
+	return true;
+}
+
+static uint32_t backendRx(void *userData, uint8_t *frame, uint32_t maxLen)
+{
+	uint32_t len;
+
+	if (!mRxNum)
+		return 0;
+	len = mRxQ[mRxHead].len;
+	CHECK(len <= maxLen, "RX frame of %u with room for %u", (unsigned)len, (unsigned)maxLen);
+	memcpy(frame, mRxQ[mRxHead].data, len);
+	mRxHead = (mRxHead + 1) % 8;
+	mRxNum--;
+	return len;
+}
+
+static const struct LanceBackend mBackend = {
+	.txFrame = backendTx,
+	.rxFrame = backendRx,
+};
+
+static void rxQueue(const uint8_t *frame, uint32_t len)
+{
+	CHECK(mRxNum < 8, "RX queue full");
+	memcpy(mRxQ[(mRxHead + mRxNum) % 8].data, frame, len);
+	mRxQ[(mRxHead + mRxNum) % 8].len = len;
+	mRxNum++;
+}
+
+// the driver's side
+
+static void wr16(uint32_t addr, uint16_t v)
+{
+	mBuf[addr] = v;
+	mBuf[addr + 1] = v >> 8;
+}
+
+static uint16_t rd16(uint32_t addr)
+{
+	return mBuf[addr] + (mBuf[addr + 1] << 8);
+}
+
+static void csrWrite(unsigned csr, uint16_t v)
+{
+	uint16_t r = csr;
+
+	CHECK(mLanceAccess(LANCE_BASE + LANCE_RAP, 2, true, &r), "RAP write");
+	CHECK(mLanceAccess(LANCE_BASE + LANCE_RDP, 2, true, &v), "CSR%u write", csr);
+}
+
+static uint16_t csr0(void)
+{
+	uint16_t v = 0;
+
+	CHECK(mLanceAccess(LANCE_BASE + LANCE_RAP, 2, true, &v), "RAP write");
+	CHECK(mLanceAccess(LANCE_BASE + LANCE_RDP, 2, false, &v), "CSR0 read");
+	return v;
+}
+
+static void csr0Ack(uint16_t bits)		// clear those, keep irqs on
+{
+	csrWrite(0, (bits & CSR0_W1C) | CSR0_INEA);
+}
+
+static uint32_t rxDesc(unsigned idx)
+{
+	return RDRA + (idx % RX_NUM) * 8;
+}
+
+static uint32_t txDesc(unsigned idx)
+{
+	return TDRA + (idx % TX_NUM) * 8;
+}
+
+// buffer at addr of len bytes. word 1 goes last, as a driver must do it
+static void descSet(uint32_t desc, uint32_t addr, uint32_t len, uint16_t flags)
+{
+	wr16(desc + 0, addr);
+	wr16(desc + 2 * 2, 0xf000 | ((0 - len) & 0x0fff));
+	wr16(desc + 3 * 2, 0);
+	wr16(desc + 1 * 2, flags | ((addr >> 16) & 0xff));
+}
+
+static void rxGive(unsigned idx, uint32_t len)
+{
+	descSet(rxDesc(idx), RX_BUFS + (idx % RX_NUM) * BUF_STRIDE, len, DESC_OWN);
+}
+
+static void chipStart(uint16_t mode, uint32_t rxLen)
+{
+	unsigned i;
+
+	csrWrite(0, CSR0_STOP);
+	CHECK(csr0() == CSR0_STOP, "stop: %04x", csr0());
+	CHECK(!mIrq, "irq when stopped");
+
+	memset(mBuf, 0, sizeof(mBuf));
+	wr16(IADR + 0, mode);
+	memcpy(mBuf + IADR + 2, mMac, sizeof(mMac));
+	wr16(IADR + 16, RDRA);
+	wr16(IADR + 18, RX_ORDER << 13);
+	wr16(IADR + 20, TDRA);
+	wr16(IADR + 22, TX_ORDER << 13);
+	for (i = 0; i < RX_NUM; i++)
+		rxGive(i, rxLen);
+	mRxIdx = 0;
+	mTxIdx = 0;
+	mRxNum = 0;
+	mTxCount = 0;
+
+	csrWrite(1, IADR);
+	csrWrite(2, 0);
+	csrWrite(0, CSR0_INIT | CSR0_INEA);
+	CHECK((csr0() & (CSR0_IDON | CSR0_INTR | CSR0_ERR)) == (CSR0_IDON | CSR0_INTR) && mIrq, "init: %04x", csr0());
+	csrWrite(0, CSR0_IDON | CSR0_STRT | CSR0_INEA);
+	CHECK((csr0() &~ CSR0_INIT) == (CSR0_STRT | CSR0_INEA | CSR0_RXON | CSR0_TXON) && !mIrq, "start: %04x", csr0());
+}
+
+static void frameMake(uint8_t *frame, uint32_t len, const uint8_t *dst)
+{
+	uint32_t i;
+
+	memcpy(frame, dst, 6);
+	memcpy(frame + 6, "\x08\x00\x2b\x99\x88\x77", 6);
+	for (i = 12; i < len; i++)
+		frame[i] = rnd();
+}
+
+// driver takes the next received frame out of the ring and gives the buffers back
+static void rxCheck(const uint8_t *frame, uint32_t len, uint32_t bufLen)
+{
+	uint32_t total = len + FCS_LEN < MIN_FRAME ? MIN_FRAME : len + FCS_LEN, done = 0, now;
+	uint16_t rmd1;
+	unsigned n;
+
+	for (n = 0; done < total; n++) {
+
+		uint32_t desc = rxDesc(mRxIdx + n);
+
+		CHECK(n < RX_NUM, "frame of %u did not fit", (unsigned)len);
+		rmd1 = rd16(desc + 2);
+		CHECK(!(rmd1 & (DESC_OWN | DESC_ERR)), "RX desc %u: %04x", n, rmd1);
+		CHECK(!!(rmd1 & DESC_STP) == !n, "RX desc %u: STP in %04x", n, rmd1);
+		now = total - done < bufLen ? total - done : bufLen;
+		if (done < len)
+			CHECK(!memcmp(mBuf + RX_BUFS + ((mRxIdx + n) % RX_NUM) * BUF_STRIDE, frame + done, (len - done < now ? len - done : now)), "RX data of desc %u", n);
+		done += now;
+		CHECK(!!(rmd1 & DESC_ENP) == (done == total), "RX desc %u: ENP in %04x", n, rmd1);
+		if (done == total)
+			CHECK(rd16(desc + 6) == total, "MCNT %u, not %u", rd16(desc + 6), (unsigned)total);
+	}
+	CHECK(rd16(rxDesc(mRxIdx + n) + 2) & DESC_OWN, "chip took a buffer it did not need");
+
+	while (n--)
+		rxGive(mRxIdx++, bufLen);
+}
+
+static void testTxHandoff(void)
+{
+	static const uint32_t lens[3] = {20, 30, 10};
+	uint8_t frame[60];
+	unsigned i;
+
+	chipStart(0, 256);
+	frameMake(frame, sizeof(frame), mMac);
+
+	// three buffers, the last one not handed over yet
+	for (i = 0; i < 3; i++)
+		memcpy(mBuf + TX_BUFS + i * BUF_STRIDE, frame + (i ? lens[0] : 0) + (i > 1 ? lens[1] : 0), lens[i]);
+	descSet(txDesc(2), TX_BUFS + 2 * BUF_STRIDE, lens[2], DESC_ENP);
+	descSet(txDesc(1), TX_BUFS + 1 * BUF_STRIDE, lens[1], DESC_OWN);
+	descSet(txDesc(0), TX_BUFS + 0 * BUF_STRIDE, lens[0], DESC_OWN | DESC_STP);
+	lancePoll();
+	csrWrite(0, CSR0_TDMD | CSR0_INEA);
+	CHECK(!mTxCount, "sent half a frame");
+	CHECK((rd16(txDesc(0) + 2) & DESC_OWN) && (rd16(txDesc(1) + 2) & DESC_OWN), "took half a frame");
+	CHECK(!(csr0() & CSR0_TINT) && !mIrq, "TINT for nothing");
+
+	// the demand alone sends it, no poll needed
+	wr16(txDesc(2) + 2, DESC_OWN | DESC_ENP);
+	csrWrite(0, CSR0_TDMD | CSR0_INEA);
+	CHECK(mTxCount == 1 && mTxLen == sizeof(frame) && !memcmp(mTxFrame, frame, sizeof(frame)), "chained TX frame");
+	for (i = 0; i < 3; i++) {
+
+		uint16_t tmd1 = rd16(txDesc(i) + 2);
+
+		CHECK(!(tmd1 & (DESC_OWN | DESC_ERR)) && rd16(txDesc(i) + 6) == 0, "TX desc %u: %04x %04x", i, tmd1, rd16(txDesc(i) + 6));
+		CHECK((tmd1 & (DESC_STP | DESC_ENP)) == (i == 0 ? DESC_STP : i == 2 ? DESC_ENP : 0), "TX desc %u flags %04x", i, tmd1);
+	}
+	CHECK((csr0() & (CSR0_TINT | CSR0_INTR)) == (CSR0_TINT | CSR0_INTR) && mIrq, "no TINT: %04x", csr0());
+	csr0Ack(CSR0_TINT);
+	CHECK(!mIrq, "irq after TINT was cleared");
+
+	// the chip carries on from the next descriptor, found by its own poll
+	memcpy(mBuf + TX_BUFS + 3 * BUF_STRIDE, frame, 40);
+	descSet(txDesc(3), TX_BUFS + 3 * BUF_STRIDE, 40, DESC_OWN | DESC_STP | DESC_ENP);
+	lancePoll();
+	CHECK(mTxCount == 2 && mTxLen == 40 && !memcmp(mTxFrame, frame, 40), "next TX frame");
+	CHECK(!(rd16(txDesc(3) + 2) & DESC_OWN) && mIrq, "next TX desc: %04x", rd16(txDesc(3) + 2));
+}
+
+static void testTxMerr(void)
+{
+	uint8_t frame[60];
+
+	chipStart(0, 256);
+	frameMake(frame, sizeof(frame), mMac);
+
+	// a buffer past the end of the chip's RAM, then a good frame
+	descSet(txDesc(0), 0x10000 + TX_BUFS, sizeof(frame), DESC_OWN | DESC_STP | DESC_ENP);
+	memcpy(mBuf + TX_BUFS + BUF_STRIDE, frame, sizeof(frame));
+	descSet(txDesc(1), TX_BUFS + BUF_STRIDE, sizeof(frame), DESC_OWN | DESC_STP | DESC_ENP);
+	lancePoll();
+
+	CHECK((rd16(txDesc(0) + 2) & (DESC_OWN | DESC_ERR)) == DESC_ERR && (rd16(txDesc(0) + 6) & TMD3_BUFF), "bad TX desc: %04x %04x", rd16(txDesc(0) + 2), rd16(txDesc(0) + 6));
+	CHECK((csr0() & (CSR0_ERR | CSR0_MERR | CSR0_INTR)) == (CSR0_ERR | CSR0_MERR | CSR0_INTR) && mIrq, "no MERR: %04x", csr0());
+	CHECK(mTxCount == 1 && mTxLen == sizeof(frame) && !memcmp(mTxFrame, frame, sizeof(frame)), "frame after the bad one");
+	csr0Ack(CSR0_MERR | CSR0_TINT);
+	CHECK(!(csr0() & CSR0_ERR) && !mIrq, "MERR stuck: %04x", csr0());
+}
+
+static void testRxChained(void)
+{
+	static const uint8_t bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+	uint8_t frame[MAX_FRAME];
+
+	chipStart(0, 64);
+
+	// 200 bytes and an FCS over four 64-byte buffers
+	frameMake(frame, 200, mMac);
+	rxQueue(frame, 200);
+	lancePoll();
+	CHECK(!mRxNum, "frame left with the backend");
+	CHECK((csr0() & (CSR0_RINT | CSR0_INTR | CSR0_ERR)) == (CSR0_RINT | CSR0_INTR) && mIrq, "no RINT: %04x", csr0());
+	rxCheck(frame, 200, 64);
+	csr0Ack(CSR0_RINT);
+
+	// a runt is padded to the minimum
+	frameMake(frame, 20, bcast);
+	rxQueue(frame, 20);
+	lancePoll();
+	rxCheck(frame, 20, 64);
+
+	// not for us
+	frameMake(frame, 100, (const uint8_t*)"\x08\x00\x2b\x11\x22\x34");
+	rxQueue(frame, 100);
+	csr0Ack(CSR0_RINT);
+	lancePoll();
+	CHECK(!mRxNum && !(csr0() & CSR0_RINT) && (rd16(rxDesc(mRxIdx) + 2) & DESC_OWN), "took a frame for someone else");
+}
+
+static void testRxNoBuffers(void)
+{
+	uint8_t frame[MAX_FRAME];
+	unsigned i;
+
+	chipStart(0, 64);
+	for (i = 0; i < RX_NUM; i++)
+		wr16(rxDesc(i) + 2, 0);
+
+	// nowhere to put it: it waits at the backend
+	frameMake(frame, 200, mMac);
+	rxQueue(frame, 200);
+	lancePoll();
+	CHECK(mRxNum == 1 && !(csr0() & (CSR0_RINT | CSR0_MISS)), "frame taken with no buffers: %04x", csr0());
+
+	// two buffers are not enough, what did fit is handed back flagged
+	rxGive(0, 64);
+	rxGive(1, 64);
+	lancePoll();
+	CHECK(!mRxNum, "frame left with the backend");
+	CHECK((rd16(rxDesc(0) + 2) & (DESC_OWN | DESC_ERR | DESC_STP | DESC_ENP)) == DESC_STP, "first desc: %04x", rd16(rxDesc(0) + 2));
+	CHECK((rd16(rxDesc(1) + 2) & (DESC_OWN | DESC_ERR | RMD1_BUFF | DESC_STP | DESC_ENP)) == (DESC_ERR | RMD1_BUFF), "last desc: %04x", rd16(rxDesc(1) + 2));
+	CHECK(!memcmp(mBuf + RX_BUFS, frame, 64) && !memcmp(mBuf + RX_BUFS + BUF_STRIDE, frame + 64, 64), "partial frame data");
+	CHECK(csr0() & CSR0_RINT, "no RINT: %04x", csr0());
+	csr0Ack(CSR0_RINT);
+
+	// the chip moved past them
+	rxGive(2, 256);
+	rxGive(3, 256);
+	frameMake(frame, 100, mMac);
+	rxQueue(frame, 100);
+	lancePoll();
+	mRxIdx = 2;
+	rxCheck(frame, 100, 256);
+}
+
+static void testRxMerr(void)
+{
+	uint8_t frame[100];
+
+	chipStart(0, 256);
+
+	// the buffer is past the end of the chip's RAM
+	descSet(rxDesc(0), 0x10000 + RX_BUFS, 256, DESC_OWN);
+	frameMake(frame, sizeof(frame), mMac);
+	rxQueue(frame, sizeof(frame));
+	lancePoll();
+	CHECK((rd16(rxDesc(0) + 2) & (DESC_OWN | DESC_ERR | RMD1_BUFF | DESC_STP)) == (DESC_ERR | RMD1_BUFF | DESC_STP), "bad RX desc: %04x", rd16(rxDesc(0) + 2));
+	CHECK((csr0() & (CSR0_ERR | CSR0_MERR | CSR0_RINT)) == (CSR0_ERR | CSR0_MERR | CSR0_RINT) && mIrq, "no MERR: %04x", csr0());
+	CHECK(rd16(rxDesc(1) + 2) & DESC_OWN, "chip went past the bad buffer");
+	csr0Ack(CSR0_MERR | CSR0_RINT);
+	CHECK(!mIrq, "irq after MERR was cleared");
+
+	// the next frame goes to the next buffer
+	rxQueue(frame, sizeof(frame));
+	lancePoll();
+	mRxIdx = 1;
+	rxCheck(frame, sizeof(frame), 256);
+}
+
+static void testLoopback(void)
+{
+	uint8_t frame[80];
+
+	chipStart(MODE_LOOP, 128);
+	frameMake(frame, sizeof(frame), mMac);
+	memcpy(mBuf + TX_BUFS, frame, sizeof(frame));
+	descSet(txDesc(0), TX_BUFS, sizeof(frame), DESC_OWN | DESC_STP | DESC_ENP);
+	csrWrite(0, CSR0_TDMD | CSR0_INEA);
+
+	CHECK(!mTxCount, "loopback frame went out");
+	CHECK((csr0() & (CSR0_RINT | CSR0_TINT)) == (CSR0_RINT | CSR0_TINT), "loopback: %04x", csr0());
+	rxCheck(frame, sizeof(frame), 128);
+}
+
+static void testRandom(void)
+{
+	static uint8_t frame[MAX_FRAME];
+	uint32_t rxLen = 100 + rnd() % 1500;
+	unsigned iter, i, n;
+
+	// every RX ring's worth of buffers holds the largest frame
+	chipStart(0, rxLen);
+
+	for (iter = 0; iter < 3000; iter++) {
+
+		uint32_t len = 14 + rnd() % (MAX_FRAME - 13), done, now;
+
+		frameMake(frame, len, mMac);
+
+		if (rnd() & 1) {
+
+			rxQueue(frame, len);
+			lancePoll();
+			CHECK(!mRxNum, "iter %u: frame left with the backend", iter);
+			rxCheck(frame, len, rxLen);
+		}
+		else {
+
+			// up to four buffers, the first one handed over last
+			n = 1 + rnd() % 4;
+			for (i = 0, done = 0; i < n; i++, done += now) {
+
+				uint32_t desc = txDesc(mTxIdx + i), addr = TX_BUFS + ((mTxIdx + i) % TX_NUM) * BUF_STRIDE;
+
+				now = i == n - 1 ? len - done : 1 + rnd() % (len - done - (n - 1 - i));
+				memcpy(mBuf + addr, frame + done, now);
+				descSet(desc, addr, now, (i ? DESC_OWN : DESC_STP) | (i == n - 1 ? DESC_ENP : 0));
+			}
+			wr16(txDesc(mTxIdx) + 2, rd16(txDesc(mTxIdx) + 2) | DESC_OWN);
+			if (rnd() & 1)
+				csrWrite(0, CSR0_TDMD | CSR0_INEA);
+			else
+				lancePoll();
+			CHECK(mTxCount == 1 && mTxLen == len && !memcmp(mTxFrame, frame, len), "iter %u: TX frame of %u in %u", iter, (unsigned)len, n);
+			for (i = 0; i < n; i++)
+				CHECK(!(rd16(txDesc(mTxIdx + i) + 2) & (DESC_OWN | DESC_ERR)), "iter %u: TX desc %u", iter, i);
+			mTxIdx += n;
+			mTxCount = 0;
+		}
+		CHECK(!(csr0() & CSR0_ERR), "iter %u: %04x", iter, csr0());
+		csr0Ack(CSR0_RINT | CSR0_TINT);
+	}
+}
+
+int main(void)
+{
+	alarm(10);		// a ring walk gone wrong spins
+	CHECK(lanceInit() && mLanceAccess, "init");
+	lanceSetBackend(&mBackend, NULL);
+
+	testTxHandoff();
+	testTxMerr();
+	testRxChained();
+	testRxNoBuffers();
+	testRxMerr();
+	testLoopback();
+	testRandom();
+
+	printf("lance_test: PASS\n");
+	return 0;
+}
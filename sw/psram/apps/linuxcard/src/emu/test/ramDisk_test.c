@@ -0,0 +1,128 @@
+// Host test of ramDisk.c, the board's RAM disk, over spiRamRP2040.c and the
+// libhyperram host stub: it starts zeroed, multi-sector reads and writes land
+// at base + sector * 512 and read back (the writes go out in the background),
+// accesses past the end are refused, and snapshot chunks go in and out whole.
+// Nothing outside the carve-out may change.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ramDisk.h"
+#include "spiRam.h"
+
+#define CHECK(c, ...)	do { if (!(c)) { fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } } while (0)
+
+#define MEM_SZ		0x40000
+#define BASE		0x10400		// 1K aligned, not 64K aligned
+#define NUM_SECS	(RAM_DISK_SIZE / BLK_DEV_BLK_SZ)
+#define MAX_RUN		16
+
+extern uint8_t hyperram_host_mem[];
+
+static uint8_t mShadow[MEM_SZ];
+static uint32_t mSeed = 1;
+
+static uint32_t rnd(void)
+{
+	mSeed ^= mSeed << 13;
+	mSeed ^= mSeed >> 17;
+	mSeed ^= mSeed << 5;
+	return mSeed;
+}
+
+static void checkMem(const char *when)
+{
+	for (unsigned port = 0; port <= SpiRamPortIo; port++)
+		spiRamWaitPort(port);
+	CHECK(!memcmp(hyperram_host_mem, mShadow, MEM_SZ), "memory differs %s", when);
+}
+
+static void testReadWrite(void)
+{
+	static uint32_t buf[MAX_RUN * BLK_DEV_BLK_SZ / sizeof(uint32_t)];
+	uint8_t *bytes = (uint8_t*)buf;
+
+	for (unsigned iter = 0; iter < 3000; iter++) {
+		uint32_t num = 1 + rnd() % MAX_RUN, sector = rnd() % (NUM_SECS - num + 1);
+		uint8_t *at = mShadow + BASE + sector * BLK_DEV_BLK_SZ;
+
+		if (rnd() & 1) {
+			for (uint32_t i = 0; i < num * BLK_DEV_BLK_SZ; i++)
+				bytes[i] = rnd();
+			CHECK(ramDiskAccess(MASS_STORE_OP_WRITE, sector, num, buf), "write of %u at %u", (unsigned)num, (unsigned)sector);
+			memcpy(at, bytes, num * BLK_DEV_BLK_SZ);
+			// the caller may reuse its buffer at once
+			memset(bytes, 0, num * BLK_DEV_BLK_SZ);
+		}
+		else {
+			memset(bytes, 0xa5, num * BLK_DEV_BLK_SZ);
+			CHECK(ramDiskAccess(MASS_STORE_OP_READ, sector, num, buf), "read of %u at %u", (unsigned)num, (unsigned)sector);
+			CHECK(!memcmp(bytes, at, num * BLK_DEV_BLK_SZ), "read of %u at %u returned wrong data", (unsigned)num, (unsigned)sector);
+		}
+	}
+	checkMem("after reads and writes");
+}
+
+static void testBounds(void)
+{
+	static uint32_t buf[2 * BLK_DEV_BLK_SZ / sizeof(uint32_t)];
+	uint32_t numSecs = 0;
+
+	CHECK(ramDiskAccess(MASS_STORE_OP_GET_SZ, 0, 0, &numSecs) && numSecs == NUM_SECS, "size %u", (unsigned)numSecs);
+	CHECK(!ramDiskAccess(MASS_STORE_OP_READ, NUM_SECS, 1, buf), "read past the end");
+	CHECK(!ramDiskAccess(MASS_STORE_OP_WRITE, NUM_SECS - 1, 2, buf), "write running past the end");
+	CHECK(!ramDiskAccess(MASS_STORE_OP_WRITE, 0xffffffff, 2, buf), "write at a huge sector");
+	CHECK(ramDiskAccess(MASS_STORE_OP_READ, NUM_SECS - 2, 2, buf), "read of the last two");
+	checkMem("after refused accesses");
+}
+
+static void testSnapshot(void)
+{
+	static uint32_t buf[4096 / sizeof(uint32_t)];
+	uint8_t *bytes = (uint8_t*)buf;
+	uint32_t ofst, len;
+
+	// saving reads the lot out
+	for (ofst = 0; ofst < RAM_DISK_SIZE; ofst += len) {
+		len = 1024 * (1 + rnd() % 4);
+		if (len > RAM_DISK_SIZE - ofst)
+			len = RAM_DISK_SIZE - ofst;
+		ramDiskSnapshot(NULL, ofst, buf, len, false);
+		CHECK(!memcmp(bytes, mShadow + BASE + ofst, len), "snapshot save of %u at %u", (unsigned)len, (unsigned)ofst);
+	}
+
+	// loading puts it back
+	for (ofst = 0; ofst < RAM_DISK_SIZE; ofst += len) {
+		len = 1024 * (1 + rnd() % 4);
+		if (len > RAM_DISK_SIZE - ofst)
+			len = RAM_DISK_SIZE - ofst;
+		for (uint32_t i = 0; i < len; i++)
+			bytes[i] = rnd();
+		ramDiskSnapshot(NULL, ofst, buf, len, true);
+		memcpy(mShadow + BASE + ofst, bytes, len);
+	}
+	checkMem("after a snapshot load");
+}
+
+int main(void)
+{
+	uint8_t eachChipSz, numChips, chipWidth;
+
+	CHECK(spiRamInit(&eachChipSz, &numChips, &chipWidth), "init");
+	CHECK(BASE + RAM_DISK_SIZE <= MEM_SZ, "test memory too small");
+
+	// the carve-out is zeroed, its neighbours kept
+	for (uint32_t i = 0; i < MEM_SZ; i++)
+		mShadow[i] = hyperram_host_mem[i] = rnd();
+	ramDiskInit(BASE);
+	memset(mShadow + BASE, 0, RAM_DISK_SIZE);
+	checkMem("after init");
+
+	testReadWrite();
+	testBounds();
+	testSnapshot();
+
+	printf("ramDisk_test: PASS\n");
+	return 0;
+}
@@ -0,0 +1,416 @@
+// Host test of the SCSI disk's disconnect path through sii.c, scsiDevice.c
+// and scsiDisk.c. The test is the initiator and drives the SII registers the
+// way a driver does: PIO for messages, commands and status, DMA for data.
+// Medium accesses go to a background hook that the test completes when it
+// chooses: before the initiator has acked the disconnect, after it, or at
+// once from inside the hook. Reads and writes across several staging-buffer
+// runs must disconnect once per run and reselect with the SCSI irq raised.
+// Initiators without disconnect privilege must get the old synchronous
+// path, and a bus reset during an access must make the disk answer BUSY
+// until the access is over.
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scsiPublic.h"
+#include "scsiDisk.h"
+#include "snapshot.h"
+#include "mem.h"
+#include "sii.h"
+
+#define CHECK(c, ...)	do { if (!(c)) { fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } } while (0)
+
+// the SII as the guest sees it
+#define SII_BASE		0x1a000000
+#define SII_SC1			0x04
+	#define SC1_InO			0x0001
+	#define SC1_CnD			0x0002
+	#define SC1_MSG			0x0004
+	#define SC1_REQ			0x0010
+	#define SC1_BSY			0x0100
+#define SII_CSR			0x0c
+	#define CSR_IE			0x0001
+	#define CSR_RSE			0x0008
+#define SII_SLCSR		0x14
+#define SII_DESTAT		0x18
+#define SII_DATA		0x20
+#define SII_DMLOTC		0x28
+	#define DMA_MAX			0x2000		// as ultrix does it
+#define SII_DMADDRL		0x2c
+#define SII_DMADDRH		0x30
+#define SII_CSTAT		0x48
+	#define CSTAT_RST		0x2000
+	#define CSTAT_SCH		0x0080
+	#define CSTAT_CON		0x0040
+	#define CSTAT_DST		0x0020
+#define SII_DSTAT		0x4c
+	#define DSTAT_DNE		0x2000
+#define SII_COMM		0x50
+	#define COMM_DMA		0x8000
+	#define COMM_RST		0x4000
+	#define COMM_ATN		0x0008
+	#define COMM_SELECT		(8 << 7)
+	#define COMM_XFER		(16 << 7)
+#define SII_DICTRL		0x54
+	#define DICTRL_PRE		0x0004
+
+#define HOST_ID			7
+#define DISK_ID			6
+#define DISK_SECS		256
+#define STAGE_SECS		8
+
+enum BgMode {
+	BgLate,			// done after the initiator acked the disconnect
+	BgEarly,		// done before it did, the reselection must wait for the ack
+	BgAtOnce,		// done inside the hook, before the disconnect is even over
+};
+
+static MemAccessF mSiiAccess;
+static bool mIrq;
+static uint8_t mSiiBuf[SII_BUFFER_SIZE];
+static uint8_t mMedium[DISK_SECS * BLK_DEV_BLK_SZ], mShadow[DISK_SECS * BLK_DEV_BLK_SZ];
+static uint8_t mStage[STAGE_SECS * BLK_DEV_BLK_SZ];
+static struct ScsiDisk mDisk;
+static enum BgMode mBgMode;
+static bool mBgPending;
+static unsigned mBgStarts;
+static uint32_t mSeed = 1;
+
+static uint32_t rnd(void)
+{
+	mSeed ^= mSeed << 13;
+	mSeed ^= mSeed >> 17;
+	mSeed ^= mSeed << 5;
+	return mSeed;
+}
+
+// what sii.c needs from the rest of the emulator
+
+bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF af)
+{
+	CHECK(pa == SII_BASE && !mSiiAccess, "unexpected region at %08x", (unsigned)pa);
+	mSiiAccess = af;
+	return true;
+}
+
+void cpuIrq(uint_fast8_t idx, bool raise)
+{
+	CHECK(idx == SOC_IRQNO_SCSI, "irq %u", idx);
+	mIrq = raise;
+}
+
+void siiPrvBufferWrite(uint_fast16_t wordIdx, uint_fast16_t val)
+{
+	mSiiBuf[wordIdx * 2] = val;
+	mSiiBuf[wordIdx * 2 + 1] = val >> 8;
+}
+
+uint_fast16_t siiPrvBufferRead(uint_fast16_t wordIdx)
+{
+	return mSiiBuf[wordIdx * 2] + (mSiiBuf[wordIdx * 2 + 1] << 8);
+}
+
+void siiPrvBufferWriteBlock(uint_fast16_t wordIdx, const uint8_t *src, uint_fast16_t numWords)
+{
+	memcpy(mSiiBuf + wordIdx * 2, src, numWords * 2);
+}
+
+void siiPrvBufferReadBlock(uint_fast16_t wordIdx, uint8_t *dst, uint_fast16_t numWords)
+{
+	memcpy(dst, mSiiBuf + wordIdx * 2, numWords * 2);
+}
+
+// no snapshots are taken here
+void snapshotSection(struct Snapshot *ss, uint32_t tag) { CHECK(0, "snapshot"); }
+void snapshotBytes(struct Snapshot *ss, void *buf, uint32_t len) { CHECK(0, "snapshot"); }
+void snapshotU32(struct Snapshot *ss, uint32_t *valP) { CHECK(0, "snapshot"); }
+void snapshotBulk(struct Snapshot *ss, uint32_t len, SnapshotBulkF f, void *userData) { CHECK(0, "snapshot"); }
+
+static bool diskAccess(uint8_t op, uint32_t sector, uint32_t numSec, void *buf)
+{
+	switch (op) {
+		case MASS_STORE_OP_GET_SZ:
+			*(uint32_t*)buf = DISK_SECS;
+			return true;
+
+		case MASS_STORE_OP_READ:
+		case MASS_STORE_OP_WRITE:
+			if (sector >= DISK_SECS || numSec > DISK_SECS - sector)
+				return false;
+			if (op == MASS_STORE_OP_WRITE)
+				memcpy(mMedium + sector * BLK_DEV_BLK_SZ, buf, numSec * BLK_DEV_BLK_SZ);
+			else
+				memcpy(buf, mMedium + sector * BLK_DEV_BLK_SZ, numSec * BLK_DEV_BLK_SZ);
+			return true;
+	}
+	return false;
+}
+
+static void bgFinish(void)
+{
+	CHECK(mBgPending, "no access to finish");
+	mBgPending = false;
+	scsiDiskBackgroundWork(&mDisk);
+	scsiDiskBackgroundDone(&mDisk);
+}
+
+static bool bgStart(struct ScsiDisk *disk)
+{
+	CHECK(disk == &mDisk && !mBgPending, "background access while one is running");
+	mBgStarts++;
+	mBgPending = true;
+	if (mBgMode == BgAtOnce)
+		bgFinish();
+	return true;
+}
+
+static uint_fast16_t regRead(uint32_t reg)
+{
+	uint16_t v;
+
+	CHECK(mSiiAccess(SII_BASE + reg, 2, false, &v), "read of reg %02x", (unsigned)reg);
+	return v;
+}
+
+static void regWrite(uint32_t reg, uint_fast16_t val)
+{
+	uint16_t v = val;
+
+	CHECK(mSiiAccess(SII_BASE + reg, 2, true, &v), "write of %04x to reg %02x", (unsigned)val, (unsigned)reg);
+}
+
+static uint_fast16_t phase(void)
+{
+	uint_fast16_t sc1 = regRead(SII_SC1);
+
+	CHECK((sc1 & (SC1_BSY | SC1_REQ)) == (SC1_BSY | SC1_REQ), "no request, SC1 %04x", (unsigned)sc1);
+	return sc1 & (SC1_MSG | SC1_CnD | SC1_InO);
+}
+
+static void pioOut(uint_fast16_t ph, uint8_t val)
+{
+	CHECK(phase() == ph, "phase %u, wanted %u for out", (unsigned)phase(), (unsigned)ph);
+	regWrite(SII_DATA, val);
+	regWrite(SII_COMM, COMM_XFER | ph);
+	regWrite(SII_DSTAT, DSTAT_DNE);
+}
+
+static uint8_t pioIn(uint_fast16_t ph)
+{
+	CHECK(phase() == ph, "phase %u, wanted %u for in", (unsigned)phase(), (unsigned)ph);
+	regWrite(SII_COMM, COMM_XFER | ph);
+	regWrite(SII_DSTAT, DSTAT_DNE);
+	return regRead(SII_DATA);
+}
+
+static uint32_t dmaXfer(uint_fast16_t ph, uint32_t len)		//bytes done
+{
+	uint32_t left;
+
+	regWrite(SII_DMADDRL, 0);
+	regWrite(SII_DMADDRH, 0);
+	regWrite(SII_DMLOTC, len);
+	regWrite(SII_COMM, COMM_DMA | COMM_XFER | ph);
+	regWrite(SII_DSTAT, DSTAT_DNE);
+	left = regRead(SII_DMLOTC);
+	CHECK(left < len, "DMA of %u did nothing", (unsigned)len);
+
+	return len - left;
+}
+
+// the disk went away after SAVE DATA POINTER + DISCONNECT: let the access finish, take the reselection
+static void reselect(unsigned *reselsP)
+{
+	CHECK(!(regRead(SII_SC1) & SC1_BSY) && !siiBusIdle(), "disk not away after disconnecting");
+	CHECK((regRead(SII_CSTAT) & (CSTAT_SCH | CSTAT_CON)) == CSTAT_SCH && mIrq, "bus free not reported");
+
+	if (mBgMode == BgEarly) {
+		bgFinish();
+		CHECK(!(regRead(SII_CSTAT) & CSTAT_DST), "reselected before the initiator saw the disconnect");
+	}
+	regWrite(SII_CSTAT, CSTAT_SCH);
+	if (mBgMode == BgLate) {
+		CHECK(!mIrq && !(regRead(SII_SC1) & SC1_BSY), "bus not idle while the access runs");
+		bgFinish();
+	}
+
+	CHECK(mIrq, "no irq for the reselection");
+	CHECK((regRead(SII_CSTAT) & (CSTAT_SCH | CSTAT_CON | CSTAT_DST)) == (CSTAT_SCH | CSTAT_CON | CSTAT_DST), "not reselected");
+	CHECK(regRead(SII_DESTAT) == DISK_ID, "reselected by %u", (unsigned)regRead(SII_DESTAT));
+	regWrite(SII_CSTAT, CSTAT_SCH);
+
+	CHECK(pioIn(SC1_MSG | SC1_CnD | SC1_InO) == SCSI_MSG_IDENTIFY(false, 0), "no IDENTIFY after reselection");
+	(*reselsP)++;
+}
+
+// one command, start to bus free. data goes from/to buf. returns the status byte
+static uint8_t command(const uint8_t *cdb, uint_fast8_t cdbLen, uint8_t *buf, uint32_t len, bool mayDisconnect, unsigned *reselsP)
+{
+	uint32_t done = 0, now;
+	uint8_t status = 0xff, msg;
+	bool disconnecting = false;
+
+	CHECK(!(regRead(SII_SC1) & SC1_BSY), "bus busy before selection");
+	regWrite(SII_SLCSR, DISK_ID);
+	regWrite(SII_COMM, COMM_SELECT | COMM_ATN);
+	CHECK((regRead(SII_CSTAT) & (CSTAT_SCH | CSTAT_CON | CSTAT_DST)) == (CSTAT_SCH | CSTAT_CON), "not selected");
+	regWrite(SII_CSTAT, CSTAT_SCH);
+
+	pioOut(SC1_MSG | SC1_CnD, SCSI_MSG_IDENTIFY(mayDisconnect, 0));
+	for (uint_fast8_t i = 0; i < cdbLen; i++)
+		pioOut(SC1_CnD, cdb[i]);
+
+	while (1) {
+
+		if (!(regRead(SII_SC1) & SC1_BSY)) {
+
+			CHECK(disconnecting, "bus went free mid-command");
+			disconnecting = false;
+			reselect(reselsP);
+			continue;
+		}
+
+		switch (phase()) {
+			case SC1_InO:
+				CHECK(done < len, "more data in than asked for");
+				now = len - done > DMA_MAX ? DMA_MAX : len - done;
+				memset(mSiiBuf, 0, now);
+				now = dmaXfer(SC1_InO, now);
+				memcpy(buf + done, mSiiBuf, now);
+				done += now;
+				break;
+
+			case 0:
+				CHECK(done < len, "more data out than there is");
+				now = len - done > DMA_MAX ? DMA_MAX : len - done;
+				memcpy(mSiiBuf, buf + done, now);
+				done += dmaXfer(0, now);
+				break;
+
+			case SC1_CnD | SC1_InO:
+				status = pioIn(SC1_CnD | SC1_InO);
+				break;
+
+			case SC1_MSG | SC1_CnD | SC1_InO:
+				msg = pioIn(SC1_MSG | SC1_CnD | SC1_InO);
+				if (msg == SCSI_MSG_CMD_COMPLETED) {
+
+					CHECK(status != 0xff, "command completed without status");
+					CHECK(!(regRead(SII_SC1) & SC1_BSY) && siiBusIdle(), "bus not free after command");
+					regWrite(SII_CSTAT, CSTAT_SCH);
+					CHECK(status != SCSI_STATUS_GOOD || done == len, "only %u of %u bytes moved", (unsigned)done, (unsigned)len);
+					return status;
+				}
+				if (msg == SCSI_MSG_DISCONNECT) {
+
+					CHECK(mayDisconnect, "disconnected without privilege");
+					disconnecting = true;
+				}
+				else
+					CHECK(msg == SCSI_MSG_SAVE_DATA_POINTER, "message %02x", msg);
+				break;
+
+			default:
+				CHECK(0, "unexpected phase %u", (unsigned)phase());
+		}
+	}
+}
+
+static uint8_t rw(bool write, uint32_t lba, uint32_t num, uint8_t *buf, bool mayDisconnect, unsigned *reselsP)
+{
+	uint8_t cdb[10] = {write ? SCSI_CMD_WRITE_EXTENDED : SCSI_CMD_READ_EXTENDED, 0, lba >> 24, lba >> 16, lba >> 8, lba, 0, num >> 8, num, 0};
+
+	return command(cdb, sizeof(cdb), buf, num * BLK_DEV_BLK_SZ, mayDisconnect, reselsP);
+}
+
+static void testReadWrite(void)
+{
+	static uint8_t buf[STAGE_SECS * 4 * BLK_DEV_BLK_SZ];
+
+	for (unsigned iter = 0; iter < 600; iter++) {
+		bool write = rnd() & 1, mayDisconnect = iter % 5;
+		uint32_t num = 1 + rnd() % (STAGE_SECS * 4), lba = rnd() % (DISK_SECS - num + 1);
+		unsigned starts = mBgStarts, resels = 0, runs = (num + STAGE_SECS - 1) / STAGE_SECS;
+
+		mBgMode = rnd() % 3;
+		if (write) {
+			for (uint32_t i = 0; i < num * BLK_DEV_BLK_SZ; i++)
+				buf[i] = rnd();
+			memcpy(mShadow + lba * BLK_DEV_BLK_SZ, buf, num * BLK_DEV_BLK_SZ);
+		}
+
+		CHECK(rw(write, lba, num, buf, mayDisconnect, &resels) == SCSI_STATUS_GOOD, "%s of %u at %u failed", write ? "write" : "read", (unsigned)num, (unsigned)lba);
+		CHECK(!mBgPending, "access left running");
+		CHECK(!memcmp(mMedium, mShadow, sizeof(mMedium)), "medium wrong after %s of %u at %u", write ? "write" : "read", (unsigned)num, (unsigned)lba);
+		if (!write)
+			CHECK(!memcmp(buf, mShadow + lba * BLK_DEV_BLK_SZ, num * BLK_DEV_BLK_SZ), "read of %u at %u returned wrong data", (unsigned)num, (unsigned)lba);
+
+		// a read may be served from what read-ahead left in the buffer, a write always goes out, one run at a time
+		if (!mayDisconnect)
+			CHECK(mBgStarts == starts && !resels, "disconnected without privilege");
+		else if (write)
+			CHECK(resels == runs && mBgStarts - starts == runs, "write of %u: %u reselections", (unsigned)num, resels);
+		else
+			CHECK(resels <= runs && mBgStarts - starts == resels, "read of %u: %u reselections", (unsigned)num, resels);
+	}
+}
+
+static void testResetDuringAccess(void)
+{
+	static const uint8_t tur[6] = {SCSI_CMD_TEST_UNIT_READY};
+	static uint8_t buf[STAGE_SECS * BLK_DEV_BLK_SZ];
+	unsigned resels = 0;
+	uint8_t cdb[10] = {SCSI_CMD_READ_EXTENDED, 0, 0, 0, 0, 100, 0, 0, 4, 0};
+
+	// disconnects for the read, then the initiator resets the bus instead of waiting
+	mBgMode = BgLate;
+	scsiDiskDropCache(&mDisk);
+	regWrite(SII_SLCSR, DISK_ID);
+	regWrite(SII_COMM, COMM_SELECT | COMM_ATN);
+	regWrite(SII_CSTAT, CSTAT_SCH);
+	pioOut(SC1_MSG | SC1_CnD, SCSI_MSG_IDENTIFY(true, 0));
+	for (unsigned i = 0; i < sizeof(cdb); i++)
+		pioOut(SC1_CnD, cdb[i]);
+	CHECK(pioIn(SC1_MSG | SC1_CnD | SC1_InO) == SCSI_MSG_SAVE_DATA_POINTER, "no SAVE DATA POINTER");
+	CHECK(pioIn(SC1_MSG | SC1_CnD | SC1_InO) == SCSI_MSG_DISCONNECT, "no DISCONNECT");
+	CHECK(mBgPending, "read not handed off");
+	regWrite(SII_CSTAT, CSTAT_SCH);
+
+	regWrite(SII_COMM, COMM_RST);
+	regWrite(SII_COMM, 0);
+	regWrite(SII_CSTAT, CSTAT_RST | CSTAT_SCH);
+	CHECK(siiBusIdle(), "disk still away after a bus reset");
+
+	// the old access still owns the buffer
+	CHECK(command(tur, sizeof(tur), NULL, 0, true, &resels) == SCSI_STATUS_BUSY, "not BUSY during an aborted access");
+
+	// once it is over it goes nowhere: no reselection
+	bgFinish();
+	CHECK(!(regRead(SII_CSTAT) & (CSTAT_SCH | CSTAT_DST)) && !mIrq, "aborted access reselected");
+	CHECK(command(tur, sizeof(tur), NULL, 0, true, &resels) == SCSI_STATUS_GOOD, "not ready after the aborted access");
+	CHECK(rw(false, 100, 4, buf, true, &resels) == SCSI_STATUS_GOOD && resels == 1, "read after reset failed");
+	CHECK(!memcmp(buf, mShadow + 100 * BLK_DEV_BLK_SZ, 4 * BLK_DEV_BLK_SZ), "read after reset returned wrong data");
+}
+
+int main(void)
+{
+	alarm(10);		// the device code spins on protocol errors
+
+	for (uint32_t i = 0; i < sizeof(mMedium); i++)
+		mMedium[i] = rnd();
+	memcpy(mShadow, mMedium, sizeof(mMedium));
+
+	CHECK(siiInit(HOST_ID) && mSiiAccess, "siiInit");
+	CHECK(scsiDiskInit(&mDisk, DISK_ID, diskAccess, mStage, sizeof(mStage), false), "scsiDiskInit");
+	scsiDiskSetBackgroundIo(&mDisk, bgStart);
+	regWrite(SII_DICTRL, DICTRL_PRE);
+	regWrite(SII_CSR, CSR_IE | CSR_RSE);
+
+	testReadWrite();
+	testResetDuringAccess();
+
+	printf("scsiDisk_test: PASS\n");
+	return 0;
+}
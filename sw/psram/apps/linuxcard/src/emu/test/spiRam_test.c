@@ -0,0 +1,180 @@
+// Host test of spiRamRP2040.c over the libhyperram host stub: sub-word
+// accesses at every alignment, masked stores, and that background transfers
+// are complete after spiRamWaitPort and seen on every other port, and that
+// one crossing a 1K boundary is refused. Block transfers from odd buffers at
+// any halfword address must reach the RAM in pieces that stay inside 1K.
+
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hyperram.h"
+#include "spiRam.h"
+
+#define CHECK(c, ...)	do { if (!(c)) { fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } } while (0)
+
+#define MEM_SZ		0x10000
+
+extern uint8_t hyperram_host_mem[];
+
+static uint8_t mShadow[MEM_SZ];
+static uint32_t mSeed = 1;
+static bool mCheckPages;
+
+// the port calls spiRamRP2040.c makes, linked with --wrap
+void __real_hyperram_port_read(hyperram_port_t port, uint32_t addr, uint8_t *dst, uint len);
+void __real_hyperram_port_write(hyperram_port_t port, uint32_t addr, const uint8_t *src, uint len);
+void __real_hyperram_port_write_mask(hyperram_port_t port, uint32_t addr, uint32_t src, uint32_t mask);
+
+void __wrap_hyperram_port_read(hyperram_port_t port, uint32_t addr, uint8_t *dst, uint len)
+{
+	CHECK(!mCheckPages || (addr & 1023) + len <= 1024, "read of %u bytes at %05x crosses 1K", len, (unsigned)addr);
+	__real_hyperram_port_read(port, addr, dst, len);
+}
+
+void __wrap_hyperram_port_write(hyperram_port_t port, uint32_t addr, const uint8_t *src, uint len)
+{
+	CHECK(!mCheckPages || (addr & 1023) + len <= 1024, "write of %u bytes at %05x crosses 1K", len, (unsigned)addr);
+	__real_hyperram_port_write(port, addr, src, len);
+}
+
+void __wrap_hyperram_port_write_mask(hyperram_port_t port, uint32_t addr, uint32_t src, uint32_t mask)
+{
+	CHECK(!mCheckPages || (addr & 1023) <= 1020, "masked write at %05x crosses 1K", (unsigned)addr);
+	__real_hyperram_port_write_mask(port, addr, src, mask);
+}
+
+static uint32_t rnd(void)
+{
+	mSeed ^= mSeed << 13;
+	mSeed ^= mSeed >> 17;
+	mSeed ^= mSeed << 5;
+	return mSeed;
+}
+
+static enum SpiRamPort rndPort(void)
+{
+	return rnd() % (SpiRamPortIo + 1);
+}
+
+static void testSmall(void)
+{
+	for (unsigned iter = 0; iter < 20000; iter++) {
+		uint32_t addr = rnd() % (MEM_SZ - 8);
+		unsigned sz = 1 + rnd() % 3;
+		uint8_t buf[4], chk[8];
+
+		// sub-word accesses never span more than the word the emulator asks for
+		if ((addr & 3) + sz > 4)
+			sz = 4 - (addr & 3);
+		for (unsigned i = 0; i < sz; i++)
+			buf[i] = rnd();
+
+		spiRamWritePort(addr, buf, sz, rndPort());
+		memcpy(mShadow + addr, buf, sz);
+
+		memset(chk, 0x5a, sizeof(chk));
+		spiRamReadPort(addr, chk, sz, rndPort());
+		CHECK(!memcmp(chk, buf, sz), "%u bytes at %05x", sz, (unsigned)addr);
+		CHECK(chk[sz] == 0x5a, "read of %u bytes at %05x wrote past the end", sz, (unsigned)addr);
+		CHECK(!memcmp(hyperram_host_mem + (addr & ~3u) - 4, mShadow + (addr & ~3u) - 4, 12), "neighbours of %u bytes at %05x", sz, (unsigned)addr);
+	}
+}
+
+static void testAsync(void)
+{
+	static uint8_t buf[SPI_RAM_ASYNC_MAX_SZ], chk[SPI_RAM_ASYNC_MAX_SZ];
+
+	for (unsigned iter = 0; iter < 2000; iter++) {
+		enum SpiRamPort wr = rndPort(), rd = rndPort();
+		uint32_t addr = (rnd() % (MEM_SZ - SPI_RAM_ASYNC_MAX_SZ)) & ~3u;
+		unsigned sz = 4 + (rnd() % SPI_RAM_ASYNC_MAX_SZ & ~3u);
+
+		if (sz > SPI_RAM_ASYNC_MAX_SZ)
+			sz = SPI_RAM_ASYNC_MAX_SZ;
+		if (sz > 1024 - (addr & 1023))
+			sz = 1024 - (addr & 1023);
+		for (unsigned i = 0; i < sz; i++)
+			buf[i] = rnd();
+
+		spiRamWriteAsync(addr, buf, sz, wr);
+		memcpy(mShadow + addr, buf, sz);
+		// the source buffer is free once the call returns
+		memset(buf, 0, sz);
+
+		if (iter & 1) {
+			// a plain access on any port sees it
+			spiRamReadPort(addr, chk, sz, rd);
+		}
+		else {
+			spiRamReadAsync(addr, chk, sz, rd);
+			spiRamWaitPort(rd);
+		}
+		CHECK(!memcmp(chk, mShadow + addr, sz), "async %u bytes at %05x, port %u -> %u", sz, (unsigned)addr, wr, rd);
+	}
+	for (unsigned port = 0; port <= SpiRamPortIo; port++)
+		spiRamWaitPort(port);
+	CHECK(!memcmp(hyperram_host_mem, mShadow, MEM_SZ), "memory differs at the end");
+}
+
+static void testAsyncCrossing(void)
+{
+	static uint8_t buf[SPI_RAM_ASYNC_MAX_SZ];
+	int status;
+	pid_t pid;
+
+	// a burst from 0x3fc onwards would run past the PSRAM page, the port asserts
+	fflush(stderr);
+	pid = fork();
+	CHECK(pid >= 0, "fork");
+	if (!pid) {
+		freopen("/dev/null", "w", stderr);
+		spiRamWriteAsync(0x3fc, buf, 8, SpiRamPortIo);
+		_exit(0);
+	}
+	CHECK(waitpid(pid, &status, 0) == pid, "waitpid");
+	CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT, "async write across a 1K boundary was accepted");
+}
+
+static void testBlock(void)
+{
+	static uint8_t buf[4096 + 1], chk[4096 + 1];
+
+	mCheckPages = true;
+
+	// right up against a boundary first, then anywhere
+	for (unsigned iter = 0; iter < 4000; iter++) {
+		uint32_t addr = iter < 64 ? 0x3fe - iter * 2 : (rnd() % (MEM_SZ - 4096)) & ~1u;
+		unsigned sz = iter < 64 ? 2 + iter * 4 : 2 + (rnd() % 4094 & ~1u);
+		uint8_t *src = buf + (rnd() & 1);
+		uint8_t *dst = chk + (rnd() & 1);
+
+		for (unsigned i = 0; i < sz; i++)
+			src[i] = rnd();
+
+		spiRamWriteBlock(addr, src, sz, rndPort());
+		memcpy(mShadow + addr, src, sz);
+		spiRamReadBlock(addr, dst, sz, rndPort());
+		CHECK(!memcmp(dst, mShadow + addr, sz), "block of %u bytes at %05x", sz, (unsigned)addr);
+	}
+	CHECK(!memcmp(hyperram_host_mem, mShadow, MEM_SZ), "memory differs after block transfers");
+
+	mCheckPages = false;
+}
+
+int main(void)
+{
+	uint8_t eachChipSz, numChips, chipWidth;
+
+	CHECK(spiRamInit(&eachChipSz, &numChips, &chipWidth), "init");
+	testSmall();
+	testAsync();
+	testAsyncCrossing();
+	testBlock();
+
+	printf("spiRam_test: PASS\n");
+	return 0;
+}
@@ -15,9 +15,13 @@ void usartTx(uint8_t ch);
 
 void usartTxEx(uint8_t channel, uint8_t ch);
 
+void usartRxPump(void);					//hand queued RX bytes to usartExtRx(), as many as usartExtRxSpace() allows
+uint32_t usartGetRxOverflows(void);		//RX bytes dropped so far
+
 
 //externally provided
 void usartExtRx(uint8_t val);
+uint_fast8_t usartExtRxSpace(void);
 
 
 
@@ -1,18 +1,69 @@
 #include <pico/stdlib.h>
 #include "pico/sync.h"
+#include "hardware/irq.h"
+#include "hardware/uart.h"
 #include <stdint.h>
 #include "usart.h"
 #include <stdio.h>
 
+// RX bytes are queued by the UART IRQ and handed to the guest as it makes room.
+// Single producer (the IRQ), single consumer (usartRxPump with IRQs off)
+#ifndef USART_RX_RING_SZ
+#define USART_RX_RING_SZ	256		// power of 2
+#endif
+
+#define USART_UART		uart_get_instance(PICO_DEFAULT_UART)
+#define USART_UART_IRQ		(UART0_IRQ + PICO_DEFAULT_UART)
+
+static uint8_t mRxRing[USART_RX_RING_SZ];
+static volatile uint32_t mRxHead, mRxTail;	// free-running, written by producer and consumer respectively
+static volatile uint32_t mRxOverflows;
+
 struct repeating_timer timerChar;
 
-bool checkchar_callback(struct repeating_timer *t) {
+static void usartPrvRxIrq(void) {
+
+  uart_hw_t *hw = uart_get_hw(USART_UART);
+  uint32_t head = mRxHead;
 
-  uint32_t c = getchar_timeout_us(0);
+  // the hardware FIFO overran before we got here
+  if (hw->rsr & UART_UARTRSR_OE_BITS) {
+    hw->rsr = UART_UARTRSR_OE_BITS;
+    mRxOverflows++;
+  }
+
+  while (uart_is_readable(USART_UART)) {
+    uint8_t c = (uint8_t)hw->dr;
 
-  if (c != PICO_ERROR_TIMEOUT) {
-    usartExtRx(c);
+    if (head - mRxTail >= USART_RX_RING_SZ)
+      mRxOverflows++;
+    else
+      mRxRing[head++ % USART_RX_RING_SZ] = c;
   }
+  mRxHead = head;
+}
+
+void usartRxPump(void) {
+
+  uint32_t save = save_and_disable_interrupts();
+  uint32_t tail = mRxTail, space = usartExtRxSpace();
+
+  while (space-- && tail != mRxHead)
+    usartExtRx(mRxRing[tail++ % USART_RX_RING_SZ]);
+  mRxTail = tail;
+
+  restore_interrupts(save);
+}
+
+uint32_t usartGetRxOverflows(void) {
+  return mRxOverflows;
+}
+
+// picks up bytes that arrived while the guest's FIFO was full and nobody read it since
+bool checkchar_callback(struct repeating_timer *t) {
+
+  if (mRxTail != mRxHead)
+    usartRxPump();
 
   return true;
 }
@@ -21,10 +72,14 @@ void usartInit(void) {
   stdio_init_all();
   //sleep_ms(3000);
 
-  // -50MS so that the timer will repeat 500 per sec, regardless of how
+  irq_set_exclusive_handler(USART_UART_IRQ, usartPrvRxIrq);
+  irq_set_enabled(USART_UART_IRQ, true);
+  uart_set_irq_enables(USART_UART, true, false);
+
+  // -5MS so that the timer will repeat 200 per sec, regardless of how
   // long the callback takes to execute
-  add_repeating_timer_ms(-50, checkchar_callback, NULL, &timerChar);
-}  
+  add_repeating_timer_ms(-5, checkchar_callback, NULL, &timerChar);
+}
 
 void usartSetBuadrate(uint32_t baud) {
 
@@ -34,6 +34,7 @@
 #include "bsp/board.h"
 #include "tusb.h"
 
+#include "core1.h"
 #include "dz11.h"
 #include "usbHID.h"
 
@@ -43,6 +44,9 @@
 
 #define MAX_REPORT  4
 
+// How often core1 polls the USB host stack
+#define USBHID_POLL_MS  75
+
 static uint8_t const keycode2ascii[128][2] =  { HID_KEYCODE_TO_ASCII };
 
 // Each HID instance can has multiple reports
@@ -485,10 +489,76 @@ int downcnt;
 static uint8_t cmd[4];
 static int cmdcnt;
 
-void send (int k) {
-  if (dz11numBytesFreeInRxBuffer(0) > 0) {
-    dz11charRx(0, k);
+// Reports are translated on core1, but the DZ11 belongs to core0, so
+// bytes from core1 are handed over through the reply ring (see core1.h).
+// A report (up to 4 bytes, a whole mouse packet) is always one message:
+// the bytes in param, line and length in userData. Only core0 can see how
+// much room the DZ11 has, so it is checked there, for the whole report.
+#define HID_RX_PENDING  16      // reports core1 holds while the ring is full, a power of 2
+
+static struct {
+  uint32_t bytes;
+  uint8_t line, len;
+} hidRxPending[HID_RX_PENDING];
+static uint32_t hidRxPendingRd, hidRxPendingWr;   // core1 only
+static volatile uint32_t hidRxDropsCore0, hidRxDropsCore1;
+
+static void hidPrvDz11Rx(void *userData, uint32_t param) {
+  uint_fast8_t line = (uintptr_t)userData >> 4, len = (uintptr_t)userData & 0x0f;
+
+  if (dz11numBytesFreeInRxBuffer(line) < len) {
+    hidRxDropsCore0++;
+    return;
+  }
+  for (uint_fast8_t i = 0; i < len; i++, param >>= 8)
+    dz11charRx(line, param & 0xff);
+}
+
+// core1: in order, stops at the first one the ring has no room for
+static void hidPrvRxFlush(void) {
+  while (hidRxPendingRd != hidRxPendingWr) {
+    uint32_t i = hidRxPendingRd % HID_RX_PENDING;
+
+    if (!core1Reply(hidPrvDz11Rx, (void *)(uintptr_t)((hidRxPending[i].line << 4) | hidRxPending[i].len), hidRxPending[i].bytes))
+      break;
+    hidRxPendingRd++;
+  }
+}
+
+static void hidRxReport(uint_fast8_t line, const uint8_t *data, uint_fast8_t len) {
+  uint32_t bytes = 0;
+
+  for (uint_fast8_t i = len; i; i--)
+    bytes = (bytes << 8) | data[i - 1];
+
+  if (get_core_num() == 0) {
+    hidPrvDz11Rx((void *)(uintptr_t)((line << 4) | len), bytes);
+    return;
+  }
+
+  // Queued behind whatever is still waiting, so bytes never overtake each other
+  if (hidRxPendingWr - hidRxPendingRd == HID_RX_PENDING) {
+    hidPrvRxFlush();
+    if (hidRxPendingWr - hidRxPendingRd == HID_RX_PENDING) {
+      hidRxDropsCore1++;
+      return;
+    }
   }
+  hidRxPending[hidRxPendingWr % HID_RX_PENDING].bytes = bytes;
+  hidRxPending[hidRxPendingWr % HID_RX_PENDING].line = line;
+  hidRxPending[hidRxPendingWr % HID_RX_PENDING].len = len;
+  hidRxPendingWr++;
+  hidPrvRxFlush();
+}
+
+uint32_t usbhidGetRxDrops(void) {
+  return hidRxDropsCore0 + hidRxDropsCore1;
+}
+
+void send (int k) {
+  uint8_t b = k;
+
+  hidRxReport(0, &b, 1);
 }
 
 void resetkb ()
@@ -507,11 +577,8 @@ void resetkb ()
   //clickVol = bellVol = DEFVOL;
   arDelay = 0;
   
-  // Send reply
-  send (1);
-  send (0);
-  send (0);
-  send (0);
+  // Send reply, all of it or none
+  hidRxReport(0, (const uint8_t[]){ 1, 0, 0, 0 }, 4);
   // Flash the LEDs
   //changeLeds (0x0f, true);
   //delay (100);
@@ -728,8 +795,7 @@ void decKeyboardTx(uint8_t inChar) {
       {
       case 0xab:
         // Request keyboard ID
-        send (0);
-        send (0);
+        hidRxReport(0, (const uint8_t[]){ 0, 0 }, 2);
         break;
       case 0x11:
         // LEDs off
@@ -845,12 +911,7 @@ static void process_mouse_report(hid_mouse_report_t const * report)
 
   // If mode is streaming, then send data now
   if (dec_mode == 'R') {
-    // Transmit only if there's space in the buffer
-    if (dz11numBytesFreeInRxBuffer(1) > 3) {
-      for (uint32_t i = 0; i < 3; i++) {
-	dz11charRx(1, dec_report[i]);
-      }
-    }
+    hidRxReport(1, dec_report, 3);
   }
 }
 
@@ -866,23 +927,17 @@ void decMouseTx(uint8_t chr) {
     break;
   case 'D': // Request mode - send current info, then go to prompt mode
     dec_mode = 'P';
-    // Transmit only if there's space in the buffer
-    if (dz11numBytesFreeInRxBuffer(1) > 3) {
-      for (uint32_t i = 0; i < 3; i++) {
-	dz11charRx(1, dec_report[i]);
-      }
-    }
+    hidRxReport(1, dec_report, 3);
     break;
   case 'T':
     // Self test - send self test report, then go to prompt mode
     dec_mode = 'P';
-    // Transmit only if there's space in the buffer
-    if (dz11numBytesFreeInRxBuffer(1) > 4) {
-      dz11charRx(1, 0xA0);  // Frame sync <7:5>, HW revision <4:0>
-      dz11charRx(1, 0x02);  // Manufacturer ID <6:4>, device code <4:0>
-      dz11charRx(1, 0x00);  // Error code <6:0> 
-      dz11charRx(1, 0x00);  // Button code <2:0> 
-    }
+    hidRxReport(1, (const uint8_t[]){
+      0xA0,   // Frame sync <7:5>, HW revision <4:0>
+      0x02,   // Manufacturer ID <6:4>, device code <4:0>
+      0x00,   // Error code <6:0>
+      0x00,   // Button code <2:0>
+    }, 4);
     break;
   }
 }
@@ -956,22 +1011,21 @@ static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t c
 }
 
 
-// Run USB stack on second core
-void usb_start_core_1() {
+// Runs on core1 (see core1.h), as do all the callbacks below
+static void usbhidPrvTask(void *userData, uint32_t param) {
+  (void)userData;
+  (void)param;
+  hidPrvRxFlush();      // what the ring had no room for last time
+  tuh_task();
+}
+
+static void usbhidPrvStart(void *userData, uint32_t param) {
+  (void)userData;
+  (void)param;
 
   // init host stack on configured roothub port
   tuh_init(BOARD_TUH_RHPORT);
-
-  while (1) {
-    // Run host usb 
-    tuh_task();  
-    //sleep_ms(100);
-    //sleep_ms(75);
-    // Working:
-    //sleep_ms(85);
-    // Exp:
-    sleep_ms(75);
-  }
+  core1AddPeriodic(usbhidPrvTask, NULL, USBHID_POLL_MS);
 }
 
 uint32_t usbhid_init() {
@@ -980,12 +1034,8 @@ uint32_t usbhid_init() {
 
   printf("TinyUSB Host CDC MSC HID Example\n");
 
-  //usb_start_core_1();
-  
   // Start USB host on second core
-  multicore_reset_core1();
-  multicore_fifo_drain();
-  multicore_launch_core1(usb_start_core_1);
+  core1Call(usbhidPrvStart, NULL, 0);
 
   return 0;
 }
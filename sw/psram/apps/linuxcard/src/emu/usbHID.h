@@ -11,4 +11,6 @@ uint32_t usbhid_init(void);
 void decMouseTx(uint8_t chr);
 void decKeyboardTx(uint8_t chr);
 
+uint32_t usbhidGetRxDrops(void);   // whole reports lost to a full DZ11 or reply ring
+
 #endif // _USBHID_H_
@@ -13,6 +13,8 @@
 #define H_STOR_READ			3
 #define H_STOR_WRITE		4
 #define H_TERM				5
+#define H_PROFILE			6
+#define H_PERF				7
 
 /*
 calls:
@@ -23,6 +25,8 @@ calls:
 	3	STOR_READ(u32 block, u32 pa)	reada a storage block to a given PA. result is a bool
 	4	STOR_WRITE(u32 block, u32 pa)	writes a block to disk from a given PA. result is a bool
 	5	TERM							terminate emulation
+	6	PROFILE(u32 op)					guest pc profiler, if built in. op: 0 = stop, 1 = start, 2 = dump to console, 3 = clear. ret: samples so far
+	7	PERF(u32 op, u32 idx)			emulator perf counters, if built in. op: 0 = how many, 1 = read counter idx, 2 = dump to console. ret: count, value, or 0
 */
 
 
@@ -1804,11 +1804,11 @@ uint32_t fb_mono_init(uint32_t vid_mode) {
   }
 
   // PSRAM channel allocated for FB refresh
-  _inst.pio_mem = g_hram_all[1].pio;
-  _inst.sm_fb = g_hram_all[1].sm;
+  _inst.pio_mem = hyperram_port_inst(HRAM_PORT_VIDEO)->pio;
+  _inst.sm_fb = hyperram_port_inst(HRAM_PORT_VIDEO)->sm;
 
   // PSRAM channel allocated for processor access
-  _inst.sm_proc = g_hram_all[0].sm;
+  _inst.sm_proc = hyperram_port_inst(HRAM_PORT_CPU)->sm;
 
   _inst.sync_base_pin = VGA_HSYNC_PIN;
   _inst.vsync_offset = 1;
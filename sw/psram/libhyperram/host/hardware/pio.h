@@ -0,0 +1,16 @@
+#ifndef _HOST_HARDWARE_PIO_H
+#define _HOST_HARDWARE_PIO_H
+
+// Just enough of the SDK's hardware/pio.h for hyperram.h in a host build
+// against hyperram_host.c
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t *PIO;
+
+#define pio0	((PIO)0)
+
+#endif
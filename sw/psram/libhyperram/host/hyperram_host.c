@@ -0,0 +1,262 @@
+// Host stand-in for hyperram.c: the same memory, port and async API over an
+// array, so code that uses them can be unit tested off the board (build with
+// -I libhyperram/host -I libhyperram). The PIO-level calls (hyperram_pio_init,
+// _hyperram_cmd_init*) are not here.
+//
+// It is strict where the hardware is loose: an async transfer only happens
+// when its handle is waited on, polled done HRAM_HOST_ASYNC_POLLS times, or a
+// port call has to wait for it the way _hyperram_port_get does, and a read's
+// buffer holds 0xa5 until then. Queueing anything on an SM with a transfer
+// still running asserts, as does an async transfer over HRAM_ASYNC_MAX_WORDS.
+// A caller that forgets a wait sees stale data instead of getting lucky.
+
+#include <assert.h>
+#include <string.h>
+
+#include "hyperram.h"
+
+#ifndef HRAM_HOST_SIZE
+#define HRAM_HOST_SIZE		(8u << 20)
+#endif
+
+#define HRAM_HOST_ASYNC_POLLS	2
+
+uint8_t hyperram_host_mem[HRAM_HOST_SIZE] __attribute__((aligned(4)));
+
+// Transfer in flight per SM. A handle has at most one, so its SM finds it.
+static struct {
+  const hyperram_async_t *h;
+  bool read;
+  uint32_t addr;
+  uint32_t *dst;
+  uint len;
+  uint polls;
+} g_host_async[4];
+
+static uint16_t g_host_cfg[2] = { 0x8f1f, 0xffc1 };
+
+// The part is addressed in halfwords, byte address bit 0 goes nowhere
+static uint8_t *_host_mem(uint32_t addr, uint len) {
+  addr &= ~1u;
+  assert(addr < HRAM_HOST_SIZE && len <= HRAM_HOST_SIZE - addr);
+  return hyperram_host_mem + addr;
+}
+
+static int _host_async_sm(const hyperram_async_t *h) {
+  for (int i = 0; i < 4; i++)
+    if (g_host_async[i].h == h)
+      return i;
+  return -1;
+}
+
+static void _host_async_finish(uint sm) {
+  if (!g_host_async[sm].h)
+    return;
+  if (g_host_async[sm].read)
+    memcpy(g_host_async[sm].dst, _host_mem(g_host_async[sm].addr, g_host_async[sm].len * 4), g_host_async[sm].len * 4);
+  else
+    memcpy(_host_mem(g_host_async[sm].addr, g_host_async[sm].len * 4), g_host_async[sm].h->buf, g_host_async[sm].len * 4);
+  g_host_async[sm].h = NULL;
+}
+
+// Nothing may be queued on an SM behind an unfinished async transfer
+static void _host_sm_idle(const hyperram_inst_t *inst) {
+  assert(!g_host_async[inst->sm].h);
+}
+
+void hyperram_read_blocking(const hyperram_inst_t *inst, uint32_t addr, uint32_t *dst, uint len) {
+  _host_sm_idle(inst);
+  memcpy(dst, _host_mem(addr, len * 4), len * 4);
+}
+
+void hyperram_write_blocking(const hyperram_inst_t *inst, uint32_t addr, const uint32_t *src, uint len) {
+  _host_sm_idle(inst);
+  memcpy(_host_mem(addr, len * 4), src, len * 4);
+}
+
+void hyperram_write_hw_blocking(const hyperram_inst_t *inst, uint32_t addr, const uint32_t *src, uint len) {
+  _host_sm_idle(inst);
+  memcpy(_host_mem(addr, len * 2), src, len * 2);
+}
+
+void hyperram_write_with_mask(const hyperram_inst_t *inst, uint32_t addr, uint32_t src, uint32_t mask) {
+  uint8_t *p = _host_mem(addr, 4);
+
+  _host_sm_idle(inst);
+  for (uint i = 0; i < 4; i++, src >>= 8)
+    if (mask & (1u << i))
+      p[i] = src;
+}
+
+void hyperram_async_init(hyperram_async_t *h) {
+  memset(h, 0, sizeof(*h));
+}
+
+void hyperram_read_async(const hyperram_inst_t *inst, uint32_t addr, uint32_t *dst, uint len, hyperram_async_t *h) {
+  _host_sm_idle(inst);
+  assert(len && len <= HRAM_ASYNC_MAX_WORDS && _host_async_sm(h) < 0);
+  (void)_host_mem(addr, len * 4);
+  memset(dst, 0xa5, len * 4);
+  g_host_async[inst->sm].h = h;
+  g_host_async[inst->sm].read = true;
+  g_host_async[inst->sm].addr = addr;
+  g_host_async[inst->sm].dst = dst;
+  g_host_async[inst->sm].len = len;
+  g_host_async[inst->sm].polls = 0;
+}
+
+void hyperram_write_async(const hyperram_inst_t *inst, uint32_t addr, const uint32_t *src, uint len, hyperram_async_t *h) {
+  _host_sm_idle(inst);
+  assert(len && len <= HRAM_ASYNC_MAX_WORDS && _host_async_sm(h) < 0);
+  (void)_host_mem(addr, len * 4);
+  // staged in the handle, like the real thing
+  memcpy(h->buf, src, len * 4);
+  g_host_async[inst->sm].h = h;
+  g_host_async[inst->sm].read = false;
+  g_host_async[inst->sm].addr = addr;
+  g_host_async[inst->sm].len = len;
+  g_host_async[inst->sm].polls = 0;
+}
+
+bool hyperram_async_done(const hyperram_async_t *h) {
+  int sm = _host_async_sm(h);
+
+  if (sm < 0)
+    return true;
+  if (++g_host_async[sm].polls < HRAM_HOST_ASYNC_POLLS)
+    return false;
+  _host_async_finish(sm);
+  return true;
+}
+
+void hyperram_async_wait(const hyperram_async_t *h) {
+  int sm = _host_async_sm(h);
+
+  if (sm >= 0)
+    _host_async_finish(sm);
+}
+
+void hyperram_cfg_write_blocking(const hyperram_inst_t *inst, uint32_t addr, uint16_t wdata) {
+  _host_sm_idle(inst);
+  if (addr == HRAM_REG_CFG0 || addr == HRAM_REG_CFG1)
+    g_host_cfg[addr == HRAM_REG_CFG1] = wdata;
+}
+
+uint16_t hyperram_cfg_read_blocking(const hyperram_inst_t *inst, uint32_t addr) {
+  _host_sm_idle(inst);
+  if (addr == HRAM_REG_CFG0 || addr == HRAM_REG_CFG1)
+    return g_host_cfg[addr == HRAM_REG_CFG1];
+  return addr == HRAM_REG_ID0 ? 0x0c81 : 0;
+}
+
+int hyperram_clk_init() {
+  for (int i = 0; i < 4; i++)
+    g_hram_all[i].target_clk = 300000000;
+  return 300000000;
+}
+
+int hyperram_get_sysclk() {
+  return g_hram_all[0].target_clk;
+}
+
+int hyperram_ram_init() {
+  memset(g_host_async, 0, sizeof(g_host_async));
+  memset(hyperram_host_mem, 0, sizeof(hyperram_host_mem));
+  return 0;
+}
+
+int hyperram_init() {
+  int target_clk = hyperram_clk_init();
+
+  if (hyperram_ram_init() == -1) return -1;
+
+  return target_clk;
+}
+
+
+// The port layer, with the ordering rules of the real one
+
+static uint8_t g_hram_port_sm[HRAM_NUM_PORTS] = {
+  [HRAM_PORT_CPU] = 0,
+  [HRAM_PORT_VIDEO] = 1,
+  [HRAM_PORT_IFETCH] = 2,
+  [HRAM_PORT_IO] = 3,
+};
+
+static int g_hram_wr_sm = -1;
+
+static const hyperram_inst_t *_hyperram_port_get(hyperram_port_t port, bool write) {
+  const hyperram_inst_t *inst = &g_hram_all[g_hram_port_sm[port]];
+
+  _host_async_finish(inst->sm);
+  if (g_hram_wr_sm >= 0 && g_hram_wr_sm != (int)inst->sm) {
+    _host_async_finish(g_hram_wr_sm);
+    g_hram_wr_sm = -1;
+  }
+  if (write)
+    g_hram_wr_sm = inst->sm;
+
+  return inst;
+}
+
+void hyperram_port_assign(hyperram_port_t port, uint sm) {
+  g_hram_port_sm[port] = sm;
+}
+
+const hyperram_inst_t *hyperram_port_inst(hyperram_port_t port) {
+  return &g_hram_all[g_hram_port_sm[port]];
+}
+
+void hyperram_port_read(hyperram_port_t port, uint32_t addr, uint8_t *dst, uint len) {
+  hyperram_read_blocking(_hyperram_port_get(port, false), addr, (uint32_t *)dst, len >> 2);
+}
+
+void hyperram_port_write(hyperram_port_t port, uint32_t addr, const uint8_t *src, uint len) {
+  hyperram_write_blocking(_hyperram_port_get(port, true), addr, (const uint32_t *)src, len >> 2);
+}
+
+void hyperram_port_write_mask(hyperram_port_t port, uint32_t addr, uint32_t src, uint32_t mask) {
+  hyperram_write_with_mask(_hyperram_port_get(port, true), addr, src, mask);
+}
+
+void hyperram_port_read_async(hyperram_port_t port, uint32_t addr, uint8_t *dst, uint len, hyperram_async_t *h) {
+  for (len >>= 2; len; ) {
+    uint now = len > HRAM_ASYNC_MAX_WORDS ? HRAM_ASYNC_MAX_WORDS : len;
+
+    hyperram_read_async(_hyperram_port_get(port, false), addr, (uint32_t *)dst, now, h);
+    addr += now * 4;
+    dst += now * 4;
+    len -= now;
+  }
+}
+
+void hyperram_port_write_async(hyperram_port_t port, uint32_t addr, const uint8_t *src, uint len, hyperram_async_t *h) {
+  for (len >>= 2; len; ) {
+    uint now = len > HRAM_ASYNC_MAX_WORDS ? HRAM_ASYNC_MAX_WORDS : len;
+
+    hyperram_write_async(_hyperram_port_get(port, true), addr, (const uint32_t *)src, now, h);
+    addr += now * 4;
+    src += now * 4;
+    len -= now;
+  }
+}
+
+void hyperram_read(uint32_t addr, uint8_t *dst, uint len) {
+  hyperram_port_read(HRAM_PORT_CPU, addr, dst, len);
+}
+
+void hyperram_write(uint32_t addr, const uint8_t *src, uint len) {
+  hyperram_port_write(HRAM_PORT_CPU, addr, src, len);
+}
+
+void hyperram_read_32(uint32_t addr, uint32_t *dst, uint len) {
+  hyperram_read_blocking(_hyperram_port_get(HRAM_PORT_CPU, false), addr, dst, len);
+}
+
+void hyperram_write_32(uint32_t addr, const uint32_t *src, uint len) {
+  hyperram_write_blocking(_hyperram_port_get(HRAM_PORT_CPU, true), addr, src, len);
+}
+
+void hyperram_write_mask(uint32_t addr, uint32_t src, uint32_t mask) {
+  hyperram_port_write_mask(HRAM_PORT_CPU, addr, src, mask);
+}
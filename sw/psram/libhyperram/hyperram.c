@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <stdio.h>
 
 // For setting 1.8v threshold
@@ -7,6 +8,7 @@
 #include "hardware/regs/pads_bank0.h"
 
 #include "hardware/pio.h"
+#include "hardware/dma.h"
 #include "pico/stdlib.h"
 
 #include "hardware/sync.h"
@@ -111,6 +113,15 @@ void hyperram_pio_init(const hyperram_inst_t *inst) {
 // ------+------------------------------+------------------------------------+
 
 void _hyperram_cmd_init(hyperram_cmd_t *cmd, const hyperram_inst_t *inst, hyperram_cmd_flags flags, uint32_t addr, uint len) {
+	// Convert word len to uint16 len
+	_hyperram_cmd_init_hw(cmd, inst, flags, addr, len * 2);
+}
+
+// As above, but len is in uint16 units. Only writes may use an odd halfword
+// count - the read path autopushes whole words. A write of 0 halfwords is
+// followed by a masked write stream (see hyperram_write_with_mask) instead of
+// data.
+void _hyperram_cmd_init_hw(hyperram_cmd_t *cmd, const hyperram_inst_t *inst, hyperram_cmd_flags flags, uint32_t addr, uint len) {
   uint32_t next_pc;
   uint32_t cmd1_be;
 
@@ -120,9 +131,6 @@ void _hyperram_cmd_init(hyperram_cmd_t *cmd, const hyperram_inst_t *inst, hyperr
 	// Add flags to addr_h upper bits for Command/Address 0
 	uint32_t addr_h = (addr >> 3) | (flags << 24);
 	
-	// Convert word len to uint16 len - 1
-	len = (len * 2) - 1;
-
 	// Little endian, so first byte is 31:24
 	// Send big endian Command/Address values via little endain PIO FIFO
 	// (i.e. byte swap CA values)
@@ -146,8 +154,9 @@ void _hyperram_cmd_init(hyperram_cmd_t *cmd, const hyperram_inst_t *inst, hyperr
 		       (((cmd1_be >> 8) & 0xff) << 16) |
 		       (((cmd1_be >> 0) & 0xff) << 24));
 
-          // Goto read latency/data
+          // Goto read latency/data, loop count is uint16 len - 1
 	  next_pc = (inst->prog_offset + hyperram_offset_r_lat);
+	  len = len - 1;
 	  // Big endian:
 	  //cmd->cmd2 = len << 16 | 0x00 << 8 | next_pc;
 	  // Little endian
@@ -169,7 +178,8 @@ void _hyperram_cmd_init(hyperram_cmd_t *cmd, const hyperram_inst_t *inst, hyperr
 		       (((cmd1_be >> 8) & 0xff) << 16) |
 		       (((cmd1_be >> 0) & 0xff) << 24));
 
-          // Goto write latency/data
+          // Goto write latency/data, loop count is uint16 len (the latency
+	  // loop exits through a decrement)
 	  next_pc = (inst->prog_offset + hyperram_offset_w_lat);
 	  // Big endian:
 	  //cmd->cmd2 = len << 16 | 0xff << 8 | next_pc;
@@ -209,8 +219,8 @@ void _hyperram_cmd_init_reg_w(hyperram_cmd_reg_w_t *cmd, const hyperram_inst_t *
 	       (((cmd1_be >> 8) & 0xff) << 16) |
 	       (((cmd1_be >> 0) & 0xff) << 24));
 
-  // Next command word (cmd2 is register data)
-  next_pc = (inst->prog_offset + hyperram_offset_passOn);
+  // Next command word (cmd2 is register data), deselect the part
+  next_pc = (inst->prog_offset + hyperram_offset_done);
   // Big endian:
   //cmd->cmd3 = next_pc;
   // Little endian:
@@ -253,6 +263,148 @@ void __not_in_flash_func(hyperram_write_blocking)(const hyperram_inst_t *inst, u
 
 }
 
+// Write len halfwords from src. The SM consumes write data a byte at a time
+// and drops the unused upper half of the last FIFO word when it pulls the
+// next command, so an odd count needs no padding.
+void __not_in_flash_func(hyperram_write_hw_blocking)(const hyperram_inst_t *inst, uint32_t addr, const uint32_t *src, uint len) {
+	hyperram_cmd_t cmd;
+
+	_hyperram_cmd_init_hw(&cmd, inst, HRAM_CMD_WRITE, addr, len);
+
+	pio_sm_put_blocking(inst->pio, inst->sm, cmd.cmd0);
+	pio_sm_put_blocking(inst->pio, inst->sm, cmd.cmd1);
+	pio_sm_put_blocking(inst->pio, inst->sm, cmd.cmd2);
+
+	for (uint i = 0; i < (len + 1) / 2; ++i)
+			pio_sm_put_blocking(inst->pio, inst->sm, src[i]);
+}
+
+// Write the bytes of src enabled in mask (bit n enables byte n) to the four
+// bytes at halfword aligned addr, in a single write transaction.
+//
+// The PSRAM word is 16 bits, so a store made of whole halfwords (byte enables
+// 0x3, 0xc, 0xf) is a plain write. Anything else drives RWDS, the device's
+// byte mask, high for the bytes to leave alone. RWDS is only reachable through
+// SET, which the write data loop has no time for, so the SM runs the masked
+// write from the FIFO instead (the w_mask loop executes it 16 bits at a time):
+//
+//   set PINS, rwds0 ; out PINS, 16 [2] ; byte 0 ; nop side 1
+//   set PINS, rwds1 ; out PINS, 16 [2] ; byte 1 ; nop side 0 (jmp done side 0)
+//
+// Four FIFO words per halfword. Each data byte gets the same 5 cycle setup to
+// its CK edge as in the write data loop; the clock just runs slower.
+void __not_in_flash_func(hyperram_write_with_mask)(const hyperram_inst_t *inst, uint32_t addr, uint32_t src, uint32_t mask) {
+	const uint32_t out_data = pio_encode_out(pio_pins, 16) | pio_encode_delay(2);
+	const uint32_t ck_rise = pio_encode_nop() | pio_encode_sideset_opt(1, 1);
+	const uint32_t ck_fall = pio_encode_nop() | pio_encode_sideset_opt(1, 0);
+	const uint32_t ck_last = pio_encode_jmp(inst->prog_offset + hyperram_offset_done) | pio_encode_sideset_opt(1, 0);
+	hyperram_cmd_t cmd;
+	uint first, num;
+
+	mask &= 0xf;
+
+	// Halfwords with anything to write
+	first = (mask & 0x3) ? 0 : 1;
+	num = (mask & 0xc) ? 2 - first : 1 - first;
+	if (!num)
+		return;
+
+	if (mask == (((1u << (num * 2)) - 1) << (first * 2))) {
+		src >>= first * 16;
+		hyperram_write_hw_blocking(inst, addr + first * 2, &src, num);
+		return;
+	}
+
+	_hyperram_cmd_init_hw(&cmd, inst, HRAM_CMD_WRITE, addr + first * 2, 0);
+
+	pio_sm_put_blocking(inst->pio, inst->sm, cmd.cmd0);
+	pio_sm_put_blocking(inst->pio, inst->sm, cmd.cmd1);
+	pio_sm_put_blocking(inst->pio, inst->sm, cmd.cmd2);
+
+	src >>= first * 16;
+	mask >>= first * 2;
+	for (uint i = 0; i < num * 2; i++, src >>= 8, mask >>= 1) {
+		// set pins are CSn (lsb), RWDS (msb) - RWDS high masks the byte
+		uint32_t rwds = pio_encode_set(pio_pins, (mask & 1) ? 0 : 2);
+		uint32_t edge = !(i & 1) ? ck_rise : (i == num * 2 - 1) ? ck_last : ck_fall;
+
+		pio_sm_put_blocking(inst->pio, inst->sm, rwds | out_data << 16);
+		pio_sm_put_blocking(inst->pio, inst->sm, (src & 0xff) | edge << 16);
+	}
+}
+
+void hyperram_async_init(hyperram_async_t *h) {
+  h->cmd_chan = dma_claim_unused_channel(true);
+  h->data_chan = dma_claim_unused_channel(true);
+}
+
+// Start a DMA from src into the SM's TX FIFO
+static void _hyperram_async_push(const hyperram_inst_t *inst, hyperram_async_t *h, const uint32_t *src, uint len) {
+  dma_channel_config c = dma_channel_get_default_config(h->cmd_chan);
+
+  channel_config_set_read_increment(&c, true);
+  channel_config_set_write_increment(&c, false);
+  channel_config_set_dreq(&c, pio_get_dreq(inst->pio, inst->sm, true));
+  dma_channel_configure(h->cmd_chan, &c, &inst->pio->txf[inst->sm], src, len, true);
+}
+
+void __not_in_flash_func(hyperram_read_async)(const hyperram_inst_t *inst, uint32_t addr, uint32_t *dst, uint len, hyperram_async_t *h) {
+  dma_channel_config c = dma_channel_get_default_config(h->data_chan);
+  hyperram_cmd_t *cmd = (hyperram_cmd_t *)h->buf;
+  uint n = 0;
+
+  // h->buf has room for this much (the port functions split longer ones)
+  assert(len && len <= HRAM_ASYNC_MAX_WORDS);
+
+  // All the command packets go out back to back, the SM runs them in turn
+  for (uint done = 0; done < len; done += HRAM_ASYNC_BURST_WORDS, n++) {
+    uint now = len - done;
+
+    if (now > HRAM_ASYNC_BURST_WORDS)
+      now = HRAM_ASYNC_BURST_WORDS;
+    _hyperram_cmd_init(&cmd[n], inst, HRAM_CMD_READ, addr + done * 4, now);
+  }
+
+  // Start draining first so read data never backs up in the RX FIFO
+  channel_config_set_read_increment(&c, false);
+  channel_config_set_write_increment(&c, true);
+  channel_config_set_dreq(&c, pio_get_dreq(inst->pio, inst->sm, false));
+  dma_channel_configure(h->data_chan, &c, dst, &inst->pio->rxf[inst->sm], len, true);
+
+  _hyperram_async_push(inst, h, h->buf, n * HRAM_CMD_READ_LEN);
+}
+
+void __not_in_flash_func(hyperram_write_async)(const hyperram_inst_t *inst, uint32_t addr, const uint32_t *src, uint len, hyperram_async_t *h) {
+  uint32_t *p = h->buf;
+
+  assert(len && len <= HRAM_ASYNC_MAX_WORDS);
+
+  // Interleave command packets with their data so one channel feeds the lot
+  for (uint done = 0; done < len; done += HRAM_ASYNC_BURST_WORDS) {
+    uint now = len - done;
+
+    if (now > HRAM_ASYNC_BURST_WORDS)
+      now = HRAM_ASYNC_BURST_WORDS;
+    _hyperram_cmd_init((hyperram_cmd_t *)p, inst, HRAM_CMD_WRITE, addr + done * 4, now);
+    p += HRAM_CMD_WRITE_LEN;
+    for (uint i = 0; i < now; i++)
+      *p++ = src[done + i];
+  }
+
+  _hyperram_async_push(inst, h, h->buf, p - h->buf);
+}
+
+// Writes are done once all their data is in the TX FIFO, like the blocking
+// call. Reads are done when the last word has landed.
+bool __not_in_flash_func(hyperram_async_done)(const hyperram_async_t *h) {
+  return !dma_channel_is_busy(h->cmd_chan) && !dma_channel_is_busy(h->data_chan);
+}
+
+void __not_in_flash_func(hyperram_async_wait)(const hyperram_async_t *h) {
+  while (!hyperram_async_done(h))
+    tight_loop_contents();
+}
+
 void hyperram_cfg_write_blocking(const hyperram_inst_t *inst, uint32_t addr, uint16_t wdata_be) {
 	hyperram_cmd_reg_w_t cmd;
 	uint32_t wdata;
@@ -369,25 +521,123 @@ int hyperram_init() {
 }
 
 
-// Friendly read/write functions 
+// Port to SM mapping
+static uint8_t g_hram_port_sm[HRAM_NUM_PORTS] = {
+  [HRAM_PORT_CPU] = 0,
+  [HRAM_PORT_VIDEO] = 1,
+  [HRAM_PORT_IFETCH] = 2,
+  [HRAM_PORT_IO] = 3,
+};
+
+// SM that last had writes queued, or -1. Writes are posted: they return once
+// the data is in the TX FIFO. Before another SM touches memory, wait for that
+// FIFO to drain - the writer then holds the bus token (a write is at least
+// four FIFO words, so it cannot be sitting entirely in the OSR), and whatever
+// is queued next on another SM is serviced behind it.
+static int g_hram_wr_sm = -1;
+
+// Async transfer last started on each SM. It has to finish feeding the FIFO
+// before anything else is queued on that SM.
+static const hyperram_async_t *g_hram_async[4];
+
+// g_hram_wr_sm and g_hram_async are not locked: the port functions belong to
+// core0's thread context (core1 and irq handlers must not use them, or must
+// use an SM of their own directly, as video refresh does)
+static inline const hyperram_inst_t *_hyperram_port_get(hyperram_port_t port, bool write) {
+  const hyperram_inst_t *inst = &g_hram_all[g_hram_port_sm[port]];
+
+  assert(get_core_num() == 0);
+
+  if (g_hram_async[inst->sm]) {
+    hyperram_async_wait(g_hram_async[inst->sm]);
+    g_hram_async[inst->sm] = NULL;
+  }
+
+  if (g_hram_wr_sm >= 0 && g_hram_wr_sm != (int)inst->sm) {
+    if (g_hram_async[g_hram_wr_sm]) {
+      hyperram_async_wait(g_hram_async[g_hram_wr_sm]);
+      g_hram_async[g_hram_wr_sm] = NULL;
+    }
+    while (!pio_sm_is_tx_fifo_empty(inst->pio, g_hram_wr_sm))
+      ;
+    g_hram_wr_sm = -1;
+  }
+
+  if (write)
+    g_hram_wr_sm = inst->sm;
+
+  return inst;
+}
+
+void hyperram_port_assign(hyperram_port_t port, uint sm) {
+  g_hram_port_sm[port] = sm;
+}
+
+const hyperram_inst_t *hyperram_port_inst(hyperram_port_t port) {
+  return &g_hram_all[g_hram_port_sm[port]];
+}
+
+// Address, length are bytes - will be aligned to word quantities
+void __not_in_flash_func(hyperram_port_read)(hyperram_port_t port, uint32_t addr, uint8_t *dst, uint len) {
+  hyperram_read_blocking(_hyperram_port_get(port, false), addr, (uint32_t*)dst, len >> 2);
+}
+
+void __not_in_flash_func(hyperram_port_write)(hyperram_port_t port, uint32_t addr, const uint8_t *src, uint len) {
+  hyperram_write_blocking(_hyperram_port_get(port, true), addr, (uint32_t *)src, len >> 2);
+}
+
+void __not_in_flash_func(hyperram_port_write_mask)(hyperram_port_t port, uint32_t addr, uint32_t src, uint32_t mask) {
+  hyperram_write_with_mask(_hyperram_port_get(port, true), addr, src, mask);
+}
+
+// Address, length are bytes. Past HRAM_ASYNC_MAX_WORDS words the transfer is
+// done in pieces that size, and only the last one is left running.
+void __not_in_flash_func(hyperram_port_read_async)(hyperram_port_t port, uint32_t addr, uint8_t *dst, uint len, hyperram_async_t *h) {
+  for (len >>= 2; len; ) {
+    const hyperram_inst_t *inst = _hyperram_port_get(port, false);
+    uint now = len > HRAM_ASYNC_MAX_WORDS ? HRAM_ASYNC_MAX_WORDS : len;
+
+    hyperram_read_async(inst, addr, (uint32_t *)dst, now, h);
+    g_hram_async[inst->sm] = h;
+    addr += now * 4;
+    dst += now * 4;
+    len -= now;
+  }
+}
+
+void __not_in_flash_func(hyperram_port_write_async)(hyperram_port_t port, uint32_t addr, const uint8_t *src, uint len, hyperram_async_t *h) {
+  for (len >>= 2; len; ) {
+    const hyperram_inst_t *inst = _hyperram_port_get(port, true);
+    uint now = len > HRAM_ASYNC_MAX_WORDS ? HRAM_ASYNC_MAX_WORDS : len;
+
+    hyperram_write_async(inst, addr, (const uint32_t *)src, now, h);
+    g_hram_async[inst->sm] = h;
+    addr += now * 4;
+    src += now * 4;
+    len -= now;
+  }
+}
+
+// Friendly read/write functions use the CPU port
 // Address, length are bytes - will be aligned to word quantities
 void hyperram_read(uint32_t addr, uint8_t *dst, uint len) {
-  // Make byte length into word length
-  len = len >> 2;
-  hyperram_read_blocking(&g_hram_all[0], addr, (uint32_t*)dst, len);
+  hyperram_port_read(HRAM_PORT_CPU, addr, dst, len);
 }
 
 void hyperram_write(uint32_t addr, const uint8_t *src, uint len) {
-  // Make byte length into word length
-  len = len >> 2;
-  hyperram_write_blocking(&g_hram_all[0], addr, (uint32_t *)src, len);
+  hyperram_port_write(HRAM_PORT_CPU, addr, src, len);
 }
  
 // Word operations
 void hyperram_read_32(uint32_t addr, uint32_t *dst, uint len) {
-  hyperram_read_blocking(&g_hram_all[0], addr, dst, len);
+  hyperram_read_blocking(_hyperram_port_get(HRAM_PORT_CPU, false), addr, dst, len);
 }
 
 void hyperram_write_32(uint32_t addr, const uint32_t *src, uint len) {
-  hyperram_write_blocking(&g_hram_all[0], addr, src, len);
+  hyperram_write_blocking(_hyperram_port_get(HRAM_PORT_CPU, true), addr, src, len);
+}
+
+// Masked write of up to 4 bytes at a halfword aligned address
+void hyperram_write_mask(uint32_t addr, uint32_t src, uint32_t mask) {
+  hyperram_port_write_mask(HRAM_PORT_CPU, addr, src, mask);
 }
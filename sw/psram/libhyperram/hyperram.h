@@ -81,18 +81,68 @@ static hyperram_inst_t g_hram_all[4] = {
 				 }
 };
 
+// Memory ports. Each port is serviced by its own SM, so traffic on different
+// ports can be queued at the same time; the SMs take turns on the bus.
+typedef enum {
+	HRAM_PORT_CPU = 0,	// Processor data accesses
+	HRAM_PORT_VIDEO,	// Video refresh (libfbh)
+	HRAM_PORT_IFETCH,	// Instruction fetch
+	HRAM_PORT_IO,		// Disk/network buffers and block copies
+	HRAM_NUM_PORTS
+} hyperram_port_t;
+
 int hyperram_ram_init();
 int hyperram_clk_init();
 int hyperram_get_sysclk();
 int hyperram_init();
 void hyperram_read(uint32_t addr, uint8_t *dst, uint len);
 void hyperram_write(uint32_t addr, const uint8_t *src, uint len);
+void hyperram_write_mask(uint32_t addr, uint32_t src, uint32_t mask);
+
+// Asynchronous transfers. Command packets and data are moved by two DMA
+// channels (claimed by hyperram_async_init) instead of the CPU. Transfers are
+// split into bursts of at most HRAM_ASYNC_BURST_WORDS, which keeps CS# low
+// well inside tCSM. Write data is staged in the handle, so the source buffer
+// is free as soon as the call returns; a read's destination must stay valid
+// until the transfer is done. One transfer per handle at a time, and nothing
+// else may be queued on the SM until it is done (the port functions below
+// take care of that). At most HRAM_ASYNC_MAX_WORDS per transfer; the port
+// functions take longer ones, waiting for all but the last piece.
+#define HRAM_ASYNC_BURST_WORDS	32
+#define HRAM_ASYNC_MAX_WORDS	128
+#define HRAM_ASYNC_MAX_BURSTS	(HRAM_ASYNC_MAX_WORDS / HRAM_ASYNC_BURST_WORDS)
+
+typedef struct {
+	uint cmd_chan;		// Pushes command packets (and write data)
+	uint data_chan;		// Drains read data
+	uint32_t buf[HRAM_ASYNC_MAX_BURSTS * HRAM_CMD_WRITE_LEN + HRAM_ASYNC_MAX_WORDS];
+} hyperram_async_t;
+
+void hyperram_async_init(hyperram_async_t *h);
+void hyperram_read_async(const hyperram_inst_t *inst, uint32_t addr, uint32_t *dst, uint len, hyperram_async_t *h);
+void hyperram_write_async(const hyperram_inst_t *inst, uint32_t addr, const uint32_t *src, uint len, hyperram_async_t *h);
+bool hyperram_async_done(const hyperram_async_t *h);
+void hyperram_async_wait(const hyperram_async_t *h);
+
+// Port assignment. Defaults are CPU = SM0, VIDEO = SM1, IFETCH = SM2, IO = SM3.
+// Writes on one port are visible to any later access through the port
+// functions, whichever port it is made on. The port functions (and the
+// friendly ones above, which use the CPU port) keep unlocked state: call them
+// from core0, outside interrupt handlers, only.
+void hyperram_port_assign(hyperram_port_t port, uint sm);
+const hyperram_inst_t *hyperram_port_inst(hyperram_port_t port);
+void hyperram_port_read(hyperram_port_t port, uint32_t addr, uint8_t *dst, uint len);
+void hyperram_port_write(hyperram_port_t port, uint32_t addr, const uint8_t *src, uint len);
+void hyperram_port_write_mask(hyperram_port_t port, uint32_t addr, uint32_t src, uint32_t mask);
+void hyperram_port_read_async(hyperram_port_t port, uint32_t addr, uint8_t *dst, uint len, hyperram_async_t *h);
+void hyperram_port_write_async(hyperram_port_t port, uint32_t addr, const uint8_t *src, uint len, hyperram_async_t *h);
 
 
 void hyperram_pio_init(const hyperram_inst_t *inst);
 
 void hyperram_read_blocking(const hyperram_inst_t *inst, uint32_t addr, uint32_t *dst, uint len);
 void hyperram_write_blocking(const hyperram_inst_t *inst, uint32_t addr, const uint32_t *src, uint len);
+void hyperram_write_hw_blocking(const hyperram_inst_t *inst, uint32_t addr, const uint32_t *src, uint len);
 
 void hyperram_write_with_mask(const hyperram_inst_t *inst, uint32_t addr, uint32_t src, uint32_t mask); 
 
@@ -104,5 +154,6 @@ uint16_t hyperram_cfg_read_blocking(const hyperram_inst_t *inst, uint32_t addr);
 void hyperram_cfg_write_blocking(const hyperram_inst_t *inst, uint32_t addr, uint16_t wdata);
 
 void _hyperram_cmd_init(hyperram_cmd_t *cmd, const hyperram_inst_t *inst, hyperram_cmd_flags flags, uint32_t addr, uint len);
+void _hyperram_cmd_init_hw(hyperram_cmd_t *cmd, const hyperram_inst_t *inst, hyperram_cmd_flags flags, uint32_t addr, uint len);
 
 #endif
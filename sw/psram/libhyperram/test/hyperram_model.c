@@ -0,0 +1,240 @@
+// HyperRAM (S27KL0641 style) device model for the libhyperram host test.
+// It sees the pins once per PIO cycle and checks what it is sent: CA phase,
+// latency count (variable, with random refresh collisions), RWDS byte masks
+// on writes, bus contention and setup/hold. Every CS# low period is logged
+// as a transaction so the test can count what an API call cost.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pio_sim.h"
+#include "hyperram_model.h"
+
+#define PIN_CK		18
+#define PIN_CS		19
+#define PIN_RWDS	20
+#define PIN_DQ		22
+#define DQ_MASK		(0xffu << PIN_DQ)
+
+#define MEM_BYTES	(8u << 20)
+#define T_CSM_CYCLES	1200	// 4us at 300MHz
+
+uint8_t model_mem[MEM_BYTES];
+struct model_txn model_log[MODEL_LOG_LEN];
+uint model_log_n;
+uint16_t model_cr0;
+bool model_fixed_refresh;	// collide with refresh on every access
+
+static struct {
+	bool selected;
+	uint edges;		// CK edges since CS# fell
+	uint64_t cs_cycles;
+	uint8_t ca[6];
+	bool dbl;		// refresh collision: twice the latency
+	bool decoded, read, reg;
+	uint32_t addr;		// byte offset of the next data byte
+	uint data_edge;		// first data edge
+	uint32_t drive_vals, drive_dirs;
+	uint last_ck, last_cs;
+	uint32_t last_dq_rwds;
+	uint64_t dq_rwds_changed;
+	struct model_txn txn;
+	uint64_t now;
+	uint32_t rand;
+} m;
+
+static uint rnd(void)
+{
+	m.rand = m.rand * 1103515245u + 12345u;
+	return m.rand >> 16;
+}
+
+void model_reset(uint32_t seed)
+{
+	memset(&m, 0, sizeof(m));
+	m.rand = seed;
+	m.last_cs = 1;
+	model_log_n = 0;
+	model_cr0 = 0x8f1f;		// power on: 6 clocks, fixed 2x latency
+	model_fixed_refresh = false;
+}
+
+static uint latency_clocks(void)
+{
+	static const uint8_t lat[16] = { 5, 6, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 4 };
+	uint l = lat[(model_cr0 >> 4) & 0xf];
+
+	if (!l)
+		sim_fail("PSRAM: reserved latency in CR0 %04x", model_cr0);
+	return m.dbl ? 2 * l : l;
+}
+
+static uint16_t reg_read(uint32_t hw_addr)
+{
+	switch (hw_addr) {
+	case 0x000: return 0x0c81;	// ID0
+	case 0x001: return 0x0000;	// ID1
+	case 0x800: return model_cr0;
+	case 0x801: return 0xffc1;	// CR1
+	default: sim_fail("PSRAM: read of register %06x", (unsigned)hw_addr);
+	}
+}
+
+static void decode_ca(void)
+{
+	uint64_t ca = 0;
+	uint32_t hw;
+
+	for (uint i = 0; i < 6; i++)
+		ca = ca << 8 | m.ca[i];
+
+	m.read = (ca >> 47) & 1;
+	m.reg = (ca >> 46) & 1;
+	if (!((ca >> 45) & 1) && !m.reg)
+		sim_fail("PSRAM: wrapped burst");
+	if (ca & 0xfff8)
+		sim_fail("PSRAM: reserved CA bits set %012llx", (unsigned long long)ca);
+	hw = (uint32_t)(((ca >> 16) & 0x1fffffff) << 3 | (ca & 7));
+	m.addr = hw * 2;
+	if (!m.reg && m.addr >= MEM_BYTES)
+		sim_fail("PSRAM: address %08x out of range", (unsigned)m.addr);
+
+	// latency is counted in clocks from the one that carried CA[23:16], data
+	// moves on the rising edge that ends it (register writes have none)
+	m.data_edge = (m.reg && !m.read) ? 6 : 6 + 2 * latency_clocks() - 2;
+	m.decoded = true;
+
+	m.txn.read = m.read;
+	m.txn.reg = m.reg;
+	m.txn.addr = m.addr;
+	m.txn.dbl = m.dbl;
+}
+
+// CK edge while selected; dq and rwds are what the PIO drives
+static void edge(uint32_t dq, uint rwds, uint32_t pio_dirs)
+{
+	uint e = m.edges++;
+
+	if (e < 6) {
+		if ((pio_dirs & DQ_MASK) != DQ_MASK)
+			sim_fail("PSRAM: CA byte %u with DQ not driven", e);
+		m.ca[e] = dq;
+		if (e == 5)
+			decode_ca();
+		return;
+	}
+
+	if (e < m.data_edge)
+		return;
+
+	if (m.read) {
+		// launch the next byte, it is sampled before the next edge
+		uint8_t v;
+
+		if (m.reg) {
+			// the register repeats for as long as the host clocks
+			uint16_t r = reg_read(m.addr / 2);
+
+			v = ((e - m.data_edge) & 1) ? r : r >> 8;
+		}
+		else
+			v = model_mem[m.addr++ % MEM_BYTES];
+		m.drive_vals = (uint32_t)v << PIN_DQ | (uint32_t)(e & 1 ? 0 : 1) << PIN_RWDS;
+		m.drive_dirs = DQ_MASK | 1u << PIN_RWDS;
+		return;
+	}
+
+	if ((pio_dirs & DQ_MASK) != DQ_MASK && (!m.reg || e < m.data_edge + 2))
+		sim_fail("PSRAM: write data with DQ not driven");
+
+	if (m.reg) {
+		// 16 bit register, big endian, further data is ignored
+		if (e == m.data_edge)
+			model_cr0 = (model_cr0 & 0x00ff) | dq << 8;
+		else if (e == m.data_edge + 1) {
+			model_cr0 = (model_cr0 & 0xff00) | dq;
+			if (m.addr != 0x1000)
+				sim_fail("PSRAM: write to register %06x", (unsigned)m.addr / 2);
+		}
+		m.txn.bytes++;
+		return;
+	}
+
+	if (!(pio_dirs & (1u << PIN_RWDS)))
+		sim_fail("PSRAM: write data with RWDS not driven");
+	if (rwds)
+		m.txn.masked++;
+	else
+		model_mem[m.addr % MEM_BYTES] = dq;
+	m.addr++;
+	m.txn.bytes++;
+}
+
+uint32_t model_clock(uint32_t pio_vals, uint32_t pio_dirs, uint32_t *vals)
+{
+	uint ck = (pio_vals >> PIN_CK) & 1, cs = (pio_vals >> PIN_CS) & 1;
+	uint32_t dq_rwds = pio_vals & pio_dirs & (DQ_MASK | 1u << PIN_RWDS);
+
+	m.now++;
+
+	if (!(pio_dirs & (1u << PIN_CK)) || !(pio_dirs & (1u << PIN_CS)))
+		sim_fail("PSRAM: CK/CS# not driven");
+
+	// DQ/RWDS may not move on the cycle a CK edge happens
+	if (dq_rwds != m.last_dq_rwds) {
+		m.dq_rwds_changed = m.now;
+		m.last_dq_rwds = dq_rwds;
+	}
+
+	if (!cs && m.last_cs) {
+		if (ck)
+			sim_fail("PSRAM: CS# fell with CK high");
+		memset(&m.txn, 0, sizeof(m.txn));
+		m.selected = true;
+		m.edges = 0;
+		m.decoded = false;
+		m.cs_cycles = 0;
+		m.dbl = (model_cr0 & 0x8) || model_fixed_refresh || !(rnd() % 4);
+	}
+	else if (m.selected && !m.drive_dirs && !m.decoded) {
+		// tDSV: RWDS shows whether this access collides with refresh
+		m.drive_vals = (uint32_t)m.dbl << PIN_RWDS;
+		m.drive_dirs = 1u << PIN_RWDS;
+	}
+
+	if (m.selected && ck != m.last_ck) {
+		// only while they are being captured (register writes ignore
+		// anything past the one halfword)
+		bool capture = m.edges < 6 || (!m.read && (!m.reg || m.edges < m.data_edge + 2));
+
+		if (capture && m.dq_rwds_changed == m.now)
+			sim_fail("PSRAM: DQ/RWDS changed on a CK edge");
+		edge((pio_vals & pio_dirs & DQ_MASK) >> PIN_DQ, (pio_vals >> PIN_RWDS) & 1, pio_dirs);
+		// RWDS is the host's byte mask once a write's CA phase is over
+		if (m.edges == 6 && !m.read)
+			m.drive_dirs = 0;
+	}
+
+	// a CK edge on the cycle CS# rises still counts
+	if (cs && !m.last_cs) {
+		if (ck)
+			sim_fail("PSRAM: CS# rose with CK high");
+		if (m.edges < 6)
+			sim_fail("PSRAM: deselected in the CA phase (%u edges)", m.edges);
+		if (m.edges & 1)
+			sim_fail("PSRAM: deselected mid clock");
+		if (model_log_n < MODEL_LOG_LEN)
+			model_log[model_log_n] = m.txn;
+		model_log_n++;
+		m.selected = false;
+		m.drive_dirs = 0;
+	}
+	if (m.selected && ++m.cs_cycles > T_CSM_CYCLES)
+		sim_fail("PSRAM: CS# low longer than tCSM");
+
+	m.last_ck = ck;
+	m.last_cs = cs;
+	*vals = m.drive_vals;
+	return m.drive_dirs;
+}
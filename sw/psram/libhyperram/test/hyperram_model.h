@@ -0,0 +1,23 @@
+#ifndef _HYPERRAM_MODEL_H
+#define _HYPERRAM_MODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// One CS# low period
+struct model_txn {
+	bool read, reg, dbl;
+	uint32_t addr;		// byte address
+	unsigned bytes;		// write data bytes clocked in
+	unsigned masked;	// of those, how many RWDS masked
+};
+
+#define MODEL_LOG_LEN	64
+
+extern uint8_t model_mem[];
+extern struct model_txn model_log[MODEL_LOG_LEN];
+extern unsigned model_log_n;
+extern uint16_t model_cr0;
+extern bool model_fixed_refresh;
+
+#endif
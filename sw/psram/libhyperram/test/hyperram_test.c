@@ -0,0 +1,216 @@
+// Host test for libhyperram: hyperram.c runs against hyperram.pio on a
+// simulated PIO with a HyperRAM model on the pins. Checks data integrity at
+// both latencies, and that masked writes are a single write transaction with
+// the right RWDS byte mask.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hyperram.h"
+#include "pio_sim.h"
+#include "hyperram_model.h"
+
+#define CHECK(c, ...)	do { if (!(c)) { fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); sim_fail(__VA_ARGS__); } } while (0)
+
+static uint32_t seed = 1;
+static hyperram_async_t h[4];		// one per SM, and so one per port
+
+static uint32_t rnd(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void test_init(const char *pio)
+{
+	sim_init(pio);
+	model_reset(rnd());
+	CHECK(!hyperram_ram_init(), "ram init");
+	CHECK(model_cr0 == 0xf0e0, "CR0 %04x", model_cr0);
+	// the register write deselects the part, so both reads are their own
+	sim_settle();
+	CHECK(model_log_n == 3, "ram init: %u transactions", model_log_n);
+
+	for (uint i = 0; i < 4; i++)
+		hyperram_async_init(&h[i]);
+	CHECK(hyperram_cfg_read_blocking(&g_hram_all[0], HRAM_REG_CFG0) == 0xf0e0, "CR0 readback");
+}
+
+static void test_read_write(void)
+{
+	static uint32_t buf[64], chk[64];
+
+	for (uint iter = 0; iter < 200; iter++) {
+		const hyperram_inst_t *inst = &g_hram_all[rnd() % 4];
+		uint32_t addr = (rnd() % 0x10000) & ~3u;
+		uint len = 1 + rnd() % 32;
+
+		for (uint i = 0; i < len; i++)
+			buf[i] = rnd();
+		hyperram_write_blocking(inst, addr, buf, len);
+		// as the port layer does: another SM only sees the write once the
+		// writer has taken its data
+		while (!pio_sm_is_tx_fifo_empty(inst->pio, inst->sm))
+			;
+		inst = &g_hram_all[rnd() % 4];
+		hyperram_read_blocking(inst, addr, chk, len);
+		CHECK(!memcmp(buf, chk, len * 4), "read back %u words at %08x", len, (unsigned)addr);
+		CHECK(!memcmp(model_mem + addr, buf, len * 4), "memory %u words at %08x", len, (unsigned)addr);
+	}
+}
+
+static void test_write_hw(void)
+{
+	for (uint len = 1; len <= 9; len++) {
+		uint32_t addr = 0x2002 + len * 64, src[5], chk[6];
+		uint8_t before[24];
+
+		for (uint i = 0; i < 5; i++)
+			src[i] = rnd();
+		memcpy(before, model_mem + addr - 2, sizeof(before));
+
+		sim_settle();
+		model_log_n = 0;
+		hyperram_write_hw_blocking(&g_hram_all[0], addr, src, len);
+		hyperram_read_blocking(&g_hram_all[0], addr - 2, chk, 6);
+		sim_settle();
+
+		CHECK(model_log_n == 2 && !model_log[0].read && model_log[0].bytes == len * 2, "%u halfwords: %u transactions, %u bytes", len, model_log_n, model_log[0].bytes);
+		CHECK(!memcmp(chk, before, 2), "halfword before %u", len);
+		CHECK(!memcmp((uint8_t *)chk + 2, src, len * 2), "data %u", len);
+		CHECK(!memcmp((uint8_t *)chk + 2 + len * 2, before + 2 + len * 2, sizeof(before) - 2 - len * 2), "after %u", len);
+	}
+}
+
+static void test_write_mask(void)
+{
+	for (uint iter = 0; iter < 4; iter++) {
+		for (uint32_t mask = 0; mask < 16; mask++) {
+			uint32_t addr = 0x4000 + (iter * 16 + mask) * 8 + (iter & 1) * 2;
+			uint32_t src = rnd(), chk[2];
+			uint8_t expect[8], nbytes = 0, nhw;
+
+			for (uint i = 0; i < 8; i++)
+				model_mem[addr - 2 + i] = rnd();
+			memcpy(expect, model_mem + addr - 2, 8);
+			for (uint i = 0; i < 4; i++) {
+				if (mask & (1u << i)) {
+					expect[2 + i] = src >> (8 * i);
+					nbytes++;
+				}
+			}
+			nhw = !!(mask & 3) + !!(mask & 0xc);
+
+			sim_settle();
+			model_log_n = 0;
+			hyperram_write_with_mask(&g_hram_all[iter], addr, src, mask);
+			sim_settle();
+			CHECK(!memcmp(model_mem + addr - 2, expect, 8), "mask %x at %08x", (unsigned)mask, (unsigned)addr);
+
+			// one write, no read; the bytes not written were masked by RWDS
+			CHECK(model_log_n == !!mask, "mask %x: %u transactions", (unsigned)mask, model_log_n);
+			if (!mask)
+				continue;
+			CHECK(!model_log[0].read && !model_log[0].reg, "mask %x: not a memory write", (unsigned)mask);
+			CHECK(model_log[0].bytes == nhw * 2u, "mask %x: %u bytes clocked", (unsigned)mask, model_log[0].bytes);
+			CHECK(model_log[0].masked == nhw * 2u - nbytes, "mask %x: %u bytes masked", (unsigned)mask, model_log[0].masked);
+			CHECK(model_log[0].addr == addr + ((mask & 3) ? 0 : 2), "mask %x: address %08x", (unsigned)mask, (unsigned)model_log[0].addr);
+
+			hyperram_read_blocking(&g_hram_all[iter], addr, chk, 1);
+			CHECK(!memcmp(chk, expect + 2, 4), "mask %x: read back", (unsigned)mask);
+		}
+	}
+}
+
+static void test_async(void)
+{
+	static uint32_t buf[4][HRAM_ASYNC_MAX_WORDS], chk[HRAM_ASYNC_MAX_WORDS];
+
+	for (uint iter = 0; iter < 40; iter++) {
+		uint len[4];
+
+		// one transfer in flight on every SM at once
+		for (uint i = 0; i < 4; i++) {
+			len[i] = 1 + rnd() % HRAM_ASYNC_MAX_WORDS;
+			for (uint j = 0; j < len[i]; j++)
+				buf[i][j] = rnd();
+			hyperram_write_async(&g_hram_all[i], 0x10000 * (i + 1), buf[i], len[i], &h[i]);
+		}
+		for (uint i = 0; i < 4; i++)
+			hyperram_async_wait(&h[i]);
+		for (uint i = 0; i < 4; i++) {
+			while (!pio_sm_is_tx_fifo_empty(pio0, i))
+				;
+		}
+
+		for (uint i = 0; i < 4; i++) {
+			memset(chk, 0, sizeof(chk));
+			hyperram_read_async(&g_hram_all[(i + 1) % 4], 0x10000 * (i + 1), chk, len[i], &h[i]);
+			hyperram_async_wait(&h[i]);
+			CHECK(!memcmp(chk, buf[i], len[i] * 4), "async SM%u %u words", i, len[i]);
+		}
+	}
+}
+
+// The port layer: writes on one port are seen by later accesses on any other,
+// async transfers of any length
+static void test_ports(void)
+{
+	static uint32_t buf[3 * HRAM_ASYNC_MAX_WORDS + 5], chk[3 * HRAM_ASYNC_MAX_WORDS + 5];
+
+	for (uint iter = 0; iter < 60; iter++) {
+		hyperram_port_t wr = rnd() % HRAM_NUM_PORTS, rd = rnd() % HRAM_NUM_PORTS;
+		uint32_t addr = 0x40000 + (rnd() % 0x1000) * 4;
+		uint len = 1 + rnd() % (sizeof(buf) / 4);
+
+		for (uint i = 0; i < len; i++)
+			buf[i] = rnd();
+		memset(chk, 0, sizeof(chk));
+
+		switch (iter % 3) {
+		case 0:
+			hyperram_port_write_async(wr, addr, (uint8_t *)buf, len * 4, &h[wr]);
+			hyperram_port_read_async(rd, addr, (uint8_t *)chk, len * 4, &h[rd]);
+			hyperram_async_wait(&h[rd]);
+			break;
+		case 1:
+			hyperram_port_write(wr, addr, (uint8_t *)buf, len > 32 ? 128 : len * 4);
+			len = len > 32 ? 32 : len;
+			hyperram_port_read(rd, addr, (uint8_t *)chk, len * 4);
+			break;
+		default:
+			// a masked store lands between two full word writes
+			hyperram_port_write(wr, addr, (uint8_t *)buf, 8);
+			hyperram_port_write_mask(rd, addr + 2, buf[2], 0x6);
+			((uint8_t *)buf)[3] = buf[2] >> 8;
+			((uint8_t *)buf)[4] = buf[2] >> 16;
+			len = 2;
+			hyperram_port_read(wr, addr, (uint8_t *)chk, 8);
+			break;
+		}
+		CHECK(!memcmp(chk, buf, len * 4), "ports %u -> %u, %u words, case %u", wr, rd, len, iter % 3);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *pio = argc > 1 ? argv[1] : "../hyperram.pio";
+
+	for (uint pass = 0; pass < 2; pass++) {
+		test_init(pio);
+		// second pass: every access collides with refresh, twice the latency
+		model_fixed_refresh = pass;
+
+		test_read_write();
+		test_write_hw();
+		test_write_mask();
+		test_async();
+		test_ports();
+	}
+
+	printf("hyperram_test: PASS (%llu cycles)\n", (unsigned long long)sim_cycles());
+	return 0;
+}
@@ -0,0 +1,2 @@
+// Host build: everything comes from the simulator
+#include "pio_sim.h"
@@ -0,0 +1,746 @@
+// Cycle level PIO0 + DMA simulation for the libhyperram host test. Only as
+// much of the PIO as hyperram.pio (and the masked write stream it executes)
+// needs: one program, side-set of 1 optional bit, right shifts with
+// autopush/autopull, relative irq flags, OUT EXEC.
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "pio_sim.h"
+
+#define SIM_TIMEOUT	2000000u	// cycles a blocking call may wait
+
+pio_hw_t sim_pio0_hw;
+
+static uint16_t prog[32];
+static uint prog_len, prog_wrap_target, prog_wrap;
+const pio_program_t hyperram_program = { prog, 0, -1 };
+
+uint hyperram_offset_start, hyperram_offset_done, hyperram_offset_passOn;
+uint hyperram_offset_r_lat, hyperram_offset_r_data, hyperram_offset_w_lat, hyperram_offset_w_mask;
+
+static const struct {
+	const char *name;
+	uint *offset;
+} publics[] = {
+	{ "start", &hyperram_offset_start },
+	{ "done", &hyperram_offset_done },
+	{ "passOn", &hyperram_offset_passOn },
+	{ "r_lat", &hyperram_offset_r_lat },
+	{ "r_data", &hyperram_offset_r_data },
+	{ "w_lat", &hyperram_offset_w_lat },
+	{ "w_mask", &hyperram_offset_w_mask },
+};
+
+struct fifo {
+	uint32_t d[4];
+	uint n, rd;
+};
+
+static struct sm {
+	pio_sm_config c;
+	bool en;
+	uint pc;
+	uint32_t x, y, osr, isr;
+	uint osr_cnt, isr_cnt;	// bits shifted out of OSR / into ISR
+	uint delay;
+	bool exec_pending;
+	uint16_t exec_instr;
+	struct fifo tx, rx;
+} sms[4];
+
+static uint8_t irq_flags;
+static uint32_t pio_vals, pio_dirs;	// what the PIO drives, shared by all SMs
+static uint32_t pins;			// what is on the pins
+static uint64_t cycles;
+
+static struct dma {
+	bool claimed, busy;
+	dma_channel_config c;
+	volatile uint32_t *wr;
+	const volatile uint32_t *rd;
+	uint count;
+} dmas[12];
+
+void sim_fail(const char *fmt, ...)
+{
+	va_list va;
+
+	fprintf(stderr, "FAIL @%llu: ", (unsigned long long)cycles);
+	va_start(va, fmt);
+	vfprintf(stderr, fmt, va);
+	va_end(va);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static bool fifo_full(const struct fifo *f) { return f->n == 4; }
+static bool fifo_empty(const struct fifo *f) { return !f->n; }
+
+static void fifo_put(struct fifo *f, uint32_t v)
+{
+	f->d[(f->rd + f->n++) % 4] = v;
+}
+
+static uint32_t fifo_get(struct fifo *f)
+{
+	uint32_t v = f->d[f->rd];
+
+	f->rd = (f->rd + 1) % 4;
+	f->n--;
+	return v;
+}
+
+/* ---- assembler ---- */
+
+struct label {
+	char name[32];
+	uint addr;
+	bool public;
+};
+
+static struct label labels[64];
+static uint nlabels;
+static struct {
+	char name[32];
+	int val;
+} defines[16];
+static uint ndefines;
+
+static struct line {
+	char text[128];
+	uint addr, lineno;
+} lines[64];
+static uint nlines;
+
+static char *skip_ws(char *s)
+{
+	while (isspace((unsigned char)*s) || *s == ',')
+		s++;
+	return s;
+}
+
+static char *token(char **sp)
+{
+	char *s = skip_ws(*sp), *t = s;
+
+	while (*s && !isspace((unsigned char)*s) && *s != ',')
+		s++;
+	if (*s)
+		*s++ = 0;
+	*sp = s;
+	return t;
+}
+
+static int value(const char *t, uint lineno)
+{
+	for (uint i = 0; i < ndefines; i++)
+		if (!strcmp(defines[i].name, t))
+			return defines[i].val;
+	for (uint i = 0; i < nlabels; i++)
+		if (!strcmp(labels[i].name, t))
+			return labels[i].addr;
+	if (!strncmp(t, "0b", 2))
+		return strtol(t + 2, NULL, 2);
+	if (isdigit((unsigned char)*t))
+		return strtol(t, NULL, 0);
+	sim_fail("hyperram.pio:%u: bad value '%s'", lineno, t);
+}
+
+static uint dest(const char *t, uint lineno)
+{
+	static const char *names[] = { "PINS", "X", "Y", "NULL", "PINDIRS", "PC", "ISR", "EXEC" };
+
+	for (uint i = 0; i < 8; i++)
+		if (!strcasecmp(t, names[i]))
+			return i;
+	sim_fail("hyperram.pio:%u: bad operand '%s'", lineno, t);
+}
+
+static uint16_t assemble(char *s, uint lineno)
+{
+	char *op = token(&s), *t;
+	uint16_t ins;
+	uint side = 0, delay = 0;
+	char *p;
+
+	// side set and delay come last
+	if ((p = strchr(s, '['))) {
+		delay = value(p + 1, lineno);
+		*p = 0;
+	}
+	if ((p = strstr(s, "side"))) {
+		char *q = p + 4;
+
+		side = 0x1000 | (value(token(&q), lineno) & 1) << 11;
+		*p = 0;
+	}
+	if (delay > 7)
+		sim_fail("hyperram.pio:%u: delay too long", lineno);
+
+	if (!strcmp(op, "jmp")) {
+		static const char *conds[] = { "", "!X", "X--", "!Y", "Y--", "X!=Y", "PIN", "!OSRE" };
+		char *a = token(&s), *b = token(&s);
+		uint cond = 0;
+
+		if (*b) {
+			for (cond = 1; cond < 8 && strcasecmp(a, conds[cond]); cond++)
+				;
+			if (cond == 8)
+				sim_fail("hyperram.pio:%u: bad condition '%s'", lineno, a);
+			a = b;
+		}
+		ins = 0x0000 | cond << 5 | value(a, lineno);
+	}
+	else if (!strcmp(op, "wait")) {
+		uint pol = value(token(&s), lineno);
+
+		if (strcmp(token(&s), "irq"))
+			sim_fail("hyperram.pio:%u: only irq waits", lineno);
+		ins = 0x2000 | pol << 7 | 2 << 5 | value(token(&s), lineno);
+		if (!strcmp(token(&s), "rel"))
+			ins |= 0x10;
+	}
+	else if (!strcmp(op, "in")) {
+		t = token(&s);
+		ins = 0x4000 | dest(t, lineno) << 5 | (value(token(&s), lineno) & 0x1f);
+	}
+	else if (!strcmp(op, "out")) {
+		t = token(&s);
+		ins = 0x6000 | dest(t, lineno) << 5 | (value(token(&s), lineno) & 0x1f);
+	}
+	else if (!strcmp(op, "pull")) {
+		ins = 0x8080;
+		t = token(&s);
+		if (strcmp(t, "noblock"))
+			ins |= 0x20;
+	}
+	else if (!strcmp(op, "nop"))
+		ins = 0xa042;
+	else if (!strcmp(op, "irq")) {
+		ins = 0xc000;
+		t = token(&s);
+		if (strcmp(t, "nowait"))
+			sim_fail("hyperram.pio:%u: only irq nowait", lineno);
+		ins |= value(token(&s), lineno);
+		if (!strcmp(token(&s), "rel"))
+			ins |= 0x10;
+	}
+	else if (!strcmp(op, "set")) {
+		t = token(&s);
+		ins = 0xe000 | dest(t, lineno) << 5 | (value(token(&s), lineno) & 0x1f);
+	}
+	else
+		sim_fail("hyperram.pio:%u: unknown instruction '%s'", lineno, op);
+
+	return ins | side | delay << 8;
+}
+
+static void load_program(const char *path)
+{
+	char buf[256];
+	uint lineno = 0, addr = 0;
+	bool wrap_target = false, wrap = false;
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		sim_fail("cannot open %s", path);
+	nlabels = ndefines = nlines = 0;
+
+	// first pass: labels, defines, directives
+	while (fgets(buf, sizeof(buf), f)) {
+		char *s = buf, *t, *c;
+		bool public = false;
+
+		lineno++;
+		if ((c = strchr(s, ';')))
+			*c = 0;
+		s = skip_ws(s);
+		if (!*s)
+			continue;
+		if (*s == '.') {
+			t = token(&s);
+			if (!strcmp(t, ".define")) {
+				t = token(&s);
+				if (!strcmp(t, "public"))
+					t = token(&s);
+				strcpy(defines[ndefines].name, t);
+				defines[ndefines++].val = strtol(token(&s), NULL, 0);
+			}
+			else if (!strcmp(t, ".wrap_target")) {
+				prog_wrap_target = addr;
+				wrap_target = true;
+			}
+			else if (!strcmp(t, ".wrap")) {
+				prog_wrap = addr - 1;
+				wrap = true;
+			}
+			else if (!strcmp(t, ".side_set") && (atoi(token(&s)) != 1 || strcmp(token(&s), "opt")))
+				sim_fail("hyperram.pio:%u: only .side_set 1 opt", lineno);
+			continue;
+		}
+		if (!strncmp(s, "public ", 7)) {
+			public = true;
+			s = skip_ws(s + 7);
+		}
+		if ((c = strchr(s, ':'))) {
+			*c = 0;
+			strcpy(labels[nlabels].name, s);
+			labels[nlabels].public = public;
+			labels[nlabels++].addr = addr;
+			continue;
+		}
+		if (nlines == 64)
+			sim_fail("hyperram.pio: too long");
+		strcpy(lines[nlines].text, s);
+		lines[nlines].lineno = lineno;
+		lines[nlines++].addr = addr++;
+	}
+	fclose(f);
+
+	if (addr > 32)
+		sim_fail("hyperram.pio: %u instructions, the PIO has room for 32", addr);
+	prog_len = addr;
+	if (!wrap_target)
+		prog_wrap_target = 0;
+	if (!wrap)
+		prog_wrap = prog_len - 1;
+
+	// second pass: encode
+	for (uint i = 0; i < nlines; i++)
+		prog[lines[i].addr] = assemble(lines[i].text, lines[i].lineno);
+
+	for (uint i = 0; i < sizeof(publics) / sizeof(*publics); i++) {
+		uint j;
+
+		for (j = 0; j < nlabels && (strcmp(labels[j].name, publics[i].name) || !labels[j].public); j++)
+			;
+		if (j == nlabels)
+			sim_fail("hyperram.pio: no public label %s", publics[i].name);
+		*publics[i].offset = labels[j].addr;
+	}
+}
+
+pio_sm_config hyperram_program_get_default_config(uint offset)
+{
+	pio_sm_config c = { .out_count = 32, .wrap_target = offset + prog_wrap_target, .wrap = offset + prog_wrap, .push_thresh = 32, .pull_thresh = 32, };
+
+	return c;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program)
+{
+	(void)pio;
+	(void)program;
+	return 0;	// jmp targets need no relocation at 0
+}
+
+/* ---- state machines ---- */
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config)
+{
+	struct sm *s = &sms[sm];
+
+	(void)pio;
+	memset(s, 0, sizeof(*s));
+	s->c = *config;
+	s->pc = initial_pc;
+	s->osr_cnt = 32;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+	(void)pio;
+	sms[sm].en = enabled;
+}
+
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div)
+{
+	(void)pio;
+	(void)sm;
+	if (div != 1)
+		sim_fail("only clkdiv 1 is modelled");
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t values, uint32_t mask)
+{
+	(void)pio;
+	(void)sm;
+	pio_vals = (pio_vals & ~mask) | (values & mask);
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t dirs, uint32_t mask)
+{
+	(void)pio;
+	(void)sm;
+	pio_dirs = (pio_dirs & ~mask) | (dirs & mask);
+}
+
+void pio_gpio_init(PIO pio, uint pin)
+{
+	(void)pio;
+	(void)pin;
+}
+
+static void write_pins(uint32_t *reg, uint base, uint count, uint32_t v)
+{
+	for (uint i = 0; i < count; i++, v >>= 1)
+		*reg = (*reg & ~(1u << (base + i))) | (v & 1) << (base + i);
+}
+
+static uint irq_index(uint sm, uint idx)
+{
+	if (idx & 0x10)
+		return (idx & 4) | ((idx + sm) & 3);
+	return idx & 7;
+}
+
+// Autopull: refill an emptied OSR from the FIFO when there is data.
+static void autopull(struct sm *s)
+{
+	if (s->c.autopull && s->osr_cnt >= s->c.pull_thresh && !fifo_empty(&s->tx)) {
+		s->osr = fifo_get(&s->tx);
+		s->osr_cnt = 0;
+	}
+}
+
+// Returns false if the instruction stalled
+static bool sm_exec(uint n, struct sm *s, uint16_t ins, bool *jumped)
+{
+	uint op = ins >> 13, a = (ins >> 5) & 7, b = ins & 0x1f;
+	uint32_t v;
+
+	*jumped = false;
+	switch (op) {
+	case 0: {	// jmp
+		bool take;
+
+		switch (a) {
+		case 0: take = true; break;
+		case 1: take = !s->x; break;
+		case 2: take = s->x; s->x--; break;
+		case 3: take = !s->y; break;
+		case 4: take = s->y; s->y--; break;
+		case 5: take = s->x != s->y; break;
+		case 6: take = (pins >> s->c.jmp_pin) & 1; break;
+		default: take = s->osr_cnt < s->c.pull_thresh; break;
+		}
+		if (take) {
+			s->pc = b;
+			*jumped = true;
+		}
+		return true;
+	}
+	case 1: {	// wait (irq only)
+		uint i = irq_index(n, b);
+
+		if (((ins >> 5) & 3) != 2)
+			sim_fail("SM%u: unmodelled wait source %04x", n, ins);
+		if (!(irq_flags & (1u << i)) == !!(ins & 0x80))
+			return false;
+		if (ins & 0x80)
+			irq_flags &= ~(1u << i);
+		return true;
+	}
+	case 2:		// in
+		if (!b)
+			b = 32;
+		if (a != 0)
+			sim_fail("SM%u: unmodelled in source %04x", n, ins);
+		if (s->c.autopush && s->isr_cnt + b >= s->c.push_thresh && fifo_full(&s->rx))
+			return false;
+		v = b == 32 ? pins >> s->c.in_base : (pins >> s->c.in_base) & ((1u << b) - 1);
+		s->isr = b == 32 ? v : (s->isr >> b) | v << (32 - b);
+		s->isr_cnt += b;
+		if (s->c.autopush && s->isr_cnt >= s->c.push_thresh) {
+			fifo_put(&s->rx, s->isr);
+			s->isr = 0;
+			s->isr_cnt = 0;
+		}
+		return true;
+	case 3:		// out
+		if (!b)
+			b = 32;
+		if (s->c.autopull && s->osr_cnt >= s->c.pull_thresh) {
+			if (fifo_empty(&s->tx))
+				return false;
+			autopull(s);
+		}
+		v = b == 32 ? s->osr : s->osr & ((1u << b) - 1);
+		s->osr = b == 32 ? 0 : s->osr >> b;
+		s->osr_cnt += b;
+		switch (a) {
+		case 0: write_pins(&pio_vals, s->c.out_base, s->c.out_count, v); break;
+		case 1: s->x = v; break;
+		case 2: s->y = v; break;
+		case 3: break;
+		case 4: write_pins(&pio_dirs, s->c.out_base, s->c.out_count, v); break;
+		case 5: s->pc = v & 0x1f; *jumped = true; break;
+		case 7:
+			s->exec_pending = true;
+			s->exec_instr = v;
+			break;
+		default: sim_fail("SM%u: unmodelled out dest %04x", n, ins);
+		}
+		autopull(s);
+		return true;
+	case 4:		// pull (push is not used)
+		if (!(ins & 0x80) || (ins & 0x40))
+			sim_fail("SM%u: unmodelled push/pull %04x", n, ins);
+		// with autopull a pull of a full OSR is a no-op
+		if (s->c.autopull && !s->osr_cnt)
+			return true;
+		if (!fifo_empty(&s->tx))
+			s->osr = fifo_get(&s->tx);
+		else if (ins & 0x20)
+			return false;
+		else
+			s->osr = s->x;
+		s->osr_cnt = 0;
+		return true;
+	case 5:		// mov, only the nop
+		if ((ins & 0xe0ff) != 0xa042)
+			sim_fail("SM%u: unmodelled mov %04x", n, ins);
+		return true;
+	case 6:		// irq set
+		if (ins & 0x60)
+			sim_fail("SM%u: unmodelled irq %04x", n, ins);
+		irq_flags |= 1u << irq_index(n, b);
+		return true;
+	default:	// set
+		switch (a) {
+		case 0: write_pins(&pio_vals, s->c.set_base, s->c.set_count, b); break;
+		case 1: s->x = b; break;
+		case 2: s->y = b; break;
+		case 4: write_pins(&pio_dirs, s->c.set_base, s->c.set_count, b); break;
+		default: sim_fail("SM%u: unmodelled set dest %04x", n, ins);
+		}
+		return true;
+	}
+}
+
+static void sm_step(uint n)
+{
+	struct sm *s = &sms[n];
+	bool exec = s->exec_pending, jumped;
+	uint16_t ins = exec ? s->exec_instr : prog[s->pc];
+
+	if (!s->en)
+		return;
+	if (s->delay) {
+		s->delay--;
+		return;
+	}
+
+	// side set happens even if the instruction stalls
+	if (ins & 0x1000)
+		write_pins(&pio_vals, s->c.sideset_base, 1, (ins >> 11) & 1);
+
+	s->exec_pending = false;
+	if (!sm_exec(n, s, ins, &jumped)) {
+		if (exec) {
+			s->exec_pending = true;
+			s->exec_instr = ins;
+		}
+		return;
+	}
+
+	// out exec ignores its own delay, the executee's counts
+	if (!s->exec_pending)
+		s->delay = (ins >> 8) & 7;
+	if (!jumped && !exec)
+		s->pc = s->pc == s->c.wrap ? s->c.wrap_target : s->pc + 1;
+}
+
+/* ---- DMA ---- */
+
+int dma_claim_unused_channel(bool required)
+{
+	for (uint i = 0; i < 12; i++) {
+		if (!dmas[i].claimed) {
+			dmas[i].claimed = true;
+			return i;
+		}
+	}
+	if (required)
+		sim_fail("out of DMA channels");
+	return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(uint chan)
+{
+	dma_channel_config c = { .read_inc = true, .write_inc = false, .dreq = 0x3f, };
+
+	(void)chan;
+	return c;
+}
+
+void dma_channel_configure(uint chan, const dma_channel_config *c, volatile void *write_addr, const volatile void *read_addr, uint count, bool trigger)
+{
+	struct dma *d = &dmas[chan];
+
+	if (d->busy)
+		sim_fail("DMA %u reconfigured while busy", chan);
+	d->c = *c;
+	d->wr = write_addr;
+	d->rd = read_addr;
+	d->count = count;
+	d->busy = trigger && count;
+}
+
+bool dma_channel_is_busy(uint chan)
+{
+	return dmas[chan].busy;
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+	(void)pio;
+	return sm + (is_tx ? 0 : 4);
+}
+
+static void dma_step(void)
+{
+	for (uint i = 0; i < 12; i++) {
+		struct dma *d = &dmas[i];
+		uint32_t v;
+
+		if (!d->busy)
+			continue;
+		if (d->c.dreq < 4 && fifo_full(&sms[d->c.dreq].tx))
+			continue;
+		if (d->c.dreq >= 4 && d->c.dreq < 8 && fifo_empty(&sms[d->c.dreq - 4].rx))
+			continue;
+
+		if (d->rd >= sim_pio0_hw.rxf && d->rd < sim_pio0_hw.rxf + 4)
+			v = fifo_get(&sms[d->rd - sim_pio0_hw.rxf].rx);
+		else
+			v = *d->rd;
+		if (d->wr >= sim_pio0_hw.txf && d->wr < sim_pio0_hw.txf + 4)
+			fifo_put(&sms[d->wr - sim_pio0_hw.txf].tx, v);
+		else
+			*d->wr = v;
+
+		if (d->c.read_inc)
+			d->rd++;
+		if (d->c.write_inc)
+			d->wr++;
+		if (!--d->count)
+			d->busy = false;
+	}
+}
+
+/* ---- the clock ---- */
+
+static uint32_t model_vals, model_dirs, keep;
+
+static void update_pins(void)
+{
+	uint32_t contention = pio_dirs & model_dirs;
+
+	if (contention)
+		sim_fail("PIO and PSRAM both drive pins %08x", contention);
+
+	// undriven DQs keep their level, RWDS is pulled down
+	pins = (pio_vals & pio_dirs) | (model_vals & model_dirs) | (keep & ~(pio_dirs | model_dirs) & 0x3fc00000u);
+	keep = pins;
+}
+
+static bool trace;
+
+void sim_step(void)
+{
+	if (trace)
+		fprintf(stderr, "%6llu: pc %2u %2u %2u %2u irq %02x pins %08x dirs %08x\n", (unsigned long long)cycles,
+			sms[0].pc, sms[1].pc, sms[2].pc, sms[3].pc, irq_flags, (unsigned)pins, (unsigned)(pio_dirs | model_dirs));
+	// everything an instruction looks at is sampled before any SM acts
+	for (uint i = 0; i < 4; i++)
+		sm_step(i);
+	dma_step();
+	model_dirs = model_clock(pio_vals, pio_dirs, &model_vals);
+	update_pins();
+	cycles++;
+}
+
+// Run until the SMs have nothing queued and the part is deselected
+void sim_settle(void)
+{
+	uint64_t until = cycles + SIM_TIMEOUT;
+	uint idle = 0;
+
+	// long enough for the bus token to go round and a pulled command to start
+	while (idle < 64) {
+		bool busy = !(pins & (1u << 19));
+
+		for (uint i = 0; i < 4; i++)
+			busy = busy || !fifo_empty(&sms[i].tx);
+		idle = busy ? 0 : idle + 1;
+		if (cycles == until)
+			sim_fail("PIO never went idle");
+		sim_step();
+	}
+}
+
+void tight_loop_contents(void)
+{
+	sim_step();
+}
+
+uint64_t sim_cycles(void)
+{
+	return cycles;
+}
+
+uint32_t sim_pins(void)
+{
+	return pins;
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data)
+{
+	uint64_t until = cycles + SIM_TIMEOUT;
+
+	(void)pio;
+	while (fifo_full(&sms[sm].tx)) {
+		if (cycles == until)
+			sim_fail("SM%u TX FIFO stuck, pc %u", sm, sms[sm].pc);
+		sim_step();
+	}
+	fifo_put(&sms[sm].tx, data);
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm)
+{
+	uint64_t until = cycles + SIM_TIMEOUT;
+
+	(void)pio;
+	while (fifo_empty(&sms[sm].rx)) {
+		if (cycles == until)
+			sim_fail("SM%u RX FIFO stuck, pc %u", sm, sms[sm].pc);
+		sim_step();
+	}
+	return fifo_get(&sms[sm].rx);
+}
+
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm)
+{
+	(void)pio;
+	sim_step();
+	return fifo_empty(&sms[sm].tx);
+}
+
+void sim_init(const char *pio_source)
+{
+	trace = !!getenv("SIM_TRACE");
+	load_program(pio_source);
+	memset(sms, 0, sizeof(sms));
+	memset(dmas, 0, sizeof(dmas));
+	irq_flags = 0;
+	pio_vals = pio_dirs = pins = keep = 0;
+	model_vals = model_dirs = 0;
+	cycles = 0;
+}
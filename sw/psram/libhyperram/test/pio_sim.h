@@ -0,0 +1,134 @@
+#ifndef _PIO_SIM_H
+#define _PIO_SIM_H
+
+// Host stand-in for the pico SDK pieces libhyperram uses. PIO0 is simulated
+// cycle by cycle running hyperram.pio (assembled from source at startup), the
+// DMA channels are serviced on the same clock, and a HyperRAM device model
+// (hyperram_model.c) sits on the pins.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+typedef volatile uint32_t io_rw_32;
+
+#define __not_in_flash_func(f)	f
+
+// PIO block. Only the FIFO registers are looked at, by address (DMA).
+typedef struct {
+	io_rw_32 input_sync_bypass;
+	io_rw_32 txf[4];
+	io_rw_32 rxf[4];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio0_hw;
+#define pio0	(&sim_pio0_hw)
+
+typedef struct {
+	uint out_base, out_count;
+	uint set_base, set_count;
+	uint in_base;
+	uint sideset_base;
+	uint jmp_pin;
+	uint wrap_target, wrap;
+	bool in_right, autopush, out_right, autopull;
+	uint push_thresh, pull_thresh;
+} pio_sm_config;
+
+typedef struct {
+	const uint16_t *instructions;
+	uint8_t length;
+	int8_t origin;
+} pio_program_t;
+
+// Assembled hyperram.pio and its public labels
+extern const pio_program_t hyperram_program;
+extern uint hyperram_offset_start, hyperram_offset_done, hyperram_offset_passOn;
+extern uint hyperram_offset_r_lat, hyperram_offset_r_data, hyperram_offset_w_lat, hyperram_offset_w_mask;
+pio_sm_config hyperram_program_get_default_config(uint offset);
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t values, uint32_t mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t dirs, uint32_t mask);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+void pio_gpio_init(PIO pio, uint pin);
+
+static inline void sm_config_set_out_pins(pio_sm_config *c, uint base, uint count) { c->out_base = base; c->out_count = count; }
+static inline void sm_config_set_set_pins(pio_sm_config *c, uint base, uint count) { c->set_base = base; c->set_count = count; }
+static inline void sm_config_set_in_pins(pio_sm_config *c, uint base) { c->in_base = base; }
+static inline void sm_config_set_sideset_pins(pio_sm_config *c, uint base) { c->sideset_base = base; }
+static inline void sm_config_set_jmp_pin(pio_sm_config *c, uint pin) { c->jmp_pin = pin; }
+static inline void sm_config_set_in_shift(pio_sm_config *c, bool right, bool autopush, uint thresh) { c->in_right = right; c->autopush = autopush; c->push_thresh = thresh; }
+static inline void sm_config_set_out_shift(pio_sm_config *c, bool right, bool autopull, uint thresh) { c->out_right = right; c->autopull = autopull; c->pull_thresh = thresh; }
+
+// Instruction encoders, as in hardware/pio_instructions.h
+enum pio_src_dest {
+	pio_pins = 0, pio_x = 1, pio_y = 2, pio_null = 3, pio_pindirs = 4,
+	pio_pc = 5, pio_isr = 6, pio_osr = 7, pio_exec_out = 7,
+};
+
+static inline uint pio_encode_delay(uint cycles) { return cycles << 8; }
+static inline uint pio_encode_sideset_opt(uint bits, uint value) { return 0x1000u | value << (12u - bits); }
+static inline uint pio_encode_jmp(uint addr) { return 0x0000u | addr; }
+static inline uint pio_encode_out(enum pio_src_dest dest, uint count) { return 0x6000u | (uint)dest << 5 | (count & 0x1f); }
+static inline uint pio_encode_set(enum pio_src_dest dest, uint value) { return 0xe000u | (uint)(dest == pio_pindirs ? 4 : dest) << 5 | value; }
+static inline uint pio_encode_nop(void) { return 0xa042u; }
+
+// DMA
+typedef struct {
+	bool read_inc, write_inc;
+	uint dreq;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(uint chan);
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool inc) { c->read_inc = inc; }
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool inc) { c->write_inc = inc; }
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) { c->dreq = dreq; }
+void dma_channel_configure(uint chan, const dma_channel_config *c, volatile void *write_addr, const volatile void *read_addr, uint count, bool trigger);
+bool dma_channel_is_busy(uint chan);
+
+// GPIO and clocks: nothing to do
+enum { GPIO_SLEW_RATE_FAST = 1, GPIO_DRIVE_STRENGTH_8MA = 2, VREG_VOLTAGE_1_20 = 0 };
+static inline void gpio_set_pulls(uint pin, bool up, bool down) { (void)pin; (void)up; (void)down; }
+static inline void gpio_pull_down(uint pin) { (void)pin; }
+static inline void gpio_set_slew_rate(uint pin, int rate) { (void)pin; (void)rate; }
+static inline void gpio_set_drive_strength(uint pin, int str) { (void)pin; (void)str; }
+static inline void gpio_put(uint pin, bool v) { (void)pin; (void)v; }
+static inline void vreg_set_voltage(int v) { (void)v; }
+static inline bool set_sys_clock_khz(uint32_t khz, bool required) { (void)khz; return required; }
+static inline void sleep_ms(uint32_t ms) { (void)ms; }
+static inline uint get_core_num(void) { return 0; }
+static inline void hw_clear_bits(io_rw_32 *reg, uint32_t mask) { *reg &= ~mask; }
+
+#define PADS_BANK0_BASE				0x4001c000
+#define PADS_BANK0_VOLTAGE_SELECT_OFFSET	0
+#define PADS_BANK0_VOLTAGE_SELECT_VALUE_1V8	1
+#define PADS_BANK0_VOLTAGE_SELECT_LSB		0
+
+// Runs the simulation for a cycle
+void tight_loop_contents(void);
+
+// Simulator control
+void sim_init(const char *pio_source);
+void sim_step(void);
+void sim_settle(void);
+uint64_t sim_cycles(void);
+uint32_t sim_pins(void);
+void sim_fail(const char *fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+// Device model, called once per cycle with the pins the PIO drives. Returns
+// the pins it drives (and their values in *vals).
+void model_reset(uint32_t seed);
+uint32_t model_clock(uint32_t pio_vals, uint32_t pio_dirs, uint32_t *vals);
+
+#endif